@@ -36,6 +36,9 @@ static koki_buffer_t *buffers;
 static int num_buffers = 1;
 static koki_t* koki = NULL;
 
+/* Each frame is converted into these, rather than new images */
+static IplImage *rgb_frame, *gs_frame;
+
 //static CvCapture *cap;
 static koki_camera_params_t params;
 
@@ -80,7 +83,10 @@ IplImage* grab_frame()
 
 	glutPostRedisplay();
 
-	return koki_v4l_YUYV_frame_to_RGB_image(frame, WIDTH, HEIGHT);
+	koki_v4l_YUYV_frame_into_RGB_image(frame, WIDTH, HEIGHT, rgb_frame);
+	koki_v4l_YUYV_frame_into_grayscale_image(frame, WIDTH, HEIGHT, gs_frame);
+
+	return rgb_frame;
 
 
 }
@@ -131,10 +137,7 @@ void display()
 
 	IplImage *frame = grab_frame();
 	assert(frame != NULL);
-	IplImage *gs = cvCreateImage(cvSize(frame->width, frame->height),
-				     IPL_DEPTH_8U, 1);
-	assert(gs != NULL);
-	cvCvtColor(frame, gs, CV_RGB2GRAY);
+	IplImage *gs = gs_frame;
 
 	glutReshapeWindow(frame->width, frame->height);
 
@@ -212,8 +215,6 @@ void display()
 
 	glFlush();
 
-	cvReleaseImage(&frame);
-	cvReleaseImage(&gs);
 	glutSwapBuffers();
 
 }
@@ -280,6 +281,10 @@ int main(int argc, char **argv)
 
 	koki_v4l_start_stream(fd);
 
+	rgb_frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 3);
+	gs_frame = cvCreateImage(cvSize(WIDTH, HEIGHT), IPL_DEPTH_8U, 1);
+	assert(rgb_frame != NULL && gs_frame != NULL);
+
 	params.size.x = WIDTH;
 	params.size.y = HEIGHT;
 	params.principal_point.x = params.size.x / 2;
@@ -300,6 +305,9 @@ int main(int argc, char **argv)
 	koki_v4l_stop_stream(fd);
 	koki_v4l_close_cam(fd);
 
+	cvReleaseImage(&rgb_frame);
+	cvReleaseImage(&gs_frame);
+
 	return 0;
 
 }
@@ -0,0 +1,70 @@
+/* Copyright 2011 Robert Spanton
+   Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <assert.h>
+#include <glib.h>
+#include <cv.h>
+#include <stdlib.h>
+
+#include <linux/videodev2.h>
+
+#include "koki.h"
+
+#define WIDTH  640
+#define HEIGHT 480
+
+
+static void print_markers( const koki_pipeline_result_t *result, void *userdata )
+{
+	printf( "frame %u: %i markers found\n", result->sequence,
+		result->markers->len );
+}
+
+
+int main(void)
+{
+	koki_t *koki = koki_new();
+	koki_camera_params_t params;
+
+	params.size.x = WIDTH;
+	params.size.y = HEIGHT;
+	params.principal_point.x = params.size.x / 2;
+	params.principal_point.y = params.size.y / 2;
+	params.focal_length.x = 571.0;
+	params.focal_length.y = 571.0;
+
+	int fd = koki_v4l_open_cam("/dev/video0");
+	struct v4l2_format fmt = koki_v4l_create_YUYV_format(WIDTH, HEIGHT);
+	koki_v4l_set_format(fd, fmt);
+
+	/* Capture, convert, detect and print on a thread each */
+	koki_pipeline_t *p = koki_pipeline_start( koki, fd, 6, 0.11, &params,
+						  print_markers, NULL );
+	assert(p != NULL);
+
+	while (!koki_pipeline_finished(p))
+		g_usleep(100000);
+
+	koki_pipeline_stop(p);
+	koki_v4l_close_cam(fd);
+	koki_destroy(koki);
+
+	return 0;
+}
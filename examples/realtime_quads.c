@@ -46,16 +46,17 @@ int main(void)
 	struct v4l2_format fmt = koki_v4l_create_YUYV_format(WIDTH, HEIGHT);
 	koki_v4l_set_format(fd, fmt);
 
-	int num_buffers = 1;
-	koki_buffer_t *buffers;
-	buffers = koki_v4l_prepare_buffers(fd, &num_buffers);
-
-	koki_v4l_start_stream(fd);
+	koki_v4l_ring_t *ring = koki_v4l_ring_start(fd, 4);
+	assert(ring != NULL);
 
 	while (1){
 
-		uint8_t *yuyv = koki_v4l_get_frame_array(fd, buffers);
-		IplImage *frame = koki_v4l_YUYV_frame_to_grayscale_image(yuyv, WIDTH, HEIGHT);
+		koki_v4l_frame_t f;
+		if (koki_v4l_ring_get_frame(ring, &f, -1) <= 0)
+			break;
+
+		IplImage *frame = koki_v4l_YUYV_frame_to_grayscale_image(f.data, WIDTH, HEIGHT);
+		koki_v4l_ring_release_frame(ring, &f);
 
 		IplImage *thresholded;
 		thresholded = koki_threshold_adaptive(frame, 5, 3,
@@ -109,6 +110,9 @@ int main(void)
 
 	}
 
+	koki_v4l_ring_stop(ring);
+	koki_v4l_close_cam(fd);
+
 	return 0;
 
 	cvDestroyWindow("frame");
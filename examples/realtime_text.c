@@ -44,24 +44,30 @@ int main(void)
 	int fd = koki_v4l_open_cam("/dev/video0");
 	struct v4l2_format fmt = koki_v4l_create_YUYV_format(WIDTH, HEIGHT);
 	koki_v4l_set_format(fd, fmt);
+	fmt = koki_v4l_get_format(fd);
 
-	int num_buffers = 1;
-	koki_buffer_t *buffers;
-	buffers = koki_v4l_prepare_buffers(fd, &num_buffers);
-
-	koki_v4l_start_stream(fd);
+	koki_v4l_ring_t *ring = koki_v4l_ring_start(fd, 4);
+	assert(ring != NULL);
 
 	while (1){
-		uint8_t *yuyv = koki_v4l_get_frame_array(fd, buffers);
-		IplImage *frame = koki_v4l_YUYV_frame_to_grayscale_image(yuyv, WIDTH, HEIGHT);
-		GPtrArray *markers = koki_find_markers( koki, frame, 0.11, &params );
+		koki_v4l_frame_t f;
+		if (koki_v4l_ring_get_frame(ring, &f, -1) <= 0)
+			break;
+
+		/* Find the markers in the capture buffer itself */
+		IplImage view;
+		koki_v4l_luma_view(&view, f.data, fmt);
+		GPtrArray *markers = koki_find_markers( koki, &view, 0.11, &params );
+		koki_v4l_ring_release_frame(ring, &f);
 
 		printf( "%i markers found\n", markers->len );
 
 		koki_markers_free(markers);
-		cvReleaseImage(&frame);
 
 	}
 
+	koki_v4l_ring_stop(ring);
+	koki_v4l_close_cam(fd);
+
 	return 0;
 }
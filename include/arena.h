@@ -0,0 +1,60 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_ARENA_H_
+#define _KOKI_ARENA_H_
+
+/**
+ * @file  arena.h
+ * @brief Header file for the per-frame memory arena
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * @brief a block of memory that an arena hands out allocations from
+ */
+typedef struct koki_arena_block {
+	struct koki_arena_block *next;	/**< the next block in the arena */
+	size_t size;			/**< the number of bytes in \c data */
+	size_t used;			/**< the number of bytes handed out */
+	uint8_t *data;			/**< the memory itself, which follows
+					     the block in the same allocation */
+} koki_arena_block_t;
+
+/**
+ * @brief a memory arena, for allocations that can all be freed at once
+ *
+ * Allocating from an arena just bumps a pointer along its current block.
+ * Nothing is freed individually: resetting the arena makes all of its
+ * memory available again, keeping its blocks for reuse.
+ */
+typedef struct {
+	koki_arena_block_t *first;	/**< the first block */
+	koki_arena_block_t *cur;	/**< the block being allocated from */
+	size_t block_size;		/**< the size of new blocks */
+} koki_arena_t;
+
+koki_arena_t* koki_arena_new( size_t block_size );
+
+void koki_arena_free( koki_arena_t *arena );
+
+void* koki_arena_alloc( koki_arena_t *arena, size_t size );
+
+void koki_arena_reset( koki_arena_t *arena );
+
+#endif /* _KOKI_ARENA_H_ */
@@ -30,4 +30,10 @@ koki_bearing_t koki_bearing_estimate_point(koki_point3Df_t point);
 
 void koki_bearing_estimate(koki_marker_t *marker);
 
+void koki_bearing_estimate_soa(uint32_t n, const float *x, const float *y,
+			       const float *z, float *bearing_x,
+			       float *bearing_y);
+
+void koki_bearing_estimate_markers(koki_marker_t **markers, uint32_t n);
+
 #endif /* _KOKI_BEARING_H_ */
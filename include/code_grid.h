@@ -63,6 +63,10 @@ IplImage *koki_code_sub_image(IplImage *unwarped_frame);
 
 int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset);
 
+int16_t koki_code_recover_from_grid_corrected(koki_grid_t *grid,
+					      float *rotation_offset,
+					      uint8_t *bits_corrected);
+
 int16_t koki_code_translation(int code);
 
 #endif /* _KOKI_CODE_GRID_H_ */
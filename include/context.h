@@ -22,9 +22,27 @@
  * @brief Header file for libkoki context functions
  */
 
+#include <stdint.h>
 #include <glib.h>
 
 #include "logger.h"
+#include "stats.h"
+
+struct koki_workspace;
+struct koki_pool;
+
+/**
+ * @brief the connected-component labelling algorithms available
+ */
+typedef enum {
+	KOKI_LABEL_PIXEL, /**< label one dark pixel at a time from its
+			       neighbours (the default) */
+	KOKI_LABEL_RUNS,  /**< label runs of dark pixels, merging overlapping
+			       runs between rows with union-find */
+	KOKI_LABEL_TRACE, /**< label while tracing the contours of dark
+			       regions, which finds the outer contours in
+			       the same pass (markers only) */
+} koki_label_method_t;
 
 /**
  * @brief a libkoki context structure
@@ -32,12 +50,43 @@
 typedef struct {
 	logger_callbacks_t logger; /**< the logger callbacks */
 	void *logger_userdata;	   /**< the userdata to pass to the logger callbacks */
+	koki_label_method_t label_method; /**< the labelling algorithm to use */
+	uint16_t label_threads;	   /**< the number of threads to label with */
+	gboolean label_stats_pass; /**< whether pixel labelling gathers region
+				        statistics in a separate pass */
+	uint16_t marker_threads;   /**< the number of threads to look for
+				        markers in candidate regions with */
+	struct koki_pool *pool;	   /**< the workers for \c marker_threads,
+				        or NULL if there's only one */
+	struct koki_workspace *workspace; /**< the buffers kept between frames,
+					       so a context must only be given
+					       one frame at a time */
+	koki_stats_t *stats;	   /**< the statistics gathered, or NULL if
+				        they aren't being */
+	GMutex stats_lock;	   /**< held while \c stats is changed or
+				        read */
 } koki_t;
 
 koki_t* koki_new( void );
 
 void koki_set_logger( koki_t* koki, const logger_callbacks_t *logger, void* userdata );
 
+void koki_set_label_method( koki_t* koki, koki_label_method_t method );
+
+void koki_set_label_threads( koki_t* koki, uint16_t n_threads );
+
+void koki_set_label_stats_pass( koki_t* koki, gboolean enabled );
+
+void koki_set_marker_threads( koki_t* koki, uint16_t n_threads );
+
+void koki_set_stats( koki_t* koki, gboolean enabled );
+
+gboolean koki_get_stats( koki_t* koki, koki_stats_t *stats );
+
+void koki_reset_stats( koki_t* koki );
+
+void koki_stats_record( koki_t* koki, const koki_stats_counts_t *frame );
+
 void koki_destroy( koki_t* koki );
 
 void koki_log( koki_t* koki, const char* text, IplImage* img );
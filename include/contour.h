@@ -26,12 +26,46 @@
 #include <glib.h>
 
 #include "labelling.h"
+#include "arena.h"
+
+/**
+ * @brief a contour, stored as packed arrays of co-ordinates
+ *
+ * The points are in the same clockwise order as those of the \c GSList
+ * contours, but are held contiguously so that they can be scanned without
+ * following pointers.
+ */
+typedef struct {
+	int16_t *x;     /**< the X co-ordinates of the points */
+	int16_t *y;     /**< the Y co-ordinates of the points */
+	uint32_t len;   /**< the number of points in the contour */
+	uint32_t size;  /**< the number of points there is room for */
+} koki_contour_t;
+
+
 
 GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 			       label_t region);
 
+GSList* koki_contour_find_arena(koki_labelled_image_t *labelled_image,
+				label_t region, koki_arena_t *arena);
+
 void koki_contour_free(GSList *contour);
 
 void koki_contour_draw(IplImage *frame, GSList *contour);
 
+koki_contour_t* koki_contour_array_new(uint32_t size, koki_arena_t *arena);
+
+void koki_contour_array_append(koki_contour_t **contour, uint16_t x,
+			       uint16_t y, koki_arena_t *arena);
+
+koki_contour_t* koki_contour_find_array(koki_labelled_image_t *labelled_image,
+					label_t region, koki_arena_t *arena);
+
+koki_contour_t* koki_contour_from_slist(GSList *contour, koki_arena_t *arena);
+
+void koki_contour_array_free(koki_contour_t *contour);
+
+void koki_contour_array_draw(IplImage *frame, const koki_contour_t *contour);
+
 #endif /* _KOKI_CONTOUR_H_ */
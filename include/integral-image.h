@@ -35,29 +35,47 @@
  *
  * Pixels in the integral image should be accessed using the 
  * \c koki_integral_image_pixel macro.
+ *
+ * A rolling integral image only keeps its most recently calculated rows, in
+ * a ring buffer, which is all that's needed to threshold an image a row at
+ * a time.
  */
 typedef struct {
-	uint32_t *data;
+	uint32_t *data;		/* Row 0 of the integral image.  The row
+				 * before it (row -1) is allocated too, and
+				 * is always zero. */
 	uint16_t w, h;		/* The width and height of the
 				 * integral image */
-	const IplImage *src; /* The IplImage that this integral image represents */
+	uint16_t n_rows;	/* The number of rows held: h, unless it's
+				 * a rolling integral image */
+	const IplImage *src; /* The IplImage that this integral image
+			      * represents, either greyscale or with its
+			      * luma interleaved (see KOKI_IPLIMAGE_IS_LUMA) */
 
 	/* The pixel to the SE of the last completed pixel of the II */
 	uint16_t complete_x,
 		complete_y;
 
-	/* The sum row */
-	uint32_t *sum;
-
 } koki_integral_image_t;
 
 
+/* Pointer to the start of row y.  y may be -1, giving a row of zeros. */
+#define koki_integral_image_row( img, y ) \
+	( (int32_t)(y) < 0 ? (img)->data - (img)->w \
+	  : (img)->data + ((img)->w * ((uint32_t)(y) % (img)->n_rows)) )
+
 #define koki_integral_image_pixel( img, x, y ) \
-	( (img)->data[ ((img)->w * (y)) + (x) ] )
+	( koki_integral_image_row( img, y )[x] )
 
 koki_integral_image_t* koki_integral_image_new( const IplImage *src,
 						bool complete_now );
 
+koki_integral_image_t* koki_integral_image_new_rolling( const IplImage *src,
+							uint16_t n_rows );
+
+void koki_integral_image_reset( koki_integral_image_t *ii,
+				const IplImage *src );
+
 void koki_integral_image_free( koki_integral_image_t *ii );
 
 void koki_integral_image_advance( koki_integral_image_t *ii,
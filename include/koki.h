@@ -23,13 +23,18 @@
  */
 
 #include "context.h"
+#include "stats.h"
 #include "logger.h"
 #include "html-logger.h"
 #include "text-logger.h"
 #include "debug.h"
 #include "points.h"
 #include "labelling.h"
+#include "arena.h"
+#include "workspace.h"
+#include "pool.h"
 #include "contour.h"
+#include "trace.h"
 #include "quad.h"
 #include "marker.h"
 #include "unwarp.h"
@@ -41,6 +46,10 @@
 #include "bearing.h"
 #include <sys/time.h> /* needed for videodev2.h */
 #include "v4l.h"
+#include "queue.h"
+#include "recording.h"
+#include "source.h"
+#include "pipeline.h"
 #include "yaml_config.h"
 
 #endif /* _KOKI_H_ */
@@ -51,6 +51,27 @@
 #define KOKI_IPLIMAGE_GS_ELEM(img, x, y) \
 	(((uint8_t*)((img)->imageData + (img)->widthStep*(y)))[(x)])
 
+/**
+ * @brief a macro for getting the luma value of a frame that's either
+ *        greyscale, or has its luma as the first of two interleaved
+ *        channels, as a YUYV capture buffer does
+ *
+ * @param img  the \c IplImage in question
+ * @param x    the X co-ordinate
+ * @param y    the Y co-ordinate
+ * @return     the luma value
+ */
+#define KOKI_IPLIMAGE_LUMA_ELEM(img, x, y) \
+	(((uint8_t*)((img)->imageData + (img)->widthStep*(y)))[(x)*(img)->nChannels])
+
+/**
+ * @brief whether markers can be found in an \c IplImage, because it has a
+ *        luma value that \c KOKI_IPLIMAGE_LUMA_ELEM can get
+ */
+#define KOKI_IPLIMAGE_IS_LUMA(img) \
+	((img)->depth == IPL_DEPTH_8U \
+	 && ((img)->nChannels == 1 || (img)->nChannels == 2))
+
 
 /**
  * @brief a macro for getting the label in a labeled image at point (x, y)
@@ -96,6 +117,15 @@ typedef uint16_t label_t;
  */
 #define KOKI_LABEL_MAX 0xffff
 
+/**
+ * @brief a horizontal run of dark pixels within a row
+ */
+typedef struct {
+	uint16_t start;	/**< the first pixel of the run */
+	uint16_t end;	/**< the last pixel of the run (inclusive) */
+	label_t label;	/**< the label the run was given */
+} label_run_t;
+
 /**
  * @brief A structure representing a labelled image
  *
@@ -139,6 +169,8 @@ koki_labelled_image_t* koki_label_image(IplImage *image, uint16_t threshold);
 
 bool koki_label_useable(koki_labelled_image_t *labelled_image, label_t region);
 
+bool koki_clip_useable(const koki_clip_region_t *clip, uint16_t w, uint16_t h);
+
 IplImage* koki_labelled_image_to_image(koki_labelled_image_t *labelled_image);
 
 label_t get_connected_label(koki_labelled_image_t *labelled_image,
@@ -150,4 +182,9 @@ koki_labelled_image_t* koki_label_adaptive( koki_t *koki,
 					    uint16_t window_size,
 					    int16_t thresh_margin );
 
+koki_labelled_image_t* koki_label_adaptive_workspace( koki_t *koki,
+						      const IplImage *frame,
+						      uint16_t window_size,
+						      int16_t thresh_margin );
+
 #endif /* _KOKI_LABELLING_H_ */
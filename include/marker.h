@@ -73,6 +73,9 @@ typedef struct {
 	float rotation_offset;             /**< a multiple of 90 degrees,
 					        indicating how many times the
 						code grid has been rotated */
+	uint8_t bits_corrected;            /**< the number of bits of the code
+					        that error correction had to
+						flip */
 	koki_marker_rotation_t rotation;   /**< the rotation of the marker
 					        about its centre point */
 	koki_bearing_t bearing;            /**< the relative bearing to the
@@ -85,6 +88,8 @@ typedef struct {
 
 koki_marker_t* koki_marker_new(koki_quad_t *quad);
 
+koki_marker_t* koki_marker_new_arena(koki_quad_t *quad, koki_arena_t *arena);
+
 void koki_marker_free(koki_marker_t *marker);
 
 bool koki_marker_recover_code( koki_t* koki, koki_marker_t *marker, IplImage *frame );
@@ -27,9 +27,35 @@
 
 #include "points.h"
 
+
+/**
+ * @brief The running sums of a set of points' co-ordinates, from which
+ *        their principal components can be found.
+ */
+typedef struct {
+	uint32_t n;	/**< the number of points */
+	int64_t sx;	/**< the sum of the X co-ordinates */
+	int64_t sy;	/**< the sum of the Y co-ordinates */
+	int64_t sxx;	/**< the sum of the squares of the X co-ordinates */
+	int64_t sxy;	/**< the sum of the products of the co-ordinates */
+	int64_t syy;	/**< the sum of the squares of the Y co-ordinates */
+} koki_pca_sums_t;
+
+
+
+void koki_pca_sums_add(koki_pca_sums_t *sums, int32_t x, int32_t y);
+
+int8_t koki_pca_sums_solve(const koki_pca_sums_t *sums,
+			   koki_point2Df_t eigen_vectors[2],
+			   float eigen_values[2], koki_point2Df_t *averages);
+
 int8_t koki_pca(GSList *start, GSList *end,
 		koki_point2Df_t eigen_vectors[2],
 		float eigen_values[2], koki_point2Df_t *averages);
 
+int8_t koki_pca_array(const int16_t *x, const int16_t *y, uint32_t n,
+		      koki_point2Df_t eigen_vectors[2],
+		      float eigen_values[2], koki_point2Df_t *averages);
+
 
 #endif /* _KOKI_PCA_H_ */
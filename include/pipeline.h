@@ -0,0 +1,138 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_PIPELINE_H_
+#define _KOKI_PIPELINE_H_
+
+/**
+ * @file  pipeline.h
+ * @brief Header file for finding markers in a camera's frames on a
+ *        pipeline of threads
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "context.h"
+#include "camera.h"
+#include "queue.h"
+#include "source.h"
+#include "v4l.h"
+
+/**
+ * @brief the markers found in a frame
+ */
+typedef struct {
+	uint32_t sequence;		/**< the camera's frame counter */
+	struct timeval timestamp;	/**< when the frame was captured */
+	GPtrArray *markers;		/**< the markers found, which belong
+					     to the pipeline */
+} koki_pipeline_result_t;
+
+/**
+ * @brief the function a pipeline calls with the markers found in each
+ *        frame, on a thread of its own
+ *
+ * @param result    the markers found, which are only valid until the
+ *                  function returns
+ * @param userdata  the userdata the pipeline was given
+ */
+typedef void (*koki_pipeline_callback_t)( const koki_pipeline_result_t *result,
+					  void *userdata );
+
+/**
+ * @brief a link between two stages of a pipeline, through which a fixed
+ *        set of items goes round
+ *
+ * The first stage takes empty items from \c free and pushes them on to
+ * \c full, and the second stage hands them back the other way.
+ */
+typedef struct {
+	koki_queue_t *full;		/**< items on their way to the next
+					     stage */
+	koki_queue_t *free;		/**< items on their way back */
+	int closed;			/**< set once the first stage has
+					     stopped pushing items */
+} koki_pipeline_link_t;
+
+/**
+ * @brief a luma frame on its way from conversion to detection
+ */
+typedef struct {
+	IplImage *image;		/**< the frame */
+	uint32_t sequence;		/**< the camera's frame counter */
+	struct timeval timestamp;	/**< when the frame was captured */
+} koki_pipeline_frame_t;
+
+/**
+ * @brief finds markers in a source's frames on four threads at once:
+ *        capture, conversion to greyscale, detection and the callback
+ *
+ * Each stage only ever works on the newest thing the stage before it has
+ * finished, dropping anything older, so frames arrive at the callback as
+ * soon after capture as the slowest stage allows.
+ */
+typedef struct {
+	koki_t *koki;			/**< the context the markers are found
+					     with, only used by the detection
+					     thread */
+	koki_source_t *source;		/**< where the frames come from */
+	bool own_source;		/**< whether the source is freed with
+					     the pipeline */
+	float marker_width;		/**< the markers' width, in metres */
+	koki_camera_params_t params;	/**< the camera's parameters */
+
+	koki_pipeline_callback_t callback; /**< the function given the
+					        markers */
+	void *userdata;			/**< the callback's userdata */
+
+	koki_v4l_frame_t *captured;	/**< the captured frames on their way
+					     from capture to conversion */
+	koki_pipeline_frame_t *frames;	/**< the luma frames */
+	koki_pipeline_result_t *results; /**< the markers found */
+	uint16_t n_captured, n_frames, n_results;
+
+	koki_pipeline_link_t links[3];	/**< between capture and conversion,
+					     conversion and detection, and
+					     detection and the callback */
+	GThread *threads[4];		/**< the stages' threads */
+	int running;			/**< cleared to stop the threads */
+	int finished;			/**< set once the source has failed
+					     or run out of frames, and its
+					     last frames have been published */
+} koki_pipeline_t;
+
+koki_pipeline_t* koki_pipeline_start( koki_t *koki, int fd, int n_buffers,
+				      float marker_width,
+				      const koki_camera_params_t *params,
+				      koki_pipeline_callback_t callback,
+				      void *userdata );
+
+koki_pipeline_t* koki_pipeline_start_source( koki_t *koki,
+					     koki_source_t *source,
+					     float marker_width,
+					     const koki_camera_params_t *params,
+					     koki_pipeline_callback_t callback,
+					     void *userdata );
+
+bool koki_pipeline_finished( koki_pipeline_t *p );
+
+void koki_pipeline_stop( koki_pipeline_t *p );
+
+#endif /* _KOKI_PIPELINE_H_ */
@@ -0,0 +1,87 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_POOL_H_
+#define _KOKI_POOL_H_
+
+/**
+ * @file  pool.h
+ * @brief Header file for the pool of worker threads
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+
+struct koki_pool;
+
+/**
+ * @brief the function a pool runs on each item of a job
+ *
+ * @param data    the job's data
+ * @param item    the index of the item
+ * @param worker  the index of the worker running it, \c 0 being the thread
+ *                that started the job
+ */
+typedef void (*koki_pool_func_t)( void *data, uint32_t item, uint16_t worker );
+
+/**
+ * @brief a worker in a pool, with the range of items it has left to do
+ */
+typedef struct {
+	struct koki_pool *pool;	/**< the pool the worker belongs to */
+	uint16_t id;		/**< the worker's index in the pool */
+	GThread *thread;	/**< the worker's thread, or NULL for worker 0 */
+	uint64_t range;		/**< the next item to do in the top 32 bits,
+				     and the item after the last in the
+				     bottom 32, only ever changed
+				     atomically */
+} koki_pool_worker_t;
+
+/**
+ * @brief a pool of threads that share out the items of a job between them
+ *
+ * Each worker starts with an equal range of the items, and takes them from
+ * the front of it.  A worker that runs out steals the back half of another
+ * worker's range.  The thread that runs a job is worker 0, so a pool of
+ * \c n workers has \c n-1 threads of its own.
+ */
+typedef struct koki_pool {
+	uint16_t n_workers;		/**< the number of workers */
+	koki_pool_worker_t *workers;	/**< the workers */
+
+	GMutex lock;			/**< protects everything below */
+	GCond start;			/**< signalled when a job starts, or the
+					     pool is freed */
+	GCond done;			/**< signalled when the last worker
+					     finishes a job */
+	guint job;			/**< the number of jobs started */
+	uint16_t active;		/**< the number of threads still working
+					     on the current job */
+	bool quit;			/**< whether the threads should exit */
+
+	koki_pool_func_t func;		/**< the current job's function */
+	void *data;			/**< the current job's data */
+} koki_pool_t;
+
+koki_pool_t* koki_pool_new( uint16_t n_workers );
+
+void koki_pool_free( koki_pool_t *pool );
+
+void koki_pool_run( koki_pool_t *pool, uint32_t n_items,
+		    koki_pool_func_t func, void *data );
+
+#endif /* _KOKI_POOL_H_ */
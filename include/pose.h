@@ -36,5 +36,13 @@ void koki_pose_estimate(koki_marker_t *marker,
 			float marker_width,
 			koki_camera_params_t *params);
 
+void koki_pose_estimate_soa(uint32_t n, const float *img_x, const float *img_y,
+			    const float *widths, float focal_length,
+			    float *world_x, float *world_y, float *world_z);
+
+void koki_pose_estimate_markers(koki_marker_t **markers, uint32_t n,
+				const float *marker_widths,
+				koki_camera_params_t *params);
+
 
 #endif /* _KOKI_POSE_H_ */
@@ -26,6 +26,8 @@
 #include <cv.h>
 
 #include "points.h"
+#include "arena.h"
+#include "contour.h"
 
 /**
  * @brief a structure containing the links contour chain links and their
@@ -36,13 +38,26 @@ typedef struct {
 					  starting at index 0 */
 	GSList *links[4];            /**< the \c GSLists of type
 					  \c koki_point2Di_t* which relate
-				          to the \c vertices */
+				          to the \c vertices, or NULL if the
+				          quad was found in a
+				          \c koki_contour_t */
+	const koki_contour_t *contour; /**< the contour the quad was found
+					    in, or NULL if it was found in
+					    a \c GSList */
+	uint32_t indices[4];         /**< the indices of the points in the
+					  contour which relate to the
+					  \c vertices */
 } koki_quad_t;
 
 
 
 koki_quad_t* koki_quad_find_vertices(GSList *contour);
 
+koki_quad_t* koki_quad_find_vertices_arena(GSList *contour, koki_arena_t *arena);
+
+koki_quad_t* koki_quad_find_vertices_array(const koki_contour_t *contour,
+					   koki_arena_t *arena);
+
 void koki_quad_refine_vertices(koki_quad_t *quad);
 
 void koki_quad_free(koki_quad_t *quad);
@@ -0,0 +1,62 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_QUEUE_H_
+#define _KOKI_QUEUE_H_
+
+/**
+ * @file  queue.h
+ * @brief Header file for the single-producer, single-consumer queue
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+
+/**
+ * @brief a bounded queue of pointers between one thread that pushes and
+ *        one thread that pops
+ *
+ * Pushing and popping don't take a lock.  The lock is only taken when the
+ * consumer has found the queue empty and goes to sleep, and by the
+ * producer to wake it.
+ */
+typedef struct {
+	void **items;		/**< the ring of items */
+	uint32_t mask;		/**< the size of the ring, less one */
+
+	uint32_t head;		/**< the count of items popped, only
+				     changed by the consumer */
+	uint32_t tail;		/**< the count of items pushed, only
+				     changed by the producer */
+
+	GMutex lock;		/**< held while going to sleep or waking */
+	GCond wake;		/**< signalled when an item's pushed to a
+				     sleeping consumer */
+	int sleeping;		/**< whether the consumer is asleep */
+} koki_queue_t;
+
+koki_queue_t* koki_queue_new( uint32_t size );
+
+void koki_queue_free( koki_queue_t *q );
+
+bool koki_queue_push( koki_queue_t *q, void *item );
+
+void* koki_queue_pop( koki_queue_t *q );
+
+void* koki_queue_pop_wait( koki_queue_t *q, gint64 timeout );
+
+#endif /* _KOKI_QUEUE_H_ */
@@ -0,0 +1,74 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_RECORDING_H_
+#define _KOKI_RECORDING_H_
+
+/**
+ * @file  recording.h
+ * @brief The layout of a file of raw frames recorded from a camera
+ *
+ * A recording starts with a \c koki_recording_header_t.  At
+ * \c index_offset there's a table of \c max_frames
+ * \c koki_recording_index_t entries, the first \c n_frames of which
+ * describe the frames recorded so far, in the order they were captured.
+ * Each frame's data is exactly as the camera gave it, at the offset its
+ * index entry gives.
+ *
+ * Everything's in the byte order of the machine that made the recording.
+ */
+
+#include <stdint.h>
+
+/**
+ * @brief the first 8 bytes of a recording
+ */
+#define KOKI_RECORDING_MAGIC "KOKIREC1"
+
+/**
+ * @brief the alignment of the index and of each frame's data within a
+ *        recording, so that they can be written with O_DIRECT
+ */
+#define KOKI_RECORDING_ALIGN 4096
+
+/**
+ * @brief the header at the start of a recording
+ */
+typedef struct {
+	char magic[8];		/**< \c KOKI_RECORDING_MAGIC */
+	uint32_t width;		/**< the frames' width, in pixels */
+	uint32_t height;	/**< the frames' height, in pixels */
+	uint32_t pixelformat;	/**< the frames' V4L2 pixel format */
+	uint32_t bytesperline;	/**< the bytes from one row to the next */
+	uint32_t frame_size;	/**< the most bytes of data a frame has */
+	uint32_t max_frames;	/**< the number of entries in the index */
+	uint32_t n_frames;	/**< the number of frames recorded */
+	uint32_t reserved;	/**< zero */
+	uint64_t index_offset;	/**< where the index starts */
+} koki_recording_header_t;
+
+/**
+ * @brief an entry in a recording's index
+ */
+typedef struct {
+	uint64_t offset;	/**< where the frame's data starts */
+	int64_t timestamp;	/**< when the frame was captured, in
+				     microseconds */
+	uint32_t sequence;	/**< the camera's frame counter */
+	uint32_t length;	/**< the number of bytes of data */
+} koki_recording_index_t;
+
+#endif /* _KOKI_RECORDING_H_ */
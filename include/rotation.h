@@ -30,4 +30,10 @@ koki_marker_rotation_t koki_rotation_estimate_array(koki_point3Df_t points[4]);
 
 void koki_rotation_estimate(koki_marker_t *marker);
 
+void koki_rotation_estimate_soa(uint32_t n, const float *x, const float *y,
+				const float *z, float *rot_x, float *rot_y,
+				float *rot_z);
+
+void koki_rotation_estimate_markers(koki_marker_t **markers, uint32_t n);
+
 #endif /* _KOKI_ROTATION_H_ */
@@ -0,0 +1,71 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_SOURCE_H_
+#define _KOKI_SOURCE_H_
+
+/**
+ * @file  source.h
+ * @brief Header file for the sources of frames to find markers in
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/time.h> /* needed by videodev2.h */
+#include <linux/videodev2.h>
+
+#include "v4l.h"
+
+typedef struct koki_source koki_source_t;
+
+/**
+ * @brief somewhere frames come from: a camera, a directory of images or a
+ *        recording
+ *
+ * Every source gives frames whose luma \c koki_v4l_luma_view() can view.
+ */
+struct koki_source {
+	struct v4l2_format fmt;	/**< the frames' format */
+	int max_held;		/**< the most frames that can be held at
+				     once */
+
+	/** gets the next frame, see \c koki_source_get_frame() */
+	int (*get_frame)( koki_source_t *source, koki_v4l_frame_t *frame,
+			  int timeout );
+
+	/** gives a frame back, see \c koki_source_release_frame() */
+	void (*release_frame)( koki_source_t *source, koki_v4l_frame_t *frame );
+
+	/** frees the source, see \c koki_source_free() */
+	void (*free)( koki_source_t *source );
+
+	void *priv;		/**< the implementation's own state */
+};
+
+koki_source_t* koki_source_v4l_new( int fd, int n_buffers );
+
+koki_source_t* koki_source_dir_new( const char *path );
+
+koki_source_t* koki_source_recording_new( const char *filename, bool paced );
+
+int koki_source_get_frame( koki_source_t *source, koki_v4l_frame_t *frame,
+			   int timeout );
+
+void koki_source_release_frame( koki_source_t *source, koki_v4l_frame_t *frame );
+
+void koki_source_free( koki_source_t *source );
+
+#endif /* _KOKI_SOURCE_H_ */
@@ -0,0 +1,99 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_STATS_H_
+#define _KOKI_STATS_H_
+
+/**
+ * @file  stats.h
+ * @brief Header file for the timings and counts gathered while finding
+ *        markers
+ */
+
+#include <stdint.h>
+
+/**
+ * @brief the stages of finding markers in a frame
+ */
+typedef enum {
+	KOKI_STAGE_LABEL,	/**< thresholding and labelling */
+	KOKI_STAGE_STATS,	/**< picking candidate regions from their
+				     statistics */
+	KOKI_STAGE_CONTOUR,	/**< finding the candidates' contours */
+	KOKI_STAGE_QUAD,	/**< finding quads' vertices in the contours */
+	KOKI_STAGE_REFINE,	/**< refining the quads' vertices */
+	KOKI_STAGE_UNWARP,	/**< sampling the quads' code grids */
+	KOKI_STAGE_DECODE,	/**< recovering codes from the grids */
+	KOKI_STAGE_POSE,	/**< estimating the markers' pose, rotation
+				     and bearing */
+	KOKI_STAGE_COUNT
+} koki_stage_t;
+
+/**
+ * @brief timings and counts from finding markers in some frames
+ */
+typedef struct {
+	uint64_t frames;	/**< the number of frames */
+	uint64_t time;		/**< the time spent finding markers, in
+				     nanoseconds */
+	uint64_t stage_time[KOKI_STAGE_COUNT]; /**< the time spent in each
+						    stage, in nanoseconds,
+						    added up over all the
+						    threads */
+
+	uint64_t regions;	/**< the dark regions labelled */
+	uint64_t usable_regions; /**< the regions that might be markers */
+	uint64_t contours;	/**< the contours found */
+	uint64_t quads;		/**< the contours that were quads */
+	uint64_t quads_rejected; /**< the quads without a code */
+	uint64_t codes;		/**< the codes decoded */
+} koki_stats_counts_t;
+
+/**
+ * @brief the statistics a context gathers
+ */
+typedef struct {
+	koki_stats_counts_t total; /**< since gathering began or was reset */
+	koki_stats_counts_t last;  /**< from the last frame */
+} koki_stats_t;
+
+/**
+ * @brief add the time since \c t to a stage, if \c stats isn't NULL, and
+ *        move \c t on to now
+ */
+#define KOKI_STATS_LAP( stats, stage, t ) do {			\
+		if( (stats) != NULL )					\
+			koki_stats_lap( (stats), (stage), &(t) );	\
+	} while( 0 )
+
+/**
+ * @brief add to a count, if \c stats isn't NULL
+ */
+#define KOKI_STATS_COUNT( stats, field, n ) do {	\
+		if( (stats) != NULL )			\
+			(stats)->field += (n);		\
+	} while( 0 )
+
+uint64_t koki_stats_clock( void );
+
+void koki_stats_lap( koki_stats_counts_t *stats, koki_stage_t stage,
+		     uint64_t *t );
+
+void koki_stats_add( koki_stats_counts_t *to, const koki_stats_counts_t *from );
+
+const char* koki_stats_stage_name( koki_stage_t stage );
+
+#endif /* _KOKI_STATS_H_ */
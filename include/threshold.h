@@ -30,11 +30,16 @@
 #define KOKI_ADAPTIVE_MEAN   1
 #define KOKI_ADAPTIVE_MEDIAN 2
 
+#define KOKI_GLOBAL_MEAN_SPLIT 1
+#define KOKI_GLOBAL_OTSU       2
+
 
 IplImage* koki_threshold_frame(IplImage *frame, uint16_t threshold);
 
 uint16_t koki_threshold_global(IplImage *frame);
 
+uint16_t koki_threshold_global_method(IplImage *frame, uint8_t method);
+
 IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 				  int16_t c, uint8_t method);
 
@@ -43,6 +48,11 @@ bool koki_threshold_adaptive_pixel( const IplImage *frame,
 				    const CvRect *roi,
 				    uint16_t x, uint16_t y, int16_t c );
 
+void koki_threshold_adaptive_row( const IplImage *frame,
+				  const koki_integral_image_t *iimg,
+				  uint16_t window_size, uint16_t y,
+				  int16_t c, uint8_t *out );
+
 void koki_threshold_adaptive_calc_window( const IplImage *frame,
 					  CvRect *win,
 					  uint16_t width,
@@ -0,0 +1,50 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_TRACE_H_
+#define _KOKI_TRACE_H_
+
+/**
+ * @file  trace.h
+ * @brief Header file for labelling an image while tracing its contours
+ */
+
+#include <stdint.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "context.h"
+#include "labelling.h"
+#include "contour.h"
+
+/**
+ * @brief a dark region found while tracing contours
+ */
+typedef struct {
+	koki_clip_region_t clip;  /**< the region's clip region and mass */
+	koki_contour_t *contour;  /**< the region's outer contour, or NULL
+				       if the region is too near the edge of
+				       the image to be useable */
+} koki_traced_region_t;
+
+GArray* koki_label_trace_workspace( koki_t *koki, const IplImage *frame,
+				    uint16_t window_size,
+				    int16_t thresh_margin );
+
+bool koki_traced_region_useable( const koki_traced_region_t *region,
+				 uint16_t w, uint16_t h );
+
+#endif /* _KOKI_TRACE_H_ */
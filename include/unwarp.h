@@ -27,9 +27,13 @@
 
 #include "koki.h"
 #include "marker.h"
+#include "code_grid.h"
 
 IplImage* koki_unwarp_marker( koki_t* koki, koki_marker_t *marker, IplImage *frame,
 			      uint16_t unwarped_width );
 
+bool koki_unwarp_grid(koki_marker_t *marker, IplImage *frame, int16_t c,
+		      koki_grid_t *grid);
+
 
 #endif /* _KOKI_UNWARP_H_ */
@@ -25,6 +25,7 @@
 #include <sys/time.h> /* needed by videodev2.h */
 #include <linux/videodev2.h>
 #include <stdint.h>
+#include <stdbool.h>
 
 /**
  * @brief a structure for representing a memory-mapped buffer
@@ -34,6 +35,32 @@ typedef struct {
 	size_t length;  /**< the length of the array */
 } koki_buffer_t;
 
+/**
+ * @brief a ring of memory-mapped buffers that the camera streams into
+ *        while the frames already captured are being processed
+ */
+typedef struct {
+	int fd;			/**< the camera's file descriptor */
+	koki_buffer_t *buffers;	/**< the buffers */
+	int count;		/**< the number of buffers */
+	bool *queued;		/**< whether each buffer is queued with the
+				     driver, rather than held by the caller */
+	int n_queued;		/**< the number of buffers queued */
+} koki_v4l_ring_t;
+
+/**
+ * @brief a frame dequeued from a \c koki_v4l_ring_t, or got from a
+ *        \c koki_source_t
+ */
+typedef struct {
+	uint8_t *data;		  /**< the image data, valid until the frame
+				       is released */
+	size_t length;		  /**< the number of bytes of image data */
+	uint32_t index;		  /**< the buffer the frame is in */
+	uint32_t sequence;	  /**< the driver's frame counter */
+	struct timeval timestamp; /**< when the frame was captured */
+} koki_v4l_frame_t;
+
 int koki_v4l_open_cam(const char* filename);
 
 void koki_v4l_close_cam(int fd);
@@ -64,6 +91,30 @@ int koki_v4l_stop_stream(int fd);
 
 uint8_t* koki_v4l_get_frame_array(int fd, koki_buffer_t *buffers);
 
+koki_v4l_ring_t* koki_v4l_ring_start(int fd, int count);
+
+void koki_v4l_ring_stop(koki_v4l_ring_t *ring);
+
+int koki_v4l_ring_get_frame(koki_v4l_ring_t *ring, koki_v4l_frame_t *frame,
+			    int timeout);
+
+int koki_v4l_ring_get_next_frame(koki_v4l_ring_t *ring,
+				 koki_v4l_frame_t *frame, int timeout);
+
+int koki_v4l_ring_release_frame(koki_v4l_ring_t *ring,
+				const koki_v4l_frame_t *frame);
+
+IplImage* koki_v4l_luma_view(IplImage *view, uint8_t *data,
+			     struct v4l2_format fmt);
+
+void koki_v4l_YUYV_frame_into_RGB_image(const uint8_t *frame,
+					uint16_t w, uint16_t h,
+					IplImage *output);
+
+void koki_v4l_YUYV_frame_into_grayscale_image(const uint8_t *frame,
+					      uint16_t w, uint16_t h,
+					      IplImage *output);
+
 IplImage *koki_v4l_YUYV_frame_to_RGB_image(uint8_t *frame,
 					   uint16_t w, uint16_t h);
 
@@ -0,0 +1,87 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+#ifndef _KOKI_WORKSPACE_H_
+#define _KOKI_WORKSPACE_H_
+
+/**
+ * @file  workspace.h
+ * @brief Header file for the buffers that are kept between frames
+ */
+
+#include <stdint.h>
+#include <cv.h>
+
+#include "labelling.h"
+#include "integral-image.h"
+#include "arena.h"
+#include "contour.h"
+
+/**
+ * @brief the buffers used to find markers in a frame, which are kept
+ *        between frames
+ *
+ * A context's workspace is sized for the last frame it was given, and is
+ * only reallocated when the frame size changes.  Anything in it is only
+ * valid until the next frame.
+ */
+typedef struct koki_workspace {
+	uint16_t w, h;			/**< the frame size the buffers are for */
+
+	koki_labelled_image_t *labelled_image; /**< the frame's labels */
+	koki_integral_image_t *iimg;	/**< the frame's integral image */
+	uint8_t *thresh_row;		/**< a row of thresholding decisions */
+	label_run_t *runs[2];		/**< two rows' worth of runs */
+	GArray *regions;		/**< the regions found by tracing, of
+					     type \c koki_traced_region_t */
+	koki_contour_t *trace_points;	/**< the contour being traced */
+
+	IplImage *luma_img;		/**< the logged luma of an interleaved
+					     frame */
+	IplImage *thresh_img;		/**< the logged thresholded image */
+	IplImage *contours;		/**< the logged contours */
+	IplImage *disc_contours;	/**< the logged discarded contours */
+
+	koki_arena_t *arena;		/**< the arena for each frame's
+					     contours, quads and candidate
+					     markers */
+	koki_arena_t **worker_arenas;	/**< the arenas of the context's other
+					     marker-finding workers, the first
+					     being unused as it's \c arena */
+	uint16_t n_workers;		/**< the number of workers with arenas,
+					     including \c arena's */
+} koki_workspace_t;
+
+koki_workspace_t* koki_workspace_new( void );
+
+void koki_workspace_free( koki_workspace_t *ws );
+
+void koki_workspace_prepare( koki_workspace_t *ws, uint16_t w, uint16_t h );
+
+koki_integral_image_t* koki_workspace_integral_image( koki_workspace_t *ws,
+						      const IplImage *frame,
+						      uint16_t n_rows );
+
+IplImage* koki_workspace_log_image( koki_workspace_t *ws, IplImage **img,
+				    int channels );
+
+koki_arena_t* koki_workspace_arena( koki_workspace_t *ws, uint16_t worker );
+
+void koki_workspace_prepare_workers( koki_workspace_t *ws, uint16_t n_workers );
+
+void koki_workspace_reset_arenas( koki_workspace_t *ws );
+
+#endif /* _KOKI_WORKSPACE_H_ */
@@ -0,0 +1,168 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  arena.c
+ * @brief Implementation of the per-frame memory arena
+ */
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include "arena.h"
+
+/**
+ * @brief the alignment of every allocation from an arena
+ */
+#define KOKI_ARENA_ALIGN 16
+
+/**
+ * @brief rounds a size up to a multiple of \c KOKI_ARENA_ALIGN
+ */
+#define arena_align( size ) \
+	( ((size) + KOKI_ARENA_ALIGN - 1) & ~(size_t)(KOKI_ARENA_ALIGN - 1) )
+
+/**
+ * @brief allocate a new, empty, arena block
+ *
+ * @param size  the number of bytes the block holds
+ * @return      the new block
+ */
+static koki_arena_block_t* arena_block_new( size_t size )
+{
+	koki_arena_block_t *block;
+
+	/* malloc() aligns the block, so keep the memory after it aligned too */
+	block = malloc( arena_align( sizeof(koki_arena_block_t) ) + size );
+	g_assert( block != NULL );
+
+	block->data = (uint8_t*)block + arena_align( sizeof(koki_arena_block_t) );
+	block->next = NULL;
+	block->size = size;
+	block->used = 0;
+
+	return block;
+}
+
+/**
+ * @brief create a new arena
+ *
+ * No blocks are allocated until the arena is first allocated from.
+ *
+ * @param block_size  the size of the blocks to allocate from, which should
+ *                    comfortably hold a frame's worth of allocations
+ * @return            the new arena
+ */
+koki_arena_t* koki_arena_new( size_t block_size )
+{
+	koki_arena_t *arena = g_malloc( sizeof(koki_arena_t) );
+
+	arena->block_size = block_size;
+	arena->first = NULL;
+	arena->cur = NULL;
+
+	return arena;
+}
+
+/**
+ * @brief free an arena, along with everything allocated from it
+ *
+ * @param arena  the arena to free
+ */
+void koki_arena_free( koki_arena_t *arena )
+{
+	koki_arena_block_t *block = arena->first;
+
+	while( block != NULL ) {
+		koki_arena_block_t *next = block->next;
+
+		free( block );
+		block = next;
+	}
+
+	g_free( arena );
+}
+
+/**
+ * @brief allocate memory from an arena
+ *
+ * The memory lasts until the arena is next reset.  It must not be freed
+ * in any other way.
+ *
+ * @param arena  the arena
+ * @param size   the number of bytes to allocate
+ * @return       the memory, aligned as malloc() would
+ */
+void* koki_arena_alloc( koki_arena_t *arena, size_t size )
+{
+	koki_arena_block_t *block;
+	void *p;
+
+	size = arena_align( size );
+
+	if( arena->first == NULL )
+		arena->first = arena->cur
+			= arena_block_new( size > arena->block_size
+					   ? size : arena->block_size );
+
+	block = arena->cur;
+
+	while( block->used + size > block->size ) {
+		/* Move on to the next block, replacing it with a bigger one
+		   if it's too small */
+		if( block->next == NULL || block->next->size < size ) {
+			koki_arena_block_t *new;
+
+			new = arena_block_new( size > arena->block_size
+					       ? size : arena->block_size );
+
+			if( block->next != NULL ) {
+				new->next = block->next->next;
+				free( block->next );
+			}
+
+			block->next = new;
+		}
+
+		block = block->next;
+		block->used = 0;
+	}
+
+	arena->cur = block;
+
+	p = block->data + block->used;
+	block->used += size;
+
+	return p;
+}
+
+/**
+ * @brief make all the memory in an arena available again
+ *
+ * Everything allocated from the arena is freed.  The arena keeps its
+ * blocks, so once it has grown to fit a frame it stops allocating.
+ *
+ * @param arena  the arena to reset
+ */
+void koki_arena_reset( koki_arena_t *arena )
+{
+	if( arena->first == NULL )
+		return;
+
+	arena->cur = arena->first;
+	arena->first->used = 0;
+}
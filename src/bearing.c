@@ -20,6 +20,8 @@
  * @brief Implementation for estimating relative bearing to a marker
  */
 
+#include <stdint.h>
+#include <assert.h>
 #include <math.h>
 
 #include "points.h"
@@ -31,6 +33,46 @@
 #define M_PI 3.14159265358979323846
 #endif
 
+/**
+ * @brief the most markers whose co-ordinates are gathered onto the stack
+ *        at once by \c koki_bearing_estimate_markers()
+ */
+#define BEARING_BATCH 32
+
+/**
+ * @brief calculates the relative bearings (from the z-axis, i.e. the
+ *        direction the camera is pointing) to a number of points
+ *
+ * See \c koki_bearing_estimate_point() for what the results mean.  The
+ * bearings about the z-axis are always zero, so aren't written.
+ *
+ * @param n          the number of points
+ * @param x          the X co-ordinates of the points
+ * @param y          the Y co-ordinates of the points
+ * @param z          the Z co-ordinates of the points
+ * @param bearing_x  where to write the bearing about the x-axis to each
+ *                   point, in radians
+ * @param bearing_y  where to write the bearing about the y-axis to each
+ *                   point, in radians
+ */
+void koki_bearing_estimate_soa(uint32_t n, const float *x, const float *y,
+			       const float *z, float *bearing_x,
+			       float *bearing_y)
+{
+
+	for (uint32_t i=0; i<n; i++){
+
+		float r = sqrtf(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+
+		bearing_y[i] = atan2(x[i], z[i]);
+		bearing_x[i] = asin(y[i] / r);
+
+	}//for
+
+}
+
+
+
 /**
  * @brief calculates the relative bearing (from the z-axis, i.e. the direction
  *        the camera is pointing) to the point specified
@@ -51,12 +93,9 @@ koki_bearing_t koki_bearing_estimate_point(koki_point3Df_t point)
 {
 
 	koki_bearing_t bearing;
-	float r;
-
-	bearing.y = atan2(point.x, point.z);
 
-	r = sqrt(pow(point.x, 2) + pow(point.y, 2) + pow(point.z, 2));
-	bearing.x = asin(point.y / r);
+	koki_bearing_estimate_soa(1, &point.x, &point.y, &point.z,
+				  &bearing.x, &bearing.y);
 
 	bearing.z = 0; /* not used (yet) */
 
@@ -66,6 +105,49 @@ koki_bearing_t koki_bearing_estimate_point(koki_point3Df_t point)
 
 
 
+/**
+ * @brief calculates the relative bearings to the centres of a number of
+ *        markers, a batch at a time, and stores the results in the markers
+ *
+ * koki_bearing_estimate_point() has more details as to what the results mean.
+ *
+ * @param markers  the markers to calculate the relative bearings to and
+ *                 store the results in
+ * @param n        the number of markers
+ */
+void koki_bearing_estimate_markers(koki_marker_t **markers, uint32_t n)
+{
+
+	float x[BEARING_BATCH], y[BEARING_BATCH], z[BEARING_BATCH];
+	float bearing_x[BEARING_BATCH], bearing_y[BEARING_BATCH];
+
+	assert(markers != NULL || n == 0);
+
+	for (uint32_t start=0; start<n; start+=BEARING_BATCH){
+
+		uint32_t m = n - start < BEARING_BATCH ? n - start : BEARING_BATCH;
+
+		for (uint32_t i=0; i<m; i++){
+			assert(markers[start+i] != NULL);
+			x[i] = markers[start+i]->centre.world.x;
+			y[i] = markers[start+i]->centre.world.y;
+			z[i] = markers[start+i]->centre.world.z;
+		}
+
+		koki_bearing_estimate_soa(m, x, y, z, bearing_x, bearing_y);
+
+		for (uint32_t i=0; i<m; i++){
+			markers[start+i]->bearing.x = bearing_x[i] * (180 / M_PI);
+			markers[start+i]->bearing.y = bearing_y[i] * (180 / M_PI);
+			markers[start+i]->bearing.z = 0;
+		}
+
+	}//for start
+
+}
+
+
+
 /**
  * @brief calculates the relative bearing to the centre of the given marker
  *
@@ -77,16 +159,8 @@ koki_bearing_t koki_bearing_estimate_point(koki_point3Df_t point)
 void koki_bearing_estimate(koki_marker_t *marker)
 {
 
-	koki_bearing_t bearing;
-
 	assert(marker != NULL);
 
-	bearing = koki_bearing_estimate_point(marker->centre.world);
-
-	bearing.x *= 180 / M_PI;
-	bearing.y *= 180 / M_PI;
-	bearing.z *= 180 / M_PI;
-
-	marker->bearing = bearing;
+	koki_bearing_estimate_markers(&marker, 1);
 
 }
@@ -22,6 +22,7 @@
 
 #include <stdint.h>
 #include <cv.h>
+#include <glib.h>
 #include <stdio.h>
 
 #include "labelling.h"
@@ -280,208 +281,378 @@ static void code_rotations(koki_grid_t *grid, uint8_t codes[4][5])
 
 
 /**
- * @brief computes the syndrome of the received chunk/block
+ * @brief the flag set in a \c hamming_table entry if a bit was corrected
+ */
+#define HAMMING_CORRECTED 0x10
+
+/**
+ * @brief the decoded nibble of every possible Hamming(7,4) block
+ *
+ * libkoki uses Hamming(7,4), as described on its Wikipedia page:
+ *
+ *   http://en.wikipedia.org/wiki/Hamming(7,4)
+ *
+ * Bit \c i of a block is bit \c i+1 of the codeword, so the syndrome's bits
+ * are the parities of block bits {0,2,4,6}, {1,2,5,6} and {3,4,5,6}.  A
+ * non-zero syndrome is the 1-based index of the bit to flip, which is the
+ * best that can be done -- a block with too many errors gets more broken,
+ * but that doesn't matter.  The data bits are then block bits 2, 4, 5 and 6.
  *
- * A syndrome of \c 0 means no errors, anything else means there were
- * errors which could *perhaps* be correct.  The syndrome is the 1-based
- * index for the bit to flip to possible correct the received block.
+ * The low nibble of each entry is the decoded data, and
+ * \c HAMMING_CORRECTED is set if a bit had to be flipped.
+ */
+static const uint8_t hamming_table[128] = {
+	0x00, 0x10, 0x10, 0x11, 0x10, 0x11, 0x11, 0x01,
+	0x10, 0x12, 0x14, 0x18, 0x19, 0x15, 0x13, 0x11,
+	0x10, 0x12, 0x1a, 0x16, 0x17, 0x1b, 0x13, 0x11,
+	0x12, 0x02, 0x13, 0x12, 0x13, 0x12, 0x03, 0x13,
+	0x10, 0x1c, 0x14, 0x16, 0x17, 0x15, 0x1d, 0x11,
+	0x14, 0x15, 0x04, 0x14, 0x15, 0x05, 0x14, 0x15,
+	0x17, 0x16, 0x16, 0x06, 0x07, 0x17, 0x17, 0x16,
+	0x1e, 0x12, 0x14, 0x16, 0x17, 0x15, 0x13, 0x1f,
+	0x10, 0x1c, 0x1a, 0x18, 0x19, 0x1b, 0x1d, 0x11,
+	0x19, 0x18, 0x18, 0x08, 0x09, 0x19, 0x19, 0x18,
+	0x1a, 0x1b, 0x0a, 0x1a, 0x1b, 0x0b, 0x1a, 0x1b,
+	0x1e, 0x12, 0x1a, 0x18, 0x19, 0x1b, 0x13, 0x1f,
+	0x1c, 0x0c, 0x1d, 0x1c, 0x1d, 0x1c, 0x0d, 0x1d,
+	0x1e, 0x1c, 0x14, 0x18, 0x19, 0x15, 0x1d, 0x1f,
+	0x1e, 0x1c, 0x1a, 0x16, 0x17, 0x1b, 0x1d, 0x1f,
+	0x0e, 0x1e, 0x1e, 0x1f, 0x1e, 0x1f, 0x1f, 0x0f
+};
+
+
+
+/**
+ * @brief decodes, i.e. extracts the original data, from the received block
  *
- * @param r  the recieved block, as a 7x1 column matrix
- * @return   the syndrome
+ * @param block      the block with the received data in it (7 bits)
+ * @param corrected  a count to increment if a bit was corrected
+ * @return           the decoded data nibble (4 bits) in a \c uint8_t
  */
-static uint8_t hamming_syndrome(CvMat *r)
+static inline uint8_t hamming_decode(uint8_t block, uint8_t *corrected)
 {
 
-	uint8_t syndrome = 0;
-	CvMat *z = cvCreateMat(3, 1, CV_32FC1);
-	CvMat *H = cvCreateMat(3, 7, CV_32FC1);
-
-	/* fill H */
-	cvmSet(H, 0, 0, 1);
-	cvmSet(H, 0, 1, 0);
-	cvmSet(H, 0, 2, 1);
-	cvmSet(H, 0, 3, 0);
-	cvmSet(H, 0, 4, 1);
-	cvmSet(H, 0, 5, 0);
-	cvmSet(H, 0, 6, 1);
-
-	cvmSet(H, 1, 0, 0);
-	cvmSet(H, 1, 1, 1);
-	cvmSet(H, 1, 2, 1);
-	cvmSet(H, 1, 3, 0);
-	cvmSet(H, 1, 4, 0);
-	cvmSet(H, 1, 5, 1);
-	cvmSet(H, 1, 6, 1);
-
-	cvmSet(H, 2, 0, 0);
-	cvmSet(H, 2, 1, 0);
-	cvmSet(H, 2, 2, 0);
-	cvmSet(H, 2, 3, 1);
-	cvmSet(H, 2, 4, 1);
-	cvmSet(H, 2, 5, 1);
-	cvmSet(H, 2, 6, 1);
-
-	/* calculate syndrome */
-	cvMatMulAdd(H, r, NULL, z);
-
-	/* get syndrome from bits in maxtrix */
-	syndrome |= (((uint8_t)cvmGet(z, 0, 0)) & 0x1) << 0;
-	syndrome |= (((uint8_t)cvmGet(z, 1, 0)) & 0x1) << 1;
-	syndrome |= (((uint8_t)cvmGet(z, 2, 0)) & 0x1) << 2;
-
-	/* clean up */
-	cvReleaseMat(&z);
-	cvReleaseMat(&H);
-
-	return syndrome;
+	uint8_t entry = hamming_table[block & 0x7F];
+
+	if (entry & HAMMING_CORRECTED)
+		(*corrected)++;
+
+	return entry & 0xF;
 
 }
 
 
 
 /**
- * @brief given a syndrome and the received block (as a 7x1 column matrix),
- *        this function corrects (flips) the erroneous bit is there is one
+ * @brief the CRC of each marker number, indexed by \c num+1 (see
+ *        \c crc_check())
+ */
+static uint16_t crc_table[256];
+
+
+
+/**
+ * @brief discoveres if the 12-bit CRC of \c num is \c crc
  *
- * @param syndrome  the syndrome, as output by \c hamming_syndrome()
- * @param r         the recieved matrix to possibly modify
+ * @param num  the marker number
+ * @param crc  the received CRC
+ * @return     \c TRUE if \c CRC12(num) equals \c crc, \c FALSE otherwise
  */
-static void hamming_correct(uint8_t syndrome, CvMat *r)
+static bool crc_check(uint8_t num, uint16_t crc)
 {
 
-	if (syndrome == 0 || syndrome > 7)
-		return;
+	/* note the 'num+1'. koki_crc12(0) == 0, which would be
+	   bad bacause that'd be very common in an image. Adding
+	   one alleviates this issue.  The same has been done in
+	   the marker generation scripts. */
+	return crc_table[(uint8_t)(num+1)] == crc;
+
+
+}
+
+
+
+/* The codeword dictionary is an open addressing hash table.  Each entry
+   packs its key (a grid pattern and a rotation) with the marker number it
+   decodes to and whether a bit had to be corrected to get there. */
+#define DICT_BITS 16
+#define DICT_SIZE (1 << DICT_BITS)
+#define DICT_KEY_MASK ((UINT64_C(1) << 38) - 1)
+#define DICT_CODE_SHIFT 38
+#define DICT_CORRECTED (UINT64_C(1) << 46)
+#define DICT_USED (UINT64_C(1) << 47)
+
+/**
+ * @brief every marker's pattern in every rotation, and every pattern one
+ *        bit away from them
+ */
+static uint64_t code_dict[DICT_SIZE];
+
+/**
+ * @brief for each rotation, the bits of a grid pattern that are part of
+ *        the code (every cell but one)
+ */
+static uint64_t rotation_masks[4];
+
+
+
+/**
+ * @brief finds the bit of a grid pattern that holds a cell of the code
+ *        grid when it's read in a given rotation
+ *
+ * This matches the \c ROT_ macros above.
+ *
+ * @param rotation  the rotation, as a multiple of 90 degrees
+ * @param x         the cell's column, in the rotated grid
+ * @param y         the cell's row, in the rotated grid
+ * @return          the bit's index, \c row*width+column of the cell in the
+ *                  unrotated grid
+ */
+static uint8_t pattern_bit(uint8_t rotation, uint8_t x, uint8_t y)
+{
 
-	/* might be wrong, correct and hope for the
-	   best -- that's all we can do */
+	const uint8_t gw = KOKI_CODE_GRID_WIDTH;
 
-	/* invert the bit */
-	cvmSet(r, syndrome-1, 0, ~((uint8_t)cvmGet(r, syndrome-1, 0)) & 0x1);
+	switch (rotation){
+	case 0:  return y * gw + x;
+	case 1:  return x * gw + (gw-1) - y;
+	case 2:  return ((gw-1) - y) * gw + (gw-1) - x;
+	default: return ((gw-1) - x) * gw + y;
+	}
 
 }
 
 
 
 /**
- * @brief decodes, i.e. extracts the original data, from the received block
+ * @brief finds the slot of the codeword dictionary to start looking for a
+ *        key at
  *
- * libkoki uses Hamming(7,4), the implemetation seen here is based on the
- * Hamming(7,4) Wikipedia page:
+ * @param key  the key
+ * @return     the slot's index
+ */
+static inline uint32_t dict_slot(uint64_t key)
+{
+
+	return (key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - DICT_BITS);
+
+}
+
+
+
+/**
+ * @brief adds an entry to the codeword dictionary
  *
- *   http://en.wikipedia.org/wiki/Hamming(7,4)
+ * @param key        the grid pattern, with the rotation in bits 36 and 37
+ * @param code       the marker number that the pattern decodes to
+ * @param corrected  whether a bit has to be corrected to decode it
+ */
+static void dict_insert(uint64_t key, uint8_t code, bool corrected)
+{
+
+	uint32_t slot = dict_slot(key);
+
+	/* the patterns one bit away from two markers' would be at least
+	   three bits apart, so no key should be added twice */
+	while (code_dict[slot] & DICT_USED){
+		assert((code_dict[slot] & DICT_KEY_MASK) != key);
+		slot = (slot + 1) & (DICT_SIZE - 1);
+	}
+
+	code_dict[slot] = key | ((uint64_t)code << DICT_CODE_SHIFT)
+		| (corrected ? DICT_CORRECTED : 0) | DICT_USED;
+
+}
+
+
+
+/**
+ * @brief looks a key up in the codeword dictionary
  *
- * @param block  the block with the received data in it (7 bits)
- * @return       the decoded data nibble (4 bits) in a \c uint8_t
+ * @param key        the grid pattern, with the rotation in bits 36 and 37
+ * @param code       where to store the marker number, if it's found
+ * @param corrected  where to store the number of bits corrected, if it's
+ *                   found
+ * @return           \c TRUE if the key is in the dictionary, \c FALSE
+ *                   otherwise
  */
-static uint8_t hamming_decode(uint8_t block)
+static inline bool dict_lookup(uint64_t key, uint8_t *code,
+			       uint8_t *corrected)
 {
 
-	uint8_t syndrome, data = 0;
-	CvMat *r     = cvCreateMat(7, 1, CV_32FC1);
-	CvMat *R_mat = cvCreateMat(4, 7, CV_32FC1);
-	CvMat *pr    = cvCreateMat(4, 1, CV_32FC1);
-
-	/* fill R */
-	assert(R_mat != NULL);
-	cvmSet(R_mat, 0, 0, 0);
-	cvmSet(R_mat, 0, 1, 0);
-	cvmSet(R_mat, 0, 2, 1);
-	cvmSet(R_mat, 0, 3, 0);
-	cvmSet(R_mat, 0, 4, 0);
-	cvmSet(R_mat, 0, 5, 0);
-	cvmSet(R_mat, 0, 6, 0);
-
-	cvmSet(R_mat, 1, 0, 0);
-	cvmSet(R_mat, 1, 1, 0);
-	cvmSet(R_mat, 1, 2, 0);
-	cvmSet(R_mat, 1, 3, 0);
-	cvmSet(R_mat, 1, 4, 1);
-	cvmSet(R_mat, 1, 5, 0);
-	cvmSet(R_mat, 1, 6, 0);
-
-	cvmSet(R_mat, 2, 0, 0);
-	cvmSet(R_mat, 2, 1, 0);
-	cvmSet(R_mat, 2, 2, 0);
-	cvmSet(R_mat, 2, 3, 0);
-	cvmSet(R_mat, 2, 4, 0);
-	cvmSet(R_mat, 2, 5, 1);
-	cvmSet(R_mat, 2, 6, 0);
-
-	cvmSet(R_mat, 3, 0, 0);
-	cvmSet(R_mat, 3, 1, 0);
-	cvmSet(R_mat, 3, 2, 0);
-	cvmSet(R_mat, 3, 3, 0);
-	cvmSet(R_mat, 3, 4, 0);
-	cvmSet(R_mat, 3, 5, 0);
-	cvmSet(R_mat, 3, 6, 1);
-
-	/* fill r with bits from block */
-	for (uint8_t i=0; i<7; i++)
-		cvmSet(r, i, 0, (block >> i) & 0x1);
-
-	/* correct any errors -- this will break the code more if it's
-	   got too many errors, but that doesn't matter */
-	syndrome = hamming_syndrome(r);
-	hamming_correct(syndrome, r);
-
-	/* get data out */
-	cvMatMulAdd(R_mat, r, NULL, pr);
-
-	/* get bits from matrix */
-	for (uint8_t i=0; i<4; i++)
-		data |= (((uint8_t)cvmGet(pr, i, 0)) & 0x1) << i;
+	uint32_t slot = dict_slot(key);
 
-	/* clean up */
-	cvReleaseMat(&r);
-	cvReleaseMat(&R_mat);
-	cvReleaseMat(&pr);
+	while (code_dict[slot] & DICT_USED){
 
-	return data;
+		if ((code_dict[slot] & DICT_KEY_MASK) == key){
+			*code = code_dict[slot] >> DICT_CODE_SHIFT;
+			*corrected = (code_dict[slot] & DICT_CORRECTED) != 0;
+			return TRUE;
+		}
+
+		slot = (slot + 1) & (DICT_SIZE - 1);
+
+	}
+
+	return FALSE;
 
 }
 
 
 
 /**
- * @brief discoveres if the 12-bit CRC of \c num is \c crc
+ * @brief builds the CRC table and the codeword dictionary
  *
- * @param num  the marker number
- * @param crc  the received CRC
- * @return     \c TRUE if \c CRC12(num) equals \c crc, \c FALSE otherwise
+ * Each marker's code is encoded just as the marker generation scripts do,
+ * then laid out in the grid in each rotation.  That pattern, and every
+ * pattern one bit from it, is added to the dictionary.
  */
-static bool crc_check(uint8_t num, uint16_t crc)
+static void code_dict_build(void)
 {
 
-	/* note the 'num+1'. koki_crc12(0) == 0, which would be
-	   bad bacause that'd be very common in an image. Adding
-	   one alleviates this issue.  The same has been done in
-	   the marker generation scripts. */
-	return koki_crc12(num+1) == crc;
+	uint8_t encode[16];
+
+	for (uint16_t i=0; i<256; i++)
+		crc_table[i] = koki_crc12(i);
+
+	/* the block that each nibble encodes to is the one that decodes to
+	   it without correction */
+	for (uint8_t block=0; block<128; block++)
+		if (!(hamming_table[block] & HAMMING_CORRECTED))
+			encode[hamming_table[block]] = block;
+
+	for (uint8_t r=0; r<4; r++)
+		rotation_masks[r] = ((UINT64_C(1) << 36) - 1)
+			& ~(UINT64_C(1) << pattern_bit(r, KOKI_CODE_GRID_WIDTH-1,
+							KOKI_CODE_GRID_WIDTH-1));
+
+	for (uint16_t num=0; num<256; num++){
+
+		uint32_t data = num | (crc_table[(uint8_t)(num+1)] << 8);
+		uint8_t blocks[5];
+
+		for (uint8_t j=0; j<5; j++)
+			blocks[j] = encode[(data >> (j*4)) & 0xF];
+
+		for (uint8_t r=0; r<4; r++){
+
+			uint64_t pattern = 0, key;
+
+			/* the same layout as code_rotations() reads */
+			for (uint8_t p=0; p<35; p++){
 
+				uint8_t x = p % KOKI_CODE_GRID_WIDTH;
+				uint8_t y = p / KOKI_CODE_GRID_WIDTH;
+
+				if ((blocks[p % 5] >> (p / 5)) & 0x1)
+					pattern |= UINT64_C(1) << pattern_bit(r, x, y);
+
+			}//for
+
+			key = pattern | ((uint64_t)r << 36);
+			dict_insert(key, num, FALSE);
+
+			for (uint8_t b=0; b<36; b++)
+				if (rotation_masks[r] & (UINT64_C(1) << b))
+					dict_insert(key ^ (UINT64_C(1) << b),
+						    num, TRUE);
+
+		}//for r
+
+	}//for num
 
 }
 
 
 
 /**
- * @brief recovers the code, if there is one, from the given grid
+ * @brief packs the code section of a grid into the bits of an integer
+ *
+ * @param grid  the populated grid
+ * @return      the pattern, with bit \c row*width+column set if that cell
+ *              of the code is black (a set bit, as in \c code_rotations())
+ */
+static uint64_t grid_pattern(koki_grid_t *grid)
+{
+
+	const uint8_t bw = (KOKI_MARKER_GRID_WIDTH - KOKI_CODE_GRID_WIDTH) / 2;
+	uint64_t pattern = 0;
+
+	for (uint8_t y=0; y<KOKI_CODE_GRID_WIDTH; y++)
+		for (uint8_t x=0; x<KOKI_CODE_GRID_WIDTH; x++)
+			if (grid->data[bw+y][bw+x].val == 0)
+				pattern |= UINT64_C(1)
+					<< (y * KOKI_CODE_GRID_WIDTH + x);
+
+	return pattern;
+
+}
+
+
+
+/**
+ * @brief recovers the code, if there is one, from the given grid, and
+ *        counts the bits that had to be corrected to do so
+ *
+ * A grid that's at most one bit from a marker is looked up in a dictionary
+ * of them, which is built the first time this is called.  Any other grid
+ * is Hamming decoded a block at a time, in each rotation, and the first
+ * rotation whose CRC checks out is used.
  *
  * @param grid             the populated input grid
  * @param rotation_offset  a pointer to a \c float in which a multiple of 90
  *                         degrees will be stored, representing the number
  *                         of times the grid had to be rotated to make it 'fit'
+ * @param bits_corrected   where to store the number of bits that Hamming
+ *                         decoding corrected in the recovered code, or
+ *                         \c NULL
  * @return                 the code, if the is one, \c -1 otherwise
  */
-int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
+int16_t koki_code_recover_from_grid_corrected(koki_grid_t *grid,
+					      float *rotation_offset,
+					      uint8_t *bits_corrected)
 {
 
+	static gsize dict_built = 0;
 	uint8_t codes[4][5];
 	uint32_t data[4];
+	uint8_t corrected[4];
 	uint8_t marker_num;
 	uint16_t marker_crc;
+	uint64_t pattern;
 
 	assert(grid != NULL);
 
+	if (g_once_init_enter(&dict_built)){
+		code_dict_build();
+		g_once_init_leave(&dict_built, 1);
+	}
+
+	/* markers read with at most one wrong bit are in the dictionary */
+	pattern = grid_pattern(grid);
+
+	for (uint8_t i=0; i<4; i++){
+
+		uint64_t key = (pattern & rotation_masks[i]) | ((uint64_t)i << 36);
+		uint8_t n;
+
+		if (dict_lookup(key, &marker_num, &n)){
+
+			if (rotation_offset != NULL)
+				*rotation_offset = 90.0 * i;
+
+			if (bits_corrected != NULL)
+				*bits_corrected = n;
+
+			return marker_num;
+
+		}
+
+	}//for
+
+	/* Otherwise, each Hamming block can still have a bit corrected, so
+	   decode them one at a time */
+
 	/* get rotations */
 	code_rotations(grid, codes);
 
@@ -489,8 +660,10 @@ int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
 	for (uint8_t i=0; i<4; i++){
 
 		data[i] = 0;
+		corrected[i] = 0;
 		for (int j=0; j<5; j++)
-			data[i] |= (hamming_decode(codes[i][j]) & 0xF) << (j*4);
+			data[i] |= hamming_decode(codes[i][j], &corrected[i])
+				<< (j*4);
 
 	}//for
 
@@ -507,6 +680,9 @@ int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
 			if (rotation_offset != NULL)
 				*rotation_offset = 90.0 * i;
 
+			if (bits_corrected != NULL)
+				*bits_corrected = corrected[i];
+
 			return marker_num;
 
 		}
@@ -520,6 +696,25 @@ int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
 
 
 
+/**
+ * @brief recovers the code, if there is one, from the given grid
+ *
+ * @param grid             the populated input grid
+ * @param rotation_offset  a pointer to a \c float in which a multiple of 90
+ *                         degrees will be stored, representing the number
+ *                         of times the grid had to be rotated to make it 'fit'
+ * @return                 the code, if the is one, \c -1 otherwise
+ */
+int16_t koki_code_recover_from_grid(koki_grid_t *grid, float *rotation_offset)
+{
+
+	return koki_code_recover_from_grid_corrected(grid, rotation_offset,
+						     NULL);
+
+}
+
+
+
 /**
  * @brief translates between from marker code space to user code space
  *
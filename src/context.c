@@ -20,9 +20,12 @@
  * @brief Implementation of libkoki context functions
  */
 
+#include <string.h>
 #include <glib.h>
 
 #include "context.h"
+#include "workspace.h"
+#include "pool.h"
 
 /**
  * @brief create a libkoki context
@@ -35,6 +38,18 @@ koki_t* koki_new( void )
 
 	/* By default, use the null logger (i.e. throw everything away) */
 	koki->logger = koki_null_logger;
+	koki->logger_userdata = NULL;
+
+	koki->label_method = KOKI_LABEL_PIXEL;
+	koki->label_threads = 1;
+	koki->label_stats_pass = FALSE;
+	koki->marker_threads = 1;
+	koki->pool = NULL;
+
+	koki->workspace = koki_workspace_new();
+
+	koki->stats = NULL;
+	g_mutex_init( &koki->stats_lock );
 
 	return koki;
 }
@@ -57,11 +72,208 @@ void koki_set_logger( koki_t* koki,
 	koki->logger_userdata = userdata;
 }
 
+/**
+ * @brief set the connected-component labelling algorithm to use
+ *
+ * \c KOKI_LABEL_PIXEL and \c KOKI_LABEL_RUNS find the same regions.
+ * \c KOKI_LABEL_RUNS is usually considerably faster on images with large
+ * uniform areas, but may number the regions in a different order.
+ *
+ * \c KOKI_LABEL_TRACE only changes how markers are found: each region's
+ * outer contour is traced as the region is labelled, instead of being
+ * searched for in the labelled image afterwards.  The same markers are
+ * found, though perhaps in a different order.  It always uses one thread,
+ * and is fastest on frames without much speckle.  Anything else that
+ * labels an image labels runs.
+ *
+ * @param koki    the libkoki context
+ * @param method  the labelling algorithm
+ */
+void koki_set_label_method( koki_t* koki, koki_label_method_t method )
+{
+	g_assert( koki != NULL );
+
+	koki->label_method = method;
+}
+
+/**
+ * @brief set the number of threads to label images with
+ *
+ * With more than one thread, each image is split into horizontal stripes
+ * which are thresholded and labelled in parallel using \c KOKI_LABEL_RUNS,
+ * whatever labelling algorithm has been set.  Small images may be given
+ * fewer threads than this.
+ *
+ * @param koki       the libkoki context
+ * @param n_threads  the number of threads, which must be at least 1
+ */
+void koki_set_label_threads( koki_t* koki, uint16_t n_threads )
+{
+	g_assert( koki != NULL );
+	g_assert( n_threads >= 1 );
+
+	koki->label_threads = n_threads;
+}
+
+/**
+ * @brief set whether \c KOKI_LABEL_PIXEL gathers each region's statistics
+ *        in a separate pass over the labelled image
+ *
+ * The statistics are normally gathered while labelling.  The separate
+ * pass is how libkoki used to do it, and is kept so that the two can be
+ * compared; the results are the same either way.  It has no effect on
+ * the other labelling algorithms, or with more than one thread.
+ *
+ * @param koki     the libkoki context
+ * @param enabled  whether to use the separate pass
+ */
+void koki_set_label_stats_pass( koki_t* koki, gboolean enabled )
+{
+	g_assert( koki != NULL );
+
+	koki->label_stats_pass = enabled;
+}
+
+/**
+ * @brief set the number of threads to look for markers in candidate
+ *        regions with
+ *
+ * Once a frame has been labelled, the regions that might be markers are
+ * shared out between this many threads, which steal work from each other
+ * as they run out.  The markers are still returned in the same order as
+ * with one thread.  While the context is logging, only one thread is used,
+ * so that the log comes out in order.
+ *
+ * @param koki       the libkoki context
+ * @param n_threads  the number of threads, which must be at least 1
+ */
+void koki_set_marker_threads( koki_t* koki, uint16_t n_threads )
+{
+	g_assert( koki != NULL );
+	g_assert( n_threads >= 1 );
+
+	if( n_threads == koki->marker_threads )
+		return;
+
+	if( koki->pool != NULL )
+		koki_pool_free( koki->pool );
+
+	koki->marker_threads = n_threads;
+	koki->pool = NULL;
+
+	if( n_threads > 1 ) {
+		koki->pool = koki_pool_new( n_threads );
+		koki_workspace_prepare_workers( koki->workspace, n_threads );
+	}
+}
+
+/**
+ * @brief start or stop gathering timings and counts from finding markers
+ *
+ * Each stage of finding markers is timed, and the regions, contours, quads
+ * and codes found are counted, both for the last frame and in total.  The
+ * stages that look in candidate regions are timed on every thread that
+ * looks, so with more than one marker thread their times can add up to
+ * more than the time taken.  While the statistics aren't being gathered,
+ * finding markers costs no more than a check of each stage.
+ *
+ * @param koki     the libkoki context
+ * @param enabled  TRUE to gather them, starting from nothing, or FALSE to
+ *                 stop and throw them away
+ */
+void koki_set_stats( koki_t* koki, gboolean enabled )
+{
+	g_assert( koki != NULL );
+
+	g_mutex_lock( &koki->stats_lock );
+
+	/* Finding markers checks the pointer without the lock */
+	if( enabled && koki->stats == NULL )
+		__atomic_store_n( &koki->stats, g_malloc0( sizeof(koki_stats_t) ),
+				  __ATOMIC_RELAXED );
+	else if( !enabled && koki->stats != NULL ) {
+		g_free( koki->stats );
+		__atomic_store_n( &koki->stats, NULL, __ATOMIC_RELAXED );
+	}
+
+	g_mutex_unlock( &koki->stats_lock );
+}
+
+/**
+ * @brief get the timings and counts gathered so far
+ *
+ * This can be called from any thread, even while markers are being found.
+ *
+ * @param koki   the libkoki context
+ * @param stats  where to copy them to
+ * @return       TRUE if they're being gathered, otherwise FALSE and
+ *               \c stats is left alone
+ */
+gboolean koki_get_stats( koki_t* koki, koki_stats_t *stats )
+{
+	gboolean enabled;
+
+	g_assert( koki != NULL && stats != NULL );
+
+	g_mutex_lock( &koki->stats_lock );
+
+	enabled = koki->stats != NULL;
+	if( enabled )
+		*stats = *koki->stats;
+
+	g_mutex_unlock( &koki->stats_lock );
+
+	return enabled;
+}
+
+/**
+ * @brief start the timings and counts gathered again from nothing
+ *
+ * @param koki  the libkoki context
+ */
+void koki_reset_stats( koki_t* koki )
+{
+	g_assert( koki != NULL );
+
+	g_mutex_lock( &koki->stats_lock );
+
+	if( koki->stats != NULL )
+		memset( koki->stats, 0, sizeof(koki_stats_t) );
+
+	g_mutex_unlock( &koki->stats_lock );
+}
+
+/**
+ * @brief record the timings and counts from a frame
+ *
+ * @param koki   the libkoki context
+ * @param frame  the frame's timings and counts
+ */
+void koki_stats_record( koki_t* koki, const koki_stats_counts_t *frame )
+{
+	g_mutex_lock( &koki->stats_lock );
+
+	/* They may have been stopped while the frame was looked in */
+	if( koki->stats != NULL ) {
+		koki->stats->last = *frame;
+		koki_stats_add( &koki->stats->total, frame );
+	}
+
+	g_mutex_unlock( &koki->stats_lock );
+}
+
 /**
  * @brief destroy a libkoki context
  */
 void koki_destroy( koki_t* koki )
 {
+	if( koki->pool != NULL )
+		koki_pool_free( koki->pool );
+
+	g_free( koki->stats );
+	g_mutex_clear( &koki->stats_lock );
+
+	koki_workspace_free( koki->workspace );
 	g_free( koki );
 }
 
@@ -21,6 +21,8 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <glib.h>
 
 #include "labelling.h"
@@ -46,19 +48,17 @@
  *                        regions
  * @param region          the index of the \c clips \c GArray in \c
  *                        labelled_image
- * @return                a pointer to the first labelled point on the top row
+ * @param point           where to put the first labelled point on the top row
+ * @return                TRUE if a labelled point was found
  */
-static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled_image,
-						 label_t region)
+static bool first_labeled_on_top_row(koki_labelled_image_t *labelled_image,
+				     label_t region, koki_point2Di_t *point)
 {
 
 	koki_clip_region_t clip;
-	koki_point2Di_t *ret = NULL, *point;
+	bool ret = FALSE;
 	uint16_t width;
 
-	point = g_slice_new(koki_point2Di_t);
-	assert(point != NULL);
-
 	assert(region < labelled_image->clips->len);
 	clip = g_array_index(labelled_image->clips, koki_clip_region_t, region);
 
@@ -86,7 +86,7 @@ static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled
 
 				point->x = clip.min.x + i;
 				point->y = clip.min.y;
-				ret = point;
+				ret = TRUE;
 				break;
 
 			}
@@ -108,7 +108,7 @@ static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled
 
 				point->x = clip.max.x - i;
 				point->y = clip.min.y;
-				ret = point;
+				ret = TRUE;
 				break;
 
 			}
@@ -117,9 +117,6 @@ static koki_point2Di_t* first_labeled_on_top_row(koki_labelled_image_t *labelled
 
 	}//for
 
-	if (ret == NULL)
-		g_slice_free(koki_point2Di_t, point);
-
 	return ret;
 
 }
@@ -191,21 +188,77 @@ static enum DIRECTION get_opposite_direction(enum DIRECTION dir)
 
 
 /**
- * @brief allocates and initialises a new \c koki_point2Di_t in memory
+ * @brief allocates an empty contour with room for a given number of points
  *
- * @param x  the X co-ordinate of the point
- * @param y  the Y co-ordinate of the point
- * @return   a pointer to the newly allocated \c koki_point2Di_t
+ * The contour and its co-ordinates are allocated as one block.
+ *
+ * @param size   the number of points to make room for
+ * @param arena  the arena to allocate the contour from, or NULL to
+ *               malloc() it, in which case it should be freed with
+ *               \c koki_contour_array_free()
+ * @return       the new contour
  */
-static koki_point2Di_t* point2Di_new(uint16_t x, uint16_t y)
+koki_contour_t* koki_contour_array_new(uint32_t size, koki_arena_t *arena)
 {
 
-	koki_point2Di_t *p;
-	p = g_slice_new(koki_point2Di_t);
-	assert(p != NULL);
-	p->x = x;
-	p->y = y;
-	return p;
+	koki_contour_t *contour;
+	size_t bytes = sizeof(koki_contour_t) + 2 * size * sizeof(int16_t);
+
+	if (arena != NULL)
+		contour = koki_arena_alloc(arena, bytes);
+	else
+		contour = malloc(bytes);
+	assert(contour != NULL);
+
+	contour->x = (int16_t*)(contour + 1);
+	contour->y = contour->x + size;
+	contour->len = 0;
+	contour->size = size;
+
+	return contour;
+
+}
+
+
+
+/**
+ * @brief appends a point to a contour, making more room for it if
+ *        necessary
+ *
+ * @param contour  a pointer to the contour to append to, which is replaced
+ *                 if the contour has to be moved to make room
+ * @param x        the X co-ordinate of the point
+ * @param y        the Y co-ordinate of the point
+ * @param arena    the arena the contour was allocated from, or NULL if it
+ *                 was malloc()ed
+ */
+void koki_contour_array_append(koki_contour_t **contour, uint16_t x,
+			       uint16_t y, koki_arena_t *arena)
+{
+
+	koki_contour_t *c = *contour;
+
+	if (c->len == c->size){
+
+		koki_contour_t *bigger;
+
+		bigger = koki_contour_array_new(2 * c->size + 16, arena);
+
+		memcpy(bigger->x, c->x, c->len * sizeof(int16_t));
+		memcpy(bigger->y, c->y, c->len * sizeof(int16_t));
+		bigger->len = c->len;
+
+		/* arena allocations go when the arena is reset */
+		if (arena == NULL)
+			free(c);
+
+		*contour = c = bigger;
+
+	}
+
+	c->x[c->len] = x;
+	c->y[c->len] = y;
+	c->len++;
 
 }
 
@@ -224,21 +277,109 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 			  label_t region)
 {
 
-	GSList *contour = NULL;
-	koki_point2Di_t *first_point, current, check;
+	return koki_contour_find_arena(labelled_image, region, NULL);
+
+}
+
+
+
+/**
+ * @brief finds the contour for a given region, allocating it from an arena
+ *
+ * The contour is freed when the arena is reset, and must not be passed to
+ * \c koki_contour_free().
+ *
+ * @param labelled_image  the labelled image that has been labelled
+ * @param region          the index to the labelled image's clip
+ *                        \c GArray
+ * @param arena           the arena to allocate the contour from, or NULL
+ *                        to allocate it as \c koki_contour_find() does
+ * @return                a pointer to the first GSList node
+ */
+GSList* koki_contour_find_arena(koki_labelled_image_t *labelled_image,
+				label_t region, koki_arena_t *arena)
+{
+
+	GSList *contour = NULL, *node;
+	koki_contour_t *points;
+	koki_point2Di_t *p;
+
+	points = koki_contour_find_array(labelled_image, region, arena);
+
+	/* build the list backwards, so it can be prepended to */
+	for (uint32_t i = points->len; i > 0; i--){
+
+		if (arena == NULL){
+			p = g_slice_new(koki_point2Di_t);
+			assert(p != NULL);
+			p->x = points->x[i-1];
+			p->y = points->y[i-1];
+			contour = g_slist_prepend(contour, p);
+			continue;
+		}
+
+		p = koki_arena_alloc(arena, sizeof(koki_point2Di_t));
+		p->x = points->x[i-1];
+		p->y = points->y[i-1];
+
+		node = koki_arena_alloc(arena, sizeof(GSList));
+		node->data = p;
+		node->next = contour;
+		contour = node;
+
+	}
+
+	if (arena == NULL)
+		koki_contour_array_free(points);
+
+	return contour;
+
+}
+
+
+
+/**
+ * @brief finds the contour for a given region, as packed arrays of
+ *        co-ordinates
+ *
+ * The points are the same, and in the same order, as those found by
+ * \c koki_contour_find().
+ *
+ * @param labelled_image  the labelled image that has been labelled
+ * @param region          the index to the labelled image's clip
+ *                        \c GArray
+ * @param arena           the arena to allocate the contour from, or NULL
+ *                        to malloc() it, in which case it should be freed
+ *                        with \c koki_contour_array_free()
+ * @return                the contour
+ */
+koki_contour_t* koki_contour_find_array(koki_labelled_image_t *labelled_image,
+					label_t region, koki_arena_t *arena)
+{
+
+	koki_contour_t *contour;
+	koki_clip_region_t clip;
+	koki_point2Di_t first_point, current, check;
+	bool found;
 
 	/* get the first point in the chain */
-	first_point = first_labeled_on_top_row(labelled_image, region);
-	assert(first_point != NULL);
+	found = first_labeled_on_top_row(labelled_image, region, &first_point);
+	assert(found);
+
+	/* the contour of a solid region is about as long as the perimeter
+	   of its clip region, so start with room for that */
+	clip = g_array_index(labelled_image->clips, koki_clip_region_t, region);
+	contour = koki_contour_array_new(2 * (clip.max.x - clip.min.x + 1)
+				+ 2 * (clip.max.y - clip.min.y + 1), arena);
 
-	/* prepend it (will be reversed later) */
-	contour = g_slist_prepend(contour, first_point);
+	koki_contour_array_append(&contour, first_point.x, first_point.y,
+				  arena);
 
 	enum DIRECTION dir = N;
 	bool first_run = TRUE;
 	label_t label;
 
-	current = *first_point;
+	current = first_point;
 
 	while (TRUE){
 
@@ -254,12 +395,8 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 
 			if (label != 0){
 
-				/* prepend it to the list (prepend
-				   for speed -- no walking to end
-				   necessary) */
-				koki_point2Di_t *p;
-				p = point2Di_new(check.x, check.y);
-				contour = g_slist_prepend(contour, p);
+				koki_contour_array_append(&contour, check.x,
+							  check.y, arena);
 
 				break;
 
@@ -271,8 +408,8 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 
 		/* check to see if we've done a full circle */
 		if (!first_run
-		    && current.x == first_point->x
-		    && current.y == first_point->y)
+		    && current.x == first_point.x
+		    && current.y == first_point.y)
 			break;
 
 		current = check;
@@ -286,9 +423,52 @@ GSList* koki_contour_find(koki_labelled_image_t *labelled_image,
 
 	}//while
 
-	/* reverse the slist so it can be walked in a
-	   clockwise manner */
-	return g_slist_reverse(contour);
+	return contour;
+
+}
+
+
+
+/**
+ * @brief copies a \c GSList contour into packed arrays of co-ordinates
+ *
+ * @param contour  the contour to copy
+ * @param arena    the arena to allocate the copy from, or NULL to malloc()
+ *                 it, in which case it should be freed with
+ *                 \c koki_contour_array_free()
+ * @return         the copy
+ */
+koki_contour_t* koki_contour_from_slist(GSList *contour, koki_arena_t *arena)
+{
+
+	koki_contour_t *points;
+	koki_point2Di_t *p;
+
+	points = koki_contour_array_new(g_slist_length(contour), arena);
+
+	for (GSList *l = contour; l != NULL; l = l->next){
+		p = l->data;
+		points->x[points->len] = p->x;
+		points->y[points->len] = p->y;
+		points->len++;
+	}
+
+	return points;
+
+}
+
+
+
+/**
+ * @brief frees a contour found by \c koki_contour_find_array() or copied
+ *        by \c koki_contour_from_slist() without an arena
+ *
+ * @param contour  the contour to free
+ */
+void koki_contour_array_free(koki_contour_t *contour)
+{
+
+	free(contour);
 
 }
 
@@ -354,3 +534,35 @@ void koki_contour_draw(IplImage *frame, GSList *contour)
 	}
 
 }
+
+
+
+/**
+ * @brief draws a contour found by \c koki_contour_find_array() on to an
+ *        \c IplImage, as \c koki_contour_draw() does
+ *
+ * @param frame    a pointer the the \c IplImage to draw on to
+ * @param contour  the contour to draw
+ */
+void koki_contour_array_draw(IplImage *frame, const koki_contour_t *contour)
+{
+
+	for (uint32_t i=0; i<contour->len; i++){
+
+		uint16_t x = contour->x[i], y = contour->y[i];
+
+		if (frame->nChannels == 3){
+
+			KOKI_IPLIMAGE_ELEM(frame, x, y, R) = KOKI_CONTOUR_RED;
+			KOKI_IPLIMAGE_ELEM(frame, x, y, G) = KOKI_CONTOUR_GREEN;
+			KOKI_IPLIMAGE_ELEM(frame, x, y, B) = KOKI_CONTOUR_BLUE;
+
+		} else if (frame->nChannels == 1){
+
+			KOKI_IPLIMAGE_GS_ELEM(frame, x, y) = 127;
+
+		}
+
+	}
+
+}
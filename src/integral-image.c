@@ -20,6 +20,11 @@
  * @brief Routines for creating and performing operations on integral images. 
  */
 #include <stdlib.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "integral-image.h"
 #include "labelling.h"
@@ -28,15 +33,15 @@
 #define ii_pix( img, x, y ) koki_integral_image_pixel( img, x, y )
 
 /**
- * @brief Create a new integral image
+ * @brief allocate an integral image holding the given number of rows
  *
  * @param src		the image to create the integral image from
- * @param complete_now	whether to calculate the integral image now
+ * @param n_rows	the number of rows to hold
  *
- * @reurn the new integral image
+ * @return the new integral image, with nothing calculated yet
  */
-koki_integral_image_t* koki_integral_image_new( const IplImage *src,
-						bool complete_now )
+static koki_integral_image_t* integral_image_alloc( const IplImage *src,
+						    uint16_t n_rows )
 {
 	koki_integral_image_t *ii;
 
@@ -46,14 +51,33 @@ koki_integral_image_t* koki_integral_image_new( const IplImage *src,
 	ii->src = src;
 	ii->w = src->width;
 	ii->h = src->height;
-	ii->data = malloc( sizeof(uint32_t) * ii->w * ii->h );
+	ii->n_rows = n_rows;
+	/* Allocate an extra row of zeros before the first row */
+	ii->data = malloc( sizeof(uint32_t) * ii->w * (ii->n_rows + 1) );
 	assert( ii->data != NULL );
+	memset( ii->data, 0, sizeof(uint32_t) * ii->w );
+	ii->data += ii->w;
 
 	ii->complete_x = 0;
 	ii->complete_y = 0;
 
-	ii->sum = calloc( ii->w, sizeof(uint32_t) );
-	assert( ii->sum != NULL );
+	return ii;
+}
+
+/**
+ * @brief Create a new integral image
+ *
+ * @param src		the image to create the integral image from
+ * @param complete_now	whether to calculate the integral image now
+ *
+ * @reurn the new integral image
+ */
+koki_integral_image_t* koki_integral_image_new( const IplImage *src,
+						bool complete_now )
+{
+	koki_integral_image_t *ii;
+
+	ii = integral_image_alloc( src, src->height );
 
 	if( complete_now )
 		koki_integral_image_advance( ii, ii->w - 1, ii->h - 1 );
@@ -61,6 +85,46 @@ koki_integral_image_t* koki_integral_image_new( const IplImage *src,
 	return ii;
 }
 
+/**
+ * @brief Create a new rolling integral image
+ *
+ * A rolling integral image only holds the last \c n_rows rows that it has
+ * been advanced to, so it takes a fraction of the memory of a whole one.
+ * Rows before those can no longer be used.  Rolling integral images have
+ * to be advanced across their full width before any rows are added.
+ *
+ * @param src		the image to create the integral image from
+ * @param n_rows	the number of rows to hold, which must be at least 2
+ *
+ * @return the new integral image
+ */
+koki_integral_image_t* koki_integral_image_new_rolling( const IplImage *src,
+							uint16_t n_rows )
+{
+	assert( n_rows >= 2 );
+
+	if( n_rows > src->height )
+		n_rows = src->height;
+
+	return integral_image_alloc( src, n_rows );
+}
+
+/**
+ * @brief Start an integral image again, for a new image of the same size
+ *
+ * @param ii	the integral image
+ * @param src	the image to create the integral image from
+ */
+void koki_integral_image_reset( koki_integral_image_t *ii,
+				const IplImage *src )
+{
+	assert( src->width == ii->w && src->height == ii->h );
+
+	ii->src = src;
+	ii->complete_x = 0;
+	ii->complete_y = 0;
+}
+
 /**
  * @brief Free an integral image
  *
@@ -68,39 +132,108 @@ koki_integral_image_t* koki_integral_image_new( const IplImage *src,
  */
 void koki_integral_image_free( koki_integral_image_t *ii )
 {
-	free( ii->data );
-
-	if( ii->sum != NULL )
-		free( ii->sum );
+	free( ii->data - ii->w );
 
 	free( ii );
 }
 
+#if defined(__SSE2__)
+/**
+ * @brief calculate four integral image values of a row with SSE2
+ *
+ * @param pix    the four source pixels, as 32-bit values
+ * @param above  the integral image values of the row above
+ * @param carry  the running row sum before these pixels, in every element
+ * @param out    where to write the four integral image values
+ * @return       the running row sum after these pixels, in every element
+ */
+static inline __m128i advance_4_sse2( __m128i pix, const uint32_t *above,
+				      __m128i carry, uint32_t *out )
+{
+	/* Prefix sum within the vector */
+	pix = _mm_add_epi32( pix, _mm_slli_si128( pix, 4 ) );
+	pix = _mm_add_epi32( pix, _mm_slli_si128( pix, 8 ) );
+	pix = _mm_add_epi32( pix, carry );
+
+	_mm_storeu_si128( (__m128i*)out,
+			  _mm_add_epi32( pix,
+					 _mm_loadu_si128( (const __m128i*)above ) ) );
+
+	return _mm_shuffle_epi32( pix, _MM_SHUFFLE(3, 3, 3, 3) );
+}
+#endif
+
 /**
- * @brief Calculate the integral image value for the given pixel
+ * @brief calculate part of a row of the integral image
+ *
+ * Each value is the one above it plus the running sum of the source row
+ * up to it, so a row is a single sweep along the source row and the row
+ * above it.  The source's luma is summed, whether it's greyscale or has
+ * interleaved chroma.  The row above must already be calculated across the range,
+ * as must the value to the left of it.
  *
  * @param ii	the integral image
- * @param x	the x-coordinate
- * @param y	the y-coordinate
+ * @param y	the row to calculate
+ * @param x0	the first x-coordinate to calculate
+ * @param x1	one after the last x-coordinate to calculate
  */
-static void update_pixel( koki_integral_image_t *ii,
-			  uint16_t x, uint16_t y )
+static void advance_row( koki_integral_image_t *ii, uint16_t y,
+			 uint16_t x0, uint16_t x1 )
 {
-	uint32_t v = 0;
+	const uint8_t *src = &KOKI_IPLIMAGE_GS_ELEM( ii->src, 0, y );
+	const uint8_t stride = ii->src->nChannels;
+	const uint32_t *above = koki_integral_image_row( ii, y - 1 );
+	uint32_t *row = koki_integral_image_row( ii, y );
+	uint32_t s = 0;
+	uint16_t x = x0;
 
-	/* Note that we expect the source image to be greyscale */
-	ii->sum[x] += KOKI_IPLIMAGE_GS_ELEM( ii->src, x, y );
+	/* Pick up the running sum of the row from where it was left */
+	if( x0 > 0 )
+		s = row[x0-1] - above[x0-1];
 
-	v = ii->sum[x];
+#if defined(__SSE2__)
+	__m128i carry = _mm_set1_epi32( s );
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i luma = _mm_set1_epi16( 0xff );
 
-	if( x > 0 )
-		v += koki_integral_image_pixel( ii, x-1, y );
+	for( ; x + 16 <= x1; x += 16 ) {
+		__m128i p, lo, hi;
 
-	koki_integral_image_pixel( ii, x, y ) = v;
+		if( stride == 1 )
+			p = _mm_loadu_si128( (const __m128i*)(src + x) );
+		else
+			/* Keep every other byte of an interleaved row */
+			p = _mm_packus_epi16(
+				_mm_and_si128( _mm_loadu_si128( (const __m128i*)(src + 2*x) ), luma ),
+				_mm_and_si128( _mm_loadu_si128( (const __m128i*)(src + 2*x + 16) ), luma ) );
+
+		lo = _mm_unpacklo_epi8( p, zero );
+		hi = _mm_unpackhi_epi8( p, zero );
+
+		carry = advance_4_sse2( _mm_unpacklo_epi16( lo, zero ),
+					above + x, carry, row + x );
+		carry = advance_4_sse2( _mm_unpackhi_epi16( lo, zero ),
+					above + x + 4, carry, row + x + 4 );
+		carry = advance_4_sse2( _mm_unpacklo_epi16( hi, zero ),
+					above + x + 8, carry, row + x + 8 );
+		carry = advance_4_sse2( _mm_unpackhi_epi16( hi, zero ),
+					above + x + 12, carry, row + x + 12 );
+	}
+
+	s = _mm_cvtsi128_si32( carry );
+#endif
+
+	for( ; x < x1; x++ ) {
+		s += src[x * stride];
+		row[x] = above[x] + s;
+	}
 }
 
 /**
  * @brief calculate integral image values down to the given pixel
+ *
+ * The integral image is calculated a row at a time, so this is quickest
+ * when every call covers the full width of the image.
  *  
  * @param ii		the integral image
  * @param target_x 	the x-coordinate to calculate (inclusive)
@@ -109,21 +242,25 @@ static void update_pixel( koki_integral_image_t *ii,
 void koki_integral_image_advance( koki_integral_image_t *ii,
 				  uint16_t target_x, uint16_t target_y )
 {
-	uint16_t x, y;
+	uint16_t y;
 	assert( target_x < ii->w );
 	assert( target_y < ii->h );
 
-	/* Advance in the x-direction, but not y first */
-	for( x = ii->complete_x; x <= target_x; x++ )
+	/* Widen the rows that have already been done.  A rolling integral
+	   image may no longer have the rows above them. */
+	if( target_x >= ii->complete_x ) {
+		assert( ii->complete_y == 0 || ii->n_rows == ii->h );
+
 		for( y=0; y < ii->complete_y; y++ )
-			update_pixel( ii, x, y );
-	ii->complete_x = target_x + 1;
-
-	/* Now advance in the y-direction */
-	for( x=0; x < ii->complete_x; x++ )
-		for( y = ii->complete_y; y <= target_y; y++ )
-			update_pixel( ii, x, y );
-	ii->complete_y = target_y + 1;
+			advance_row( ii, y, ii->complete_x, target_x + 1 );
+		ii->complete_x = target_x + 1;
+	}
+
+	/* Now add the new rows */
+	for( y = ii->complete_y; y <= target_y; y++ )
+		advance_row( ii, y, 0, ii->complete_x );
+	if( target_y >= ii->complete_y )
+		ii->complete_y = target_y + 1;
 }
 
 /**
@@ -144,6 +281,8 @@ uint32_t koki_integral_image_sum( const koki_integral_image_t *ii,
 
 	assert( region->x < ii->complete_x );
 	assert( region->y < ii->complete_y );
+	/* The row above the region must still be held */
+	assert( region->y == 0 || region->y + ii->n_rows > ii->complete_y );
 
 	/* SE corner */
 	v = ii_pix( ii, se_x, se_y );
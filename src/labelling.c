@@ -24,11 +24,13 @@
 #include <glib.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <string.h>
 #include <cv.h>
 
 #include "labelling.h"
 #include "integral-image.h"
 #include "threshold.h"
+#include "workspace.h"
 
 #define KOKI_MIN_REGION_MASS 64
 #define KOKI_MIN_DISTANCE_FROM_BORDER 3
@@ -168,6 +170,63 @@ label_t get_connected_label(koki_labelled_image_t *labelled_image,
 
 }
 
+/**
+ * @brief sets a clip region to be empty, ready for pixels to be added
+ *
+ * @param clip  the clip region to reset
+ */
+static void clip_reset( koki_clip_region_t *clip )
+{
+	clip->mass = 0;
+	clip->max.x = 0;
+	clip->max.y = 0;
+	clip->min.x = 0xFFFF; /* max out so that adding pixels works */
+	clip->min.y = 0xFFFF;
+}
+
+/**
+ * @brief extends a clip region to include a run of pixels
+ *
+ * @param clip   the clip region to extend
+ * @param y      the row that the run is on
+ * @param start  the first pixel of the run
+ * @param end    the last pixel of the run (inclusive)
+ */
+static void clip_add_run( koki_clip_region_t *clip,
+			  uint16_t y, uint16_t start, uint16_t end )
+{
+	clip->mass += end - start + 1;
+
+	if (start < clip->min.x)
+		clip->min.x = start;
+	if (end > clip->max.x)
+		clip->max.x = end;
+	if (y < clip->min.y)
+		clip->min.y = y;
+	if (y > clip->max.y)
+		clip->max.y = y;
+}
+
+/**
+ * @brief merges one clip region into another
+ *
+ * @param dst  the clip region to merge into
+ * @param src  the clip region to merge from
+ */
+static void clip_merge( koki_clip_region_t *dst, const koki_clip_region_t *src )
+{
+	dst->mass += src->mass;
+
+	if (src->min.x < dst->min.x)
+		dst->min.x = src->min.x;
+	if (src->min.y < dst->min.y)
+		dst->min.y = src->min.y;
+	if (src->max.x > dst->max.x)
+		dst->max.x = src->max.x;
+	if (src->max.y > dst->max.y)
+		dst->max.y = src->max.y;
+}
+
 /**
  * @brief find the canonical number for the given label
  *
@@ -209,15 +268,39 @@ static void label_alias( koki_labelled_image_t *lmg, label_t l_canon, label_t l_
 	*l = l_canon;
 }
 
+/**
+ * @brief sets the label of a dark pixel, and adds the pixel to the clip
+ *        region of the label it ends up with
+ *
+ * @param lmg    the labelled image
+ * @param x      the X co-ordinate of the pixel
+ * @param y      the Y co-ordinate of the pixel
+ * @param label  the label that the pixel should have
+ * @param stats  whether to add the pixel to the clip region, rather than
+ *               leave it to \c label_image_calc_stats()
+ */
+static void set_dark_label( koki_labelled_image_t *lmg,
+			    uint16_t x, uint16_t y, label_t label,
+			    bool stats )
+{
+	set_label( lmg, x, y, label );
+
+	if( !stats )
+		return;
+
+	label = KOKI_LABELLED_IMAGE_LABEL( lmg, x, y );
+	clip_add_run( &label_clips_index( lmg->clips, label-1 ), y, x, x );
+}
+
 static void label_dark_pixel( koki_labelled_image_t *lmg,
-			      uint16_t x, uint16_t y )
+			      uint16_t x, uint16_t y, bool stats )
 {
 	label_t label_tmp;
 
 	/* if pixel above is labelled, join that label */
 	label_tmp = get_connected_label(lmg, x, y, N);
 	if (label_tmp > 0){
-		set_label(lmg, x, y, label_tmp);
+		set_dark_label(lmg, x, y, label_tmp, stats);
 		return;
 	}
 
@@ -247,11 +330,11 @@ static void label_dark_pixel( koki_labelled_image_t *lmg,
 				label_max = l1;
 			}
 
-			set_label(lmg, x, y, label_min);
+			set_dark_label(lmg, x, y, label_min, stats);
 			label_alias( lmg, label_min, label_max );
 		} else {
 
-			set_label(lmg, x, y, label_tmp);
+			set_dark_label(lmg, x, y, label_tmp, stats);
 
 		}
 
@@ -261,14 +344,14 @@ static void label_dark_pixel( koki_labelled_image_t *lmg,
 	/* Otherwise, take the NW label, if present */
 	label_tmp = get_connected_label(lmg, x, y, NW);
 	if (label_tmp > 0){
-		set_label(lmg, x, y, label_tmp);
+		set_dark_label(lmg, x, y, label_tmp, stats);
 		return;
 	}
 
 	/* Otherwise, take the W label, if present */
 	label_tmp = get_connected_label(lmg, x, y, W);
 	if (label_tmp > 0){
-		set_label(lmg, x, y, label_tmp);
+		set_dark_label(lmg, x, y, label_tmp, stats);
 		return;
 	}
 
@@ -279,7 +362,14 @@ static void label_dark_pixel( koki_labelled_image_t *lmg,
 
 	label_tmp = lmg->aliases->len + 1;
 	g_array_append_val(lmg->aliases, label_tmp);
-	set_label(lmg, x, y, label_tmp);
+
+	if (stats){
+		koki_clip_region_t clip;
+		clip_reset(&clip);
+		g_array_append_val(lmg->clips, clip);
+	}
+
+	set_dark_label(lmg, x, y, label_tmp, stats);
 }
 
 /**
@@ -304,74 +394,538 @@ static void label_pixel(IplImage *image, koki_labelled_image_t *labelled_image,
 	}
 
 	/* must be a black pixel then... */
-	label_dark_pixel( labelled_image, x, y );
+	label_dark_pixel( labelled_image, x, y, true );
 }
 
-static void label_image_calc_stats( koki_labelled_image_t *labelled_image )
-{
-	/* Now renumber all labels to ensure they're all canonical */
-	for( label_t i=1; i<labelled_image->aliases->len; i++ ) {
-		label_t *a = &label_aliases_index( labelled_image->aliases, i-1 );
-
-		*a = label_find_canonical( labelled_image, i );
-	}
-
-	/* collect label statistics (mass, bounding box) */
+/**
+ * @brief the state kept between rows when labelling a run at a time
+ */
+typedef struct {
+	label_run_t *prev;	/**< the runs in the previous row */
+	label_run_t *cur;	/**< the runs in the current row */
+	uint16_t n_prev;	/**< the number of runs in \c prev */
+	uint16_t n_cur;		/**< the number of runs in \c cur */
+} run_labeller_t;
 
+/**
+ * @brief resolves every label to its canonical alias, then gathers each
+ *        region's statistics (mass, bounding box) in a pass over the whole
+ *        labelled image
+ *
+ * This is how pixel labelling used to gather them, before it did so while
+ * labelling; see \c koki_set_label_stats_pass().
+ *
+ * @param lmg  the labelled image, with no clip regions yet
+ */
+static void label_image_calc_stats( koki_labelled_image_t *lmg )
+{
 	label_t max_alias = 0;
-	GArray *aliases, *clips;
+	GArray *aliases = lmg->aliases, *clips = lmg->clips;
+
+	/* Now renumber all labels to ensure they're all canonical */
+	for( uint32_t l = 1; l <= aliases->len; l++ ) {
+		label_t canon = label_find_canonical( lmg, l );
 
-	aliases = labelled_image->aliases;
-	clips = labelled_image->clips;
+		label_aliases_index( aliases, l-1 ) = canon;
 
-	/* find largest alias */
-	for (label_t i=0; i<aliases->len; i++){
-		label_t alias = label_aliases_index( aliases, i );
-		if (alias > max_alias)
-			max_alias = alias;
+		if( canon > max_alias )
+			max_alias = canon;
 	}
 
 	/* init clips */
-	for (label_t i=0; i<max_alias; i++){
-		koki_clip_region_t clip;
-		clip.mass = 0;
-		clip.max.x = 0;
-		clip.max.y = 0;
-		clip.min.x = 0xFFFF; /* max out so below works */
-		clip.min.y = 0xFFFF;
-		g_array_append_val(clips, clip);
-	}
+	g_array_set_size( clips, max_alias );
+	for( label_t i=0; i<max_alias; i++ )
+		clip_reset( &label_clips_index( clips, i ) );
 
 	/* gather stats */
-	for (uint16_t y=0; y<labelled_image->h; y++){
-		for (uint16_t x=0; x<labelled_image->w; x++){
+	for (uint16_t y=0; y<lmg->h; y++){
+		for (uint16_t x=0; x<lmg->w; x++){
 
 			label_t label, alias;
-			koki_clip_region_t *clip;
 
-			label = KOKI_LABELLED_IMAGE_LABEL(labelled_image, x, y);
+			label = KOKI_LABELLED_IMAGE_LABEL(lmg, x, y);
 
 			/* a threshold white pixel, ignore */
 			if (label == 0)
 				continue;
 
 			alias = label_aliases_index( aliases, label-1 );
-			clip = &label_clips_index( clips, alias-1 );
-
-			clip->mass++;
-			if (x > clip->max.x)
-				clip->max.x = x;
-			if (y > clip->max.y)
-				clip->max.y = y;
-			if (x < clip->min.x)
-				clip->min.x = x;
-			if (y < clip->min.y)
-				clip->min.y = y;
+			clip_add_run( &label_clips_index( clips, alias-1 ),
+				      y, x, x );
 
 		}//for col
 	}//for row
 }
 
+/**
+ * @brief resolves every label to its canonical alias once pixel labelling
+ *        is done
+ *
+ * The clip region statistics were gathered against the label each pixel
+ * was given, so those of every alias are merged into the canonical label's
+ * clip region.  The clip regions after the highest canonical label (which
+ * are all empty) are dropped.
+ *
+ * @param lmg  the labelled image
+ */
+static void label_pixels_finish( koki_labelled_image_t *lmg )
+{
+	label_t max_alias = 0;
+
+	for( uint32_t l = 1; l <= lmg->aliases->len; l++ ) {
+		label_t canon = label_find_canonical( lmg, l );
+		koki_clip_region_t *clip;
+
+		label_aliases_index( lmg->aliases, l-1 ) = canon;
+
+		if( canon > max_alias )
+			max_alias = canon;
+
+		if( canon == l )
+			continue;
+
+		clip = &label_clips_index( lmg->clips, l-1 );
+		clip_merge( &label_clips_index( lmg->clips, canon-1 ), clip );
+		clip_reset( clip );
+	}
+
+	g_array_set_size( lmg->clips, max_alias );
+}
+
+/**
+ * @brief finds the root of a label's union-find tree, halving the path
+ *        to it along the way
+ *
+ * @param lmg  the labelled image
+ * @param l    the label to find the root of
+ * @return     the root label
+ */
+static label_t run_find_root( koki_labelled_image_t *lmg, label_t l )
+{
+	label_t *aliases = (label_t*)lmg->aliases->data;
+
+	while( aliases[l-1] != l ) {
+		aliases[l-1] = aliases[ aliases[l-1] - 1 ];
+		l = aliases[l-1];
+	}
+
+	return l;
+}
+
+/**
+ * @brief joins the regions of two labels together
+ *
+ * The higher of the two roots becomes an alias of the lower, and its
+ * statistics are merged into those of the lower.
+ *
+ * @param lmg  the labelled image
+ * @param a    a label in the first region
+ * @param b    a label in the second region
+ * @return     the root label of the joined region
+ */
+static label_t run_union( koki_labelled_image_t *lmg, label_t a, label_t b )
+{
+	label_t lo, hi;
+	koki_clip_region_t *clip_hi;
+
+	a = run_find_root( lmg, a );
+	b = run_find_root( lmg, b );
+
+	if( a == b )
+		return a;
+
+	lo = a < b ? a : b;
+	hi = a < b ? b : a;
+
+	label_aliases_index( lmg->aliases, hi-1 ) = lo;
+
+	clip_hi = &label_clips_index( lmg->clips, hi-1 );
+	clip_merge( &label_clips_index( lmg->clips, lo-1 ), clip_hi );
+	clip_reset( clip_hi );
+
+	return lo;
+}
+
+/**
+ * @brief allocates a new label, with an empty clip region
+ *
+ * @param lmg  the labelled image
+ * @return     the new label
+ */
+static label_t run_new_label( koki_labelled_image_t *lmg )
+{
+	label_t l;
+	koki_clip_region_t clip;
+
+	/* Check we do not exceed the maximum number of labels */
+	assert( lmg->aliases->len != KOKI_LABEL_MAX );
+
+	l = lmg->aliases->len + 1;
+	g_array_append_val( lmg->aliases, l );
+
+	clip_reset( &clip );
+	g_array_append_val( lmg->clips, clip );
+
+	return l;
+}
+
+/**
+ * @brief labels a thresholded row, a run of dark pixels at a time
+ *
+ * Each run of dark pixels is joined to every run in the previous row that
+ * it touches (including diagonally), or gets a new label if there are none.
+ * Clip region statistics are gathered as the runs are labelled.
+ *
+ * @param lmg         the labelled image being created
+ * @param rl          the run labeller state
+ * @param y           the row being labelled
+ * @param thresh_row  the row's thresholded pixels: zero for dark pixels
+ */
+static void label_row_runs( koki_labelled_image_t *lmg, run_labeller_t *rl,
+			    uint16_t y, const uint8_t *thresh_row )
+{
+	label_t *row = &KOKI_LABELLED_IMAGE_LABEL( lmg, 0, y );
+	label_run_t *tmp;
+	uint16_t x = 0, j = 0;
+
+	/* This row's runs become the previous row's */
+	tmp = rl->prev;
+	rl->prev = rl->cur;
+	rl->n_prev = rl->n_cur;
+	rl->cur = tmp;
+	rl->n_cur = 0;
+
+	while( x < lmg->w ) {
+		uint16_t start, end;
+		label_t label = 0;
+
+		/* Skip over the white pixels */
+		while( x < lmg->w && thresh_row[x] )
+			row[x++] = 0;
+
+		if( x == lmg->w )
+			break;
+
+		/* Find the end of this run of dark ones */
+		start = x;
+		while( x < lmg->w && !thresh_row[x] )
+			x++;
+		end = x - 1;
+
+		/* Skip previous runs that end too far left to touch this one */
+		while( j < rl->n_prev && rl->prev[j].end + 1 < start )
+			j++;
+
+		/* Join all the previous runs that this one touches.  The last
+		   of them may touch the next run too, so j isn't advanced. */
+		for( uint16_t k = j;
+		     k < rl->n_prev && rl->prev[k].start <= end + 1;
+		     k++ ) {
+			if( label == 0 )
+				label = run_find_root( lmg, rl->prev[k].label );
+			else
+				label = run_union( lmg, label, rl->prev[k].label );
+		}
+
+		if( label == 0 )
+			/* A new region */
+			label = run_new_label( lmg );
+
+		clip_add_run( &label_clips_index( lmg->clips, label-1 ),
+			      y, start, end );
+
+		for( uint16_t i = start; i <= end; i++ )
+			row[i] = label;
+
+		rl->cur[rl->n_cur].start = start;
+		rl->cur[rl->n_cur].end = end;
+		rl->cur[rl->n_cur].label = label;
+		rl->n_cur++;
+	}
+}
+
+/**
+ * @brief resolves every label to its final alias once run labelling is done
+ *
+ * The clip region statistics are already held against the root of each
+ * region, so this just makes the aliases canonical, and drops the clip
+ * regions after the highest root (which are all empty).
+ *
+ * @param lmg  the labelled image
+ */
+static void label_runs_finish( koki_labelled_image_t *lmg )
+{
+	label_t max_alias = 0;
+
+	for( uint32_t l = 1; l <= lmg->aliases->len; l++ ) {
+		label_t root = run_find_root( lmg, l );
+
+		label_aliases_index( lmg->aliases, l-1 ) = root;
+
+		if( root > max_alias )
+			max_alias = root;
+	}
+
+	g_array_set_size( lmg->clips, max_alias );
+}
+
+/**
+ * @brief a horizontal stripe of the frame, labelled on its own thread
+ *
+ * Each stripe is labelled a run at a time straight into the rows of the
+ * shared label data that it covers, but with its own label numbers,
+ * aliases and clip regions.  These are then joined up with those of the
+ * other stripes by \c label_stripes_merge().
+ */
+typedef struct {
+	const IplImage *frame;		/**< the frame being labelled */
+	const koki_integral_image_t *iimg; /**< the frame's complete integral image */
+	uint16_t window_size;		/**< the thresholding window size */
+	int16_t thresh_margin;		/**< the thresholding margin */
+	IplImage *thresh_img;		/**< where to log the thresholded image
+					     to, or NULL */
+
+	uint16_t y0;			/**< the first row of the stripe */
+	uint16_t y1;			/**< one after the last row of the stripe */
+	koki_labelled_image_t lmg;	/**< the stripe's labels, sharing its data
+					     with the whole frame's */
+	run_labeller_t rl;		/**< the run labeller state, which holds
+					     the stripe's last row of runs once
+					     labelling is done */
+	label_run_t *first_runs;	/**< the runs in the stripe's first row */
+	uint16_t n_first;		/**< the number of runs in \c first_runs */
+
+	label_t *map;			/**< a label in the whole frame for each
+					     of the stripe's labels */
+} label_stripe_t;
+
+/**
+ * @brief the minimum number of rows worth giving a thread of its own
+ */
+#define KOKI_MIN_STRIPE_HEIGHT 32
+
+/**
+ * @brief thresholds and labels one stripe of the frame
+ *
+ * @param data  the \c label_stripe_t to label
+ * @return      NULL
+ */
+static gpointer label_stripe_thread( gpointer data )
+{
+	label_stripe_t *st = data;
+	uint8_t *thresh_row;
+
+	thresh_row = malloc( st->frame->width );
+	assert( thresh_row != NULL );
+
+	for( uint16_t y = st->y0; y < st->y1; y++ ) {
+		koki_threshold_adaptive_row( st->frame, st->iimg,
+					     st->window_size, y,
+					     st->thresh_margin, thresh_row );
+
+		label_row_runs( &st->lmg, &st->rl, y, thresh_row );
+
+		if( y == st->y0 ) {
+			/* Keep the first row's runs for joining to the
+			   stripe above */
+			st->n_first = st->rl.n_cur;
+			st->first_runs = malloc( sizeof(label_run_t) * (st->n_first + 1) );
+			assert( st->first_runs != NULL );
+			memcpy( st->first_runs, st->rl.cur,
+				sizeof(label_run_t) * st->n_first );
+		}
+
+		if( st->thresh_img != NULL )
+			memcpy( st->thresh_img->imageData
+				+ st->thresh_img->widthStep * y,
+				thresh_row, st->frame->width );
+	}
+
+	label_runs_finish( &st->lmg );
+	free( thresh_row );
+
+	return NULL;
+}
+
+/**
+ * @brief rewrites a stripe's label data from its own labels to the frame's
+ *
+ * @param data  the \c label_stripe_t to rewrite the labels of
+ * @return      NULL
+ */
+static gpointer relabel_stripe_thread( gpointer data )
+{
+	label_stripe_t *st = data;
+
+	for( uint16_t y = st->y0; y < st->y1; y++ ) {
+		label_t *row = &KOKI_LABELLED_IMAGE_LABEL( &st->lmg, 0, y );
+
+		for( uint16_t x = 0; x < st->lmg.w; x++ )
+			row[x] = st->map[ row[x] ];
+	}
+
+	return NULL;
+}
+
+/**
+ * @brief joins the labels of each stripe together into the frame's labels
+ *
+ * Labels are handed out in the order that labelling the whole frame in one
+ * go with \c label_row_runs() would have done.  That's the stripes' own
+ * label orders, one stripe after the other, except for the runs on the
+ * first row of a stripe that touch the stripe above: those would have
+ * joined a region from above rather than starting a new one.  This makes
+ * the aliases and clip regions identical to those from labelling in one go.
+ *
+ * @param lmg      the labelled image for the whole frame
+ * @param stripes  the labelled stripes
+ * @param n        the number of stripes
+ */
+static void label_stripes_merge( koki_labelled_image_t *lmg,
+				 label_stripe_t *stripes, uint16_t n )
+{
+	for( uint16_t k = 0; k < n; k++ ) {
+		label_stripe_t *st = &stripes[k];
+		label_stripe_t *above = k > 0 ? &stripes[k-1] : NULL;
+		uint32_t n_labels = st->lmg.aliases->len;
+		uint16_t j = 0;
+
+		st->map = calloc( n_labels + 1, sizeof(label_t) );
+		assert( st->map != NULL );
+
+		/* Each run in a stripe's first row got a new label, in order.
+		   Find those that actually join a region in the stripe above. */
+		for( uint16_t i = 0; above != NULL && i < st->n_first; i++ ) {
+			label_run_t *run = &st->first_runs[i];
+
+			while( j < above->rl.n_cur
+			       && above->rl.cur[j].end + 1 < run->start )
+				j++;
+
+			for( uint16_t p = j;
+			     p < above->rl.n_cur
+				     && above->rl.cur[p].start <= run->end + 1;
+			     p++ ) {
+				label_t l = above->map[ above->rl.cur[p].label ];
+
+				if( st->map[run->label] == 0 )
+					st->map[run->label] = l;
+				else
+					run_union( lmg, st->map[run->label], l );
+			}
+		}
+
+		/* Everything else gets a new label */
+		for( uint32_t l = 1; l <= n_labels; l++ )
+			if( st->map[l] == 0 )
+				st->map[l] = run_new_label( lmg );
+
+		/* Apply the stripe's own aliases, and add its regions' stats */
+		for( uint32_t l = 1; l <= n_labels; l++ ) {
+			label_t root = label_aliases_index( st->lmg.aliases, l-1 );
+
+			if( root != l ) {
+				run_union( lmg, st->map[l], st->map[root] );
+				continue;
+			}
+
+			clip_merge( &label_clips_index( lmg->clips,
+							run_find_root( lmg, st->map[l] ) - 1 ),
+				    &label_clips_index( st->lmg.clips, l-1 ) );
+		}
+	}
+}
+
+/**
+ * @brief thresholds and labels the frame in horizontal stripes, each on
+ *        its own thread
+ *
+ * The result is the same as labelling the whole frame with
+ * \c label_row_runs() on a single thread.
+ *
+ * @param lmg            the labelled image to label into
+ * @param frame          the frame to label
+ * @param iimg           the frame's integral image, which must be complete
+ * @param window_size    the size of window to use around the threshold
+ * @param thresh_margin  the margin around the adaptively-calculated threshold
+ * @param thresh_img     an image to write the thresholded frame to, or NULL
+ * @param n              the number of stripes (and threads) to use
+ */
+static void label_stripes( koki_labelled_image_t *lmg,
+			   const IplImage *frame,
+			   const koki_integral_image_t *iimg,
+			   uint16_t window_size, int16_t thresh_margin,
+			   IplImage *thresh_img, uint16_t n )
+{
+	label_stripe_t *stripes;
+	GThread **threads;
+	uint16_t max_runs = frame->width / 2 + 1;
+
+	stripes = calloc( n, sizeof(label_stripe_t) );
+	threads = calloc( n, sizeof(GThread*) );
+	assert( stripes != NULL && threads != NULL );
+
+	for( uint16_t k = 0; k < n; k++ ) {
+		label_stripe_t *st = &stripes[k];
+
+		st->frame = frame;
+		st->iimg = iimg;
+		st->window_size = window_size;
+		st->thresh_margin = thresh_margin;
+		st->thresh_img = thresh_img;
+
+		st->y0 = (uint32_t)frame->height * k / n;
+		st->y1 = (uint32_t)frame->height * (k + 1) / n;
+
+		st->lmg.data = lmg->data;
+		st->lmg.w = lmg->w;
+		st->lmg.h = lmg->h;
+		st->lmg.aliases = g_array_new( FALSE, TRUE, sizeof(label_t) );
+		st->lmg.clips = g_array_new( FALSE, FALSE, sizeof(koki_clip_region_t) );
+
+		st->rl.prev = malloc( sizeof(label_run_t) * max_runs );
+		st->rl.cur = malloc( sizeof(label_run_t) * max_runs );
+		assert( st->rl.prev != NULL && st->rl.cur != NULL );
+	}
+
+	/* Label the stripes, the first on this thread */
+	for( uint16_t k = 1; k < n; k++ )
+		threads[k] = g_thread_new( "koki-label", label_stripe_thread,
+					   &stripes[k] );
+	label_stripe_thread( &stripes[0] );
+
+	for( uint16_t k = 1; k < n; k++ )
+		g_thread_join( threads[k] );
+
+	label_stripes_merge( lmg, stripes, n );
+
+	/* The first stripe's labels are already the frame's labels, but the
+	   others need rewriting */
+	for( uint16_t k = 2; k < n; k++ )
+		threads[k] = g_thread_new( "koki-relabel", relabel_stripe_thread,
+					   &stripes[k] );
+	relabel_stripe_thread( &stripes[1] );
+
+	for( uint16_t k = 2; k < n; k++ )
+		g_thread_join( threads[k] );
+
+	label_runs_finish( lmg );
+
+	for( uint16_t k = 0; k < n; k++ ) {
+		label_stripe_t *st = &stripes[k];
+
+		g_array_free( st->lmg.aliases, TRUE );
+		g_array_free( st->lmg.clips, TRUE );
+		free( st->rl.prev );
+		free( st->rl.cur );
+		free( st->first_runs );
+		free( st->map );
+	}
+
+	free( stripes );
+	free( threads );
+}
+
 /**
  * @brief produces a new labelled image from the given \c IplImage
  *
@@ -397,7 +951,7 @@ koki_labelled_image_t* koki_label_image(IplImage *image, uint16_t threshold)
 		}//for col
 	}//for row
 
-	label_image_calc_stats( labelled_image );
+	label_pixels_finish( labelled_image );
 
 	return labelled_image;
 }
@@ -463,12 +1017,30 @@ IplImage* koki_labelled_image_to_image(koki_labelled_image_t *labelled_image)
 bool koki_label_useable(koki_labelled_image_t *labelled_image, label_t region)
 {
 
-	koki_clip_region_t *clip;
-
 	/* ensure the region number isn't too high */
 	assert(labelled_image->clips->len > region);
 
-	clip = &label_clips_index( labelled_image->clips, region );
+	return koki_clip_useable(&label_clips_index( labelled_image->clips,
+						     region ),
+				 labelled_image->w, labelled_image->h);
+
+}
+
+
+
+/**
+ * @brief determines whether or not a region is going to be useful, from
+ *        its clip region
+ *
+ * See \c koki_label_useable().
+ *
+ * @param clip  the region's clip region
+ * @param w     the width of the image the region is in
+ * @param h     the height of the image the region is in
+ * @return      FALSE if the region is considered unusable, TRUE otherwise
+ */
+bool koki_clip_useable(const koki_clip_region_t *clip, uint16_t w, uint16_t h)
+{
 
 	/* are there enough pixels */
 	if (clip->mass < KOKI_MIN_REGION_MASS)
@@ -477,14 +1049,110 @@ bool koki_label_useable(koki_labelled_image_t *labelled_image, label_t region)
 	/* make sure we're not interacting with the edge of the image */
 	if (   clip->min.x < KOKI_MIN_DISTANCE_FROM_BORDER
 	    || clip->min.y < KOKI_MIN_DISTANCE_FROM_BORDER
-	    || clip->max.x > labelled_image->w - KOKI_MIN_DISTANCE_FROM_BORDER
-	    || clip->max.y > labelled_image->h - KOKI_MIN_DISTANCE_FROM_BORDER)
+	    || clip->max.x > w - KOKI_MIN_DISTANCE_FROM_BORDER
+	    || clip->max.y > h - KOKI_MIN_DISTANCE_FROM_BORDER)
 		return FALSE;
 
 	return TRUE;
 
 }
 
+/**
+ * @brief thresholds and labels a frame into a workspace
+ *
+ * See \c koki_label_adaptive() for the details.
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image to label
+ * @param window_size    the size of window to use around the threshold
+ * @param thresh_margin  the margin around the adaptively-calculated threshold
+ * @param ws             the workspace to label into, prepared for the frame
+ */
+static void label_adaptive( koki_t *koki, const IplImage *frame,
+			    uint16_t window_size, int16_t thresh_margin,
+			    koki_workspace_t *ws )
+{
+	uint16_t x, y;
+	koki_integral_image_t *iimg;
+	koki_labelled_image_t *lmg = ws->labelled_image;
+	IplImage *thresh_img = NULL;
+	uint8_t *thresh_row = ws->thresh_row;
+	run_labeller_t rl = { ws->runs[0], ws->runs[1], 0, 0 };
+	uint16_t n_stripes;
+	bool stats_pass = koki->label_stats_pass;
+
+	assert(frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame));
+
+	if( koki_is_logging( koki ) )
+		/* We'll log the thresholded image */
+		thresh_img = koki_workspace_log_image( ws, &ws->thresh_img, 1 );
+
+	/* Don't bother giving threads tiny stripes */
+	n_stripes = MIN( koki->label_threads,
+			 frame->height / KOKI_MIN_STRIPE_HEIGHT );
+
+	if( n_stripes > 1 ) {
+		/* Each stripe needs the integral image around it, so do the
+		   whole thing up-front */
+		iimg = koki_workspace_integral_image( ws, frame, frame->height );
+		koki_integral_image_advance( iimg, frame->width - 1,
+					     frame->height - 1 );
+
+		label_stripes( lmg, frame, iimg, window_size, thresh_margin,
+			       thresh_img, n_stripes );
+	} else {
+		/* Only the rows of the integral image covering the current
+		   threshold window (and the row above it) are needed */
+		iimg = koki_workspace_integral_image( ws, frame,
+						      window_size + 1 );
+
+		for( y=0; y<frame->height; y++ ) {
+			CvRect win;
+
+			/* Advance the integral image to the bottom of this
+			   row's window */
+			koki_threshold_adaptive_calc_window( frame, &win,
+							     window_size, 0, y );
+			koki_integral_image_advance( iimg,
+						     frame->width - 1,
+						     win.y + win.height - 1 );
+
+			/* Threshold the whole row in one go */
+			koki_threshold_adaptive_row( frame, iimg, window_size, y,
+						     thresh_margin, thresh_row );
+
+			if( koki->label_method != KOKI_LABEL_PIXEL )
+				label_row_runs( lmg, &rl, y, thresh_row );
+			else
+				for( x=0; x<frame->width; x++ ) {
+					if( thresh_row[x] )
+						/* Nothing exciting */
+						set_label( lmg, x, y, 0 );
+					else
+						/* Label the thing */
+						label_dark_pixel( lmg, x, y,
+								  !stats_pass );
+				}
+
+			if( thresh_img != NULL )
+				memcpy( thresh_img->imageData
+					+ thresh_img->widthStep * y,
+					thresh_row, frame->width );
+		}
+
+		/* Sort out all the remaining labelling related stuff */
+		if( koki->label_method != KOKI_LABEL_PIXEL )
+			label_runs_finish( lmg );
+		else if( stats_pass )
+			label_image_calc_stats( lmg );
+		else
+			label_pixels_finish( lmg );
+	}
+
+	if( thresh_img != NULL )
+		koki_log( koki, "thresholded image\n", thresh_img );
+}
+
 /**
  * @brief threshold and label the provided image
  *
@@ -495,6 +1163,13 @@ bool koki_label_useable(koki_labelled_image_t *labelled_image, label_t region)
  * friendly way.  (Furthermore, it internally progressively generates
  * and uses an integral image to speed up the adaptive thresholding.)
  *
+ * The labelling algorithm used is the one selected for the context with
+ * \c koki_set_label_method(), except that \c KOKI_LABEL_TRACE, which
+ * doesn't produce a labelled image, labels runs.  If the context has been
+ * given more than one thread with \c koki_set_label_threads(), the frame is
+ * split into horizontal stripes that are thresholded and labelled in
+ * parallel, always with \c KOKI_LABEL_RUNS.
+ *
  * @param koki           the libkoki context
  * @param frame          the input image to label
  * @param window_size    the size of window to use around the threshold
@@ -507,65 +1182,50 @@ koki_labelled_image_t* koki_label_adaptive( koki_t *koki,
 					    uint16_t window_size,
 					    int16_t thresh_margin )
 {
-	uint16_t x, y;
-	koki_integral_image_t *iimg;
+	koki_workspace_t *ws;
 	koki_labelled_image_t *lmg;
-	IplImage *thresh_img = NULL;
-
-	assert(frame != NULL && frame->nChannels == 1);
 
-	iimg = koki_integral_image_new( frame, false );
-	lmg = koki_labelled_image_new( frame->width, frame->height );
+	assert(frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame));
 
-	if( koki_is_logging( koki ) ) {
-		/* We'll log the thresholded image */
-		/* create an image for logging purposes */
-		thresh_img = cvCreateImage( cvSize( frame->width, frame->height ),
-					    IPL_DEPTH_8U, 1 );
+	/* Label into a workspace of our own, then take its labelled image */
+	ws = koki_workspace_new();
+	koki_workspace_prepare( ws, frame->width, frame->height );
 
-		g_assert( thresh_img != NULL );
-	}
+	label_adaptive( koki, frame, window_size, thresh_margin, ws );
 
-	for( y=0; y<frame->height; y++ )
-		for( x=0; x<frame->width; x++ ) {
-			CvRect win;
+	lmg = ws->labelled_image;
+	ws->labelled_image = NULL;
+	koki_workspace_free( ws );
 
-			/* Get the ROI from the thresholder */
-			koki_threshold_adaptive_calc_window( frame, &win,
-							     window_size, x, y );
-
-			/* Advance the integral image */
-			if( x == 0 )
-				koki_integral_image_advance( iimg,
-							     frame->width - 1,
-							     win.y + win.height - 1 );
-
-			if( koki_threshold_adaptive_pixel( frame,
-							   iimg,
-							   &win, x, y, thresh_margin ) ) {
-				/* Nothing exciting */
-				set_label( lmg, x, y, 0);
-
-				if( thresh_img != NULL )
-					KOKI_IPLIMAGE_GS_ELEM( thresh_img, x, y ) = 0xff;
-			} else {
-				/* Label the thing */
-				label_dark_pixel( lmg, x, y );
-
-				if( thresh_img != NULL )
-					KOKI_IPLIMAGE_GS_ELEM( thresh_img, x, y ) = 0;
-			}
-		}
+	return lmg;
+}
 
-	if( thresh_img != NULL ) {
-		koki_log( koki, "thresholded image\n", thresh_img );
-		cvReleaseImage( &thresh_img );
-	}
+/**
+ * @brief labels a frame just as \c koki_label_adaptive() does, but into the
+ *        context's workspace
+ *
+ * This saves allocating new buffers for every frame.  The labelled image
+ * belongs to the context, and is only valid until the context is next
+ * given a frame; it must not be freed.
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image to label, greyscale or with its
+ *                       luma interleaved (see \c KOKI_IPLIMAGE_LUMA_ELEM)
+ * @param window_size    the size of window to use around the threshold
+ * @param thresh_margin  the margin around the adaptively-calculated threshold
+ * @return               the labelled image, which belongs to the context
+ */
+koki_labelled_image_t* koki_label_adaptive_workspace( koki_t *koki,
+						      const IplImage *frame,
+						      uint16_t window_size,
+						      int16_t thresh_margin )
+{
+	assert(frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame));
 
-	/* Sort out all the remaining labelling related stuff */
-	label_image_calc_stats( lmg );
+	koki_workspace_prepare( koki->workspace, frame->width, frame->height );
 
-	koki_integral_image_free( iimg );
+	label_adaptive( koki, frame, window_size, thresh_margin,
+			koki->workspace );
 
-	return lmg;
+	return koki->workspace->labelled_image;
 }
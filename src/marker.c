@@ -22,20 +22,23 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
 #include <cv.h>
 #include <glib.h>
 
 #include "quad.h"
 #include "code_grid.h"
 #include "unwarp.h"
-#include "threshold.h"
 #include "camera.h"
 #include "labelling.h"
+#include "workspace.h"
 #include "contour.h"
+#include "trace.h"
 #include "pose.h"
 #include "rotation.h"
 #include "bearing.h"
 #include "debug.h"
+#include "stats.h"
 
 #include "marker.h"
 
@@ -48,12 +51,36 @@
  * @return      a pointer to the new marker
  */
 koki_marker_t* koki_marker_new(koki_quad_t *quad)
+{
+
+	return koki_marker_new_arena(quad, NULL);
+
+}
+
+
+
+/**
+ * @brief creates a marker just as \c koki_marker_new() does, but allocates
+ *        it from an arena
+ *
+ * The marker is freed when the arena is reset, and must not be passed to
+ * \c koki_marker_free().
+ *
+ * @param quad   the quad the transfer data from
+ * @param arena  the arena to allocate the marker from, or NULL to allocate
+ *               it as \c koki_marker_new() does
+ * @return       a pointer to the new marker
+ */
+koki_marker_t* koki_marker_new_arena(koki_quad_t *quad, koki_arena_t *arena)
 {
 
 	koki_marker_t *marker;
 	float sum[2] = {0, 0};
 
-	marker = malloc(sizeof(koki_marker_t));
+	if (arena != NULL)
+		marker = koki_arena_alloc(arena, sizeof(koki_marker_t));
+	else
+		marker = malloc(sizeof(koki_marker_t));
 	assert(marker != NULL);
 
 	/* copy quad vertex values over */
@@ -84,6 +111,7 @@ koki_marker_t* koki_marker_new(koki_quad_t *quad)
 	}
 
 	marker->rotation_offset = 0;
+	marker->bits_corrected = 0;
 
 	/* zero the rotations */
 	marker->rotation.x = 0;
@@ -111,51 +139,57 @@ void koki_marker_free(koki_marker_t *marker)
 
 
 /**
- * @brief recovers the code from a marker, if possible
+ * @brief recovers the code from a marker, if possible, timing the stages
  *
  * @param koki    the libkoki context
  * @param marker  the marker to try and get the code for
  * @param frame   the original image, used to extract the marker's pixels from
+ * @param stats   the counts to add the stages' times to, or NULL
+ * @param t       when the stage before finished, which is moved on
  * @return        TRUE if a good code is found, indicating the marker structure
  *                has been changed to reflect this; FALSE if no success
  */
-bool koki_marker_recover_code( koki_t* koki, koki_marker_t *marker, IplImage *frame )
+static bool recover_code( koki_t* koki, koki_marker_t *marker, IplImage *frame,
+			  koki_stats_counts_t *stats, uint64_t *t )
 {
 
-	IplImage *unwarped;
-	IplImage *res;
 	koki_grid_t grid;
 	float rotation;
 	int16_t code;
+	uint8_t corrected;
 
 	assert(marker != NULL);
-	assert(frame != NULL && frame->nChannels == 1);
+	assert(frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame));
 
-	/* unwarp */
-	unwarped = koki_unwarp_marker( koki, marker, frame, 100 );
+	/* The grid is sampled straight from the frame, but an unwarped
+	   image is still useful to look at when logging */
+	if (koki_is_logging(koki)){
 
-	/* can we continue? */
-	if (unwarped == NULL)
-		return FALSE;
+		IplImage *unwarped = koki_unwarp_marker( koki, marker, frame, 100 );
 
-	koki_log( koki, "unwarped marker\n", unwarped );
+		if (unwarped != NULL){
+			koki_log( koki, "unwarped marker\n", unwarped );
+			cvReleaseImage(&unwarped);
+		}
 
-	/* Adaptively threshold the marker */
-	res = koki_threshold_adaptive( unwarped, 21, 3, KOKI_ADAPTIVE_MEAN );
-	koki_log( koki, "unwarped and thresholded marker\n", res );
+	}
+
+	/* Sample the grid, thresholding each cell against the area about it */
+	if (!koki_unwarp_grid(marker, frame, 3, &grid)){
+		KOKI_STATS_LAP( stats, KOKI_STAGE_UNWARP, *t );
+		return FALSE;
+	}
 
-	/* Resulting image is already b&w, so a threshold of 127 will do */
-	koki_grid_from_image(res, 127, &grid);
+	KOKI_STATS_LAP( stats, KOKI_STAGE_UNWARP, *t );
 
 	/* recover code */
-	code = koki_code_recover_from_grid(&grid, &rotation);
+	code = koki_code_recover_from_grid_corrected(&grid, &rotation,
+						     &corrected);
+
+	KOKI_STATS_LAP( stats, KOKI_STAGE_DECODE, *t );
 
 	if (code < 0){ /* code not recovered */
 		koki_log( koki, "Failed to recover code from unwarped marker -- discarding\n", NULL );
-
-		cvReleaseImage(&unwarped);
-		cvReleaseImage(&res);
-
 		return FALSE;
 	}
 
@@ -164,15 +198,203 @@ bool koki_marker_recover_code( koki_t* koki, koki_marker_t *marker, IplImage *fr
 
 	/* add rotation info to the marker */
 	marker->rotation_offset = rotation;
-
-	/* clean up */
-	cvReleaseImage(&unwarped);
-	cvReleaseImage(&res);
+	marker->bits_corrected = corrected;
 
 	return TRUE;
 
 }
 
+
+
+/**
+ * @brief recovers the code from a marker, if possible
+ *
+ * @param koki    the libkoki context
+ * @param marker  the marker to try and get the code for
+ * @param frame   the original image, used to extract the marker's pixels from
+ * @return        TRUE if a good code is found, indicating the marker structure
+ *                has been changed to reflect this; FALSE if no success
+ */
+bool koki_marker_recover_code( koki_t* koki, koki_marker_t *marker, IplImage *frame )
+{
+
+	return recover_code( koki, marker, frame, NULL, NULL );
+
+}
+
+/**
+ * @brief looks for a marker in a contour
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image
+ * @param contour        the contour, which may be allocated from \c arena
+ * @param arena          the arena to allocate the quad and the candidate
+ *                       marker from
+ * @param contours       the image to draw the contour on if it's a quad,
+ *                       or NULL
+ * @param disc_contours  the image to draw the contour on if it isn't a
+ *                       quad, or NULL
+ * @param stats          the counts to add to, or NULL
+ * @param t              when the contour was found, if \c stats isn't NULL
+ * @return               a copy of the marker that outlives the arena, or
+ *                       NULL if there isn't one
+ */
+static koki_marker_t* find_marker_in_contour( koki_t *koki,
+					      IplImage *frame,
+					      koki_contour_t *contour,
+					      koki_arena_t *arena,
+					      IplImage *contours,
+					      IplImage *disc_contours,
+					      koki_stats_counts_t *stats,
+					      uint64_t t )
+{
+	koki_quad_t *quad;
+	koki_marker_t *marker, *m;
+
+	/* find vertices */
+	quad = koki_quad_find_vertices_array(contour, arena);
+
+	KOKI_STATS_LAP( stats, KOKI_STAGE_QUAD, t );
+
+	if (quad == NULL){
+		if( disc_contours != NULL )
+			koki_contour_array_draw( disc_contours, contour );
+
+		return NULL;
+	}
+
+	KOKI_STATS_COUNT( stats, quads, 1 );
+
+	if( contours != NULL )
+		koki_contour_array_draw( contours, contour );
+
+	/* refine vertices */
+	koki_quad_refine_vertices(quad);
+
+	KOKI_STATS_LAP( stats, KOKI_STAGE_REFINE, t );
+
+	/* create a base marker */
+	marker = koki_marker_new_arena(quad, arena);
+	assert(marker != NULL);
+
+	/* recover code */
+	if (!recover_code(koki, marker, frame, stats, &t)){
+		KOKI_STATS_COUNT( stats, quads_rejected, 1 );
+		return NULL;
+	}
+
+	KOKI_STATS_COUNT( stats, codes, 1 );
+
+	/* return a copy of the marker that outlives the arena, leaving its
+	   pose to be estimated along with the others' */
+	m = malloc(sizeof(koki_marker_t));
+	assert(m != NULL);
+	*m = *marker;
+
+	return m;
+}
+
+/**
+ * @brief the regions of a frame that might be markers, and what's been
+ *        found in them
+ */
+typedef struct {
+	koki_t *koki;			/**< the libkoki context */
+	IplImage *frame;		/**< the input image */
+	koki_labelled_image_t *labelled_image; /**< the labelled frame, or
+					     NULL if it was traced */
+	GArray *regions;		/**< the traced regions, or NULL if the
+					     frame was labelled */
+	uint32_t *candidates;		/**< the labels or indices in \c regions
+					     of the candidate regions */
+	koki_marker_t **found;		/**< the marker found in each candidate,
+					     or NULL */
+	IplImage *contours;		/**< the image to draw quads' contours
+					     on, or NULL */
+	IplImage *disc_contours;	/**< the image to draw other contours
+					     on, or NULL */
+	koki_stats_counts_t *stats;	/**< each worker's timings and counts,
+					     or NULL if they aren't wanted */
+} candidates_t;
+
+/**
+ * @brief looks for a marker in one candidate region, on any thread
+ *
+ * @param data       the \c candidates_t
+ * @param candidate  the index of the candidate
+ * @param worker     the worker it's being looked for on
+ */
+static void find_marker_in_candidate( void *data, uint32_t candidate,
+				      uint16_t worker )
+{
+	candidates_t *c = data;
+	koki_arena_t *arena;
+	koki_contour_t *contour;
+	koki_stats_counts_t *stats = NULL;
+	uint64_t t = 0;
+
+	if( c->stats != NULL ) {
+		stats = &c->stats[worker];
+		t = koki_stats_clock();
+	}
+
+	arena = koki_workspace_arena( c->koki->workspace, worker );
+
+	if( c->regions != NULL )
+		contour = g_array_index( c->regions, koki_traced_region_t,
+					 c->candidates[candidate] ).contour;
+	else
+		contour = koki_contour_find_array( c->labelled_image,
+						   c->candidates[candidate],
+						   arena );
+
+	KOKI_STATS_LAP( stats, KOKI_STAGE_CONTOUR, t );
+	KOKI_STATS_COUNT( stats, contours, 1 );
+
+	c->found[candidate] = find_marker_in_contour( c->koki, c->frame,
+						      contour, arena,
+						      c->contours,
+						      c->disc_contours,
+						      stats, t );
+}
+
+/**
+ * @brief estimates the pose, rotation and bearing of all the markers found
+ *        in a frame in one go
+ *
+ * @param koki          the libkoki context
+ * @param markers       the markers
+ * @param fp            a pointer to a function that returns the size of
+ *                      the marker of the given number in metres.  If NULL,
+ *                      marker_width will be used.
+ * @param marker_width  the marker size to use if fp is NULL, in metres.
+ * @param params        the camera params for the camera at the frame's
+ *                      resolution
+ */
+static void estimate_markers( koki_t *koki,
+			      GPtrArray *markers,
+			      float (*fp)(int),
+			      float marker_width,
+			      koki_camera_params_t *params )
+{
+	koki_marker_t **m = (koki_marker_t**)markers->pdata;
+	float *sizes;
+
+	sizes = koki_arena_alloc(koki->workspace->arena,
+				 sizeof(float) * markers->len);
+
+	for (guint i=0; i<markers->len; i++){
+		if( fp == NULL )
+			sizes[i] = marker_width;
+		else
+			sizes[i] = fp(m[i]->code);
+	}
+
+	koki_pose_estimate_markers(m, markers->len, sizes, params);
+	koki_rotation_estimate_markers(m, markers->len);
+	koki_bearing_estimate_markers(m, markers->len);
+}
+
 /**
  * @brief Find the markers in the given frame.  This function can
  *        take the physical size of the markers as a constant, or a
@@ -196,111 +418,153 @@ static GPtrArray* find_markers( koki_t *koki,
 			        float marker_width,
 			        koki_camera_params_t *params )
 {
-	koki_labelled_image_t *labelled_image;
-	GSList *contour;
-	koki_quad_t *quad;
-	koki_marker_t *marker;
+	candidates_t c;
+	uint32_t n = 0, max;
 	GPtrArray *markers = NULL;
-	IplImage *contours = NULL, *disc_contours = NULL;
+	koki_arena_t *arena = koki->workspace->arena;
+	koki_stats_counts_t frame_stats, *stats = NULL;
+	uint64_t start = 0, t = 0;
 
-	assert(frame != NULL && frame->nChannels == 1);
+	assert(frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame));
+
+	/* The log wants a greyscale image, and is slow anyway, so an
+	   interleaved frame is copied to one to find the markers in */
+	if (frame->nChannels != 1 && koki_is_logging(koki)){
+
+		IplImage *luma;
+
+		koki_workspace_prepare( koki->workspace, frame->width,
+					frame->height );
+		luma = koki_workspace_log_image( koki->workspace,
+						 &koki->workspace->luma_img, 1 );
+		cvSplit( frame, luma, NULL, NULL, NULL );
+		frame = luma;
+
+	}
 
 	koki_log( koki, "find_markers() input image\n", frame );
 
-	/* labelling */
-	labelled_image = koki_label_adaptive( koki, frame, 11, 5 );
+	/* Only a check of the pointer when they aren't wanted */
+	if( __atomic_load_n( &koki->stats, __ATOMIC_RELAXED ) != NULL ) {
+		memset( &frame_stats, 0, sizeof(frame_stats) );
+		stats = &frame_stats;
+		start = t = koki_stats_clock();
+	}
 
-	if (labelled_image == NULL)
+	c.koki = koki;
+	c.frame = frame;
+	c.labelled_image = NULL;
+	c.regions = NULL;
+	c.contours = c.disc_contours = NULL;
+
+	/* labelling, into the context's workspace, either finding the
+	   regions' contours as it goes or leaving that for later */
+	if( koki->label_method == KOKI_LABEL_TRACE )
+		c.regions = koki_label_trace_workspace( koki, frame, 11, 5 );
+	else
+		c.labelled_image = koki_label_adaptive_workspace( koki, frame,
+								  11, 5 );
+
+	if (c.labelled_image == NULL && c.regions == NULL)
 		return NULL;
 
+	KOKI_STATS_LAP( stats, KOKI_STAGE_LABEL, t );
+
 	if (koki_is_logging(koki) ) {
-		/* Create images of contours and discarded contours */
-		contours = cvCreateImage( cvSize( frame->width, frame->height ),
-					  IPL_DEPTH_8U, 3 );
+		/* Get images of contours and discarded contours */
+		c.contours = koki_workspace_log_image( koki->workspace,
+						       &koki->workspace->contours, 3 );
 
-		disc_contours = cvCreateImage( cvSize( frame->width, frame->height ),
-					       IPL_DEPTH_8U, 3 );
+		c.disc_contours = koki_workspace_log_image( koki->workspace,
+							    &koki->workspace->disc_contours, 3 );
 
 		/* Set both to be black */
-		cvSetZero( contours );
-		cvSetZero( disc_contours );
+		cvSetZero( c.contours );
+		cvSetZero( c.disc_contours );
 	}
 
-	/* init markers array */
-	markers = g_ptr_array_new();
-
-	/* loop though all regions */
-	for (label_t i=0; i<labelled_image->clips->len; i++){
-
-		/* make sure it's big enough, etc... */
-		if (!koki_label_useable(labelled_image, i))
-			continue;
+	/* list the regions that are worth looking in -- those that are
+	   big enough, etc... */
+	if( c.regions != NULL )
+		max = c.regions->len;
+	else
+		max = c.labelled_image->clips->len;
 
-		/* get contour */
-		contour = koki_contour_find(labelled_image, i);
+	c.candidates = koki_arena_alloc( arena, sizeof(uint32_t) * max );
 
-		/* find vertices */
-		quad = koki_quad_find_vertices(contour);
+	for (uint32_t i=0; i<max; i++){
 
-		if (quad == NULL){
-			if( disc_contours != NULL )
-				koki_contour_draw( disc_contours, contour );
+		if( c.regions != NULL ) {
+			koki_traced_region_t *region;
+			region = &g_array_index(c.regions, koki_traced_region_t, i);
 
-			koki_contour_free(contour);
+			if (!koki_traced_region_useable(region, frame->width,
+							frame->height))
+				continue;
+		} else if (!koki_label_useable(c.labelled_image, i))
 			continue;
-		}
 
-		if( contours != NULL )
-			koki_contour_draw( contours, contour );
+		c.candidates[n++] = i;
+
+	}//for
 
-		/* refine vertices */
-		koki_quad_refine_vertices(quad);
+	c.found = koki_arena_alloc( arena, sizeof(koki_marker_t*) * n );
 
-		/* create a base marker */
-		marker = koki_marker_new(quad);
-		assert(marker != NULL);
+	c.stats = NULL;
+	if( stats != NULL ) {
+		stats->regions = max;
+		stats->usable_regions = n;
+		KOKI_STATS_LAP( stats, KOKI_STAGE_STATS, t );
 
-		/* recover code */
-		if (koki_marker_recover_code(koki, marker, frame)){
-			float size;
-			assert(marker != NULL);
+		/* Each worker counts for itself, to be added up after */
+		c.stats = koki_arena_alloc( arena, sizeof(koki_stats_counts_t)
+					    * koki->marker_threads );
+		memset( c.stats, 0, sizeof(koki_stats_counts_t)
+			* koki->marker_threads );
+	}
 
-			if( fp == NULL )
-				size = marker_width;
-			else
-				size = fp(marker->code);
+	/* Look in the candidates, sharing them between threads unless the
+	   log needs to come out in order */
+	if( koki->pool != NULL && c.contours == NULL && n > 1 )
+		koki_pool_run( koki->pool, n, find_marker_in_candidate, &c );
+	else
+		for (uint32_t i=0; i<n; i++)
+			find_marker_in_candidate( &c, i, 0 );
 
-			koki_pose_estimate(marker, size, params);
-			koki_rotation_estimate(marker);
-			koki_bearing_estimate(marker);
+	/* gather the markers in candidate order, whichever thread found
+	   them */
+	markers = g_ptr_array_new();
 
-			/* append the marker to the output array */
-			g_ptr_array_add(markers, marker);
+	for (uint32_t i=0; i<n; i++)
+		if (c.found[i] != NULL)
+			g_ptr_array_add(markers, c.found[i]);
 
-		} else {
+	if( stats != NULL ) {
+		for (uint16_t i=0; i<koki->marker_threads; i++)
+			koki_stats_add( stats, &c.stats[i] );
 
-			/* not a useful marker, free it */
-			koki_marker_free(marker);
+		t = koki_stats_clock();
+	}
 
-		}
+	estimate_markers( koki, markers, fp, marker_width, params );
 
-		/* cleanup */
-		koki_contour_free(contour);
-		koki_quad_free(quad);
+	KOKI_STATS_LAP( stats, KOKI_STAGE_POSE, t );
 
-	}//for
+	/* All the contours, quads and candidate markers go at once */
+	koki_workspace_reset_arenas(koki->workspace);
 
-	/* clean up */
-	koki_labelled_image_free(labelled_image);
+	/* The labelled image, regions and log images belong to the
+	   workspace */
+	if( c.contours != NULL )
+		koki_log( koki, "Contours", c.contours );
 
-	if( contours != NULL ) {
-		koki_log( koki, "Contours", contours );
-		cvReleaseImage( &contours );
-	}
+	if( c.disc_contours != NULL )
+		koki_log( koki, "Discarded Contours", c.disc_contours );
 
-	if( disc_contours != NULL ) {
-		koki_log( koki, "Discarded Contours", disc_contours );
-		cvReleaseImage( &disc_contours );
+	if( stats != NULL ) {
+		stats->frames = 1;
+		stats->time = koki_stats_clock() - start;
+		koki_stats_record( koki, stats );
 	}
 
 	return markers;
@@ -312,6 +576,11 @@ static GPtrArray* find_markers( koki_t *koki,
  *
  * Note that with this function, one can only have a single marker size.
  *
+ * The frame can be greyscale, or have its luma as the first of two
+ * interleaved channels.  The latter lets markers be found straight in a
+ * YUYV capture buffer, through a header made by \c koki_v4l_luma_view(),
+ * without copying the luma out first.
+ *
  * @param koki    the libkoki context
  * @param frame         the input image
  * @param marker_width  the width, in metres, of the marker(s) in the image
@@ -335,7 +604,8 @@ GPtrArray* koki_find_markers( koki_t *koki,
  *
  * The function pointer, \c fp, should point to a function that takes as
  * argument a marker code, and returns a float representing the width of
- * a marker with said code.
+ * a marker with said code.  The frame can be anything
+ * \c koki_find_markers() accepts.
  *
  * @param koki    the libkoki context
  * @param frame   the input image
@@ -21,7 +21,8 @@
  */
 
 #include <glib.h>
-#include <cv.h>
+#include <assert.h>
+#include <math.h>
 #include <stdint.h>
 
 #include "points.h"
@@ -29,6 +30,110 @@
 #include "pca.h"
 
 
+/**
+ * @brief adds a point to the sums that PCA is worked out from
+ *
+ * A \c koki_pca_sums_t should be zeroed before the first point is added.
+ *
+ * @param sums  the sums to add the point to
+ * @param x     the point's X co-ordinate
+ * @param y     the point's Y co-ordinate
+ */
+void koki_pca_sums_add(koki_pca_sums_t *sums, int32_t x, int32_t y)
+{
+
+	sums->n++;
+	sums->sx += x;
+	sums->sy += y;
+	sums->sxx += (int64_t)x * x;
+	sums->sxy += (int64_t)x * y;
+	sums->syy += (int64_t)y * y;
+
+}
+
+
+
+/**
+ * @brief finds the principal components of a set of points, given the
+ *        sums of their co-ordinates and of their products
+ *
+ * The covariance matrix is worked out exactly, in integers, before being
+ * converted to floating point, so no precision is lost to the large
+ * co-ordinate values.  Its eigen values and vectors are then found in
+ * closed form, as it is only 2x2.
+ *
+ * The eigen values are written largest first, and each eigen vector has
+ * unit length.  If the points are spread equally in every direction, the
+ * eigen vectors are the X and Y axes.
+ *
+ * @param sums           the sums of the points
+ * @param eigen_vectors  the array that will have the eigen vectors written to
+ * @param eigen values   the array that will have \c eigen_vector's corresponding
+ *                       eigen values written to
+ * @param averages       where to write the mean of the points
+ * @return               \c 0 on success, anything else if there are fewer
+ *                       than two points
+ */
+int8_t koki_pca_sums_solve(const koki_pca_sums_t *sums,
+			   koki_point2Df_t eigen_vectors[2],
+			   float eigen_values[2], koki_point2Df_t *averages)
+{
+
+	const int64_t n = sums->n;
+	double nn, a, b, d, half_diff, disc, vx, vy, norm;
+
+	if (n < 2)
+		return -1;
+
+	/* the covariance matrix [a b; b d], scaled by 1/n */
+	nn = (double)n * n;
+	a = (n * sums->sxx - sums->sx * sums->sx) / nn;
+	b = (n * sums->sxy - sums->sx * sums->sy) / nn;
+	d = (n * sums->syy - sums->sy * sums->sy) / nn;
+
+	/* the eigen values are the roots of its characteristic polynomial */
+	half_diff = (a - d) / 2;
+	disc = sqrt(half_diff * half_diff + b * b);
+
+	eigen_values[0] = (a + d) / 2 + disc;
+	eigen_values[1] = (a + d) / 2 - disc;
+
+	/* The larger one's eigen vector is (l-d, b) or (b, l-a).  The one with
+	   the larger diagonal term is used, as it can't cancel to nothing
+	   unless the matrix is a multiple of the identity. */
+	if (half_diff >= 0){
+		vx = half_diff + disc;
+		vy = b;
+	} else {
+		vx = b;
+		vy = disc - half_diff;
+	}
+
+	norm = sqrt(vx * vx + vy * vy);
+
+	if (norm > 0){
+		vx /= norm;
+		vy /= norm;
+	} else {
+		vx = 1;
+		vy = 0;
+	}
+
+	/* the other is perpendicular to it */
+	eigen_vectors[0].x = vx;
+	eigen_vectors[0].y = vy;
+	eigen_vectors[1].x = -vy;
+	eigen_vectors[1].y = vx;
+
+	averages->x = (double)sums->sx / n;
+	averages->y = (double)sums->sy / n;
+
+	return 0;
+
+}
+
+
+
 /**
  * @brief performs Principal Component Analysis on a list of \c koki_point2Di_t
  *
@@ -45,73 +150,69 @@ int8_t koki_pca(GSList *start, GSList *end,
 		float eigen_values[2], koki_point2Df_t *averages)
 {
 
-	CvMat **data       = malloc(sizeof(CvMat));
-	CvMat *covar       = cvCreateMat(2, 2, CV_64FC1);
-	CvMat *avg         = cvCreateMat(2, 1, CV_64FC1);
-	CvMat *eigen_vals  = cvCreateMat(2, 1, CV_64FC1);
-	CvMat *eigen_vects = cvCreateMat(2, 2, CV_64FC1);
-
-	uint16_t len = 1;
+	koki_pca_sums_t sums = {0};
 	GSList *l;
 	koki_point2Di_t *p;
 
 	assert (start != NULL);
 
-	/* zero matrices */
-	cvSetZero(covar);
-	cvSetZero(avg);
-	cvSetZero(eigen_vals);
-	cvSetZero(eigen_vects);
-
-	/* work out how many elements we're dealing with */
-	l = start;
-	while (l != end && l != NULL && l->next != NULL){
-		l = l->next;
-		len++;
-	}
+	/* the chain includes end, if it's reached */
+	for (l = start; l != NULL; l = l->next){
 
-	if (len < 2)
-		return -1;
+		p = l->data;
+		koki_pca_sums_add(&sums, p->x, p->y);
 
-	/* create and fill the data matrix */
-	data[0] = cvCreateMat(2, len, CV_64FC1);
+		if (l == end)
+			break;
 
-	l = start;
-	for (uint16_t i = 0; i < len; i++, l = l->next){
-		p = l->data;
-		cvmSet(data[0], 0, i, p->x);
-		cvmSet(data[0], 1, i, p->y);
 	}
 
-	/* calculate the covariance matrix */
-	cvCalcCovarMatrix((const CvArr **)data, 1, covar, avg,
-			  CV_COVAR_NORMAL | CV_COVAR_SCALE | CV_COVAR_COLS);
+	return koki_pca_sums_solve(&sums, eigen_vectors, eigen_values,
+				   averages);
 
-	/* calculate eigen vectors and values */
-	cvEigenVV(covar, eigen_vects, eigen_vals, 0, -1, -1);
+}
 
-	/* a row of eigen_vects is an eigen vector */
-	eigen_vectors[0].x = cvmGet(eigen_vects, 0, 0);
-	eigen_vectors[0].y = cvmGet(eigen_vects, 0, 1);
-	eigen_vectors[1].x = cvmGet(eigen_vects, 1, 0);
-	eigen_vectors[1].y = cvmGet(eigen_vects, 1, 1);
 
-	/* get eigen vals */
-	eigen_values[0] = cvmGet(eigen_vals, 0, 0);
-	eigen_values[1] = cvmGet(eigen_vals, 1, 0);
 
-	/* get averages */
-	averages->x = cvmGet(avg, 0, 0);
-	averages->y = cvmGet(avg, 1, 0);
+/**
+ * @brief performs Principal Component Analysis on points held as packed
+ *        arrays of co-ordinates
+ *
+ * @param x              the X co-ordinates of the points
+ * @param y              the Y co-ordinates of the points
+ * @param n              the number of points
+ * @param eigen_vectors  the array that will have the eigen vectors written to
+ * @param eigen values   the array that will have \c eigen_vector's corresponding
+ *                       eigen values written to
+ * @param averages       where to write the mean of the points
+ * @return               \c 0 on success, anything else on failure
+ */
+int8_t koki_pca_array(const int16_t *x, const int16_t *y, uint32_t n,
+		      koki_point2Df_t eigen_vectors[2],
+		      float eigen_values[2], koki_point2Df_t *averages)
+{
 
-	/* clean up */
-	cvReleaseMat(&data[0]);
-	free(data);
-	cvReleaseMat(&covar);
-	cvReleaseMat(&avg);
-	cvReleaseMat(&eigen_vects);
-	cvReleaseMat(&eigen_vals);
+	koki_pca_sums_t sums = {0};
+	int64_t sx = 0, sy = 0, sxx = 0, sxy = 0, syy = 0;
+
+	/* a straight scan, which the compiler can vectorise */
+	for (uint32_t i=0; i<n; i++){
+		int32_t px = x[i], py = y[i];
+		sx += px;
+		sy += py;
+		sxx += px * px;
+		sxy += px * py;
+		syy += py * py;
+	}
 
-	return 0;
+	sums.n = n;
+	sums.sx = sx;
+	sums.sy = sy;
+	sums.sxx = sxx;
+	sums.sxy = sxy;
+	sums.syy = syy;
+
+	return koki_pca_sums_solve(&sums, eigen_vectors, eigen_values,
+				   averages);
 
 }
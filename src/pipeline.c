@@ -0,0 +1,488 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  pipeline.c
+ * @brief Implementation of finding markers in a source's frames on a
+ *        pipeline of threads
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "marker.h"
+#include "queue.h"
+#include "source.h"
+#include "v4l.h"
+#include "pipeline.h"
+
+/**
+ * @brief how long, in milliseconds, a stage waits for something to do
+ *        before checking whether the pipeline's been stopped
+ */
+#define PIPELINE_WAIT 100
+
+/**
+ * @brief the number of luma frames, and of results: enough for the stages
+ *        either side to each have one while the newest waits between them
+ */
+#define PIPELINE_ITEMS 3
+
+/**
+ * @brief the most captured frames to hold at once
+ */
+#define PIPELINE_MAX_CAPTURED 4
+
+/**
+ * @brief whether the pipeline's threads should carry on
+ */
+static bool pipeline_running( koki_pipeline_t *p )
+{
+	return __atomic_load_n( &p->running, __ATOMIC_ACQUIRE );
+}
+
+/**
+ * @brief take an empty item to send down a link, waiting for one to come
+ *        back if need be
+ *
+ * @param p     the pipeline
+ * @param link  the link
+ * @return      the item, or NULL if the pipeline's been stopped
+ */
+static void* link_take_free( koki_pipeline_t *p, koki_pipeline_link_t *link )
+{
+	void *item = NULL;
+
+	while( item == NULL && pipeline_running( p ) )
+		item = koki_queue_pop_wait( link->free,
+					    PIPELINE_WAIT * G_TIME_SPAN_MILLISECOND );
+
+	return item;
+}
+
+/**
+ * @brief take the newest item that's come down a link, handing any older
+ *        ones straight back, waiting for one if need be
+ *
+ * @param p     the pipeline
+ * @param link  the link
+ * @param drop  a function to call on each item that's handed back unused,
+ *              or NULL
+ * @return      the item, or NULL if the pipeline's been stopped or the
+ *              stage before has finished
+ */
+static void* link_take_newest( koki_pipeline_t *p, koki_pipeline_link_t *link,
+			       void (*drop)( void *item ) )
+{
+	void *item = NULL, *newer;
+
+	while( item == NULL && pipeline_running( p ) ) {
+		/* Anything pushed before the link was closed is still seen */
+		bool closed = __atomic_load_n( &link->closed, __ATOMIC_ACQUIRE );
+
+		item = koki_queue_pop_wait( link->full, closed ? 0
+					    : PIPELINE_WAIT * G_TIME_SPAN_MILLISECOND );
+
+		if( item == NULL && closed )
+			return NULL;
+	}
+
+	if( item == NULL )
+		return NULL;
+
+	while( (newer = koki_queue_pop( link->full )) != NULL ) {
+		if( drop != NULL )
+			drop( item );
+
+		koki_queue_push( link->free, item );
+		item = newer;
+	}
+
+	return item;
+}
+
+/**
+ * @brief say that nothing more will be pushed down a link, so the stage
+ *        after can finish once it's taken what's already there
+ *
+ * @param link  the link
+ */
+static void link_close( koki_pipeline_link_t *link )
+{
+	__atomic_store_n( &link->closed, 1, __ATOMIC_RELEASE );
+}
+
+/**
+ * @brief free the markers in a result
+ *
+ * @param item  the \c koki_pipeline_result_t
+ */
+static void drop_result( void *item )
+{
+	koki_pipeline_result_t *r = item;
+
+	if( r->markers != NULL )
+		koki_markers_free( r->markers );
+
+	r->markers = NULL;
+}
+
+/**
+ * @brief the capture stage: gets the newest frame from the source and
+ *        passes it on, giving frames back to the source once they've been
+ *        converted
+ *
+ * This is the only thread that touches the source.
+ *
+ * @param data  the pipeline
+ * @return      NULL
+ */
+static gpointer capture_thread( gpointer data )
+{
+	koki_pipeline_t *p = data;
+	koki_pipeline_link_t *out = &p->links[0];
+	koki_v4l_frame_t *f;
+
+	while( (f = link_take_free( p, out )) != NULL ) {
+
+		int ret = 0;
+
+		if( f->data != NULL ) {
+			koki_source_release_frame( p->source, f );
+			f->data = NULL;
+		}
+
+		while( ret == 0 && pipeline_running( p ) )
+			ret = koki_source_get_frame( p->source, f, PIPELINE_WAIT );
+
+		/* The source has failed or run out of frames */
+		if( ret <= 0 )
+			break;
+
+		koki_queue_push( out->full, f );
+	}
+
+	link_close( out );
+	return NULL;
+}
+
+/**
+ * @brief copies the luma of a captured frame into a greyscale image
+ *
+ * @param p       the pipeline
+ * @param f       the captured frame
+ * @param output  the image to copy it to
+ */
+static void convert_frame( koki_pipeline_t *p, const koki_v4l_frame_t *f,
+			   IplImage *output )
+{
+	IplImage view;
+
+	koki_v4l_luma_view( &view, f->data, p->source->fmt );
+
+	if( view.nChannels == 1 )
+		cvCopy( &view, output, NULL );
+	else if( view.widthStep == view.width * 2 )
+		koki_v4l_YUYV_frame_into_grayscale_image( f->data, view.width,
+							  view.height, output );
+	else
+		cvSplit( &view, output, NULL, NULL, NULL );
+}
+
+/**
+ * @brief the conversion stage: copies the luma of the newest captured
+ *        frame out of the source's buffer, so the buffer can be given back
+ *        before the markers are found
+ *
+ * @param data  the pipeline
+ * @return      NULL
+ */
+static gpointer convert_thread( gpointer data )
+{
+	koki_pipeline_t *p = data;
+	koki_pipeline_link_t *in = &p->links[0], *out = &p->links[1];
+	koki_pipeline_frame_t *frame;
+	koki_v4l_frame_t *f;
+
+	/* An empty frame's got first, so the captured frame is held for as
+	   short a time as possible */
+	while( (frame = link_take_free( p, out )) != NULL
+	       && (f = link_take_newest( p, in, NULL )) != NULL ) {
+
+		convert_frame( p, f, frame->image );
+		frame->sequence = f->sequence;
+		frame->timestamp = f->timestamp;
+
+		koki_queue_push( in->free, f );
+		koki_queue_push( out->full, frame );
+	}
+
+	link_close( out );
+	return NULL;
+}
+
+/**
+ * @brief the detection stage: finds the markers in the newest converted
+ *        frame
+ *
+ * @param data  the pipeline
+ * @return      NULL
+ */
+static gpointer detect_thread( gpointer data )
+{
+	koki_pipeline_t *p = data;
+	koki_pipeline_link_t *in = &p->links[1], *out = &p->links[2];
+	koki_pipeline_result_t *r;
+	koki_pipeline_frame_t *frame;
+
+	while( (r = link_take_free( p, out )) != NULL
+	       && (frame = link_take_newest( p, in, NULL )) != NULL ) {
+
+		r->markers = koki_find_markers( p->koki, frame->image,
+						p->marker_width, &p->params );
+		r->sequence = frame->sequence;
+		r->timestamp = frame->timestamp;
+
+		koki_queue_push( in->free, frame );
+		koki_queue_push( out->full, r );
+	}
+
+	link_close( out );
+	return NULL;
+}
+
+/**
+ * @brief the publishing stage: gives the newest markers to the callback
+ *
+ * @param data  the pipeline
+ * @return      NULL
+ */
+static gpointer publish_thread( gpointer data )
+{
+	koki_pipeline_t *p = data;
+	koki_pipeline_link_t *in = &p->links[2];
+	koki_pipeline_result_t *r;
+
+	while( (r = link_take_newest( p, in, drop_result )) != NULL ) {
+
+		p->callback( r, p->userdata );
+
+		drop_result( r );
+		koki_queue_push( in->free, r );
+	}
+
+	/* Everything the source gave has been through, unless we're being
+	   stopped */
+	if( pipeline_running( p ) )
+		__atomic_store_n( &p->finished, 1, __ATOMIC_RELEASE );
+
+	return NULL;
+}
+
+/**
+ * @brief set up a link, with all its items on their way back
+ *
+ * @param link   the link
+ * @param items  the items
+ * @param size   the size of each item
+ * @param n      the number of items
+ */
+static void link_init( koki_pipeline_link_t *link, void *items,
+		       size_t size, uint16_t n )
+{
+	link->full = koki_queue_new( n );
+	link->free = koki_queue_new( n );
+
+	for( uint16_t i = 0; i < n; i++ )
+		koki_queue_push( link->free, (uint8_t*)items + size * i );
+}
+
+/**
+ * @brief start finding markers in a source's frames on a pipeline of
+ *        threads
+ *
+ * Getting frames from the source, conversion to greyscale, finding the
+ * markers and the callback each have a thread, so a frame can be captured
+ * while the one before is converted, the one before that is searched for
+ * markers and so on.  The stages are joined by lock-free queues.  Each
+ * stage takes the newest thing waiting for it and drops anything older, so
+ * the callback gets the markers from the newest frame that the slowest
+ * stage had time for.  Gaps in the results' sequence numbers show the
+ * frames that were dropped.
+ *
+ * While the pipeline's running, the context and the source mustn't be
+ * used by anything else.
+ *
+ * @param koki          the libkoki context to find the markers with
+ * @param source        where the frames come from, which is left for the
+ *                      caller to free once the pipeline's stopped
+ * @param marker_width  the width of the markers, in metres
+ * @param params        the camera's parameters
+ * @param callback      the function to give the markers found in each
+ *                      frame to
+ * @param userdata      the userdata to pass to \c callback
+ * @return              the running pipeline
+ */
+koki_pipeline_t* koki_pipeline_start_source( koki_t *koki,
+					     koki_source_t *source,
+					     float marker_width,
+					     const koki_camera_params_t *params,
+					     koki_pipeline_callback_t callback,
+					     void *userdata )
+{
+	koki_pipeline_t *p;
+	CvSize size;
+
+	g_assert( koki != NULL && source != NULL );
+	g_assert( params != NULL && callback != NULL );
+
+	p = g_malloc0( sizeof(koki_pipeline_t) );
+	p->koki = koki;
+	p->source = source;
+	p->marker_width = marker_width;
+	p->params = *params;
+	p->callback = callback;
+	p->userdata = userdata;
+
+	p->n_captured = MIN( source->max_held, PIPELINE_MAX_CAPTURED );
+	p->n_frames = PIPELINE_ITEMS;
+	p->n_results = PIPELINE_ITEMS;
+
+	p->captured = g_malloc0( sizeof(koki_v4l_frame_t) * p->n_captured );
+	p->frames = g_malloc0( sizeof(koki_pipeline_frame_t) * p->n_frames );
+	p->results = g_malloc0( sizeof(koki_pipeline_result_t) * p->n_results );
+
+	size = cvSize( source->fmt.fmt.pix.width, source->fmt.fmt.pix.height );
+
+	for( uint16_t i = 0; i < p->n_frames; i++ ) {
+		p->frames[i].image = cvCreateImage( size, IPL_DEPTH_8U, 1 );
+		g_assert( p->frames[i].image != NULL );
+	}
+
+	link_init( &p->links[0], p->captured, sizeof(koki_v4l_frame_t),
+		   p->n_captured );
+	link_init( &p->links[1], p->frames, sizeof(koki_pipeline_frame_t),
+		   p->n_frames );
+	link_init( &p->links[2], p->results, sizeof(koki_pipeline_result_t),
+		   p->n_results );
+
+	p->running = 1;
+
+	p->threads[0] = g_thread_new( "koki-capture", capture_thread, p );
+	p->threads[1] = g_thread_new( "koki-convert", convert_thread, p );
+	p->threads[2] = g_thread_new( "koki-detect", detect_thread, p );
+	p->threads[3] = g_thread_new( "koki-publish", publish_thread, p );
+
+	return p;
+}
+
+/**
+ * @brief start finding markers in a camera's frames on a pipeline of
+ *        threads
+ *
+ * This is \c koki_pipeline_start_source() on a camera, which is stopped
+ * when the pipeline is.
+ *
+ * @param koki          the libkoki context to find the markers with
+ * @param fd            the camera's file descriptor, with its format set to
+ *                      one \c koki_v4l_luma_view() understands
+ * @param n_buffers     the number of buffers to capture into
+ * @param marker_width  the width of the markers, in metres
+ * @param params        the camera's parameters
+ * @param callback      the function to give the markers found in each
+ *                      frame to
+ * @param userdata      the userdata to pass to \c callback
+ * @return              the running pipeline, or NULL if the camera
+ *                      couldn't be started
+ */
+koki_pipeline_t* koki_pipeline_start( koki_t *koki, int fd, int n_buffers,
+				      float marker_width,
+				      const koki_camera_params_t *params,
+				      koki_pipeline_callback_t callback,
+				      void *userdata )
+{
+	koki_source_t *source;
+	koki_pipeline_t *p;
+
+	source = koki_source_v4l_new( fd, n_buffers );
+	if( source == NULL )
+		return NULL;
+
+	p = koki_pipeline_start_source( koki, source, marker_width, params,
+					callback, userdata );
+	p->own_source = TRUE;
+
+	return p;
+}
+
+/**
+ * @brief whether a pipeline has finished because its source failed or ran
+ *        out of frames
+ *
+ * The frames already got from the source are all seen through the
+ * pipeline first, so the last of them reach the callback.
+ *
+ * @param p  the pipeline
+ * @return   TRUE if it has, in which case it should be stopped
+ */
+bool koki_pipeline_finished( koki_pipeline_t *p )
+{
+	return __atomic_load_n( &p->finished, __ATOMIC_ACQUIRE );
+}
+
+/**
+ * @brief stop a pipeline's threads, and free it and any camera it started
+ *
+ * The callback won't be called again once this returns.
+ *
+ * @param p  the pipeline
+ */
+void koki_pipeline_stop( koki_pipeline_t *p )
+{
+	__atomic_store_n( &p->running, 0, __ATOMIC_RELEASE );
+
+	for( int i = 0; i < 4; i++ )
+		g_thread_join( p->threads[i] );
+
+	/* Results that never got to the callback */
+	for( uint16_t i = 0; i < p->n_results; i++ )
+		drop_result( &p->results[i] );
+
+	/* Frames still held are given back, as the source may outlive us */
+	for( uint16_t i = 0; i < p->n_captured; i++ )
+		if( p->captured[i].data != NULL )
+			koki_source_release_frame( p->source, &p->captured[i] );
+
+	if( p->own_source )
+		koki_source_free( p->source );
+
+	for( uint16_t i = 0; i < p->n_frames; i++ )
+		cvReleaseImage( &p->frames[i].image );
+
+	for( int i = 0; i < 3; i++ ) {
+		koki_queue_free( p->links[i].full );
+		koki_queue_free( p->links[i].free );
+	}
+
+	g_free( p->captured );
+	g_free( p->frames );
+	g_free( p->results );
+	g_free( p );
+}
@@ -0,0 +1,246 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  pool.c
+ * @brief Implementation of the pool of worker threads
+ */
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include "pool.h"
+
+/**
+ * @brief packs a range of items into a worker's range
+ */
+#define pool_range( next, end ) ( ((uint64_t)(next) << 32) | (uint32_t)(end) )
+
+/**
+ * @brief takes the next item from the front of a worker's own range
+ *
+ * @param w     the worker
+ * @param item  where to store the item
+ * @return      TRUE if there was an item, FALSE if the range is empty
+ */
+static bool pool_take( koki_pool_worker_t *w, uint32_t *item )
+{
+	uint64_t r = __atomic_load_n( &w->range, __ATOMIC_ACQUIRE );
+
+	while( (uint32_t)(r >> 32) < (uint32_t)r ) {
+		uint32_t next = r >> 32;
+
+		/* a thief may have shortened the range in the meantime, in
+		   which case r is reloaded and tried again */
+		if( __atomic_compare_exchange_n( &w->range, &r,
+						 pool_range( next + 1, (uint32_t)r ),
+						 false, __ATOMIC_ACQ_REL,
+						 __ATOMIC_ACQUIRE ) ) {
+			*item = next;
+			return TRUE;
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * @brief steals the back half of another worker's range
+ *
+ * The workers are tried in turn, starting with the next one along.  The
+ * thief's own range must be empty, so no-one else will touch it until it
+ * is given the stolen items.
+ *
+ * @param thief  the worker that has run out of items
+ * @return       TRUE if some items were stolen, FALSE if there were none
+ *               left to steal
+ */
+static bool pool_steal( koki_pool_worker_t *thief )
+{
+	koki_pool_t *pool = thief->pool;
+
+	for( uint16_t k = 1; k < pool->n_workers; k++ ) {
+		koki_pool_worker_t *victim;
+		uint64_t r;
+
+		victim = &pool->workers[ (thief->id + k) % pool->n_workers ];
+		r = __atomic_load_n( &victim->range, __ATOMIC_ACQUIRE );
+
+		while( (uint32_t)(r >> 32) < (uint32_t)r ) {
+			uint32_t next = r >> 32, end = r;
+			uint32_t mid = end - (end - next + 1) / 2;
+
+			if( __atomic_compare_exchange_n( &victim->range, &r,
+							 pool_range( next, mid ),
+							 false, __ATOMIC_ACQ_REL,
+							 __ATOMIC_ACQUIRE ) ) {
+				__atomic_store_n( &thief->range,
+						  pool_range( mid, end ),
+						  __ATOMIC_RELEASE );
+				return TRUE;
+			}
+		}
+	}
+
+	return FALSE;
+}
+
+/**
+ * @brief does a worker's share of the current job, stealing more until
+ *        there's none left
+ *
+ * @param w  the worker
+ */
+static void pool_work( koki_pool_worker_t *w )
+{
+	koki_pool_t *pool = w->pool;
+	uint32_t item;
+
+	do {
+		while( pool_take( w, &item ) )
+			pool->func( pool->data, item, w->id );
+	} while( pool_steal( w ) );
+}
+
+/**
+ * @brief the main loop of one of a pool's threads
+ *
+ * @param data  the thread's \c koki_pool_worker_t
+ * @return      NULL
+ */
+static gpointer pool_thread( gpointer data )
+{
+	koki_pool_worker_t *w = data;
+	koki_pool_t *pool = w->pool;
+	guint job = 0;
+
+	g_mutex_lock( &pool->lock );
+
+	while( TRUE ) {
+		while( !pool->quit && pool->job == job )
+			g_cond_wait( &pool->start, &pool->lock );
+
+		if( pool->quit )
+			break;
+
+		job = pool->job;
+		g_mutex_unlock( &pool->lock );
+
+		pool_work( w );
+
+		g_mutex_lock( &pool->lock );
+		if( --pool->active == 0 )
+			g_cond_signal( &pool->done );
+	}
+
+	g_mutex_unlock( &pool->lock );
+
+	return NULL;
+}
+
+/**
+ * @brief create a pool of workers, starting its threads
+ *
+ * @param n_workers  the number of workers, including the thread that runs
+ *                   jobs, which must be at least 1
+ * @return           the new pool
+ */
+koki_pool_t* koki_pool_new( uint16_t n_workers )
+{
+	koki_pool_t *pool = g_malloc0( sizeof(koki_pool_t) );
+
+	g_assert( n_workers >= 1 );
+
+	pool->n_workers = n_workers;
+	pool->workers = g_malloc0( sizeof(koki_pool_worker_t) * n_workers );
+
+	g_mutex_init( &pool->lock );
+	g_cond_init( &pool->start );
+	g_cond_init( &pool->done );
+
+	for( uint16_t k = 0; k < n_workers; k++ ) {
+		pool->workers[k].pool = pool;
+		pool->workers[k].id = k;
+	}
+
+	for( uint16_t k = 1; k < n_workers; k++ )
+		pool->workers[k].thread = g_thread_new( "koki-worker", pool_thread,
+							&pool->workers[k] );
+
+	return pool;
+}
+
+/**
+ * @brief stop a pool's threads and free it
+ *
+ * @param pool  the pool, which mustn't be running a job
+ */
+void koki_pool_free( koki_pool_t *pool )
+{
+	g_mutex_lock( &pool->lock );
+	pool->quit = TRUE;
+	g_cond_broadcast( &pool->start );
+	g_mutex_unlock( &pool->lock );
+
+	for( uint16_t k = 1; k < pool->n_workers; k++ )
+		g_thread_join( pool->workers[k].thread );
+
+	g_cond_clear( &pool->done );
+	g_cond_clear( &pool->start );
+	g_mutex_clear( &pool->lock );
+
+	g_free( pool->workers );
+	g_free( pool );
+}
+
+/**
+ * @brief run a function on every item of a job, sharing the items out
+ *        between the pool's workers, and wait for them all to be done
+ *
+ * The calling thread works on the job too, as worker 0.  Items are run in
+ * no particular order, so anything they produce should be stored by item.
+ *
+ * @param pool     the pool
+ * @param n_items  the number of items
+ * @param func     the function to run on each item
+ * @param data     the data to pass to \c func
+ */
+void koki_pool_run( koki_pool_t *pool, uint32_t n_items,
+		    koki_pool_func_t func, void *data )
+{
+	const uint16_t n = pool->n_workers;
+
+	/* give each worker an equal share to start with */
+	for( uint16_t k = 0; k < n; k++ )
+		pool->workers[k].range = pool_range( (uint64_t)n_items * k / n,
+						     (uint64_t)n_items * (k+1) / n );
+
+	g_mutex_lock( &pool->lock );
+	pool->func = func;
+	pool->data = data;
+	pool->active = n - 1;
+	pool->job++;
+	g_cond_broadcast( &pool->start );
+	g_mutex_unlock( &pool->lock );
+
+	pool_work( &pool->workers[0] );
+
+	g_mutex_lock( &pool->lock );
+	while( pool->active > 0 )
+		g_cond_wait( &pool->done, &pool->lock );
+	g_mutex_unlock( &pool->lock );
+}
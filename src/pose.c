@@ -20,8 +20,9 @@
  * @brief Implementation of position estimation in 3D space
  */
 
-#include <cv.h>
 #include <stdint.h>
+#include <assert.h>
+#include <math.h>
 
 #include "points.h"
 #include "camera.h"
@@ -31,9 +32,18 @@
 
 
 /**
- * @brief given 4 co-planar 2D image points of a square (e.g. a marker), the
- * width of a side of said square, and camera's parameters (for focal length),
- * this function calculates the 3D co-ordinates of the 4 vertices
+ * @brief the most markers whose co-ordinates are gathered onto the stack
+ *        at once by \c koki_pose_estimate_markers()
+ */
+#define POSE_BATCH 32
+
+
+
+/**
+ * @brief given 4 co-planar 2D image points of a number of squares (e.g.
+ *        markers), the width of a side of each square, and the camera's
+ *        focal length, this function calculates the 3D co-ordinates of the
+ *        squares' vertices
  *
  * Based on the method detailed in:
  *   Y. Hung., et.al. "Passive Ranging to Known Planar Point Sets", 1985
@@ -50,6 +60,90 @@
  * The world point is simply the ray vector from the camera to the point on
  * the image plane, scaled by its corresponding \c k.
  *
+ * The 3x3 linear system for \c k0/k3 to \c k2/k3 is solved by Cramer's
+ * rule.  Each array holds vertex \c v of square \c i at index \c v*n+i, so
+ * the squares are worked on side by side.
+ *
+ * @param n             the number of squares
+ * @param img_x         the X co-ordinates of the image points, relative to
+ *                      the principal point
+ * @param img_y         the Y co-ordinates of the image points, relative to
+ *                      the principal point and increasing upwards
+ * @param widths        the width, in metres, of each square
+ * @param focal_length  the camera's focal length, in pixels
+ * @param world_x       where to write the X co-ordinates of the world points
+ * @param world_y       where to write the Y co-ordinates of the world points
+ * @param world_z       where to write the Z co-ordinates of the world points
+ */
+void koki_pose_estimate_soa(uint32_t n, const float *img_x, const float *img_y,
+			    const float *widths, float focal_length,
+			    float *world_x, float *world_y, float *world_z)
+{
+
+	const double f = focal_length;
+
+	for (uint32_t i=0; i<n; i++){
+
+		double x0 = img_x[i], x1 = img_x[n+i];
+		double x2 = img_x[2*n+i], x3 = img_x[3*n+i];
+		double y0 = img_y[i], y1 = img_y[n+i];
+		double y2 = img_y[2*n+i], y3 = img_y[3*n+i];
+		double c12x, c12y, c12z, det, k_out[3] = {0, 0, 0};
+		double dx, dy, dz, k[4];
+
+		/* The columns of A are (-x0,-y0,-f), (x1,y1,f) and (x2,y2,f),
+		   and b is (x3,y3,f).  Every determinant has a column of the
+		   form (x,y,f), so each is f times a 2D cross product sum. */
+		c12x = y1 - y2;
+		c12y = x2 - x1;
+		c12z = x1 * y2 - x2 * y1;
+
+		det = f * (-x0 * c12x - y0 * c12y) - f * c12z;
+
+		/* a singular system leaves k0/k3 to k2/k3 as zero, as
+		   inverting it with cvInvert() used to */
+		if (det != 0){
+			k_out[0] = (f * (x3 * c12x + y3 * c12y) + f * c12z) / det;
+			k_out[1] = -f * (x0 * (y3 - y2) + y0 * (x2 - x3)
+					 + (x3 * y2 - x2 * y3)) / det;
+			k_out[2] = -f * (x0 * (y1 - y3) + y0 * (x3 - x1)
+					 + (x1 * y3 - x3 * y1)) / det;
+		}
+
+		/* calculate k3 */
+		dx = -k_out[0] * x0 - x3;
+		dy = -k_out[0] * y0 - y3;
+		dz = -k_out[0] * f - f;
+
+		k[3] = fabs(widths[i] / sqrt(dx * dx + dy * dy + dz * dz));
+
+		/* use k3 to calculate the others */
+		k[0] = fabs(k_out[0]) * k[3];
+		k[1] = fabs(k_out[1]) * k[3];
+		k[2] = fabs(k_out[2]) * k[3];
+
+		/* do pose estimation calculation */
+		for (uint8_t v=0; v<4; v++){
+
+			world_x[v*n+i] = img_x[v*n+i] * k[v];
+			world_y[v*n+i] = img_y[v*n+i] * k[v];
+			world_z[v*n+i] = f * k[v];
+
+		}//for
+
+	}//for
+
+}
+
+
+
+/**
+ * @brief given 4 co-planar 2D image points of a square (e.g. a marker), the
+ * width of a side of said square, and camera's parameters (for focal length),
+ * this function calculates the 3D co-ordinates of the 4 vertices
+ *
+ * See \c koki_pose_estimate_soa() for the method.
+ *
  * @param img           the 2D image points of the 4 vertices of the square
  * @param world         the destination 3D points to store the world
  *                      co-ordinates in
@@ -60,75 +154,113 @@ void koki_pose_estimate_arrays(koki_point2Df_t img[4], koki_point3Df_t world[4],
 			       float marker_width, koki_camera_params_t *params)
 {
 
-	CvMat *A, *A_inv, *b, *k_out;
-	float focal_length, k0_over_k3, tmp;
-	float k[4];
+	float img_x[4], img_y[4], world_x[4], world_y[4], world_z[4];
+	float focal_length;
 
 	/* average the X and Y focal lengths
 	   (they are approx. the same, anyway) */
 	focal_length = (params->focal_length.x + params->focal_length.y) / 2;
 
-	A = cvCreateMat(3, 3, CV_64FC1);
-	A_inv = cvCreateMat(3, 3, CV_64FC1);
-	b = cvCreateMat(3, 1, CV_64FC1);
-	k_out = cvCreateMat(3, 1, CV_64FC1);
+	for (uint8_t i=0; i<4; i++){
+		img_x[i] = img[i].x;
+		img_y[i] = img[i].y;
+	}
 
-	/* solve some linear equations */
+	koki_pose_estimate_soa(1, img_x, img_y, &marker_width, focal_length,
+			       world_x, world_y, world_z);
 
-	/* setup A */
-	cvmSet(A, 0, 0, -img[0].x);
-	cvmSet(A, 0, 1,  img[1].x);
-	cvmSet(A, 0, 2,  img[2].x);
+	for (uint8_t i=0; i<4; i++){
+		world[i].x = world_x[i];
+		world[i].y = world_y[i];
+		world[i].z = world_z[i];
+	}
 
-	cvmSet(A, 1, 0, -img[0].y);
-	cvmSet(A, 1, 1,  img[1].y);
-	cvmSet(A, 1, 2,  img[2].y);
+}
+
+
+
+/**
+ * @brief estimates the 3D position in space of a number of markers'
+ *        vertices, a batch at a time
+ *
+ * @param markers        the markers to estimate the positions of
+ * @param n              the number of markers
+ * @param marker_widths  the width, in meters, of each marker
+ * @param params         the camera params
+ */
+void koki_pose_estimate_markers(koki_marker_t **markers, uint32_t n,
+				const float *marker_widths,
+				koki_camera_params_t *params)
+{
 
-	cvmSet(A, 2, 0, -focal_length);
-	cvmSet(A, 2, 1,  focal_length);
-	cvmSet(A, 2, 2,  focal_length);
+	float img_x[4*POSE_BATCH], img_y[4*POSE_BATCH];
+	float world_x[4*POSE_BATCH], world_y[4*POSE_BATCH];
+	float world_z[4*POSE_BATCH];
+	float focal_length;
 
-	/* setup b */
-	cvmSet(b, 0, 0, img[3].x);
-	cvmSet(b, 1, 0, img[3].y);
-	cvmSet(b, 2, 0, focal_length);
+	assert(markers != NULL || n == 0);
+	assert(params != NULL);
 
+	/* average the X and Y focal lengths
+	   (they are approx. the same, anyway) */
+	focal_length = (params->focal_length.x + params->focal_length.y) / 2;
 
-	/* invert A */
-	cvInvert(A, A_inv, CV_LU);
+	for (uint32_t start=0; start<n; start+=POSE_BATCH){
 
-	/* solve */
-	cvMatMulAdd(A_inv, b, NULL, k_out);
+		uint32_t m = n - start < POSE_BATCH ? n - start : POSE_BATCH;
 
+		/* prepare arrays: use co-ordinates with origin being
+		   the principal point */
+		for (uint32_t i=0; i<m; i++){
 
-	k0_over_k3 = cvmGet(k_out, 0, 0);
+			koki_marker_t *marker = markers[start+i];
 
-	/* calculate k3 */
-	tmp = sqrt( pow(-k0_over_k3 * img[0].x - img[3].x, 2) +
-		    pow(-k0_over_k3 * img[0].y - img[3].y, 2) +
-		    pow(-k0_over_k3 * focal_length - focal_length, 2));
+			assert(marker != NULL);
+			assert(marker_widths[start+i] > 0);
 
-	k[3] = fabs(marker_width / tmp);
+			for (uint8_t v=0; v<4; v++){
 
-	/* use k3 to calculate the others */
-	for (uint8_t i=0; i<3; i++)
-		k[i] = fabs(cvmGet(k_out, i, 0)) * k[3];
+				img_x[v*m+i] = marker->vertices[v].image.x -
+					params->principal_point.x;
 
-	/* do pose estimation calculation */
-	for (uint8_t i=0; i<4; i++){
+				img_y[v*m+i] = params->principal_point.y -
+					marker->vertices[v].image.y;
 
-		world[i].x = img[i].x * k[i];
-		world[i].y = img[i].y * k[i];
-		world[i].z = focal_length * k[i];
+			}//for v
+		}//for i
 
-	}//for
+		/* perform estimation */
+		koki_pose_estimate_soa(m, img_x, img_y, &marker_widths[start],
+				       focal_length, world_x, world_y, world_z);
 
+		/* copy results and calc centre point */
+		for (uint32_t i=0; i<m; i++){
 
-	/* clean up */
-	cvReleaseMat(&A);
-	cvReleaseMat(&A_inv);
-	cvReleaseMat(&b);
-	cvReleaseMat(&k_out);
+			koki_marker_t *marker = markers[start+i];
+			koki_point3Df_t centre = {0, 0, 0};
+
+			for (uint8_t v=0; v<4; v++){
+				marker->vertices[v].world.x = world_x[v*m+i];
+				marker->vertices[v].world.y = world_y[v*m+i];
+				marker->vertices[v].world.z = world_z[v*m+i];
+				centre.x += world_x[v*m+i];
+				centre.y += world_y[v*m+i];
+				centre.z += world_z[v*m+i];
+			}
+
+			centre.x /= 4;
+			centre.y /= 4;
+			centre.z /= 4;
+			marker->centre.world = centre;
+
+			/* calc straight line distance to centre */
+			marker->distance = sqrtf(centre.x * centre.x +
+						 centre.y * centre.y +
+						 centre.z * centre.z);
+
+		}//for i
+
+	}//for start
 
 }
 
@@ -145,44 +277,9 @@ void koki_pose_estimate(koki_marker_t *marker, float marker_width,
 			koki_camera_params_t *params)
 {
 
-	koki_point2Df_t image[4];
-	koki_point3Df_t world[4];
-	koki_point3Df_t centre = {0, 0, 0};
-
 	assert(marker != NULL);
 	assert(marker_width > 0);
-	assert(params != NULL);
-
-	/* prepare array: use co-ordinates with origin being
-	   the principal point */
-	for (uint8_t i=0; i<4; i++){
-
-		image[i].x = marker->vertices[i].image.x -
-			params->principal_point.x;
-
-		image[i].y = params->principal_point.y -
-			marker->vertices[i].image.y;
-
-	}//for
-
-	/* perform estimation */
-	koki_pose_estimate_arrays(image, world, marker_width, params);
-
-	/* copy results and calc centre point */
-	for (uint8_t i=0; i<4; i++){
-		marker->vertices[i].world = world[i];
-		centre.x += world[i].x;
-		centre.y += world[i].y;
-		centre.z += world[i].z;
-	}
-
-	marker->centre.world.x = centre.x/4;
-	marker->centre.world.y = centre.y/4;
-	marker->centre.world.z = centre.z/4;
 
-	/* calc straight line distance to centre */
-	marker->distance = sqrt(pow(marker->centre.world.x, 2) +
-				pow(marker->centre.world.y, 2) +
-				pow(marker->centre.world.z, 2));
+	koki_pose_estimate_markers(&marker, 1, &marker_width, params);
 
 }
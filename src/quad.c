@@ -39,47 +39,40 @@
 
 
 /**
- * @brief finds the point in \c chain that is the furthest from \c start
+ * @brief finds the point in a contour that is the furthest from \c start
  *
- * @param start  the \c GSList node (of type \c koki_point2Di_t) with the
- *               start point in it
- * @param chain  the chain of pixels (of type \c koki_point2Di_t) in which
- *               to find the most distant
- * @return       the \c GSList (of type \c koki_point2Di_t) containing the
- *               furthest point
+ * @param contour  the contour to search
+ * @param start    the index of the point to measure from
+ * @param from     the index of the first point to consider; all points
+ *                 from here to the end of the contour are considered
+ * @return         the index of the furthest point, or \c start if no
+ *                 point is further away than it
  */
-static GSList* furthest_point(GSList *start, GSList *chain)
+static uint32_t furthest_point(const koki_contour_t *contour, uint32_t start,
+			       uint32_t from)
 {
 
 	int32_t max_dist_squared, dist_squared, dx, dy;
-	koki_point2Di_t *s, *p;
-	GSList *furthest;
-
-	if (start == NULL)
-		return NULL;
+	const int16_t *x = contour->x, *y = contour->y;
+	uint32_t furthest;
 
 	max_dist_squared = dist_squared = 0;
 	furthest = start;
-	s = start->data;
 
-	while (chain != NULL){
+	for (uint32_t i = from; i < contour->len; i++){
 
-		p = chain->data;
-
-		dx = p->x - s->x;
-		dy = p->y - s->y;
+		dx = x[i] - x[start];
+		dy = y[i] - y[start];
 
 		dist_squared = dx*dx + dy*dy;
 
 		if (dist_squared > max_dist_squared){
 
 			max_dist_squared = dist_squared;
-			furthest = chain;
+			furthest = i;
 
 		}
 
-		chain = chain->next;
-
 	}
 
 	return furthest;
@@ -98,10 +91,10 @@ static GSList* furthest_point(GSList *start, GSList *chain)
  * point.
  *
  * Imagine a point chain, starting at \c start and ending at \c end, which
- * contains a point we'd like to test, \c link (in the code below, using \c t
+ * contains a point we'd like to test, \c i (in the code below, using \c t
  * as above). Now imagine a line drawn from \c start to \c end. We construct
  * a line that is perpendicular to the line from \c start to \c end which
- * passes through point \c t (or \c link).  The aim of this function is to
+ * passes through point \c t (or \c i).  The aim of this function is to
  * find the point \c t in the chain where the distance from \c t to the
  * intersection of the perpendicular line and the line from \c start to \c end
  * is greatest.
@@ -111,44 +104,35 @@ static GSList* furthest_point(GSList *start, GSList *chain)
  * is sufficiently small enough for it to be considered a vertex.
 
  *
- * @param start           a pointer to the first item in the chain to be
+ * @param contour         the contour the chain is part of
+ * @param start           the index of the first point in the chain to be
  *                        considered
- * @param end             a pointer to the last item in the chain to be
- *                        considered
- * @param furthest point  a pointer to a \c GSList* where the furthest point
- *                        will be stored
+ * @param end             the index of the last point in the chain to be
+ *                        considered, which must be after \c start
+ * @param furthest point  where the index of the furthest point will be
+ *                        stored
  * @return                the length of the line perpendicular to \c start -->
- *                        \c end
+ *                        \c end, or -1 if there's no vertex between them
  */
-static int32_t furthest_point_perpendicular_to_line(GSList *start, GSList *end,
-						    GSList **furthest_point)
+static int32_t furthest_point_perpendicular_to_line(const koki_contour_t *contour,
+						    uint32_t start, uint32_t end,
+						    uint32_t *furthest_point)
 {
 
 	int16_t ys_minus_ye, xe_minus_xs, xt_minus_xs, yt_minus_ys;
 	int16_t x_dist, y_dist;
 	int32_t dist_squared, max_dist_squared = -1;
 	int32_t threshold;
-	koki_point2Di_t *start_point, *end_point, *chain_point;
+	const int16_t *x = contour->x, *y = contour->y;
 	float scale_fraction, scale_fraction_dividend, scale_fraction_divisor;
-	GSList *link, *furthest = NULL;
+	uint32_t furthest = start;
 
 
-	if (start == NULL || end == NULL){
-		*furthest_point = NULL;
-		return -1;
-	}
+	xe_minus_xs = x[end] - x[start];
+	ys_minus_ye = y[start] - y[end];
 
-	/* get the points out */
-	start_point = start->data;
-	end_point = end->data;
-
-	xe_minus_xs = end_point->x - start_point->x;
-	ys_minus_ye = start_point->y - end_point->y;
-
-	if (xe_minus_xs == 0 && ys_minus_ye == 0){
-		*furthest_point = NULL;
+	if (xe_minus_xs == 0 && ys_minus_ye == 0)
 		return -1;
-	}
 
 	/* calculate a threshold based on the area involved. It will
 	   be used to decide whether or not furthest point is likely
@@ -160,20 +144,18 @@ static int32_t furthest_point_perpendicular_to_line(GSList *start, GSList *end,
 	threshold = (xe_minus_xs * xe_minus_xs +
 		     ys_minus_ye * ys_minus_ye) / n + 1;
 
-	for (link = start->next; link != NULL && link != end; link = link->next){
+	/* the same for every point */
+	scale_fraction_divisor = (float)(-(xe_minus_xs * xe_minus_xs)
+					 -(ys_minus_ye * ys_minus_ye));
 
-		/* get the associated point */
-		chain_point = link->data;
+	for (uint32_t i = start + 1; i < end; i++){
 
-		xt_minus_xs = chain_point->x - start_point->x;
-		yt_minus_ys = chain_point->y - start_point->y;
+		xt_minus_xs = x[i] - x[start];
+		yt_minus_ys = y[i] - y[start];
 
 		scale_fraction_dividend = (float)(ys_minus_ye * xt_minus_xs +
 						  xe_minus_xs * yt_minus_ys);
 
-		scale_fraction_divisor = (float)(-(xe_minus_xs * xe_minus_xs)
-						 -(ys_minus_ye * ys_minus_ye));
-
 		scale_fraction =
 			scale_fraction_dividend
 			/ scale_fraction_divisor;
@@ -187,7 +169,7 @@ static int32_t furthest_point_perpendicular_to_line(GSList *start, GSList *end,
 		/* is it the furthest we've seen? */
 		if (dist_squared > max_dist_squared){
 			max_dist_squared = dist_squared;
-			furthest = link;
+			furthest = i;
 		}
 
 	}//for
@@ -199,10 +181,9 @@ static int32_t furthest_point_perpendicular_to_line(GSList *start, GSList *end,
 
 		koki_debug(KOKI_DEBUG_INFO,
 			   "(%d, %d)<-->(%d, %d) Not pointy enough, mds: %d, threshold:%d\n",
-			   start_point->x, start_point->y, end_point->x, end_point->y,
+			   x[start], y[start], x[end], y[end],
 			   max_dist_squared, threshold);
 
-		*furthest_point = NULL;
 		return -1;
 
 	}
@@ -220,30 +201,31 @@ static int32_t furthest_point_perpendicular_to_line(GSList *start, GSList *end,
  * @brief given two points of a contour, \c start and \c end, this function
  *        finds vertices between them, if any.
  *
- * @param start           the \c GSList* of the start node
- * @param end             the \c GSList* of the end node
- * @param points          an array that may contain points on return
+ * @param contour         the contour the points are in
+ * @param start           the index of the start point
+ * @param end             the index of the end point
+ * @param points          an array that may contain the indices of points on
+ *                        return
  * @param num_points      a pointer to an count for the number of points in
  *                        \c points
  * @param vertices_found  a pointer the the number of vertices found so far,
  *                        used to limit the recursion
  */
-static void find_intermediate_vertices(GSList *start, GSList *end,
-				       GSList *points[10], uint8_t *num_points,
+static void find_intermediate_vertices(const koki_contour_t *contour,
+				       uint32_t start, uint32_t end,
+				       uint32_t points[10], uint8_t *num_points,
 				       uint8_t *vertices_found)
 {
 
-	GSList *furthest;
+	uint32_t furthest;
 	int32_t dist;
-	koki_point2Di_t *start_point, *end_point;
-
-	start_point = start->data;
-	end_point = end->data;
 
 	koki_debug(KOKI_DEBUG_INFO, "f_i_v: start: (%d, %d), end: (%d, %d)\n",
-		   start_point->x, start_point->y, end_point->x, end_point->y);
+		   contour->x[start], contour->y[start],
+		   contour->x[end], contour->y[end]);
 
-	dist = furthest_point_perpendicular_to_line(start, end, &furthest);
+	dist = furthest_point_perpendicular_to_line(contour, start, end,
+						    &furthest);
 
 	if (dist < 0)
 		return;
@@ -254,8 +236,7 @@ static void find_intermediate_vertices(GSList *start, GSList *end,
 	(*num_points)++;
 
 	koki_debug(KOKI_DEBUG_INFO, "added vertex (%d, %d)\n",
-		   ((koki_point2Di_t*)furthest->data)->x,
-		   ((koki_point2Di_t*)furthest->data)->y);
+		   contour->x[furthest], contour->y[furthest]);
 
 	/* now for the recursive bit */
 
@@ -265,7 +246,7 @@ static void find_intermediate_vertices(GSList *start, GSList *end,
 
 	/* start --> furthest */
 	koki_debug(KOKI_DEBUG_INFO, "First f_i_v recursive call\n");
-	find_intermediate_vertices(start, furthest, points, num_points,
+	find_intermediate_vertices(contour, start, furthest, points, num_points,
 				   vertices_found);
 
 	/* make sure we don't find too many for a quad */
@@ -274,7 +255,7 @@ static void find_intermediate_vertices(GSList *start, GSList *end,
 
 	/* furthest --> end */
 	koki_debug(KOKI_DEBUG_INFO, "Second f_i_v recursive call\n");
-	find_intermediate_vertices(furthest, end, points, num_points,
+	find_intermediate_vertices(contour, furthest, end, points, num_points,
 				   vertices_found);
 
 
@@ -283,149 +264,153 @@ static void find_intermediate_vertices(GSList *start, GSList *end,
 
 
 /**
- * @brief a quick test to see if a \c GSList is of sufficient length for use
+ * @brief returns the index of a point approximately in the middle of two
+ *        others
  *
- * @param l  the \c GSList to test the length of
- * @param n  the requred minimum length
- * @return   TRUE if it's length is greater than \c n, FALSE otherwise
+ * @param start  the index of the point at the begining of the chain
+ * @param end    the index of the point at the end of the chain
+ * @return       the index of the point which is approximately in the
+ *               centre of \c start and \c end
  */
-static bool slist_longer_than(GSList *l, uint16_t n)
+static uint32_t chain_middle(uint32_t start, uint32_t end)
 {
 
-	for (uint8_t i=0; i<n+1; i++){
-		if (l == NULL)
-			return FALSE;
-		l = l->next;
-	}
-
-	return TRUE;
+	return start + (end - start) / 2;
 
 }
 
 
 
 /**
- * @brief returns a pointer to the last element in the \c GSList
+ * @brief given 4 vertices and the contour they are from, this function
+ *        returns a pointer to a \c koki_quad_t with the vertices ordered
+ *        in a clockwise manner, starting at \c v1.
  *
- * @param l  a pointer to the \c GSList in question
- * @return   the last element
+ * @param v1       the index of the first vertex, which must be the start
+ *                 of the contour
+ * @param v2       the index of the second vertex
+ * @param v3       the index of the third vertex
+ * @param v4       the index of the fourth vertex
+ * @param contour  the contour the vertices are from
+ * @param arena    the arena to allocate the quad from, or NULL to
+ *                 malloc() it
  */
-static GSList* last_in_slist(GSList *l)
+static koki_quad_t* quad_from_vertices(uint32_t v1, uint32_t v2, uint32_t v3,
+				       uint32_t v4, const koki_contour_t *contour,
+				       koki_arena_t *arena)
 {
 
-	if (l == NULL)
-		return NULL;
+	koki_quad_t q, *quad = &q;
+	uint32_t tmp;
+	koki_point2Df_t centre;
 
-	while (l->next != NULL)
-		l = l->next;
+	assert(v1 == 0);
 
-	return l;
+	/* put the other three in the order they appear in the contour */
+	if (v2 > v3){ tmp = v2; v2 = v3; v3 = tmp; }
+	if (v3 > v4){ tmp = v3; v3 = v4; v4 = tmp; }
+	if (v2 > v3){ tmp = v2; v2 = v3; v3 = tmp; }
 
-}
+	assert(v1 < v2 && v2 < v3 && v3 < v4);
 
+	quad->contour = contour;
+	quad->indices[0] = v1;
+	quad->indices[1] = v2;
+	quad->indices[2] = v3;
+	quad->indices[3] = v4;
 
+	for (uint8_t i=0; i<4; i++){
+		quad->links[i] = NULL;
+		quad->vertices[i].x = contour->x[quad->indices[i]];
+		quad->vertices[i].y = contour->y[quad->indices[i]];
+	}
 
-/**
- * @brief returns an element that is approximately in the middle of the
- *        \c GSList between two elements
- *
- * @param start  the element to be considered at the begining of the list
- * @param end    the element to be considered at the end of the list
- * @return       the \c GSList which is approximately in the centre of
- *               \c start and \c end
- */
-static GSList* slist_middle(GSList *start, GSList *end)
-{
 
-	uint16_t i, len = 1;
-	GSList *l;
+	/* check we don't ave a boomerang shape */
+	centre.x = (float)(quad->vertices[0].x + quad->vertices[2].x) / 2;
 
-	if (start == NULL || end == NULL)
-		return NULL;
+	if ( (centre.x - quad->vertices[1].x) *
+	     (centre.x - quad->vertices[3].x) > 0){
+
+	  /* it's a boomerang shape */
 
-	l = start;
+	  return NULL;
 
-	while (l->next != end){
-		len++;
-		l = l->next;
 	}
 
-	for (l = start, i=0;
-	     i < len/2;
-	     i++, l=l->next);
+	/* it's a keeper, so allocate it */
+	if (arena != NULL)
+		quad = koki_arena_alloc(arena, sizeof(koki_quad_t));
+	else
+		quad = malloc(sizeof(koki_quad_t));
+	assert(quad != NULL);
+
+	*quad = q;
 
-	return l;
+	return quad;
 
 }
 
 
 
 /**
- * @brief given 4 vertices and the contour they are from, this function
- *        returns a pointer to a \c koki_quad_t with the vertices ordered
- *        in a clockwise manner, starting at \c v1.
+ * @brief given a contour chain, the function works out if the chain
+ *        could represent a quadrilateral
  *
- * @param v1       the first vertex
- * @param v2       the second vertex
- * @param v3       the third vertex
- * @param v4       the fourth vertex
- * @param contour  the contour the vertices are from
+ * @param contour  the chain to check
+ * @return         a populated \c koki_quad_t if a quad has been found,
+ *                 NULL otherwise
  */
-static koki_quad_t* quad_from_vertices(GSList *v1, GSList *v2, GSList *v3,
-				       GSList *v4, GSList *contour)
+koki_quad_t* koki_quad_find_vertices(GSList *contour)
 {
 
-	koki_quad_t *quad;
-	uint8_t n = 1;
-	koki_point2Df_t centre;
-
-	quad = malloc(sizeof(koki_quad_t));
-	assert(quad != NULL);
-
-	assert(v1 == contour);
+	return koki_quad_find_vertices_arena(contour, NULL);
 
-	quad->links[0] = v1;
-
-	while (contour != NULL){
-
-		if (contour == v2){
-			quad->links[n] = v2;
-			n++;
-		} else if (contour == v3){
-			quad->links[n] = v3;
-			n++;
-		} else if (contour == v4){
-			quad->links[n] = v4;
-			n++;
-		}
-
-		contour = contour->next;
+}
 
-	}
 
-	assert(n == 4);
 
-	for (uint8_t i=0; i<4; i++){
-		koki_point2Di_t *p;
-		p = quad->links[i]->data;
-		quad->vertices[i].x = p->x;
-		quad->vertices[i].y = p->y;
-	}
+/**
+ * @brief finds the vertices of a quad just as \c koki_quad_find_vertices()
+ *        does, but allocates the quad from an arena
+ *
+ * The quad is freed when the arena is reset, and must not be passed to
+ * \c koki_quad_free().
+ *
+ * @param contour  the contour to find the vertices of
+ * @param arena    the arena to allocate the quad from, or NULL to allocate
+ *                 it as \c koki_quad_find_vertices() does
+ * @return         the quad, or NULL if the contour isn't a quad
+ */
+koki_quad_t* koki_quad_find_vertices_arena(GSList *contour, koki_arena_t *arena)
+{
 
+	koki_contour_t *points;
+	koki_quad_t *quad;
+	GSList *l;
+	uint32_t i;
+	uint8_t v;
 
-	/* check we don't ave a boomerang shape */
-	centre.x = (float)(quad->vertices[0].x + quad->vertices[2].x) / 2;
+	points = koki_contour_from_slist(contour, arena);
+	quad = koki_quad_find_vertices_array(points, arena);
 
-	if ( (centre.x - quad->vertices[1].x) *
-	     (centre.x - quad->vertices[3].x) > 0){
+	if (quad != NULL){
 
-	  /* it's a boomerang shape */
+		/* find the links for the vertices */
+		for (l = contour, i = 0, v = 0; v < 4; l = l->next, i++)
+			if (i == quad->indices[v])
+				quad->links[v++] = l;
 
-	  free(quad);
-	  quad = NULL;
+		/* an arena's copy of the points lasts as long as the quad,
+		   so it can be used when refining the vertices */
+		if (arena == NULL)
+			quad->contour = NULL;
 
 	}
 
+	if (arena == NULL)
+		koki_contour_array_free(points);
+
 	return quad;
 
 }
@@ -433,41 +418,45 @@ static koki_quad_t* quad_from_vertices(GSList *v1, GSList *v2, GSList *v3,
 
 
 /**
- * @brief given a contour chain, the function works out if the chain
- *        could represent a quadrilateral
+ * @brief finds the vertices of a quad in a contour found by
+ *        \c koki_contour_find_array()
  *
- * @param contour  the chain to check
- * @return         a populated \c koki_quad_t if a quad has been found,
- *                 NULL otherwise
+ * The quad refers to the contour, which must last at least as long as it
+ * does.  Its \c links are all NULL.
+ *
+ * @param contour  the contour to find the vertices of
+ * @param arena    the arena to allocate the quad from, or NULL to malloc()
+ *                 it, in which case it should be freed with
+ *                 \c koki_quad_free()
+ * @return         the quad, or NULL if the contour isn't a quad
  */
-koki_quad_t* koki_quad_find_vertices(GSList *contour)
+koki_quad_t* koki_quad_find_vertices_array(const koki_contour_t *contour,
+					   koki_arena_t *arena)
 {
 
-	GSList *v1, *v2, *v3, *v4; /* number don't mean anything here */
-	GSList *end, *tmp;
+	uint32_t v1, v2, v3, v4; /* number don't mean anything here */
+	uint32_t end, tmp;
 	uint8_t vertices_found, num_points1, num_points2;
-	GSList *points1[10], *points2[10];
+	uint32_t points1[10], points2[10];
 
 	/* make sure there are enough points to make a quad */
-	if (!slist_longer_than(contour, 4))
+	if (contour->len <= 4)
 		return NULL;
 
 	/* get first 2 vertices (our starting point, and the point
 	   furthest from it) */
-	v1 = contour;
-	v2 = furthest_point(v1, contour->next);
+	v1 = 0;
+	v2 = furthest_point(contour, v1, 1);
 
 	koki_debug(KOKI_DEBUG_INFO, "v1: (%d, %d), v2: (%d, %d)\n",
-		   ((koki_point2Di_t*)v1->data)->x,
-		   ((koki_point2Di_t*)v1->data)->y,
-		   ((koki_point2Di_t*)v2->data)->x,
-		   ((koki_point2Di_t*)v2->data)->y);
+		   contour->x[v1], contour->y[v1],
+		   contour->x[v2], contour->y[v2]);
 
 	/* find the last in the chain */
-	end = last_in_slist(contour);
+	end = contour->len - 1;
 
 	/* make sure everything's in order */
-	if (v1 == NULL || v2 == NULL || end == NULL)
+	if (v2 == v1)
 		return NULL;
 
 	/* now find vertices between v1 and v2, and v2 and the end */
@@ -476,11 +465,11 @@ koki_quad_t* koki_quad_find_vertices(GSList *contour)
 	num_points1 = num_points2 = 0;
 
 	koki_debug(KOKI_DEBUG_INFO, "First *initial* f_i_v call\n");
-	find_intermediate_vertices(v1, v2, points1, &num_points1,
+	find_intermediate_vertices(contour, v1, v2, points1, &num_points1,
 				   &vertices_found);
 
 	koki_debug(KOKI_DEBUG_INFO, "Second *initial* f_i_v call\n");
-	find_intermediate_vertices(v2, end, points2, &num_points2,
+	find_intermediate_vertices(contour, v2, end, points2, &num_points2,
 				   &vertices_found);
 
 
@@ -504,15 +493,15 @@ koki_quad_t* koki_quad_find_vertices(GSList *contour)
 			koki_debug(KOKI_DEBUG_INFO,
 				   "v1-->v2 contains 0 vertices, v2-->end has more than 1\n");
 
-			tmp = slist_middle(v2, end);
+			tmp = chain_middle(v2, end);
 
 			num_points1 = 0;
-			find_intermediate_vertices(v2, tmp, points1,
+			find_intermediate_vertices(contour, v2, tmp, points1,
 						   &num_points1,
 						   &vertices_found);
 
 			num_points2 = 0;
-			find_intermediate_vertices(tmp, end, points2,
+			find_intermediate_vertices(contour, tmp, end, points2,
 						   &num_points2,
 						   &vertices_found);
 
@@ -534,15 +523,15 @@ koki_quad_t* koki_quad_find_vertices(GSList *contour)
 			koki_debug(KOKI_DEBUG_INFO,
 				   "v1-->v2 contains more than 1 vertices, v2-->end has 0\n");
 
-			tmp = slist_middle(v1, v2);
+			tmp = chain_middle(v1, v2);
 
 			num_points1 = 0;
-			find_intermediate_vertices(v1, tmp, points1,
+			find_intermediate_vertices(contour, v1, tmp, points1,
 						   &num_points1,
 						   &vertices_found);
 
 			num_points2 = 0;
-			find_intermediate_vertices(tmp, v2, points2,
+			find_intermediate_vertices(contour, tmp, v2, points2,
 						   &num_points2,
 						   &vertices_found);
 
@@ -565,7 +554,7 @@ koki_quad_t* koki_quad_find_vertices(GSList *contour)
 
 	}//if
 
-	return quad_from_vertices(v1, v2, v3, v4, contour);
+	return quad_from_vertices(v1, v2, v3, v4, contour, arena);
 
 }
 
@@ -665,71 +654,70 @@ static void pca_output_debug(koki_point2Df_t vects[2], float vals[2],
 
 
 /**
- * @brief finds the number of nodes in a list between two points
+ * @brief finds the middle of a chain (identified by a start and end point)
+ *        that is the same as the original, but with 5% of each end removed
  *
- * @param start  the start node
- * @param end    the end node (can be \c NULL for the end of the list)
- * @return       the length of sublist \c start --> \c end
+ * @param contour    the contour the chain is in
+ * @param src_start  the index of the start point of the original chain
+ * @param src_end    the index one past the end of the original chain
+ * @param dst_start  where to store the index of the start point of the new
+ *                   chain
+ * @return           the length of the new chain, including its end point,
+ *                   which is never past the end of the contour
  */
-static uint16_t length_between(GSList *start, GSList *end)
+static uint32_t get_centre_section(const koki_contour_t *contour,
+				   uint32_t src_start, uint32_t src_end,
+				   uint32_t *dst_start)
 {
 
-	uint16_t ret = 0;
+	uint32_t len, start_offset, new_len, dst_end;
 
-	while (start != NULL && start != end){
-		ret++;
-		start = start->next;
-	}
+	assert(src_start < src_end && src_end <= contour->len);
+
+	len = src_end - src_start;
+
+	new_len = (uint32_t)(len * 0.9);
+	start_offset = (uint32_t)(len * 0.05);
+
+	*dst_start = src_start + start_offset;
+	dst_end = *dst_start + new_len;
 
-	return ret;
+	if (dst_end >= contour->len)
+		dst_end = contour->len - 1;
+
+	return dst_end - *dst_start + 1;
 
 }
 
 
 
 /**
- * @brief finds the middle of a chain (identified by a start and end node)
- *        that is the same as the original, but with 5% of each end removed
+ * @brief performs PCA on the centre section of one side of a quad
  *
- * @param src_start  the start node of the original list
- * @param src_end    the end node of the original list
- * @param dst_start  a pointer to a \c GSList* to store the start node of the
- *                   new list
- * @param dst_end    a pointer to a \c GSList* to store the end node of the
- *                   new list
- * @return           the length of the new list
+ * @param quad   the quad, which must have a contour
+ * @param side   the side of the quad, from vertex \c side to the next
+ * @param vects  the array that will have the eigen vectors written to
+ * @param vals   the array that will have the eigen values written to
+ * @param avgs   where to write the mean of the side's points
  */
-static uint16_t get_centre_section(GSList *src_start, GSList *src_end,
-			GSList **dst_start, GSList **dst_end)
+static void side_pca(const koki_quad_t *quad, uint8_t side,
+		     koki_point2Df_t vects[2], float vals[2],
+		     koki_point2Df_t *avgs)
 {
 
-	uint16_t len, start_offset, new_len;
-	GSList *l = NULL;
-
-	assert(src_start != NULL);
-	assert(dst_start != NULL && dst_end != NULL);
-
-	len = length_between(src_start, src_end);
-	if (len < 10){
-		*dst_start = NULL;
-		*dst_end = NULL;
-	}
-
-	new_len = (uint16_t)(len * 0.9);
-	start_offset = (uint16_t)(len * 0.05);
+	const koki_contour_t *contour = quad->contour;
+	uint32_t start, end, len;
 
-	l = src_start;
-	for (uint16_t i=0; i<start_offset; i++)
-		l = l->next;
+	/* the last side runs to the end of the contour */
+	if (side < 3)
+		end = quad->indices[side + 1];
+	else
+		end = contour->len;
 
-	*dst_start = l;
-
-	for (uint16_t i=0; i<new_len; i++)
-		l = l->next;
-
-	*dst_end = l;
-
-	return new_len;
+	len = get_centre_section(contour, quad->indices[side], end, &start);
+	koki_pca_array(&contour->x[start], &contour->y[start], len,
+		       vects, vals, avgs);
+	pca_output_debug(vects, vals, *avgs, side);
 
 }
 
@@ -748,35 +736,28 @@ void koki_quad_refine_vertices(koki_quad_t *quad)
 	koki_point2Df_t vects[4][2];
 	float vals[4][2];
 	koki_point2Df_t avgs[4];
-	GSList *start, *end;
+	koki_contour_t *points = NULL;
 
 	if (quad == NULL)
 		return;
 
+	/* quads found in a GSList contour need its points in an array */
+	if (quad->contour == NULL){
+		points = koki_contour_from_slist(quad->links[0], NULL);
+		quad->contour = points;
+	}
 
 	/* perform PCA on edges between vertices */
 	koki_debug(KOKI_DEBUG_INFO, "PCA on quad\n");
 	koki_debug(KOKI_DEBUG_INFO, "-----------\n");
 
-	/* side 0 (v0 --> v1) */
-	get_centre_section(quad->links[0], quad->links[1], &start, &end);
-	koki_pca(start, end, vects[0], vals[0], &avgs[0]);
-	pca_output_debug(vects[0], vals[0], avgs[0], 0);
-
-	/* side 1 (v1 --> v2) */
-	get_centre_section(quad->links[1], quad->links[2], &start, &end);
-	koki_pca(start, end, vects[1], vals[1], &avgs[1]);
-	pca_output_debug(vects[1], vals[1], avgs[1], 1);
-
-	/* side 2  (v2 --> v3) */
-	get_centre_section(quad->links[2], quad->links[3], &start, &end);
-	koki_pca(start, end, vects[2], vals[2], &avgs[2]);
-	pca_output_debug(vects[2], vals[2], avgs[2], 2);
-
-	/* side 3 (v3 --> [end]) */
-	get_centre_section(quad->links[3], NULL, &start, &end);
-	koki_pca(start, end, vects[3], vals[3], &avgs[3]);
-	pca_output_debug(vects[3], vals[3], avgs[3], 3);
+	for (uint8_t side=0; side<4; side++)
+		side_pca(quad, side, vects[side], vals[side], &avgs[side]);
+
+	if (points != NULL){
+		quad->contour = NULL;
+		koki_contour_array_free(points);
+	}
 
 
 	/* set vertex positions based on the intersection of PCA's
@@ -0,0 +1,154 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  queue.c
+ * @brief Implementation of the single-producer, single-consumer queue
+ */
+
+#include <stdlib.h>
+#include <glib.h>
+
+#include "queue.h"
+
+/**
+ * @brief create a queue
+ *
+ * @param size  the most items it can hold, which is rounded up to a power
+ *              of two
+ * @return      the new queue
+ */
+koki_queue_t* koki_queue_new( uint32_t size )
+{
+	koki_queue_t *q = g_malloc0( sizeof(koki_queue_t) );
+	uint32_t n = 1;
+
+	g_assert( size >= 1 && size <= 0x80000000 );
+
+	while( n < size )
+		n <<= 1;
+
+	q->items = g_malloc0( sizeof(void*) * n );
+	q->mask = n - 1;
+
+	g_mutex_init( &q->lock );
+	g_cond_init( &q->wake );
+
+	return q;
+}
+
+/**
+ * @brief free a queue, but not the items still in it
+ *
+ * @param q  the queue, which mustn't be in use
+ */
+void koki_queue_free( koki_queue_t *q )
+{
+	g_cond_clear( &q->wake );
+	g_mutex_clear( &q->lock );
+
+	g_free( q->items );
+	g_free( q );
+}
+
+/**
+ * @brief push an item on to the back of a queue, from the producer
+ *
+ * @param q     the queue
+ * @param item  the item, which mustn't be NULL
+ * @return      TRUE if it was pushed, FALSE if the queue is full
+ */
+bool koki_queue_push( koki_queue_t *q, void *item )
+{
+	uint32_t tail = q->tail;
+
+	g_assert( item != NULL );
+
+	if( tail - __atomic_load_n( &q->head, __ATOMIC_ACQUIRE ) > q->mask )
+		return FALSE;
+
+	q->items[ tail & q->mask ] = item;
+	__atomic_store_n( &q->tail, tail + 1, __ATOMIC_RELEASE );
+
+	/* The consumer checks the queue again after saying it's going to
+	   sleep, so between this and that, one of us sees the other */
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+	if( __atomic_load_n( &q->sleeping, __ATOMIC_RELAXED ) ) {
+		g_mutex_lock( &q->lock );
+		g_cond_signal( &q->wake );
+		g_mutex_unlock( &q->lock );
+	}
+
+	return TRUE;
+}
+
+/**
+ * @brief pop the item from the front of a queue, from the consumer
+ *
+ * @param q  the queue
+ * @return   the item, or NULL if the queue is empty
+ */
+void* koki_queue_pop( koki_queue_t *q )
+{
+	uint32_t head = q->head;
+	void *item;
+
+	if( head == __atomic_load_n( &q->tail, __ATOMIC_ACQUIRE ) )
+		return NULL;
+
+	item = q->items[ head & q->mask ];
+	__atomic_store_n( &q->head, head + 1, __ATOMIC_RELEASE );
+
+	return item;
+}
+
+/**
+ * @brief pop the item from the front of a queue, from the consumer,
+ *        waiting for one to be pushed if it's empty
+ *
+ * @param q        the queue
+ * @param timeout  the longest to wait, in microseconds
+ * @return         the item, or NULL if none was pushed in time
+ */
+void* koki_queue_pop_wait( koki_queue_t *q, gint64 timeout )
+{
+	gint64 end;
+	void *item;
+
+	item = koki_queue_pop( q );
+	if( item != NULL )
+		return item;
+
+	end = g_get_monotonic_time() + timeout;
+
+	g_mutex_lock( &q->lock );
+	__atomic_store_n( &q->sleeping, 1, __ATOMIC_RELAXED );
+	__atomic_thread_fence( __ATOMIC_SEQ_CST );
+
+	while( (item = koki_queue_pop( q )) == NULL )
+		if( !g_cond_wait_until( &q->wake, &q->lock, end ) )
+			break;
+
+	if( item == NULL )
+		item = koki_queue_pop( q );
+
+	__atomic_store_n( &q->sleeping, 0, __ATOMIC_RELAXED );
+	g_mutex_unlock( &q->lock );
+
+	return item;
+}
@@ -21,7 +21,6 @@
  */
 
 #include <stdint.h>
-#include <cv.h>
 #include <assert.h>
 #include <math.h>
 
@@ -34,11 +33,18 @@
 #define M_PI 3.14159265
 #endif
 
+/**
+ * @brief the most markers whose co-ordinates are gathered onto the stack
+ *        at once by \c koki_rotation_estimate_markers()
+ */
+#define ROTATION_BATCH 32
+
+
 
 /**
- * @brief given 4 planar 3D points with the mean of the points at (0, 0, 0),
- *        i.e. rotations about the centre, calculate the rotation about each
- *        of the 3 axes
+ * @brief given sets of 4 planar 3D points, each with the mean of its points
+ *        at (0, 0, 0), i.e. rotations about the centre, calculate the
+ *        rotation of each set about each of the 3 axes
  *
  * To calcuate rotation about the X and Y axes, the normal to the 4 planar
  * points is constructed using the formula:
@@ -52,6 +58,95 @@
  *
  * In the code, \c p2 is referred to as \c a, and \c p3 as \c b.
  *
+ * Each array holds point \c v of set \c i at index \c v*n+i.
+ *
+ * @param n      the number of sets of points
+ * @param x      the X co-ordinates of the points, centred about some centre
+ *               (i.e. the mean of the 4 points)
+ * @param y      the Y co-ordinates of the points
+ * @param z      the Z co-ordinates of the points
+ * @param rot_x  where to write each set's rotation about the X axis, in
+ *               degrees
+ * @param rot_y  where to write each set's rotation about the Y axis
+ * @param rot_z  where to write each set's rotation about the Z axis
+ */
+void koki_rotation_estimate_soa(uint32_t n, const float *x, const float *y,
+				const float *z, float *rot_x, float *rot_y,
+				float *rot_z)
+{
+
+	for (uint32_t i=0; i<n; i++){
+
+		float ax = x[i], ay = y[i], az = z[i];
+		float bx = x[n+i], by = y[n+i], bz = z[n+i];
+		float nx, ny, nz, len, mx, my, mz, ux, uy;
+		float cos_x, cos_y, sin_x, sin_y;
+		float out_x, out_y;
+
+		/* calculate normal -- Note that this assumes the centre of
+		   the points is \c (0, 0, 0) */
+		nx = ay * bz - az * by;
+		ny = az * bx - ax * bz;
+		nz = ax * by - ay * bx;
+
+		/* normalise -- unit vector */
+		len = sqrtf(nx * nx + ny * ny + nz * nz);
+		nx /= len;
+		ny /= len;
+		nz /= len;
+
+		/* rotation about Y --> atan2(n_x, n_z) */
+		out_y = atan2(nx, nz);
+
+		/* rotation about X --> atan2(n_y, len) */
+		out_x = asin(ny);
+
+		/* re-jiggle the numbers to be between +/- 180 degrees (M_PI
+		   radians) */
+		out_y = M_PI - out_y;
+
+		/* put in range: -180 < angle <= 180 (but in radians) */
+		out_x -= out_x >= M_PI ? 2 * M_PI : 0;
+		out_y -= out_y >= M_PI ? 2 * M_PI : 0;
+
+		/* invert Y so that +ve rotations are looking towards the +ve
+		   end of the axis from (0, 0, 0), and rotating anti-clockwise */
+		out_y = -out_y;
+
+		/* rotation about Z -- unrotate the centre point of the top edge
+		   about X and Y as calculated, then calculate Z rotation from
+		   there.  Only the first two rows of the rotation matrix are
+		   needed. */
+		sin_x = sin(-out_x);
+		sin_y = sin(-out_y);
+		cos_x = cos(-out_x);
+		cos_y = cos(-out_y);
+
+		mx = (ax + bx) / 2;
+		my = (ay + by) / 2;
+		mz = (az + bz) / 2;
+
+		ux = cos_y * mx + sin_y * mz;
+		uy = sin_x * sin_y * mx + cos_x * my - sin_x * cos_y * mz;
+
+		/* convert to degrees */
+		rot_x[i] = out_x * (180.0 / M_PI);
+		rot_y[i] = out_y * (180.0 / M_PI);
+		rot_z[i] = atan2(ux, uy) * (180.0 / M_PI);
+
+	}//for
+
+}
+
+
+
+/**
+ * @brief given 4 planar 3D points with the mean of the points at (0, 0, 0),
+ *        i.e. rotations about the centre, calculate the rotation about each
+ *        of the 3 axes
+ *
+ * See \c koki_rotation_estimate_soa() for the method.
+ *
  * @param points  the array of points, centred about some centre (i.e. the
  *                mean of the 4 points) to estimate the rotation of
  * @return        an estimate of the rotation of the points, as a
@@ -60,114 +155,95 @@
 koki_marker_rotation_t koki_rotation_estimate_array(koki_point3Df_t points[4])
 {
 
-	CvMat *a;
-	CvMat *b;
-	CvMat *n;
-	CvMat *R;
-	float len;
-	float cos_x, cos_y, sin_x, sin_y;
+	float x[4], y[4], z[4];
 	koki_marker_rotation_t output;
 
 	assert(points != NULL);
 
-	/* calculate normal */
-	a = cvCreateMat(3, 1, CV_64FC1);
-	b = cvCreateMat(3, 1, CV_64FC1);
-	n = cvCreateMat(3, 1, CV_64FC1);
-
-	/* fill a */
-	cvmSet(a, 0, 0, points[0].x);
-	cvmSet(a, 1, 0, points[0].y);
-	cvmSet(a, 2, 0, points[0].z);
-
-	/* fill b */
-	cvmSet(b, 0, 0, points[1].x);
-	cvmSet(b, 1, 0, points[1].y);
-	cvmSet(b, 2, 0, points[1].z);
-
+	for (uint8_t i=0; i<4; i++){
+		x[i] = points[i].x;
+		y[i] = points[i].y;
+		z[i] = points[i].z;
+	}
 
-	/* calculate normal -- Note that this assumes the centre of
-	   the points is \c (0, 0, 0) */
-	cvCrossProduct(a, b, n);
+	koki_rotation_estimate_soa(1, x, y, z, &output.x, &output.y, &output.z);
 
-	/* normalise -- unit vector */
-	len = sqrt(pow(cvmGet(n, 0, 0), 2) +
-		   pow(cvmGet(n, 1, 0), 2) +
-		   pow(cvmGet(n, 2, 0), 2));
+	return output;
 
-	for (uint8_t i=0; i<3; i++)
-		cvmSet(n, i, 0, cvmGet(n, i, 0) / len);
+}
 
 
-	/* rotation about Y --> atan2(n_x, n_z) */
-	output.y = atan2(cvmGet(n, 0, 0), cvmGet(n, 2, 0));
 
-	/* rotation about X --> atan2(n_y, len) */
-	output.x = asin(cvmGet(n, 1, 0) / 1);
+/**
+ * @brief estimates the rotation in 3D space of a number of markers, a batch
+ *        at a time, and stores the results in the markers
+ *
+ * See \c koki_rotation_estimate().
+ *
+ * @param markers  the markers that contain the vertices to estimate the
+ *                 rotation of
+ * @param n        the number of markers
+ */
+void koki_rotation_estimate_markers(koki_marker_t **markers, uint32_t n)
+{
 
+	float x[4*ROTATION_BATCH], y[4*ROTATION_BATCH], z[4*ROTATION_BATCH];
+	float rot_x[ROTATION_BATCH], rot_y[ROTATION_BATCH];
+	float rot_z[ROTATION_BATCH];
 
-	/* clean up (mat a and b will be used later) */
-	cvReleaseMat(&n);
+	assert(markers != NULL || n == 0);
 
+	for (uint32_t start=0; start<n; start+=ROTATION_BATCH){
 
-	/* re-jiggle the numbers to be between +/- 180 degrees (M_PI radians) */
-	output.y = M_PI - output.y;
+		uint32_t m = n - start < ROTATION_BATCH ? n - start : ROTATION_BATCH;
 
-	/* put in range: -180 < angle <= 180 (but in radians) */
-	output.x -= output.x >= M_PI ? 2 * M_PI : 0;
-	output.y -= output.y >= M_PI ? 2 * M_PI : 0;
+		/* create (0, 0, 0) centred points arrays */
+		for (uint32_t i=0; i<m; i++){
 
-	/* invert Y so that +ve rotations are looking towards the +ve
-	   end of the axis from (0, 0, 0), and rotating anti-clockwise */
-	output.y = -output.y;
+			koki_marker_t *marker = markers[start+i];
 
+			assert(marker != NULL);
 
-	/* rotation about Z -- unrotate about X and Y as calculated, then
-	   calculate Z rotation from there */
+			for (uint8_t v=0; v<4; v++){
+				x[v*m+i] = marker->vertices[v].world.x -
+					marker->centre.world.x;
+				y[v*m+i] = marker->vertices[v].world.y -
+					marker->centre.world.y;
+				z[v*m+i] = marker->vertices[v].world.z -
+					marker->centre.world.z;
+			}
 
-	R = cvCreateMat(3, 3, CV_64FC1); /* a rotation matrix about the X
-					    and Y axes */
+		}//for i
 
-	sin_x = sin(-output.x);
-	sin_y = sin(-output.y);
-	cos_x = cos(-output.x);
-	cos_y = cos(-output.y);
+		/* estimate rotation */
+		koki_rotation_estimate_soa(m, x, y, z, rot_x, rot_y, rot_z);
 
-	/* fill R */
-	cvmSet(R, 0, 0, cos_y);
-	cvmSet(R, 0, 1, 0);
-	cvmSet(R, 0, 2, sin_y);
+		for (uint32_t i=0; i<m; i++){
 
-	cvmSet(R, 1, 0, -sin_x * -sin_y);
-	cvmSet(R, 1, 1, cos_x);
-	cvmSet(R, 1, 2, -sin_x * cos_y);
+			koki_marker_t *marker = markers[start+i];
 
-	cvmSet(R, 2, 0, -sin_y * cos_x);
-	cvmSet(R, 2, 1, sin_x);
-	cvmSet(R, 2, 2, cos_x * cos_y);
+			/* add to marker rotation and normalise */
+			marker->rotation.x += rot_x[i];
+			marker->rotation.x -= marker->rotation.x >= 360 ? 360 : 0;
 
-	/* fill a -- the point in between the first 2 vertices,
-	   i.e. the centre point of the top edge */
-	cvmSet(a, 0, 0, (points[0].x + points[1].x) / 2);
-	cvmSet(a, 1, 0, (points[0].y + points[1].y) / 2);
-	cvmSet(a, 2, 0, (points[0].z + points[1].z) / 2);
+			marker->rotation.y += rot_y[i];
+			marker->rotation.y -= marker->rotation.y >= 360 ? 360 : 0;
 
-	/* unrotate about X and Y */
-	cvMatMulAdd(R, a, NULL, b);
+			/* add code rotation offset */
+			marker->rotation.z += rot_z[i] + marker->rotation_offset;
+			marker->rotation.z -= marker->rotation.z >= 360 ? 360 : 0;
 
-	output.z = atan2(cvmGet(b, 0, 0), cvmGet(b, 1, 0));
+			/* put in range -180 < angle <= 180 */
+			if (marker->rotation.z > 180.0)
+				marker->rotation.z = -(360.0 - marker->rotation.z);
 
-	/* convert to degrees */
-	output.x *= 180.0 / M_PI;
-	output.y *= 180.0 / M_PI;
-	output.z *= 180.0 / M_PI;
+			/* negate so +ve rotation is anti-clockwise looking from
+			   (0, 0, 0) towards +ve Z (in the distance) */
+			marker->rotation.z = -marker->rotation.z;
 
-	/* clean up */
-	cvReleaseMat(&a);
-	cvReleaseMat(&b);
-	cvReleaseMat(&R);
+		}//for i
 
-	return output;
+	}//for start
 
 }
 
@@ -177,8 +253,8 @@ koki_marker_rotation_t koki_rotation_estimate_array(koki_point3Df_t points[4])
  * @brief estimates the rotation of the marker in 3D space about the 3 axes
  *        and stores the result in the given marker
  *
- * This function calls koki_rotation_estimat_array() after constructing
- * suitable arrays.
+ * This function calls koki_rotation_estimate_markers() for just the one
+ * marker.
  *
  * @param marker  the marker that contains the vertices to estimate the
  *                rotation of
@@ -186,41 +262,8 @@ koki_marker_rotation_t koki_rotation_estimate_array(koki_point3Df_t points[4])
 void koki_rotation_estimate(koki_marker_t *marker)
 {
 
-	koki_point3Df_t points[4];
-	koki_marker_rotation_t rotation;
-
 	assert(marker != NULL);
 
-	/* create (0, 0, 0) centred points array */
-	for (uint8_t i=0; i<4; i++){
-		points[i].x = marker->vertices[i].world.x -
-			marker->centre.world.x;
-		points[i].y = marker->vertices[i].world.y -
-			marker->centre.world.y;
-		points[i].z = marker->vertices[i].world.z -
-			marker->centre.world.z;
-	}
-
-	/* estimate rotation */
-	rotation = koki_rotation_estimate_array(points);
-
-	/* add to marker rotation and normalise */
-	marker->rotation.x += rotation.x;
-	marker->rotation.x -= marker->rotation.x >= 360 ? 360 : 0;
-
-	marker->rotation.y += rotation.y;
-	marker->rotation.y -= marker->rotation.y >= 360 ? 360 : 0;
-
-	/* add code rotation offset */
-	marker->rotation.z += rotation.z + marker->rotation_offset;
-	marker->rotation.z -= marker->rotation.z >= 360 ? 360 : 0;
-
-	/* put in range -180 < angle <= 180 */
-	if (marker->rotation.z > 180.0)
-		marker->rotation.z = -(360.0 - marker->rotation.z);
-
-	/* negate so +ve rotation is anti-clockwise looking from (0, 0, 0)
-	   towards +ve Z (in the distance) */
-	marker->rotation.z = -marker->rotation.z;
+	koki_rotation_estimate_markers(&marker, 1);
 
 }
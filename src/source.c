@@ -0,0 +1,461 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  source.c
+ * @brief Implementation of the sources of frames to find markers in
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <cv.h>
+#include <highgui.h>
+
+#include "recording.h"
+#include "v4l.h"
+#include "source.h"
+
+/**
+ * @brief the most frames a directory or a recording lets be held at once
+ */
+#define SOURCE_MAX_HELD 4
+
+/**
+ * @brief get the next frame from a source
+ *
+ * @param source   the source
+ * @param frame    the frame to fill in, whose data is valid (but mustn't
+ *                 be written to) until it's released
+ * @param timeout  the longest to wait for a frame, in milliseconds, or -1
+ *                 to wait for ever
+ * @return         1 if there was a frame, 0 if none came in time, or -1 if
+ *                 the source failed or has run out of frames
+ */
+int koki_source_get_frame( koki_source_t *source, koki_v4l_frame_t *frame,
+			   int timeout )
+{
+	return source->get_frame( source, frame, timeout );
+}
+
+/**
+ * @brief give a frame back to the source it came from
+ *
+ * @param source  the source
+ * @param frame   the frame
+ */
+void koki_source_release_frame( koki_source_t *source, koki_v4l_frame_t *frame )
+{
+	source->release_frame( source, frame );
+}
+
+/**
+ * @brief free a source, once all its frames have been given back
+ *
+ * @param source  the source
+ */
+void koki_source_free( koki_source_t *source )
+{
+	source->free( source );
+	g_free( source );
+}
+
+/* ---- Cameras ---- */
+
+static int v4l_get_frame( koki_source_t *source, koki_v4l_frame_t *frame,
+			  int timeout )
+{
+	return koki_v4l_ring_get_frame( source->priv, frame, timeout );
+}
+
+static void v4l_release_frame( koki_source_t *source, koki_v4l_frame_t *frame )
+{
+	koki_v4l_ring_release_frame( source->priv, frame );
+}
+
+static void v4l_free( koki_source_t *source )
+{
+	koki_v4l_ring_stop( source->priv );
+}
+
+/**
+ * @brief start streaming from a camera, as a source
+ *
+ * @param fd         the camera's file descriptor, with its format already
+ *                   set; it's left open when the source is freed
+ * @param n_buffers  the number of buffers to capture into
+ * @return           the source, or NULL if the camera couldn't be started
+ */
+koki_source_t* koki_source_v4l_new( int fd, int n_buffers )
+{
+	koki_source_t *source = g_malloc0( sizeof(koki_source_t) );
+	koki_v4l_ring_t *ring;
+	IplImage view;
+
+	source->fmt = koki_v4l_get_format( fd );
+
+	ring = koki_v4l_ring_start( fd, n_buffers );
+	if( ring == NULL ) {
+		g_free( source );
+		return NULL;
+	}
+
+	if( koki_v4l_luma_view( &view, ring->buffers[0].start,
+				source->fmt ) == NULL ) {
+		koki_v4l_ring_stop( ring );
+		g_free( source );
+		return NULL;
+	}
+
+	/* Leave the camera two buffers to capture into, if it has them */
+	source->max_held = ring->count > 2 ? ring->count - 2 : 1;
+	source->get_frame = v4l_get_frame;
+	source->release_frame = v4l_release_frame;
+	source->free = v4l_free;
+	source->priv = ring;
+
+	return source;
+}
+
+/* ---- Directories of images ---- */
+
+/**
+ * @brief the state of a directory of images
+ */
+typedef struct {
+	GPtrArray *paths;	/**< the images' paths, in order */
+	guint next;		/**< the next one to load */
+	IplImage *held[SOURCE_MAX_HELD]; /**< the images loaded but not yet
+					      released */
+} dir_source_t;
+
+static int compare_paths( gconstpointer a, gconstpointer b )
+{
+	return strcmp( *(const char**)a, *(const char**)b );
+}
+
+static int dir_get_frame( koki_source_t *source, koki_v4l_frame_t *frame,
+			  int timeout )
+{
+	dir_source_t *dir = source->priv;
+	IplImage *img = NULL;
+	uint32_t slot;
+
+	/* Things that aren't images are skipped */
+	while( img == NULL ) {
+		if( dir->next >= dir->paths->len )
+			return -1;
+
+		img = cvLoadImage( g_ptr_array_index( dir->paths, dir->next ),
+				   CV_LOAD_IMAGE_GRAYSCALE );
+		dir->next++;
+	}
+
+	if( (uint32_t)img->width != source->fmt.fmt.pix.width
+	    || (uint32_t)img->height != source->fmt.fmt.pix.height ) {
+		fprintf( stderr, "%s isn't the same size as the images before it\n",
+			 (char*)g_ptr_array_index( dir->paths, dir->next - 1 ) );
+		cvReleaseImage( &img );
+		return -1;
+	}
+
+	for( slot = 0; dir->held[slot] != NULL; slot++ )
+		g_assert( slot + 1 < SOURCE_MAX_HELD );
+
+	dir->held[slot] = img;
+
+	frame->data = (uint8_t*)img->imageData;
+	frame->length = img->imageSize;
+	frame->index = slot;
+	frame->sequence = dir->next - 1;
+	gettimeofday( &frame->timestamp, NULL );
+
+	return 1;
+}
+
+static void dir_release_frame( koki_source_t *source, koki_v4l_frame_t *frame )
+{
+	dir_source_t *dir = source->priv;
+
+	g_assert( frame->index < SOURCE_MAX_HELD && dir->held[frame->index] != NULL );
+	cvReleaseImage( &dir->held[frame->index] );
+}
+
+static void dir_free( koki_source_t *source )
+{
+	dir_source_t *dir = source->priv;
+
+	for( int i = 0; i < SOURCE_MAX_HELD; i++ )
+		if( dir->held[i] != NULL )
+			cvReleaseImage( &dir->held[i] );
+
+	g_ptr_array_free( dir->paths, TRUE );
+	g_free( dir );
+}
+
+/**
+ * @brief use the images in a directory as a source, in the order of their
+ *        names
+ *
+ * The images are loaded as they're needed, and converted to greyscale.
+ * They must all be the same size.  The frames' sequence numbers count the
+ * files in the directory, including any that aren't images.
+ *
+ * @param path  the directory
+ * @return      the source, or NULL if there are no images in it
+ */
+koki_source_t* koki_source_dir_new( const char *path )
+{
+	koki_source_t *source;
+	dir_source_t *dir;
+	IplImage *img = NULL;
+	const char *name;
+	GDir *d;
+
+	d = g_dir_open( path, 0, NULL );
+	if( d == NULL ) {
+		fprintf( stderr, "couldn't open %s\n", path );
+		return NULL;
+	}
+
+	dir = g_malloc0( sizeof(dir_source_t) );
+	dir->paths = g_ptr_array_new_with_free_func( g_free );
+
+	while( (name = g_dir_read_name( d )) != NULL )
+		g_ptr_array_add( dir->paths, g_build_filename( path, name, NULL ) );
+
+	g_dir_close( d );
+	g_ptr_array_sort( dir->paths, compare_paths );
+
+	/* The first image gives the format */
+	for( guint i = 0; i < dir->paths->len && img == NULL; i++ )
+		img = cvLoadImage( g_ptr_array_index( dir->paths, i ),
+				   CV_LOAD_IMAGE_GRAYSCALE );
+
+	if( img == NULL ) {
+		fprintf( stderr, "there are no images in %s\n", path );
+		g_ptr_array_free( dir->paths, TRUE );
+		g_free( dir );
+		return NULL;
+	}
+
+	source = g_malloc0( sizeof(koki_source_t) );
+	source->fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	source->fmt.fmt.pix.width = img->width;
+	source->fmt.fmt.pix.height = img->height;
+	source->fmt.fmt.pix.pixelformat = V4L2_PIX_FMT_GREY;
+	source->fmt.fmt.pix.bytesperline = img->widthStep;
+	source->fmt.fmt.pix.sizeimage = img->imageSize;
+	source->max_held = SOURCE_MAX_HELD;
+	source->get_frame = dir_get_frame;
+	source->release_frame = dir_release_frame;
+	source->free = dir_free;
+	source->priv = dir;
+
+	cvReleaseImage( &img );
+
+	return source;
+}
+
+/* ---- Recordings ---- */
+
+/**
+ * @brief the state of a recording
+ */
+typedef struct {
+	uint8_t *map;		/**< the whole file, mapped read-only */
+	size_t size;		/**< the file's size */
+	const koki_recording_index_t *index; /**< the frames' index */
+	uint32_t n_frames;	/**< the number of frames */
+	uint32_t next;		/**< the next frame to give out */
+	bool paced;		/**< whether frames are given out no faster
+				     than they were recorded */
+	gint64 start;		/**< when the first frame was given out */
+} recording_source_t;
+
+static int recording_get_frame( koki_source_t *source, koki_v4l_frame_t *frame,
+				int timeout )
+{
+	recording_source_t *rec = source->priv;
+	const koki_recording_index_t *entry;
+
+	if( rec->next >= rec->n_frames )
+		return -1;
+
+	entry = &rec->index[rec->next];
+
+	if( rec->paced ) {
+		gint64 now = g_get_monotonic_time(), due;
+
+		if( rec->next == 0 )
+			rec->start = now;
+
+		due = rec->start + (entry->timestamp - rec->index[0].timestamp);
+
+		if( due > now ) {
+			if( timeout >= 0 && due - now > (gint64)timeout * 1000 ) {
+				g_usleep( (gint64)timeout * 1000 );
+				return 0;
+			}
+
+			g_usleep( due - now );
+		}
+	}
+
+	frame->data = rec->map + entry->offset;
+	frame->length = entry->length;
+	frame->index = rec->next;
+	frame->sequence = entry->sequence;
+	frame->timestamp.tv_sec = entry->timestamp / 1000000;
+	frame->timestamp.tv_usec = entry->timestamp % 1000000;
+
+	rec->next++;
+
+	return 1;
+}
+
+static void recording_release_frame( koki_source_t *source,
+				     koki_v4l_frame_t *frame )
+{
+	/* The frames are in the mapping for as long as the source exists */
+}
+
+static void recording_free( koki_source_t *source )
+{
+	recording_source_t *rec = source->priv;
+
+	munmap( rec->map, rec->size );
+	g_free( rec );
+}
+
+/**
+ * @brief check a recording's header and index, and read its format
+ *
+ * @param rec  the recording, with its file mapped
+ * @param fmt  set to the frames' format
+ * @return     TRUE if it's a recording that can be used
+ */
+static bool recording_check( recording_source_t *rec, struct v4l2_format *fmt )
+{
+	const koki_recording_header_t *header = (const koki_recording_header_t*)rec->map;
+	IplImage view;
+	size_t min_length;
+
+	if( memcmp( header->magic, KOKI_RECORDING_MAGIC, 8 ) != 0
+	    || header->width == 0 || header->height == 0
+	    || header->n_frames > header->max_frames
+	    || header->index_offset % sizeof(uint64_t) != 0
+	    || header->index_offset > rec->size
+	    || header->max_frames > (rec->size - header->index_offset)
+				    / sizeof(koki_recording_index_t) )
+		return FALSE;
+
+	memset( fmt, 0, sizeof(struct v4l2_format) );
+	fmt->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	fmt->fmt.pix.width = header->width;
+	fmt->fmt.pix.height = header->height;
+	fmt->fmt.pix.pixelformat = header->pixelformat;
+	fmt->fmt.pix.bytesperline = header->bytesperline;
+	fmt->fmt.pix.sizeimage = header->frame_size;
+
+	if( koki_v4l_luma_view( &view, rec->map, *fmt ) == NULL )
+		return FALSE;
+
+	/* Every frame has to hold the whole of the luma */
+	min_length = (size_t)view.widthStep * (view.height - 1)
+		+ view.width * view.nChannels;
+
+	rec->index = (const koki_recording_index_t*)(rec->map + header->index_offset);
+	rec->n_frames = header->n_frames;
+
+	for( uint32_t i = 0; i < rec->n_frames; i++ )
+		if( rec->index[i].length < min_length
+		    || rec->index[i].offset > rec->size
+		    || rec->index[i].length > rec->size - rec->index[i].offset )
+			return FALSE;
+
+	return TRUE;
+}
+
+/**
+ * @brief use a recording made from a camera as a source
+ *
+ * The recording is mapped into memory and its frames are given out in
+ * place, straight from the page cache.  Only the frames recorded when it's
+ * opened are given out.
+ *
+ * @param filename  the recording's filename
+ * @param paced     whether to give the frames out no faster than they were
+ *                  recorded, rather than as fast as they're asked for
+ * @return          the source, or NULL if the file couldn't be read or
+ *                  isn't a recording
+ */
+koki_source_t* koki_source_recording_new( const char *filename, bool paced )
+{
+	recording_source_t *rec;
+	koki_source_t *source;
+	struct stat st;
+	int fd;
+
+	fd = open( filename, O_RDONLY );
+	if( fd < 0 ) {
+		fprintf( stderr, "couldn't open %s\n", filename );
+		return NULL;
+	}
+
+	if( fstat( fd, &st ) < 0
+	    || (size_t)st.st_size < sizeof(koki_recording_header_t) ) {
+		fprintf( stderr, "%s isn't a recording\n", filename );
+		close( fd );
+		return NULL;
+	}
+
+	rec = g_malloc0( sizeof(recording_source_t) );
+	rec->size = st.st_size;
+	rec->paced = paced;
+	rec->map = mmap( NULL, rec->size, PROT_READ, MAP_SHARED, fd, 0 );
+	close( fd );
+
+	if( rec->map == MAP_FAILED ) {
+		fprintf( stderr, "couldn't map %s\n", filename );
+		g_free( rec );
+		return NULL;
+	}
+
+	source = g_malloc0( sizeof(koki_source_t) );
+	source->max_held = SOURCE_MAX_HELD;
+	source->get_frame = recording_get_frame;
+	source->release_frame = recording_release_frame;
+	source->free = recording_free;
+	source->priv = rec;
+
+	if( !recording_check( rec, &source->fmt ) ) {
+		fprintf( stderr, "%s isn't a valid recording\n", filename );
+		koki_source_free( source );
+		return NULL;
+	}
+
+	/* The frames are read through once, in order */
+	posix_madvise( rec->map, rec->size, POSIX_MADV_SEQUENTIAL );
+
+	return source;
+}
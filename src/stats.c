@@ -0,0 +1,97 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  stats.c
+ * @brief Implementation of the timings and counts gathered while finding
+ *        markers
+ */
+
+#include <time.h>
+#include <glib.h>
+
+#include "stats.h"
+
+/**
+ * @brief read the clock the stages are timed with
+ *
+ * @return  the time, in nanoseconds, from some fixed point
+ */
+uint64_t koki_stats_clock( void )
+{
+	struct timespec ts;
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * @brief add the time since \c *t to a stage, and move \c *t on to now
+ *
+ * @param stats  the counts to add the time to
+ * @param stage  the stage that's just finished
+ * @param t      when the stage began
+ */
+void koki_stats_lap( koki_stats_counts_t *stats, koki_stage_t stage,
+		     uint64_t *t )
+{
+	uint64_t now = koki_stats_clock();
+
+	stats->stage_time[stage] += now - *t;
+	*t = now;
+}
+
+/**
+ * @brief add one set of timings and counts to another
+ *
+ * @param to    the timings and counts to add to
+ * @param from  the timings and counts to add
+ */
+void koki_stats_add( koki_stats_counts_t *to, const koki_stats_counts_t *from )
+{
+	to->frames += from->frames;
+	to->time += from->time;
+
+	for( int i = 0; i < KOKI_STAGE_COUNT; i++ )
+		to->stage_time[i] += from->stage_time[i];
+
+	to->regions += from->regions;
+	to->usable_regions += from->usable_regions;
+	to->contours += from->contours;
+	to->quads += from->quads;
+	to->quads_rejected += from->quads_rejected;
+	to->codes += from->codes;
+}
+
+/**
+ * @brief get the name of a stage, for printing
+ *
+ * @param stage  the stage
+ * @return       its name
+ */
+const char* koki_stats_stage_name( koki_stage_t stage )
+{
+	static const char *names[KOKI_STAGE_COUNT] = {
+		"threshold+label", "stats", "contour", "quad find",
+		"refine", "unwarp", "decode", "pose"
+	};
+
+	g_assert( stage < KOKI_STAGE_COUNT );
+
+	return names[stage];
+}
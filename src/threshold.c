@@ -23,9 +23,19 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 #include <cv.h>
 #include <highgui.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KOKI_HAVE_AVX2_KERNEL 1
+#endif
+
 #include "labelling.h"
 
 #include "threshold.h"
@@ -76,50 +86,74 @@ IplImage* koki_threshold_frame(IplImage *frame, uint16_t threshold)
 
 
 /**
- * @brief performs thresholding with a given threshold and generates averages
- *        of the greyscale values of each pixel in each class (i.e. black or
- *        white)
+ * @brief counts the pixels of each greyscale value in a frame
  *
- * @param frame      the \c IplImage to threshold
- * @param threshold  the threshold to apply (in range \c 0-255)
- * @param avg_white  a pointer to where the white average should be stored
- * @param avg_black  a pointer to where the black average should be stored
+ * @param frame  the \c IplImage to count the pixels of
+ * @param hist   where to write the 256 counts
  */
-static void classify_and_average(IplImage *frame, uint16_t threshold,
-				 uint16_t *avg_white, uint16_t *avg_black)
+static void build_histogram(const IplImage *frame, uint32_t hist[256])
 {
 
-	uint16_t num_white, num_black;
-	uint32_t sum_white, sum_black;
-	CvSize size;
-	uint8_t val;
-
-	assert(frame != NULL);
-	assert(threshold >= 0 && threshold <= 255);
+	/* Alternate between two sets of counts, so that runs of the same
+	   value don't wait on each other's increments */
+	uint32_t hist2[256];
 
-	sum_white = 0;
-	sum_black = 0;
-	num_white = 0;
-	num_black = 0;
+	memset(hist, 0, sizeof(uint32_t) * 256);
+	memset(hist2, 0, sizeof(hist2));
 
-	size = cvGetSize(frame);
+	for (uint16_t y=0; y<frame->height; y++){
 
-	for (uint16_t y=0; y<size.height; y++){
-		for (uint16_t x=0; x<size.width; x++){
+		const uint8_t *row = (const uint8_t*)(frame->imageData
+						      + frame->widthStep * y);
+		uint16_t x;
 
-			val = KOKI_IPLIMAGE_GS_ELEM(frame, x, y);
+		for (x=0; x+1<frame->width; x+=2){
+			hist[row[x]]++;
+			hist2[row[x+1]]++;
+		}
 
-			if (val >= threshold){
-				sum_white += val;
-				num_white++;
-			} else {
-				sum_black += val;
-				num_black++;
-			}
+		if (x < frame->width)
+			hist[row[x]]++;
 
-		}//for
 	}//for
 
+	for (uint16_t i=0; i<256; i++)
+		hist[i] += hist2[i];
+
+}
+
+
+
+/**
+ * @brief generates averages of the greyscale values of each class (i.e.
+ *        black or white) that a given threshold would put pixels in
+ *
+ * The averages come from cumulative counts and sums of the frame's
+ * histogram, so no pass over the frame is needed.
+ *
+ * @param cum_num    the number of pixels below each value (257 entries)
+ * @param cum_sum    the sum of the pixels below each value (257 entries)
+ * @param threshold  the threshold to apply (in range \c 0-255): pixels at
+ *                   or above it are white
+ * @param avg_white  a pointer to where the white average should be stored
+ * @param avg_black  a pointer to where the black average should be stored
+ */
+static void classify_and_average(const uint32_t *cum_num,
+				 const uint64_t *cum_sum,
+				 uint16_t threshold,
+				 uint16_t *avg_white, uint16_t *avg_black)
+{
+
+	uint32_t num_white, num_black;
+	uint64_t sum_white, sum_black;
+
+	assert(threshold >= 0 && threshold <= 255);
+
+	num_black = cum_num[threshold];
+	sum_black = cum_sum[threshold];
+	num_white = cum_num[256] - num_black;
+	sum_white = cum_sum[256] - sum_black;
+
 	*avg_white = 255;
 	*avg_black = 0;
 
@@ -152,15 +186,22 @@ static void classify_and_average(IplImage *frame, uint16_t threshold,
  *
  * /code threshold >= (avg_white + avg_black)/2 \end_code
  *
- * @param frame  the \c IplImage to threshold
- * @return       the threshold, in the range \c 0-255
+ * @param hist  the frame's histogram
+ * @return      the threshold, in the range \c 0-255
  */
-uint16_t koki_threshold_global(IplImage *frame)
+static uint16_t threshold_mean_split(const uint32_t hist[256])
 {
 
+	uint32_t cum_num[257];
+	uint64_t cum_sum[257];
 	uint16_t avg_black, avg_white, threshold;
 
-	assert(frame != NULL);
+	cum_num[0] = 0;
+	cum_sum[0] = 0;
+	for (uint16_t i=0; i<256; i++){
+		cum_num[i+1] = cum_num[i] + hist[i];
+		cum_sum[i+1] = cum_sum[i] + (uint64_t)hist[i] * i;
+	}
 
 	avg_black = avg_white = 256;
 	threshold = KOKI_THRESHOLD_LOWER_BOUND - KOKI_THRESHOLD_INCREMENT;
@@ -169,7 +210,8 @@ uint16_t koki_threshold_global(IplImage *frame)
 	       threshold < KOKI_THRESHOLD_UPPER_BOUND){
 
 		threshold += KOKI_THRESHOLD_INCREMENT;
-		classify_and_average(frame, threshold, &avg_white, &avg_black);
+		classify_and_average(cum_num, cum_sum, threshold,
+				     &avg_white, &avg_black);
 
 	}//while
 
@@ -177,6 +219,104 @@ uint16_t koki_threshold_global(IplImage *frame)
 
 }
 
+
+
+/**
+ * @brief finds the threshold that maximises the variance between the two
+ *        classes of pixel it creates, as described by Otsu
+ *
+ * @param hist  the frame's histogram
+ * @return      the threshold, in the range \c 0-255: pixels above it are in
+ *              the brighter class
+ */
+static uint16_t threshold_otsu(const uint32_t hist[256])
+{
+
+	uint64_t total = 0, sum = 0;
+	uint64_t num_black = 0, sum_black = 0;
+	double best = -1;
+	uint16_t threshold = 0;
+
+	for (uint16_t i=0; i<256; i++){
+		total += hist[i];
+		sum += (uint64_t)hist[i] * i;
+	}
+
+	for (uint16_t t=0; t<255; t++){
+
+		uint64_t num_white;
+		double diff, var;
+
+		num_black += hist[t];
+		sum_black += (uint64_t)hist[t] * t;
+		num_white = total - num_black;
+
+		if (num_black == 0)
+			continue;
+		if (num_white == 0)
+			break;
+
+		/* Between-class variance, scaled by total^2 */
+		diff = (double)sum_black / num_black
+			- (double)(sum - sum_black) / num_white;
+		var = (double)num_black * num_white * diff * diff;
+
+		if (var > best){
+			best = var;
+			threshold = t;
+		}
+
+	}//for
+
+	return threshold;
+
+}
+
+
+
+/**
+ * @brief finds a good threshold for a whole frame
+ *
+ * The frame is read once to build a histogram, and the thresholds are all
+ * tried against that.
+ *
+ * @param frame   the \c IplImage to threshold
+ * @param method  the method to use, choose from
+ *                { KOKI_GLOBAL_MEAN_SPLIT, KOKI_GLOBAL_OTSU }
+ * @return        the threshold, in the range \c 0-255
+ */
+uint16_t koki_threshold_global_method(IplImage *frame, uint8_t method)
+{
+
+	uint32_t hist[256];
+
+	assert(frame != NULL && frame->nChannels == 1);
+
+	build_histogram(frame, hist);
+
+	if (method == KOKI_GLOBAL_OTSU)
+		return threshold_otsu(hist);
+
+	return threshold_mean_split(hist);
+
+}
+
+
+
+/**
+ * @brief finds a good threshold for a whole frame, using
+ *        \c KOKI_GLOBAL_MEAN_SPLIT
+ *
+ * @param frame  the \c IplImage to threshold
+ * @return       the threshold, in the range \c 0-255
+ */
+uint16_t koki_threshold_global(IplImage *frame)
+{
+
+	return koki_threshold_global_method(frame, KOKI_GLOBAL_MEAN_SPLIT);
+
+}
+
 /**
  * @brief adaptively threshold the given pixel
  *
@@ -206,10 +346,10 @@ bool koki_threshold_adaptive_pixel( const IplImage *frame,
 
 	/* The following is a rearranged version of
 	      threshold = sum / (w*h);
-	      if( KOKI_IPLIMAGE_GS_ELEM(frame, x, y) > (threshold-c) ) ...
+	      if( KOKI_IPLIMAGE_LUMA_ELEM(frame, x, y) > (threshold-c) ) ...
 	   This is re-arranged to avoid division. */
 
-	cmp = KOKI_IPLIMAGE_GS_ELEM(frame, x, y) + c;
+	cmp = KOKI_IPLIMAGE_LUMA_ELEM(frame, x, y) + c;
 	cmp *= w * h;
 
 	/* apply threshold */
@@ -220,149 +360,545 @@ bool koki_threshold_adaptive_pixel( const IplImage *frame,
 }
 
 /**
- * @brief sets \c output(x,y) to the thresholded value of \c frame in the region of
- *        interest specified by \c roi, using the mean as the base threshold
+ * @brief thresholds the interior of a row, where every window is the full
+ *        window width and sits wholly inside the frame
  *
- * For this method, the pixels in the region of interest are mean averaged and then
- * a threshold of of \c mean-c is applied to the frame, and stored in output. The
- * \c mean-c allows the image to look less cluttered. Small values, 3-7 say, are
- * just enough to prevent tiny 'features' being noticed.
+ * This is the scalar version of the row kernel.  For each pixel \c x in
+ * <tt>[x_start, x_end)</tt>, the window sum is calculated from the
+ * difference of the integral image's bottom and top rows at the window's
+ * left and right edges.  The comparison is exactly that performed by
+ * \c koki_threshold_adaptive_pixel(), including its unsigned 32-bit
+ * wrap-around behaviour.
  *
- * @param frame   the frame being thresholded
- * @param iimg    the integral image of the frame being thresholded
- * @param output  the 1-channel image to output the thresholded image to
- * @param x       the X co-ordinate of current pixel (probably the centre of the roi)
- * @param y       the Y co-ordinate of current pixel (probably the centre of the roi)
- * @param roi     the \c CvRect describing the regoin we're interested in
- * @param c       the constant to subtract from mean to use as the threshold
+ * @param pix      the source row
+ * @param bot      the integral image row at the bottom of the window
+ * @param top      the integral image row just above the window
+ * @param r        half the window width (i.e. \c window_size/2)
+ * @param area     the number of pixels in the window
+ * @param c        the constant to subtract from the mean
+ * @param x_start  the first pixel to threshold (must be > \c r)
+ * @param x_end    one after the last pixel to threshold
+ * @param out      the output row
  */
-static void threshold_window_mean(IplImage *frame,
-				  koki_integral_image_t *iimg,
-				  IplImage *output,
-				  uint16_t x, uint16_t y, CvRect roi, int16_t c)
+static void threshold_row_scalar( const uint8_t *pix,
+				  const uint32_t *bot, const uint32_t *top,
+				  uint16_t r, uint32_t area, int16_t c,
+				  uint16_t x_start, uint16_t x_end,
+				  uint8_t *out )
 {
-	uint8_t grey = 0;
+	for( uint16_t x = x_start; x < x_end; x++ ) {
+		uint32_t sum, cmp;
 
-	if( koki_threshold_adaptive_pixel( frame, iimg, &roi, x, y, c ) )
-		grey = 255;
+		sum = (bot[x+r] - top[x+r]) - (bot[x-r-1] - top[x-r-1]);
 
-	KOKI_IPLIMAGE_GS_ELEM(output, x, y) = grey;
+		cmp = pix[x] + c;
+		cmp *= area;
 
+		out[x] = cmp > sum ? 0xff : 0;
+	}
 }
 
+#if defined(__SSE2__)
+/**
+ * @brief multiplies the four unsigned 32-bit lanes of \c a and \c b,
+ *        keeping the low 32 bits (SSE2 lacks \c pmulld)
+ */
+static inline __m128i mullo_epi32_sse2( __m128i a, __m128i b )
+{
+	__m128i even, odd;
 
+	even = _mm_mul_epu32( a, b );
+	odd = _mm_mul_epu32( _mm_srli_epi64( a, 32 ), _mm_srli_epi64( b, 32 ) );
+
+	return _mm_unpacklo_epi32( _mm_shuffle_epi32( even, _MM_SHUFFLE(0,0,2,0) ),
+				   _mm_shuffle_epi32( odd, _MM_SHUFFLE(0,0,2,0) ) );
+}
 
 /**
- * @brief a comparison function for use with qsort() to sort pixel values in a median
- *        window
+ * @brief thresholds four pixels, returning all-ones in the lanes that
+ *        are white
+ */
+static inline __m128i threshold_4_sse2( __m128i pix32,
+					const uint32_t *bot, const uint32_t *top,
+					uint16_t x, uint16_t r,
+					__m128i area, __m128i c, __m128i bias )
+{
+	__m128i b1, t1, b0, t0, sum, cmp;
+
+	b1 = _mm_loadu_si128( (const __m128i*)(bot + x + r) );
+	t1 = _mm_loadu_si128( (const __m128i*)(top + x + r) );
+	b0 = _mm_loadu_si128( (const __m128i*)(bot + x - r - 1) );
+	t0 = _mm_loadu_si128( (const __m128i*)(top + x - r - 1) );
+
+	sum = _mm_sub_epi32( _mm_sub_epi32( b1, t1 ),
+			     _mm_sub_epi32( b0, t0 ) );
+
+	cmp = mullo_epi32_sse2( _mm_add_epi32( pix32, c ), area );
+
+	/* Unsigned comparison, by flipping the sign bits */
+	return _mm_cmpgt_epi32( _mm_xor_si128( cmp, bias ),
+				_mm_xor_si128( sum, bias ) );
+}
+
+/**
+ * @brief SSE2 version of \c threshold_row_scalar(), 16 pixels at a time
+ */
+static void threshold_row_sse2( const uint8_t *pix,
+				const uint32_t *bot, const uint32_t *top,
+				uint16_t r, uint32_t area, int16_t c,
+				uint16_t x_start, uint16_t x_end,
+				uint8_t *out )
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i v_area = _mm_set1_epi32( area );
+	const __m128i v_c = _mm_set1_epi32( c );
+	const __m128i bias = _mm_set1_epi32( 0x80000000 );
+	uint16_t x = x_start;
+
+	for( ; x + 16 <= x_end; x += 16 ) {
+		__m128i p8, p16lo, p16hi, m0, m1, m2, m3;
+
+		p8 = _mm_loadu_si128( (const __m128i*)(pix + x) );
+		p16lo = _mm_unpacklo_epi8( p8, zero );
+		p16hi = _mm_unpackhi_epi8( p8, zero );
+
+		m0 = threshold_4_sse2( _mm_unpacklo_epi16( p16lo, zero ),
+				       bot, top, x, r, v_area, v_c, bias );
+		m1 = threshold_4_sse2( _mm_unpackhi_epi16( p16lo, zero ),
+				       bot, top, x + 4, r, v_area, v_c, bias );
+		m2 = threshold_4_sse2( _mm_unpacklo_epi16( p16hi, zero ),
+				       bot, top, x + 8, r, v_area, v_c, bias );
+		m3 = threshold_4_sse2( _mm_unpackhi_epi16( p16hi, zero ),
+				       bot, top, x + 12, r, v_area, v_c, bias );
+
+		/* Each lane is 0 or -1, so saturating packs give 0 or 0xff */
+		_mm_storeu_si128( (__m128i*)(out + x),
+				  _mm_packs_epi16( _mm_packs_epi32( m0, m1 ),
+						   _mm_packs_epi32( m2, m3 ) ) );
+	}
+
+	threshold_row_scalar( pix, bot, top, r, area, c, x, x_end, out );
+}
+#endif	/* __SSE2__ */
+
+#if defined(KOKI_HAVE_AVX2_KERNEL)
+/**
+ * @brief thresholds eight pixels, returning all-ones in the lanes that
+ *        are white
+ */
+__attribute__((target("avx2")))
+static inline __m256i threshold_8_avx2( const uint8_t *pix,
+					const uint32_t *bot, const uint32_t *top,
+					uint16_t x, uint16_t r,
+					__m256i area, __m256i c, __m256i bias )
+{
+	__m256i p, b1, t1, b0, t0, sum, cmp;
+
+	p = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)(pix + x) ) );
+
+	b1 = _mm256_loadu_si256( (const __m256i*)(bot + x + r) );
+	t1 = _mm256_loadu_si256( (const __m256i*)(top + x + r) );
+	b0 = _mm256_loadu_si256( (const __m256i*)(bot + x - r - 1) );
+	t0 = _mm256_loadu_si256( (const __m256i*)(top + x - r - 1) );
+
+	sum = _mm256_sub_epi32( _mm256_sub_epi32( b1, t1 ),
+				_mm256_sub_epi32( b0, t0 ) );
+
+	cmp = _mm256_mullo_epi32( _mm256_add_epi32( p, c ), area );
+
+	return _mm256_cmpgt_epi32( _mm256_xor_si256( cmp, bias ),
+				   _mm256_xor_si256( sum, bias ) );
+}
+
+/**
+ * @brief AVX2 version of \c threshold_row_scalar(), 32 pixels at a time
+ */
+__attribute__((target("avx2")))
+static void threshold_row_avx2( const uint8_t *pix,
+				const uint32_t *bot, const uint32_t *top,
+				uint16_t r, uint32_t area, int16_t c,
+				uint16_t x_start, uint16_t x_end,
+				uint8_t *out )
+{
+	const __m256i v_area = _mm256_set1_epi32( area );
+	const __m256i v_c = _mm256_set1_epi32( c );
+	const __m256i bias = _mm256_set1_epi32( 0x80000000 );
+	/* The packs below work within 128-bit lanes; this undoes that */
+	const __m256i order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+	uint16_t x = x_start;
+
+	for( ; x + 32 <= x_end; x += 32 ) {
+		__m256i m0, m1, m2, m3, packed;
+
+		m0 = threshold_8_avx2( pix, bot, top, x, r, v_area, v_c, bias );
+		m1 = threshold_8_avx2( pix, bot, top, x + 8, r, v_area, v_c, bias );
+		m2 = threshold_8_avx2( pix, bot, top, x + 16, r, v_area, v_c, bias );
+		m3 = threshold_8_avx2( pix, bot, top, x + 24, r, v_area, v_c, bias );
+
+		packed = _mm256_packs_epi16( _mm256_packs_epi32( m0, m1 ),
+					     _mm256_packs_epi32( m2, m3 ) );
+		packed = _mm256_permutevar8x32_epi32( packed, order );
+
+		_mm256_storeu_si256( (__m256i*)(out + x), packed );
+	}
+
+	threshold_row_scalar( pix, bot, top, r, area, c, x, x_end, out );
+}
+#endif	/* KOKI_HAVE_AVX2_KERNEL */
+
+/**
+ * @brief copies the luma of part of a row whose pixels are more than one
+ *        byte apart into a contiguous array
  *
- * @param a  an \c int* to an element
- * @param b  an \c int* to an element
- * @return   a positive number if a > b, 0 if they are the same, or a negative number
- *           if a < b
+ * @param row     the source row
+ * @param stride  the number of bytes from one pixel to the next, which
+ *                must be 2
+ * @param x0      the first pixel to copy
+ * @param x1      one after the last pixel to copy
+ * @param out     the array to copy pixel \c x to element \c x of
  */
-static int thresh_cmp(const void *a, const void *b)
+static void gather_luma( const uint8_t *row, uint8_t stride,
+			 uint16_t x0, uint16_t x1, uint8_t *out )
 {
+	uint16_t x = x0;
+
+	assert( stride == 2 );
+
+#if defined(__SSE2__)
+	const __m128i luma = _mm_set1_epi16( 0xff );
 
-	return *((const int *)a) - *((const int *)b);
+	for( ; x + 16 <= x1; x += 16 ) {
+		__m128i a, b;
 
+		a = _mm_loadu_si128( (const __m128i*)(row + 2*x) );
+		b = _mm_loadu_si128( (const __m128i*)(row + 2*x + 16) );
+
+		_mm_storeu_si128( (__m128i*)(out + x),
+				  _mm_packus_epi16( _mm_and_si128( a, luma ),
+						    _mm_and_si128( b, luma ) ) );
+	}
+#endif
+
+	for( ; x < x1; x++ )
+		out[x] = row[2*x];
 }
 
+/**
+ * @brief adaptively thresholds an entire row of the frame at once
+ *
+ * This produces the same result as calling \c koki_threshold_adaptive_pixel()
+ * for every pixel in the row, with the window from
+ * \c koki_threshold_adaptive_calc_window().  Pixels away from the left and
+ * right edges of the frame share the same window shape, so they are
+ * processed by a vectorised kernel (AVX2 or SSE2, depending on what's
+ * available) straight from the integral image's rows.
+ *
+ * The integral image must have been advanced to at least the bottom of
+ * the window for row \c y.
+ *
+ * @param frame        the frame to threshold, greyscale or with its luma
+ *                     interleaved
+ * @param iimg         the integral image for the frame
+ * @param window_size  the size of window to use (must be odd)
+ * @param y            the row to threshold
+ * @param c            the constant to subtract from mean to use as the
+ *                     threshold
+ * @param out          an array of \c frame->width bytes to write the result
+ *                     to: \c 0xff for pixels that exceed the local threshold,
+ *                     \c 0 for those that don't
+ */
+void koki_threshold_adaptive_row( const IplImage *frame,
+				  const koki_integral_image_t *iimg,
+				  uint16_t window_size, uint16_t y,
+				  int16_t c, uint8_t *out )
+{
+	CvRect win;
+	const uint8_t *pix;
+	const uint32_t *bot, *top;
+	uint16_t r, x, x_start, x_end;
+	uint32_t area;
+
+	assert( frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame) );
+	assert( out != NULL );
+
+	pix = (const uint8_t*)( frame->imageData + frame->widthStep * y );
+	r = window_size / 2;
+
+	/* The interior runs from the first pixel whose window doesn't touch
+	   column 0, to the first pixel that gets the right-hand edge window */
+	x_start = r + 1;
+	x_end = frame->width - 1 > r ? frame->width - 1 - r : 0;
+
+	if( x_end <= x_start ) {
+		/* The frame's too narrow to have an interior */
+		x_start = frame->width;
+		x_end = frame->width;
+	}
+
+	/* Left edge */
+	for( x = 0; x < x_start; x++ ) {
+		koki_threshold_adaptive_calc_window( frame, &win, window_size, x, y );
+		out[x] = koki_threshold_adaptive_pixel( frame, iimg, &win, x, y, c )
+			? 0xff : 0;
+	}
 
+	if( x_start == x_end )
+		return;
+
+	/* All pixels in the row share the window's vertical extent */
+	koki_threshold_adaptive_calc_window( frame, &win, window_size, x_start, y );
+	assert( win.y + win.height - 1 < iimg->complete_y );
+	assert( win.y == 0 || win.y + iimg->n_rows > iimg->complete_y );
+	bot = koki_integral_image_row( iimg, win.y + win.height - 1 );
+	top = koki_integral_image_row( iimg, win.y - 1 );
+	area = win.width * win.height;
+
+	/* The kernels want the luma contiguous.  If it's interleaved, it's
+	   gathered into the output row, which the kernels can overwrite as
+	   they go as each pixel's only read before its own result is
+	   written. */
+	if( frame->nChannels != 1 ) {
+		gather_luma( pix, frame->nChannels, x_start, x_end, out );
+		pix = out;
+	}
+
+#if defined(KOKI_HAVE_AVX2_KERNEL)
+	if( __builtin_cpu_supports( "avx2" ) )
+		threshold_row_avx2( pix, bot, top, r, area, c, x_start, x_end, out );
+	else
+#endif
+#if defined(__SSE2__)
+		threshold_row_sse2( pix, bot, top, r, area, c, x_start, x_end, out );
+#else
+		threshold_row_scalar( pix, bot, top, r, area, c, x_start, x_end, out );
+#endif
+
+	/* Right edge */
+	for( x = x_end; x < frame->width; x++ ) {
+		koki_threshold_adaptive_calc_window( frame, &win, window_size, x, y );
+		out[x] = koki_threshold_adaptive_pixel( frame, iimg, &win, x, y, c )
+			? 0xff : 0;
+	}
+}
 
 /**
- * @brief sets \c output(x,y) to the thresholded value of \c frame in the region of
- *        interest specified by \c roi, using the median as the base threshold
+ * @brief a histogram of greyscale values, split into 16 coarse bins of 16
+ *        fine bins each
  *
- * For this method, the pixels in the region of interest are median averaged and then
- * a threshold of of \c median-c is applied to the frame, and stored in output. The
- * \c median-c allows the image to look less cluttered. Small values, 3-7 say, are
- * just enough to prevent tiny 'features' being noticed.
+ * The coarse bins let a value of any rank be found in at most 32 steps.
+ */
+typedef struct {
+	uint16_t coarse[16];
+	uint16_t fine[256];
+} median_hist_t;
+
+
+
+/**
+ * @brief adds one histogram to another
  *
- * @param frame   the frame being thresholded
- * @param output  the 1-channel image to output the thresholded image to
- * @param x       the X co-ordinate of current pixel (probably the centre of the roi)
- * @param y       the Y co-ordinate of current pixel (probably the centre of the roi)
- * @param roi     the \c CvRect describing the regoin we're interested in
- * @param c       the constant to subtract from median to use as the threshold
+ * @param dst  the histogram to add to
+ * @param src  the histogram to add
  */
+static inline void median_hist_add(median_hist_t *dst, const median_hist_t *src)
+{
+
+	for (uint16_t i=0; i<16; i++)
+		dst->coarse[i] += src->coarse[i];
+
+	for (uint16_t i=0; i<256; i++)
+		dst->fine[i] += src->fine[i];
+
+}
+
 
-static void threshold_window_median(IplImage *frame, IplImage *output,
-				    uint16_t x, uint16_t y, CvRect roi, int16_t c)
+
+/**
+ * @brief subtracts one histogram from another
+ *
+ * @param dst  the histogram to subtract from
+ * @param src  the histogram to subtract
+ */
+static inline void median_hist_sub(median_hist_t *dst, const median_hist_t *src)
 {
 
-	uint16_t w, h, threshold, grey, data_len;
+	for (uint16_t i=0; i<16; i++)
+		dst->coarse[i] -= src->coarse[i];
 
-	w = roi.width;
-	h = roi.height;
-	data_len = w * h;
+	for (uint16_t i=0; i<256; i++)
+		dst->fine[i] -= src->fine[i];
 
-	int data[data_len];
+}
 
-	/* calculate threshold */
-	for (uint16_t win_y = 0; win_y < h; win_y++)
-		for (uint16_t win_x = 0; win_x < w; win_x++)
-			data[win_y*w + win_x] = KOKI_IPLIMAGE_GS_ELEM(frame, roi.x + win_x,
-								      roi.y + win_y);
 
-	/* sort and find threshold */
-	qsort(data, data_len, sizeof(int), thresh_cmp);
 
-	threshold = data_len % 2 != 0
-		? data[data_len/2]                           /* odd  */
-		: (data[data_len/2-1] + data[data_len/2])/2; /* even */
+/**
+ * @brief finds the value of a given rank in a histogram
+ *
+ * @param hist  the histogram
+ * @param k     the rank, counting from 0 for the smallest value
+ * @return      the value that would be at index \c k if the histogram's
+ *              values were sorted
+ */
+static uint8_t median_hist_rank(const median_hist_t *hist, uint32_t k)
+{
 
+	const uint16_t *fine;
+	uint16_t c = 0, f = 0;
 
-	/* apply threshold */
-	grey = KOKI_IPLIMAGE_GS_ELEM(frame, x, y) > threshold - c
-		? 255
-		: 0;
+	while (k >= hist->coarse[c]){
+		k -= hist->coarse[c];
+		c++;
+	}
 
-	KOKI_IPLIMAGE_GS_ELEM(output, x, y) = grey;
+	fine = &hist->fine[c * 16];
+	while (k >= fine[f]){
+		k -= fine[f];
+		f++;
+	}
+
+	return c * 16 + f;
 
 }
 
 
 
 /**
- * @brief constructs a window to look at, and calls the required thresholding
- *        function as specified by method
+ * @brief finds the median of a histogram holding \c n values
  *
- * @param frame        the image the threshold
- * @param iimg         the integral image of frame
- * @param output       the image to write the thresholded values to
- * @param x            the current X co-ordinate of interest
- * @param y            the current Y co-ordinate of interest
- * @param window_size  the window size to use. NOTE: window size must be an odd
- *                     number so that \c (x,y) can be in the centre of the window
- * @param c            the constant to subtract from the threshold before it's
- *                     applied to de-clutter the thresholded image
- * @param method       the thresholding method to use, one of { KOKI_ADAPTIVE_MEAN,
- *                     KOKI_ADAPTIVE_MEDIAN }
+ * @param hist  the histogram
+ * @param n     the number of values in the histogram
+ * @return      the median, which for an even \c n is the mean of the two
+ *              middle values (rounded down)
  */
-static void threshold_window(IplImage *frame,
-			     koki_integral_image_t *iimg,
-			     IplImage *output,
-			     uint16_t x, uint16_t y, uint16_t window_size,
-			     int16_t c, uint8_t method)
+static uint16_t median_hist_median(const median_hist_t *hist, uint32_t n)
 {
+
+	if (n % 2 != 0)
+		return median_hist_rank(hist, n/2);
+
+	return (median_hist_rank(hist, n/2 - 1) + median_hist_rank(hist, n/2)) / 2;
+
+}
+
+
+
+/**
+ * @brief thresholds a frame against the median of the window around each
+ *        pixel, in constant time per pixel
+ *
+ * This is the method of Perreault and Hebert.  A histogram is kept for each
+ * column, covering the rows of the current window, and is updated a row at
+ * a time.  The window's histogram then slides along each row by adding the
+ * column histogram entering the window and subtracting the one leaving it.
+ *
+ * For each pixel, the median of the window is found, and a threshold of
+ * \c median-c is applied.  Pixels above it are set to 255 in the output,
+ * and the rest to 0.  The windows are those given by
+ * \c koki_threshold_adaptive_calc_window().
+ *
+ * @param frame        the frame to threshold
+ * @param output       the 1-channel image to output the thresholded image to
+ * @param window_size  the size of the window to use (odd, and at most 255)
+ * @param c            the constant to subtract from the median to use as the
+ *                     threshold
+ */
+static void threshold_median(const IplImage *frame, IplImage *output,
+			     uint16_t window_size, int16_t c)
+{
+
+	const uint16_t w = frame->width, h = frame->height;
+	const uint16_t r = window_size / 2;
+	median_hist_t *cols, win, edge;
 	CvRect roi;
+	uint16_t top = 0, bottom = 0; /* the rows in cols, bottom exclusive */
 
-	koki_threshold_adaptive_calc_window( frame, &roi,
-					     window_size, x, y );
+	/* the window's counts have to fit in the histogram */
+	assert(window_size <= 255);
+	assert(window_size < w && window_size < h);
 
-	/* threshold */
-	if (method == KOKI_ADAPTIVE_MEAN)
-		threshold_window_mean(frame, iimg, output, x, y, roi, c);
+	cols = calloc(w, sizeof(median_hist_t));
+	assert(cols != NULL);
 
-	else if (method == KOKI_ADAPTIVE_MEDIAN)
-		threshold_window_median(frame, output, x, y, roi, c);
+	for (uint16_t y=0; y<h; y++){
 
-	else
-		assert(FALSE);
+		const uint8_t *pix;
+		uint8_t *out;
+		uint32_t n;
+		uint16_t median;
+
+		/* Bring the column histograms to this row's window, which only
+		   ever moves down */
+		koki_threshold_adaptive_calc_window(frame, &roi, window_size, r, y);
+
+		for (; bottom < roi.y + roi.height; bottom++){
+			pix = (const uint8_t*)(frame->imageData + frame->widthStep * bottom);
+			for (uint16_t x=0; x<w; x++){
+				cols[x].fine[pix[x]]++;
+				cols[x].coarse[pix[x] >> 4]++;
+			}
+		}
+
+		for (; top < roi.y; top++){
+			pix = (const uint8_t*)(frame->imageData + frame->widthStep * top);
+			for (uint16_t x=0; x<w; x++){
+				cols[x].fine[pix[x]]--;
+				cols[x].coarse[pix[x] >> 4]--;
+			}
+		}
+
+		pix = (const uint8_t*)(frame->imageData + frame->widthStep * y);
+		out = (uint8_t*)(output->imageData + output->widthStep * y);
+
+		/* The pixels at the left edge share a window */
+		memset(&edge, 0, sizeof(edge));
+		for (uint16_t x=0; x<=r; x++)
+			median_hist_add(&edge, &cols[x]);
+
+		n = (r + 1) * roi.height;
+		median = median_hist_median(&edge, n);
+
+		for (uint16_t x=0; x<r; x++)
+			out[x] = pix[x] > median - c ? 255 : 0;
+
+		/* Slide the full window along the interior */
+		memset(&win, 0, sizeof(win));
+		for (uint16_t x=0; x<window_size; x++)
+			median_hist_add(&win, &cols[x]);
+
+		n = window_size * roi.height;
+
+		for (uint16_t x=r; x<(w-1)-r; x++){
+
+			if (x > r){
+				median_hist_add(&win, &cols[x + r]);
+				median_hist_sub(&win, &cols[x - r - 1]);
+			}
+
+			median = median_hist_median(&win, n);
+			out[x] = pix[x] > median - c ? 255 : 0;
+
+		}//for
+
+		/* As do the pixels at the right edge */
+		memset(&edge, 0, sizeof(edge));
+		for (uint16_t x=(w-1)-r; x<w; x++)
+			median_hist_add(&edge, &cols[x]);
+
+		n = (r + 1) * roi.height;
+		median = median_hist_median(&edge, n);
+
+		for (uint16_t x=(w-1)-r; x<w; x++)
+			out[x] = pix[x] > median - c ? 255 : 0;
+
+	}//for
+
+	free(cols);
 
 }
 
+
+
 /**
  * @brief thresholds an image in a localised, adaptive way, allowing large
  *        illumination variations to exist in the source image and still be
@@ -375,7 +911,9 @@ static void threshold_window(IplImage *frame,
  *                     applied to de-clutter the output somewhat. Good values
  *                     are small, perhaps no greater than 10.
  * @param method       the method to use when thresholding a window, choose from
- *                     { KOKI_ADAPTIVE_MEAN, KOKI_ADAPTIVE_MEDIAN }
+ *                     { KOKI_ADAPTIVE_MEAN, KOKI_ADAPTIVE_MEDIAN }.  Both take
+ *                     constant time per pixel, though the median is slower
+ *                     and needs a window no bigger than 255.
  */
 IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 				  int16_t c, uint8_t method)
@@ -386,9 +924,6 @@ IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 
 	assert(frame != NULL && frame->nChannels == 1);
 
-	/* create the integral image to accelerate window summation */
-	iimg = koki_integral_image_new( frame, true );
-
 	/* create output image */
 	output = cvCreateImage(cvGetSize(frame),
 			       frame->depth,
@@ -399,16 +934,23 @@ IplImage* koki_threshold_adaptive(IplImage *frame, uint16_t window_size,
 	if (method == 0) /* default */
 		method = KOKI_ADAPTIVE_MEAN;
 
+	if (method == KOKI_ADAPTIVE_MEDIAN){
 
-	/* threshold the image */
-	for (uint16_t y=0; y<frame->height; y++){
-		for (uint16_t x=0; x<frame->width; x++){
+		threshold_median(frame, output, window_size, c);
+		return output;
 
-			threshold_window(frame, iimg, output, x, y,
-					 window_size, c, method);
+	}
 
-		}//for
-	}//for
+	assert(method == KOKI_ADAPTIVE_MEAN);
+
+	/* create the integral image to accelerate window summation */
+	iimg = koki_integral_image_new( frame, true );
+
+	/* threshold the image, a row at a time */
+	for (uint16_t y=0; y<frame->height; y++)
+		koki_threshold_adaptive_row(frame, iimg, window_size, y, c,
+					    (uint8_t*)(output->imageData
+						       + output->widthStep*y));
 
 	koki_integral_image_free( iimg );
 
@@ -0,0 +1,566 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+/**
+ * @file  trace.c
+ * @brief Implementation of labelling an image while tracing its contours
+ *
+ * This is the contour tracing labelling algorithm of Chang, Chen and Lu.
+ * The image is scanned a row at a time, and whenever a dark pixel is found
+ * on a contour that hasn't been seen yet, the whole contour is traced,
+ * labelling it as it goes.  The remaining dark pixels take the label of
+ * the pixel to their left.  A region's outer contour is the first of its
+ * contours to be found, so it can be kept as soon as it's traced.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <glib.h>
+#include <cv.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "labelling.h"
+#include "contour.h"
+#include "integral-image.h"
+#include "threshold.h"
+#include "workspace.h"
+#include "logger.h"
+
+#include "trace.h"
+
+/* Besides labels, the label buffer holds these during tracing */
+#define TRACE_WHITE   0                  /**< a light pixel */
+#define TRACE_VISITED KOKI_LABEL_MAX     /**< a light pixel next to a
+					      traced contour */
+#define TRACE_DARK    (KOKI_LABEL_MAX-1) /**< an unlabelled dark pixel */
+
+/**
+ * @brief the highest label that can be given out
+ */
+#define TRACE_LABEL_MAX (KOKI_LABEL_MAX-2)
+
+/* The light values are the two either side of zero */
+#define trace_is_dark( v ) ( (label_t)((v) + 1) > 1 )
+
+/**
+ * @brief the state of a trace through a frame's label buffer
+ */
+typedef struct {
+	label_t *data;		/**< the label buffer, with a border */
+	int32_t offsets[8];	/**< the offset to the neighbour in each
+				     direction, in the order of
+				     \c enum DIRECTION */
+	koki_contour_t *points;	/**< the contour being traced */
+	bool revisited;		/**< whether the last contour traced passed
+				     through its start part way round */
+} tracer_t;
+
+static const int8_t trace_dx[8] = { 0, 1, 1, 1, 0, -1, -1, -1 };
+static const int8_t trace_dy[8] = { -1, -1, 0, 1, 1, 1, 0, -1 };
+
+
+
+/**
+ * @brief finds the next point of a contour
+ *
+ * The neighbours of the point are searched clockwise from \c dir, and the
+ * first dark one is the next point.  The light pixels passed over are
+ * marked as visited, so that contours are only traced once.
+ *
+ * @param t    the tracer
+ * @param p    the current point
+ * @param dir  the direction to start searching in
+ * @return     the direction of the next point, or -1 if the point has no
+ *             dark neighbours
+ */
+static int8_t trace_next( tracer_t *t, label_t *p, uint8_t dir )
+{
+	for( uint8_t i=0; i<8; i++ ) {
+		label_t *q = p + t->offsets[dir];
+
+		if( trace_is_dark( *q ) )
+			return dir;
+
+		*q = TRACE_VISITED;
+		dir = (dir + 1) & 7;
+	}
+
+	return -1;
+}
+
+/**
+ * @brief finds the next dark pixel in a row
+ *
+ * @param row  the row of the label buffer
+ * @param x    the X co-ordinate to start looking from
+ * @param w    the width of the row
+ * @return     the X co-ordinate of the next dark pixel, or \c w if there
+ *             isn't one
+ */
+static inline uint16_t trace_skip_light( const label_t *row, uint16_t x,
+					 uint16_t w )
+{
+#if defined(__SSE2__)
+	const __m128i one = _mm_set1_epi16( 1 );
+	const __m128i zero = _mm_setzero_si128();
+
+	/* Eight at a time, using the same trick as trace_is_dark() */
+	for( ; x + 8 <= w; x += 8 ) {
+		__m128i v = _mm_loadu_si128( (const __m128i*)&row[x] );
+		int light;
+
+		v = _mm_subs_epu16( _mm_add_epi16( v, one ), one );
+		light = _mm_movemask_epi8( _mm_cmpeq_epi16( v, zero ) );
+
+		if( light != 0xffff )
+			return x + __builtin_ctz( ~light ) / 2;
+	}
+#endif
+
+	while( x < w && !trace_is_dark( row[x] ) )
+		x++;
+
+	return x;
+}
+
+/**
+ * @brief adds a point to the contour being traced
+ *
+ * @param t  the tracer
+ * @param x  the X co-ordinate of the point
+ * @param y  the Y co-ordinate of the point
+ */
+static inline void trace_keep( tracer_t *t, uint16_t x, uint16_t y )
+{
+	koki_contour_t *points = t->points;
+
+	if( points->len == points->size ) {
+		koki_contour_array_append( &t->points, x, y, NULL );
+		return;
+	}
+
+	points->x[points->len] = x;
+	points->y[points->len] = y;
+	points->len++;
+}
+
+/**
+ * @brief traces a contour, giving every point on it a label
+ *
+ * The contour is followed clockwise until it comes back to its start, and
+ * is heading in the same direction as it first did.  If \c keep is set,
+ * its points are put in the tracer's contour in the same form as
+ * \c koki_contour_find() gives: the start point, and the one after it,
+ * are repeated at the end.
+ *
+ * @param t      the tracer
+ * @param start  the start of the contour
+ * @param x      the X co-ordinate of the start
+ * @param y      the Y co-ordinate of the start
+ * @param dir    the direction to start searching in from the start
+ * @param label  the label to give the contour
+ * @param keep   whether to keep the contour's points
+ */
+static void trace_contour( tracer_t *t, label_t *start, uint16_t x,
+			   uint16_t y, uint8_t dir, label_t label, bool keep )
+{
+	label_t *p = start;
+	int8_t first, d;
+
+	t->revisited = FALSE;
+	*start = label;
+	if( keep )
+		trace_keep( t, x, y );
+
+	first = d = trace_next( t, start, dir );
+
+	/* An isolated pixel */
+	if( first < 0 )
+		return;
+
+	while( TRUE ) {
+		p += t->offsets[d];
+		x += trace_dx[d];
+		y += trace_dy[d];
+
+		*p = label;
+		if( keep )
+			trace_keep( t, x, y );
+
+		/* The neighbour before the previous point has already been
+		   searched, so start after it */
+		d = trace_next( t, p, (d + 6) & 7 );
+
+		if( p == start ) {
+			if( d == first )
+				break;
+
+			t->revisited = TRUE;
+		}
+	}
+
+	if( keep )
+		trace_keep( t, x + trace_dx[first], y + trace_dy[first] );
+}
+
+/**
+ * @brief traces an outer contour in the same way as \c koki_contour_find()
+ *
+ * Unlike \c trace_contour(), this starts by searching north, and stops as
+ * soon as it comes back to its start.  It doesn't change the label buffer.
+ *
+ * @param t      the tracer
+ * @param start  the start of the contour, which must be on the top row of
+ *               a region of more than one pixel
+ * @param x      the X co-ordinate of the start
+ * @param y      the Y co-ordinate of the start
+ */
+static void trace_outer_contour( tracer_t *t, label_t *start, uint16_t x,
+				 uint16_t y )
+{
+	label_t *p = start;
+	uint8_t dir = N;
+	bool first_run = TRUE;
+
+	t->points->len = 0;
+	trace_keep( t, x, y );
+
+	while( TRUE ) {
+		for( uint8_t i=0; i<8; i++ ) {
+			if( trace_is_dark( p[t->offsets[dir]] ) )
+				break;
+
+			dir = (dir + 1) & 7;
+		}
+
+		trace_keep( t, x + trace_dx[dir], y + trace_dy[dir] );
+
+		if( !first_run && p == start )
+			break;
+
+		p += t->offsets[dir];
+		x += trace_dx[dir];
+		y += trace_dy[dir];
+
+		/* One clockwise of the direction back to the previous point */
+		dir = (dir + 5) & 7;
+		first_run = FALSE;
+	}
+}
+
+/**
+ * @brief finds a region's clip region from its outer contour
+ *
+ * @param points     the outer contour, starting on the region's top row
+ * @param clip       the clip region to fill in, apart from its mass
+ * @param top_right  where to put the X co-ordinate of the rightmost point
+ *                   on the region's top row
+ */
+static void trace_clip( const koki_contour_t *points,
+			koki_clip_region_t *clip, uint16_t *top_right )
+{
+	int16_t min_x = points->x[0], max_x = points->x[0];
+	int16_t min_y = points->y[0], max_y = points->y[0];
+	int16_t top_x = points->x[0];
+
+	for( uint32_t i=1; i<points->len; i++ ) {
+		min_x = MIN( min_x, points->x[i] );
+		max_x = MAX( max_x, points->x[i] );
+		min_y = MIN( min_y, points->y[i] );
+		max_y = MAX( max_y, points->y[i] );
+
+		if( points->y[i] == points->y[0] )
+			top_x = MAX( top_x, points->x[i] );
+	}
+
+	clip->min.x = min_x;
+	clip->max.x = max_x;
+	clip->min.y = min_y;
+	clip->max.y = max_y;
+	*top_right = top_x;
+}
+
+/**
+ * @brief labels a new region, tracing its outer contour and adding it to
+ *        the workspace's regions
+ *
+ * The contour is made to start at the same point as \c koki_contour_find()
+ * would start it: whichever end of the region's top row is nearer the
+ * side of its clip region, favouring the left.  Usually that's the left
+ * end, where the trace started, and the traced contour is kept as it is.
+ * Otherwise, the contour is traced again from the right end.
+ *
+ * @param t   the tracer
+ * @param p   the region's first pixel, which is the left end of its top row
+ * @param x   the X co-ordinate of the first pixel
+ * @param y   the Y co-ordinate of the first pixel
+ * @param ws  the workspace
+ */
+static void trace_region( tracer_t *t, label_t *p, uint16_t x, uint16_t y,
+			  koki_workspace_t *ws )
+{
+	koki_traced_region_t r;
+	koki_contour_t *points;
+	uint16_t top_right;
+
+	assert( ws->regions->len < TRACE_LABEL_MAX );
+
+	/* Nothing is above or to the left, so start with the north east */
+	t->points->len = 0;
+	trace_contour( t, p, x, y, NE, ws->regions->len + 1, TRUE );
+
+	trace_clip( t->points, &r.clip, &top_right );
+
+	/* Only keep the contours of regions that might be useable.  The
+	   mass isn't known yet, but can't be more than the clip's area. */
+	r.clip.mass = MIN( (uint32_t)(r.clip.max.x - r.clip.min.x + 1)
+			   * (r.clip.max.y - r.clip.min.y + 1), UINT16_MAX );
+	r.contour = NULL;
+
+	if( koki_clip_useable( &r.clip, ws->w, ws->h ) ) {
+
+		if( r.clip.max.x - top_right < x - r.clip.min.x )
+			/* The right end is nearer its side */
+			trace_outer_contour( t, p + (top_right - x),
+					     top_right, y );
+		else if( t->revisited )
+			/* koki_contour_find() would stop part way round */
+			trace_outer_contour( t, p, x, y );
+
+		points = t->points;
+		r.contour = koki_contour_array_new( points->len, ws->arena );
+		memcpy( r.contour->x, points->x, sizeof(int16_t) * points->len );
+		memcpy( r.contour->y, points->y, sizeof(int16_t) * points->len );
+		r.contour->len = points->len;
+	}
+
+	r.clip.mass = 0;
+	g_array_append_val( ws->regions, r );
+}
+
+/**
+ * @brief thresholds a frame into the label buffer, as light and unlabelled
+ *        dark pixels
+ *
+ * @param koki           the libkoki context
+ * @param frame          the frame to threshold
+ * @param window_size    the size of window to use around the threshold
+ * @param thresh_margin  the margin around the adaptively-calculated threshold
+ * @param ws             the workspace, prepared for the frame
+ */
+static void trace_threshold( koki_t *koki, const IplImage *frame,
+			     uint16_t window_size, int16_t thresh_margin,
+			     koki_workspace_t *ws )
+{
+	koki_labelled_image_t *lmg = ws->labelled_image;
+	const uint16_t w = frame->width, h = frame->height;
+	koki_integral_image_t *iimg;
+	IplImage *thresh_img = NULL;
+	uint8_t *thresh_row = ws->thresh_row;
+
+	if( koki_is_logging( koki ) )
+		thresh_img = koki_workspace_log_image( ws, &ws->thresh_img, 1 );
+
+	/* The border is light, but gets marked as visited */
+	memset( &KOKI_LABELLED_IMAGE_LABEL( lmg, -1, -1 ), 0,
+		sizeof(label_t) * (w + 2) );
+	memset( &KOKI_LABELLED_IMAGE_LABEL( lmg, -1, h ), 0,
+		sizeof(label_t) * (w + 2) );
+
+	/* Only the rows of the integral image covering the current
+	   threshold window (and the row above it) are needed */
+	iimg = koki_workspace_integral_image( ws, frame, window_size + 1 );
+
+	for( uint16_t y=0; y<h; y++ ) {
+		label_t *row = &KOKI_LABELLED_IMAGE_LABEL( lmg, 0, y );
+		CvRect win;
+
+		koki_threshold_adaptive_calc_window( frame, &win,
+						     window_size, 0, y );
+		koki_integral_image_advance( iimg, w - 1,
+					     win.y + win.height - 1 );
+
+		koki_threshold_adaptive_row( frame, iimg, window_size, y,
+					     thresh_margin, thresh_row );
+
+		row[-1] = row[w] = TRACE_WHITE;
+		for( uint16_t x=0; x<w; x++ )
+			row[x] = thresh_row[x] ? TRACE_WHITE : TRACE_DARK;
+
+		if( thresh_img != NULL )
+			memcpy( thresh_img->imageData + thresh_img->widthStep * y,
+				thresh_row, w );
+	}
+
+	if( thresh_img != NULL )
+		koki_log( koki, "thresholded image\n", thresh_img );
+}
+
+/**
+ * @brief puts the label buffer's border back to unlabelled, after tracing
+ *        has marked parts of it as visited
+ *
+ * The workspace keeps its label buffer between frames of the same size,
+ * and the other labellers expect its border to be zero.
+ *
+ * @param lmg  the labelled image holding the label buffer
+ */
+static void trace_clear_border( koki_labelled_image_t *lmg )
+{
+	const uint16_t w = lmg->w, h = lmg->h;
+
+	memset( &KOKI_LABELLED_IMAGE_LABEL( lmg, -1, -1 ), 0,
+		sizeof(label_t) * (w + 2) );
+	memset( &KOKI_LABELLED_IMAGE_LABEL( lmg, -1, h ), 0,
+		sizeof(label_t) * (w + 2) );
+
+	for( uint16_t y=0; y<h; y++ ) {
+		label_t *row = &KOKI_LABELLED_IMAGE_LABEL( lmg, 0, y );
+
+		row[-1] = row[w] = 0;
+	}
+}
+
+/**
+ * @brief thresholds and labels a frame, finding the outer contour of each
+ *        dark region as it goes
+ *
+ * The frame is thresholded in the same way as \c koki_label_adaptive()
+ * does, and the same dark regions are found.  Instead of a labelled image,
+ * the result is an array of the regions, each with its clip region and
+ * outer contour.  The contours are the same as those found by
+ * \c koki_contour_find().  The regions are in the order of their first
+ * pixels.
+ *
+ * Everything belongs to the context's workspace, and is only valid until
+ * the context is next given a frame.  The contours are allocated from the
+ * workspace's arena, so also go when it is reset.
+ *
+ * @param koki           the libkoki context
+ * @param frame          the input image to label, greyscale or with its
+ *                       luma interleaved (see \c KOKI_IPLIMAGE_LUMA_ELEM)
+ * @param window_size    the size of window to use around the threshold
+ * @param thresh_margin  the margin around the adaptively-calculated threshold
+ * @return               a \c GArray of \c koki_traced_region_t, which
+ *                       belongs to the context
+ */
+GArray* koki_label_trace_workspace( koki_t *koki, const IplImage *frame,
+				    uint16_t window_size,
+				    int16_t thresh_margin )
+{
+	koki_workspace_t *ws = koki->workspace;
+	koki_labelled_image_t *lmg;
+	GArray *regions;
+	tracer_t t;
+	const uint16_t w = frame->width, h = frame->height;
+	const int32_t stride = w + 2;
+
+	assert(frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame));
+
+	koki_workspace_prepare( ws, w, h );
+	lmg = ws->labelled_image;
+	regions = ws->regions;
+
+	trace_threshold( koki, frame, window_size, thresh_margin, ws );
+
+	t.data = lmg->data;
+	t.offsets[N]  = -stride;
+	t.offsets[NE] = -stride + 1;
+	t.offsets[E]  = 1;
+	t.offsets[SE] = stride + 1;
+	t.offsets[S]  = stride;
+	t.offsets[SW] = stride - 1;
+	t.offsets[W]  = -1;
+	t.offsets[NW] = -stride - 1;
+	t.points = ws->trace_points;
+
+	for( uint16_t y=0; y<h; y++ ) {
+		label_t *row = &KOKI_LABELLED_IMAGE_LABEL( lmg, 0, y );
+		uint16_t x = 0;
+
+		while( TRUE ) {
+			uint16_t run_start;
+			koki_traced_region_t *region;
+
+			/* Find the next run of dark pixels */
+			x = trace_skip_light( row, x, w );
+
+			if( x == w )
+				break;
+
+			run_start = x;
+
+			/* Only the first pixel of a run can be the top of a
+			   new region */
+			if( row[x] == TRACE_DARK
+			    && !trace_is_dark( row[x - stride] ) )
+				trace_region( &t, &row[x], x, y, ws );
+
+			for( ; x < w && trace_is_dark( row[x] ); x++ ) {
+				label_t *p = &row[x];
+
+				if( p[stride] == TRACE_WHITE ) {
+					/* Above a light pixel that no contour
+					   has been next to, so this is on an
+					   inner contour */
+					if( *p == TRACE_DARK )
+						*p = p[-1];
+
+					trace_contour( &t, p, x, y, SW, *p,
+						       FALSE );
+				}
+
+				/* The rest of the run's pixels are in the
+				   same region */
+				if( *p == TRACE_DARK )
+					*p = p[-1];
+			}
+
+			assert( row[run_start] >= 1
+				&& row[run_start] <= regions->len );
+			region = &g_array_index( regions, koki_traced_region_t,
+						 row[run_start] - 1 );
+			region->clip.mass += x - run_start;
+		}
+	}
+
+	/* The scratch contour may have moved to grow */
+	ws->trace_points = t.points;
+
+	trace_clear_border( lmg );
+
+	return regions;
+}
+
+/**
+ * @brief determines whether or not a traced region is going to be useful
+ *
+ * See \c koki_label_useable().
+ *
+ * @param region  the region
+ * @param w       the width of the frame the region is in
+ * @param h       the height of the frame the region is in
+ * @return        FALSE if the region is considered unusable, TRUE otherwise
+ */
+bool koki_traced_region_useable( const koki_traced_region_t *region,
+				 uint16_t w, uint16_t h )
+{
+	return region->contour != NULL
+		&& koki_clip_useable( &region->clip, w, h );
+}
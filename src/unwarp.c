@@ -21,10 +21,12 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
 #include <cv.h>
 
 #include "points.h"
 #include "marker.h"
+#include "code_grid.h"
 
 #include "unwarp.h"
 
@@ -156,3 +158,223 @@ IplImage* koki_unwarp_marker( koki_t* koki, koki_marker_t *marker, IplImage *fra
 	return ret;
 
 }
+
+
+
+/**
+ * @brief the number of points sampled along each side of a grid cell by
+ *        \c koki_unwarp_grid()
+ */
+#define GRID_CELL_SAMPLES 4
+
+
+
+/**
+ * @brief finds the homography that maps the unit square onto a marker
+ *
+ * This is the closed form given by Heckbert in "Fundamentals of Texture
+ * Mapping and Image Warping".  The square's corners \c (0,0), \c (1,0),
+ * \c (1,1) and \c (0,1) map to the marker's vertices 0 to 3, and a point
+ * \c (u,v) maps to \c ((h0*u + h1*v + h2) / w, (h3*u + h4*v + h5) / w), where
+ * \c w is \c (h6*u + h7*v + 1).
+ *
+ * @param marker  the marker
+ * @param h       the array to write the homography's 8 coefficients to
+ * @return        \c TRUE on success, \c FALSE if the marker's vertices are
+ *                degenerate
+ */
+static bool square_to_marker(koki_marker_t *marker, double h[8])
+{
+
+	double x[4], y[4];
+	double sx, sy, dx1, dx2, dy1, dy2, den;
+
+	for (uint8_t i=0; i<4; i++){
+		x[i] = marker->vertices[i].image.x;
+		y[i] = marker->vertices[i].image.y;
+	}
+
+	sx = x[0] - x[1] + x[2] - x[3];
+	sy = y[0] - y[1] + y[2] - y[3];
+
+	dx1 = x[1] - x[2];
+	dx2 = x[3] - x[2];
+	dy1 = y[1] - y[2];
+	dy2 = y[3] - y[2];
+
+	den = dx1 * dy2 - dx2 * dy1;
+
+	if (den == 0)
+		return FALSE;
+
+	/* a parallelogram needs no perspective division, but the general
+	   case reduces to that anyway */
+	h[6] = (sx * dy2 - dx2 * sy) / den;
+	h[7] = (dx1 * sy - sx * dy1) / den;
+
+	h[0] = x[1] - x[0] + h[6] * x[1];
+	h[1] = x[3] - x[0] + h[7] * x[3];
+	h[2] = x[0];
+	h[3] = y[1] - y[0] + h[6] * y[1];
+	h[4] = y[3] - y[0] + h[7] * y[3];
+	h[5] = y[0];
+
+	return TRUE;
+
+}
+
+
+
+/**
+ * @brief samples the luma of a frame at a point, interpolating bilinearly
+ *        between the four pixels around it
+ *
+ * @param frame  the frame, greyscale or with its luma interleaved
+ * @param x      the X co-ordinate, which must be within the frame
+ * @param y      the Y co-ordinate, which must be within the frame
+ * @return       the interpolated value, scaled up by 256
+ */
+static inline uint32_t sample_bilinear(const IplImage *frame, float x, float y)
+{
+
+	const uint8_t *row;
+	const int32_t stride = frame->nChannels;
+	int32_t ix, iy, fx, fy, top, bottom;
+
+	/* keep the pixel to the right and the one below in the frame too */
+	if (x > frame->width - 1.001f)
+		x = frame->width - 1.001f;
+	if (y > frame->height - 1.001f)
+		y = frame->height - 1.001f;
+
+	ix = (int32_t)x;
+	iy = (int32_t)y;
+	fx = (x - ix) * 16;
+	fy = (y - iy) * 16;
+
+	row = &KOKI_IPLIMAGE_LUMA_ELEM(frame, ix, iy);
+	top = row[0] * (16 - fx) + row[stride] * fx;
+	row += frame->widthStep;
+	bottom = row[0] * (16 - fx) + row[stride] * fx;
+
+	return top * (16 - fy) + bottom * fy;
+
+}
+
+
+
+/**
+ * @brief samples a marker straight from the frame into a code grid,
+ *        without unwarping it into an image first
+ *
+ * The homography from the grid to the frame is found once, and a few
+ * points in each cell are sampled through it.  Each cell is then
+ * thresholded against the mean of the area about it, less a constant.
+ * Much as \c koki_threshold_adaptive() would do to an unwarped image with
+ * a window two cells wide, the cell's neighbours count half as much as it
+ * does, and its diagonal neighbours a quarter.
+ *
+ * @param marker  the marker to sample
+ * @param frame   the frame the marker was found in, greyscale or with its
+ *                luma interleaved
+ * @param c       the constant to subtract from each cell's threshold
+ * @param grid    the grid to output to
+ * @return        \c TRUE on success, \c FALSE if the marker isn't wholly in
+ *                the frame, or isn't a proper quadrilateral
+ */
+bool koki_unwarp_grid(koki_marker_t *marker, IplImage *frame, int16_t c,
+		      koki_grid_t *grid)
+{
+
+	const uint8_t gw = KOKI_MARKER_GRID_WIDTH;
+	const uint8_t n = GRID_CELL_SAMPLES;
+	float means[KOKI_MARKER_GRID_WIDTH][KOKI_MARKER_GRID_WIDTH];
+	double h[8];
+
+	assert(marker != NULL);
+	assert(frame != NULL && KOKI_IPLIMAGE_IS_LUMA(frame));
+	assert(grid != NULL);
+
+	/* make sure we're within bounds, so every sample is too */
+	for (uint8_t i=0; i<4; i++){
+		if (marker->vertices[i].image.x < 0 ||
+		    marker->vertices[i].image.y < 0 ||
+		    marker->vertices[i].image.x >= frame->width ||
+		    marker->vertices[i].image.y >= frame->height){
+
+			return FALSE;
+
+		}//if
+	}//for
+
+	if (!square_to_marker(marker, h))
+		return FALSE;
+
+	/* sample each cell on an n by n grid of points */
+	for (uint8_t row=0; row<gw; row++){
+		for (uint8_t col=0; col<gw; col++){
+
+			uint32_t sum = 0;
+
+			for (uint8_t j=0; j<n; j++){
+				for (uint8_t i=0; i<n; i++){
+
+					double u = (col + (i + 0.5) / n) / gw;
+					double v = (row + (j + 0.5) / n) / gw;
+					double w = h[6] * u + h[7] * v + 1;
+					double x, y;
+
+					/* a concave or twisted quad can send
+					   points off to infinity */
+					if (w <= 0)
+						return FALSE;
+
+					x = (h[0] * u + h[1] * v + h[2]) / w;
+					y = (h[3] * u + h[4] * v + h[5]) / w;
+
+					if (x < 0 || y < 0)
+						return FALSE;
+
+					sum += sample_bilinear(frame, x, y);
+
+				}//for i
+			}//for j
+
+			grid->data[row][col].sum = sum / 256;
+			grid->data[row][col].num_pixels = n * n;
+			means[row][col] = (float)sum / (256 * n * n);
+
+		}//for col
+	}//for row
+
+	/* threshold each cell against the area about it */
+	for (int8_t row=0; row<gw; row++){
+		for (int8_t col=0; col<gw; col++){
+
+			float local = 0, weights = 0;
+
+			for (int8_t dy=-1; dy<=1; dy++){
+				for (int8_t dx=-1; dx<=1; dx++){
+
+					float weight;
+
+					if (row+dy < 0 || row+dy >= gw ||
+					    col+dx < 0 || col+dx >= gw)
+						continue;
+
+					weight = (2 - abs(dx)) * (2 - abs(dy));
+					local += weight * means[row+dy][col+dx];
+					weights += weight;
+
+				}//for dx
+			}//for dy
+
+			grid->data[row][col].val =
+				means[row][col] > local / weights - c ? 1 : 0;
+
+		}//for col
+	}//for row
+
+	return TRUE;
+
+}
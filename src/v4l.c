@@ -26,12 +26,24 @@
 #include <sys/ioctl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <poll.h>
+#include <errno.h>
 #include <string.h>
 #include <assert.h>
 #include <sys/time.h> /* for videodev2.h */
+#include <time.h>
 #include <linux/videodev2.h>
 #include <cv.h>
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define KOKI_HAVE_YUYV_KERNELS 1
+#endif
+
 #include "labelling.h" /* for KOKI_IPLIMAGE_ELEM */
 
 #include "v4l.h"
@@ -434,6 +446,10 @@ int koki_v4l_stop_stream(int fd)
 /**
  * @brief grabs a frame from the camera
  *
+ * Only the first buffer is used, and the camera isn't capturing while the
+ * frame is being processed, so frames will be missed.  A
+ * \c koki_v4l_ring_t captures continuously.
+ *
  * @param fd       the camera's file descriptor
  * @param buffers  the already allocated buffers structure
  * @return         a pointer to the image data array
@@ -471,52 +487,947 @@ uint8_t* koki_v4l_get_frame_array(int fd, koki_buffer_t *buffers)
 }
 
 
+
+/**
+ * @brief queues one of a ring's buffers with the driver
+ *
+ * @param ring   the ring
+ * @param index  the buffer to queue
+ * @return       a negative value on failure
+ */
+static int ring_queue(koki_v4l_ring_t *ring, uint32_t index)
+{
+
+	struct v4l2_buffer buffer;
+	int ret;
+
+	assert(index < (uint32_t)ring->count && !ring->queued[index]);
+
+	CLEAR(buffer);
+
+	buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buffer.memory = V4L2_MEMORY_MMAP;
+	buffer.index = index;
+
+	ret = ioctl(ring->fd, VIDIOC_QBUF, &buffer);
+	if (ret < 0){
+		fprintf(stderr, "failed to queue buffer\n");
+		return ret;
+	}
+
+	ring->queued[index] = true;
+	ring->n_queued++;
+
+	return ret;
+
+}
+
+
+
+/**
+ * @brief waits for the camera to fill a buffer
+ *
+ * @param fd       the camera's file descriptor
+ * @param timeout  how long to wait, in milliseconds, or -1 to wait for
+ *                 ever
+ * @return         1 if a buffer is ready, 0 if the time ran out or a
+ *                 negative value on failure
+ */
+static int ring_poll(int fd, int timeout)
+{
+
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	do {
+		ret = poll(&pfd, 1, timeout);
+	} while (ret < 0 && errno == EINTR);
+
+	if (ret < 0){
+		fprintf(stderr, "failed to poll camera\n");
+		return ret;
+	}
+
+	if (ret > 0 && (pfd.revents & POLLERR)){
+		fprintf(stderr, "camera error while polling\n");
+		return -1;
+	}
+
+	return ret > 0 && (pfd.revents & POLLIN);
+
+}
+
+
+
+/**
+ * @brief unmaps a ring's buffers and frees them in the driver too, so that
+ *        the camera can be given new ones (or a new format)
+ *
+ * @param ring  the ring, which is freed
+ */
+static void ring_free(koki_v4l_ring_t *ring)
+{
+
+	struct v4l2_requestbuffers reqbuf;
+
+	koki_v4l_free_buffers(ring->buffers, ring->count);
+
+	CLEAR(reqbuf);
+
+	reqbuf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	reqbuf.memory = V4L2_MEMORY_MMAP;
+	reqbuf.count = 0;
+
+	if (ioctl(ring->fd, VIDIOC_REQBUFS, &reqbuf) < 0)
+		fprintf(stderr, "couldn't free the driver's buffers\n");
+
+	free(ring->queued);
+	free(ring);
+
+}
+
+
+
+/**
+ * @brief the time on \c CLOCK_MONOTONIC, in milliseconds
+ */
+static int64_t ring_now(void)
+{
+
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+
+}
+
+
+
+/**
+ * @brief how much of a wait is left, so that waiting again after a
+ *        corrupt frame doesn't start the time over
+ *
+ * @param timeout   how long the whole wait was, in milliseconds, or -1 to
+ *                  wait for ever
+ * @param deadline  when the wait ends, from \c ring_now()
+ * @return          the time left, in milliseconds, or -1 to wait for ever
+ */
+static int ring_time_left(int timeout, int64_t deadline)
+{
+
+	int64_t left;
+
+	if (timeout < 0)
+		return -1;
+
+	left = deadline - ring_now();
+
+	return left > 0 ? left : 0;
+
+}
+
+
+
+/**
+ * @brief allocates a ring of buffers, queues them all with the camera and
+ *        starts it streaming
+ *
+ * While the caller holds one frame, the camera carries on filling the
+ * others, so capture and processing overlap.  Frames are fetched with
+ * \c koki_v4l_ring_get_frame() and handed back with
+ * \c koki_v4l_ring_release_frame().
+ *
+ * @param fd     the camera's file descriptor, with its format already set
+ * @param count  the number of buffers to ask for; the driver may give
+ *               more or fewer, and at least 3 are needed to never stall
+ *               while a frame is held
+ * @return       the ring, or NULL on failure
+ */
+koki_v4l_ring_t* koki_v4l_ring_start(int fd, int count)
+{
+
+	koki_v4l_ring_t *ring;
+
+	assert(count > 0);
+
+	ring = calloc(1, sizeof(koki_v4l_ring_t));
+	assert(ring != NULL);
+
+	ring->fd = fd;
+	ring->count = count;
+	ring->buffers = koki_v4l_prepare_buffers(fd, &ring->count);
+
+	if (ring->buffers == NULL){
+		free(ring);
+		return NULL;
+	}
+
+	ring->queued = calloc(ring->count, sizeof(bool));
+	assert(ring->queued != NULL);
+
+	for (int i=0; i<ring->count; i++)
+		if (ring_queue(ring, i) < 0)
+			goto fail;
+
+	if (koki_v4l_start_stream(fd) < 0)
+		goto fail;
+
+	return ring;
+
+fail:
+	ring_free(ring);
+
+	return NULL;
+
+}
+
+
+
+/**
+ * @brief stops the camera streaming and frees a ring of buffers
+ *
+ * Any frames the caller still holds become invalid.
+ *
+ * @param ring  the ring, as returned by \c koki_v4l_ring_start()
+ */
+void koki_v4l_ring_stop(koki_v4l_ring_t *ring)
+{
+
+	assert(ring != NULL);
+
+	koki_v4l_stop_stream(ring->fd);
+	ring_free(ring);
+
+}
+
+
+
+/**
+ * @brief dequeues a buffer the camera has captured a frame into
+ *
+ * If the driver flags the frame as corrupt, the buffer is queued straight
+ * back again.
+ *
+ * @param ring    the ring
+ * @param buffer  where to store the buffer's details
+ * @return        1 if a frame was dequeued, 0 if it was corrupt and its
+ *                buffer has been requeued, or a negative value on failure
+ */
+static int ring_dequeue(koki_v4l_ring_t *ring, struct v4l2_buffer *buffer)
+{
+
+	CLEAR(*buffer);
+
+	buffer->type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	buffer->memory = V4L2_MEMORY_MMAP;
+
+	if (ioctl(ring->fd, VIDIOC_DQBUF, buffer) < 0){
+		fprintf(stderr, "failed to dequeue buffer\n");
+		return -1;
+	}
+
+	ring->queued[buffer->index] = false;
+	ring->n_queued--;
+
+	if (buffer->flags & V4L2_BUF_FLAG_ERROR)
+		return ring_queue(ring, buffer->index) < 0 ? -1 : 0;
+
+	return 1;
+
+}
+
+
+
+/**
+ * @brief fills in a frame from the buffer it was dequeued from
+ */
+static void ring_fill_frame(koki_v4l_ring_t *ring,
+			    const struct v4l2_buffer *buffer,
+			    koki_v4l_frame_t *frame)
+{
+
+	frame->data = ring->buffers[buffer->index].start;
+	frame->length = buffer->bytesused;
+	frame->index = buffer->index;
+	frame->sequence = buffer->sequence;
+	frame->timestamp = buffer->timestamp;
+
+}
+
+
+
+/**
+ * @brief gets the newest frame the camera has captured
+ *
+ * If more than one frame has been captured since the last call, all but
+ * the newest are handed straight back to the camera, which can be told
+ * from gaps in the sequence numbers.  So are frames the driver flags as
+ * corrupt.  The frame must be released with
+ * \c koki_v4l_ring_release_frame() once it's no longer needed.
+ *
+ * If a stale frame can't be handed back, its buffer is lost to the ring
+ * and a negative value is returned, but the newest frame is still stored
+ * in \c frame and must be released as usual.
+ *
+ * @param ring     the ring, as returned by \c koki_v4l_ring_start()
+ * @param frame    where to store the frame
+ * @param timeout  how long to wait for a frame, in milliseconds; 0 to
+ *                 only take one that's ready, or -1 to wait for ever
+ * @return         1 if a frame was got, 0 if the time ran out or a negative
+ *                 value on failure, including when every buffer is held
+ */
+int koki_v4l_ring_get_frame(koki_v4l_ring_t *ring, koki_v4l_frame_t *frame,
+			    int timeout)
+{
+
+	struct v4l2_buffer buffer, newest;
+	int64_t deadline = ring_now() + timeout;
+	int ret;
+	bool got = false, lost = false;
+
+	assert(ring != NULL && frame != NULL);
+
+	if (ring->n_queued == 0){
+		fprintf(stderr, "no buffers queued to capture into\n");
+		return -1;
+	}
+
+	ret = ring_poll(ring->fd, timeout);
+
+	/* keep dequeuing until there's nothing ready, so that the newest
+	   frame is the one returned */
+	while (ret > 0){
+
+		ret = ring_dequeue(ring, &buffer);
+		if (ret < 0)
+			break;
+
+		if (ret > 0){
+
+			/* the older frame's stale -- let the camera have it
+			   back */
+			if (got && ring_queue(ring, newest.index) < 0)
+				lost = true;
+
+			newest = buffer;
+			got = true;
+
+			if (lost || ring->n_queued == 0)
+				break;
+
+		}
+
+		/* after a corrupt frame, carry on waiting for a good one,
+		   for whatever's left of the time */
+		ret = ring_poll(ring->fd,
+				got ? 0 : ring_time_left(timeout, deadline));
+
+	}//while
+
+	/* a failure after a frame was got can wait for the next call */
+	if (!got)
+		return ret;
+
+	ring_fill_frame(ring, &newest, frame);
+
+	/* the stale buffer's dropped out of the ring, which is worth
+	   knowing about before the ring runs dry */
+	if (lost)
+		return -1;
+
+	return 1;
+
+}
+
+
+
 /**
- * @brief recovers the Y, U and V values from a YUYV data array
+ * @brief gets the oldest frame the camera has captured that hasn't been
+ *        got yet, so that, unlike \c koki_v4l_ring_get_frame(), no frames
+ *        are skipped
+ *
+ * Frames are only lost if the camera runs out of buffers to capture into,
+ * which shows up as gaps in the sequence numbers, or if the driver flags
+ * them as corrupt, in which case they're handed straight back to the
+ * camera and the wait goes on for the next.  The frame must be
+ * released with \c koki_v4l_ring_release_frame() once it's no longer
+ * needed.
+ *
+ * @param ring     the ring, as returned by \c koki_v4l_ring_start()
+ * @param frame    where to store the frame
+ * @param timeout  how long to wait for a frame, in milliseconds; 0 to
+ *                 only take one that's ready, or -1 to wait for ever
+ * @return         1 if a frame was got, 0 if the time ran out or a negative
+ *                 value on failure, including when every buffer is held
  */
-#define GET_YUV(yuyv_frame, x, y, w, h, Y, U, V) do {	\
-		uint8_t *tmp;				\
-		tmp = &yuyv_frame[((w) * 2 * (y)) +	\
-				 (((x) & ~1) * 2)];	\
-		U = tmp[1];				\
-		V = tmp[3];				\
-		Y = ((x) & 1) ? tmp[2] : tmp[0];	\
-	}  while (0);					\
+int koki_v4l_ring_get_next_frame(koki_v4l_ring_t *ring,
+				 koki_v4l_frame_t *frame, int timeout)
+{
+
+	struct v4l2_buffer buffer;
+	int64_t deadline = ring_now() + timeout;
+	int ret;
+
+	assert(ring != NULL && frame != NULL);
+
+	if (ring->n_queued == 0){
+		fprintf(stderr, "no buffers queued to capture into\n");
+		return -1;
+	}
+
+	/* corrupt frames are skipped, and waited past within the time */
+	do {
+		ret = ring_poll(ring->fd, ring_time_left(timeout, deadline));
+		if (ret <= 0)
+			return ret;
+
+		ret = ring_dequeue(ring, &buffer);
+		if (ret < 0)
+			return ret;
+	} while (ret == 0);
+
+	ring_fill_frame(ring, &buffer, frame);
+
+	return 1;
+
+}
+
+
 
 /**
- * @brief recovers just the Y value from a YUYV data array
+ * @brief hands a frame back to the camera to capture into again
+ *
+ * @param ring   the ring the frame came from
+ * @param frame  the frame, as got from \c koki_v4l_ring_get_frame(), whose
+ *               data mustn't be used afterwards
+ * @return       a negative value on failure
  */
-#define GET_Y(yuyv_frame, x, y, w, h, Y) do {		\
-		uint8_t *tmp;				\
-		tmp = &yuyv_frame[((w) * 2 * (y)) +	\
-				  (((x) & ~1) * 2)];	\
-		Y = CLIP(((x) & 1) ? tmp[2] : tmp[0]);	\
-	}  while (0);					\
+int koki_v4l_ring_release_frame(koki_v4l_ring_t *ring,
+				const koki_v4l_frame_t *frame)
+{
 
+	assert(ring != NULL && frame != NULL);
 
-#ifndef MIN
-#define MIN(a, b) a < b ? a : b;
+	return ring_queue(ring, frame->index);
+
+}
+
+
+/**
+ * @brief makes an image header that views the luma of a frame in place,
+ *        so markers can be found in it without copying it out
+ *
+ * For packed formats like YUYV, the header has two interleaved channels,
+ * the first being the luma.  For greyscale and the formats with a plane of
+ * luma first (e.g. NV12), it has one.  Either way, \c koki_find_markers()
+ * can be given it directly.
+ *
+ * @param view  the header to fill in, whose data mustn't be released
+ * @param data  the frame's data, e.g. from \c koki_v4l_ring_get_frame(),
+ *              which must outlive the view
+ * @param fmt   the format the frame was captured in
+ * @return      \c view, or NULL if the format's luma can't be viewed
+ */
+IplImage* koki_v4l_luma_view(IplImage *view, uint8_t *data,
+			     struct v4l2_format fmt)
+{
+
+	int channels, step;
+
+	assert(view != NULL && data != NULL);
+
+	switch (fmt.fmt.pix.pixelformat){
+
+	case V4L2_PIX_FMT_YUYV:
+	case V4L2_PIX_FMT_YVYU:
+		channels = 2;
+		break;
+
+	case V4L2_PIX_FMT_GREY:
+	case V4L2_PIX_FMT_NV12:
+	case V4L2_PIX_FMT_NV21:
+	case V4L2_PIX_FMT_YUV420:
+	case V4L2_PIX_FMT_YVU420:
+		channels = 1;
+		break;
+
+	default:
+		fprintf(stderr, "can't view the luma of this format\n");
+		return NULL;
+
+	}
+
+	step = fmt.fmt.pix.bytesperline;
+	if (step == 0)
+		step = fmt.fmt.pix.width * channels;
+
+	cvInitImageHeader(view, cvSize(fmt.fmt.pix.width, fmt.fmt.pix.height),
+			  IPL_DEPTH_8U, channels, IPL_ORIGIN_TL, 4);
+	cvSetData(view, data, step);
+
+	return view;
+
+}
+
+
+
+/**
+ * @brief clips a value to the range of a byte
+ */
+static inline uint8_t clip_byte(int32_t v)
+{
+
+	return v < 0 ? 0 : (v > 255 ? 255 : v);
+
+}
+
+
+
+/**
+ * @brief converts a pixel from YUV to BGR, as an \c IplImage stores it
+ *
+ * @param y    the pixel's Y value
+ * @param d    the pixel's U value, less 128
+ * @param e    the pixel's V value, less 128
+ * @param out  the three bytes to write the blue, green and red values to
+ */
+static inline void yuv_to_bgr(int32_t y, int32_t d, int32_t e, uint8_t *out)
+{
+
+	int32_t c = (y - 16) * 298 + 128;
+
+	out[0] = clip_byte((c + 516*d) >> 8);
+	out[1] = clip_byte((c - 100*d - 208*e) >> 8);
+	out[2] = clip_byte((c + 409*e) >> 8);
+
+}
+
+
+
+/**
+ * @brief converts part of a row of YUYV data to BGR, a pair of pixels at
+ *        a time
+ *
+ * @param row  the YUYV row
+ * @param x0   the first pixel to convert, which must be even
+ * @param w    the width of the row
+ * @param out  the BGR row to write to
+ */
+static void yuyv_row_to_bgr_scalar(const uint8_t *row, uint16_t x0,
+				   uint16_t w, uint8_t *out)
+{
+
+	for (uint16_t x=x0; x<w; x+=2){
+
+		const uint8_t *p = &row[x * 2];
+		int32_t d = p[1] - 128, e = p[3] - 128;
+
+		yuv_to_bgr(p[0], d, e, &out[x * 3]);
+		if (x + 1 < w)
+			yuv_to_bgr(p[2], d, e, &out[x * 3 + 3]);
+
+	}
+
+}
+
+
+
+#if defined(KOKI_HAVE_YUYV_KERNELS)
+/**
+ * @brief packs a pair of 16-bit coefficients into 32 bits, for
+ *        \c _mm_madd_epi16() to multiply a pair of values by
+ */
+#define COEFF_PAIR(a, b) \
+	((int32_t)(((uint32_t)(uint16_t)(b) << 16) | (uint16_t)(a)))
+
+/**
+ * @brief converts eight pixels of YUYV to one of B, G or R, as 16-bit
+ *        values that are yet to be clipped
+ *
+ * Each pixel's value is <tt>(298(Y-16) + 128 + cu(U-128) + cv(V-128))
+ * >> 8</tt>, the same as \c yuv_to_bgr() calculates.
+ *
+ * @param y_lo  pixels 0-3's Y less 16, interleaved with 1s
+ * @param y_hi  pixels 4-7's Y less 16, interleaved with 1s
+ * @param uv_lo pixels 0-3's U and V, less 128
+ * @param uv_hi pixels 4-7's U and V, less 128
+ * @param k     the U and V coefficients, \c cu and \c cv, repeated
+ * @return      the eight values
+ */
+__attribute__((target("ssse3")))
+static inline __m128i yuyv_channel_ssse3(__m128i y_lo, __m128i y_hi,
+					 __m128i uv_lo, __m128i uv_hi,
+					 __m128i k)
+{
+
+	const __m128i ky = _mm_set1_epi32(COEFF_PAIR(298, 128));
+	__m128i lo, hi;
+
+	lo = _mm_add_epi32(_mm_madd_epi16(y_lo, ky), _mm_madd_epi16(uv_lo, k));
+	hi = _mm_add_epi32(_mm_madd_epi16(y_hi, ky), _mm_madd_epi16(uv_hi, k));
+
+	return _mm_packs_epi32(_mm_srai_epi32(lo, 8), _mm_srai_epi32(hi, 8));
+
+}
+
+
+
+/**
+ * @brief converts eight pixels of YUYV to B, G and R
+ *
+ * @param in  the 16 bytes of YUYV data
+ * @param b   where to store the blue values, as 16-bit values that are yet
+ *            to be clipped
+ * @param g   where to store the green values, likewise
+ * @param r   where to store the red values, likewise
+ */
+__attribute__((target("ssse3")))
+static inline void yuyv_8_ssse3(__m128i in, __m128i *b, __m128i *g, __m128i *r)
+{
+
+	const __m128i mask = _mm_set1_epi16(0xff);
+	const __m128i ones = _mm_set1_epi16(1);
+	__m128i y, uv, y_lo, y_hi, uv_lo, uv_hi;
+
+	/* Y-16 in each 16-bit element, paired with a 1 for the rounding */
+	y = _mm_sub_epi16(_mm_and_si128(in, mask), _mm_set1_epi16(16));
+	y_lo = _mm_unpacklo_epi16(y, ones);
+	y_hi = _mm_unpackhi_epi16(y, ones);
+
+	/* U-128 and V-128 of each pair of pixels, repeated for each pixel */
+	uv = _mm_sub_epi16(_mm_srli_epi16(in, 8), _mm_set1_epi16(128));
+	uv_lo = _mm_unpacklo_epi32(uv, uv);
+	uv_hi = _mm_unpackhi_epi32(uv, uv);
+
+	*b = yuyv_channel_ssse3(y_lo, y_hi, uv_lo, uv_hi,
+				_mm_set1_epi32(COEFF_PAIR(516, 0)));
+	*g = yuyv_channel_ssse3(y_lo, y_hi, uv_lo, uv_hi,
+				_mm_set1_epi32(COEFF_PAIR(-100, -208)));
+	*r = yuyv_channel_ssse3(y_lo, y_hi, uv_lo, uv_hi,
+				_mm_set1_epi32(COEFF_PAIR(0, 409)));
+
+}
+
+
+
+/**
+ * @brief interleaves 16 blue, green and red values into 48 bytes of BGR
+ */
+__attribute__((target("ssse3")))
+static inline void store_bgr_ssse3(__m128i b, __m128i g, __m128i r,
+				   uint8_t *out)
+{
+
+	/* Where each output byte comes from in each input, -1 for none */
+	const __m128i b0 = _mm_setr_epi8(0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1,5);
+	const __m128i g0 = _mm_setr_epi8(-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1,-1);
+	const __m128i r0 = _mm_setr_epi8(-1,-1,0,-1,-1,1,-1,-1,2,-1,-1,3,-1,-1,4,-1);
+	const __m128i b1 = _mm_setr_epi8(-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10,-1);
+	const __m128i g1 = _mm_setr_epi8(5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1,10);
+	const __m128i r1 = _mm_setr_epi8(-1,5,-1,-1,6,-1,-1,7,-1,-1,8,-1,-1,9,-1,-1);
+	const __m128i b2 = _mm_setr_epi8(-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1,-1);
+	const __m128i g2 = _mm_setr_epi8(-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15,-1);
+	const __m128i r2 = _mm_setr_epi8(10,-1,-1,11,-1,-1,12,-1,-1,13,-1,-1,14,-1,-1,15);
+
+	_mm_storeu_si128((__m128i*)out,
+			 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b0),
+						   _mm_shuffle_epi8(g, g0)),
+				      _mm_shuffle_epi8(r, r0)));
+	_mm_storeu_si128((__m128i*)(out + 16),
+			 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b1),
+						   _mm_shuffle_epi8(g, g1)),
+				      _mm_shuffle_epi8(r, r1)));
+	_mm_storeu_si128((__m128i*)(out + 32),
+			 _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(b, b2),
+						   _mm_shuffle_epi8(g, g2)),
+				      _mm_shuffle_epi8(r, r2)));
+
+}
+
+
+
+/**
+ * @brief SSSE3 version of \c yuyv_row_to_bgr_scalar(), 16 pixels at a time
+ */
+__attribute__((target("ssse3")))
+static void yuyv_row_to_bgr_ssse3(const uint8_t *row, uint16_t w, uint8_t *out)
+{
+
+	uint16_t x = 0;
+
+	for (; x + 16 <= w; x += 16){
+
+		__m128i b[2], g[2], r[2];
+
+		yuyv_8_ssse3(_mm_loadu_si128((const __m128i*)&row[x * 2]),
+			     &b[0], &g[0], &r[0]);
+		yuyv_8_ssse3(_mm_loadu_si128((const __m128i*)&row[x * 2 + 16]),
+			     &b[1], &g[1], &r[1]);
+
+		/* The saturating packs clip to 0-255 */
+		store_bgr_ssse3(_mm_packus_epi16(b[0], b[1]),
+				_mm_packus_epi16(g[0], g[1]),
+				_mm_packus_epi16(r[0], r[1]),
+				&out[x * 3]);
+
+	}
+
+	yuyv_row_to_bgr_scalar(row, x, w, out);
+
+}
+
+
+
+/**
+ * @brief AVX2 version of \c yuyv_8_ssse3(), converting 16 pixels from
+ *        32 bytes of YUYV, eight in each 128-bit lane
+ */
+__attribute__((target("avx2")))
+static inline void yuyv_16_avx2(__m256i in, __m256i *b, __m256i *g, __m256i *r)
+{
+
+	const __m256i mask = _mm256_set1_epi16(0xff);
+	const __m256i ones = _mm256_set1_epi16(1);
+	const __m256i ky = _mm256_set1_epi32(COEFF_PAIR(298, 128));
+	const __m256i kb = _mm256_set1_epi32(COEFF_PAIR(516, 0));
+	const __m256i kg = _mm256_set1_epi32(COEFF_PAIR(-100, -208));
+	const __m256i kr = _mm256_set1_epi32(COEFF_PAIR(0, 409));
+	__m256i y, uv, y_lo, y_hi, uv_lo, uv_hi, yt_lo, yt_hi;
+
+	y = _mm256_sub_epi16(_mm256_and_si256(in, mask), _mm256_set1_epi16(16));
+	y_lo = _mm256_unpacklo_epi16(y, ones);
+	y_hi = _mm256_unpackhi_epi16(y, ones);
+
+	uv = _mm256_sub_epi16(_mm256_srli_epi16(in, 8), _mm256_set1_epi16(128));
+	uv_lo = _mm256_unpacklo_epi32(uv, uv);
+	uv_hi = _mm256_unpackhi_epi32(uv, uv);
+
+	yt_lo = _mm256_madd_epi16(y_lo, ky);
+	yt_hi = _mm256_madd_epi16(y_hi, ky);
+
+#define CHANNEL(k)							\
+	_mm256_packs_epi32(						\
+		_mm256_srai_epi32(_mm256_add_epi32(yt_lo,		\
+			_mm256_madd_epi16(uv_lo, (k))), 8),		\
+		_mm256_srai_epi32(_mm256_add_epi32(yt_hi,		\
+			_mm256_madd_epi16(uv_hi, (k))), 8))
+
+	*b = CHANNEL(kb);
+	*g = CHANNEL(kg);
+	*r = CHANNEL(kr);
+
+#undef CHANNEL
+
+}
+
+
+
+/**
+ * @brief AVX2 version of \c yuyv_row_to_bgr_scalar(), 32 pixels at a time
+ */
+__attribute__((target("avx2")))
+static void yuyv_row_to_bgr_avx2(const uint8_t *row, uint16_t w, uint8_t *out)
+{
+
+	uint16_t x = 0;
+
+	for (; x + 32 <= w; x += 32){
+
+		__m256i b[2], g[2], r[2], pb, pg, pr;
+
+		yuyv_16_avx2(_mm256_loadu_si256((const __m256i*)&row[x * 2]),
+			     &b[0], &g[0], &r[0]);
+		yuyv_16_avx2(_mm256_loadu_si256((const __m256i*)&row[x * 2 + 32]),
+			     &b[1], &g[1], &r[1]);
+
+		/* The packs work within lanes, leaving pixels 0-7, 16-23,
+		   8-15 and 24-31, which the permutes put back in order */
+		pb = _mm256_permute4x64_epi64(_mm256_packus_epi16(b[0], b[1]),
+					      _MM_SHUFFLE(3, 1, 2, 0));
+		pg = _mm256_permute4x64_epi64(_mm256_packus_epi16(g[0], g[1]),
+					      _MM_SHUFFLE(3, 1, 2, 0));
+		pr = _mm256_permute4x64_epi64(_mm256_packus_epi16(r[0], r[1]),
+					      _MM_SHUFFLE(3, 1, 2, 0));
+
+		store_bgr_ssse3(_mm256_castsi256_si128(pb),
+				_mm256_castsi256_si128(pg),
+				_mm256_castsi256_si128(pr),
+				&out[x * 3]);
+		store_bgr_ssse3(_mm256_extracti128_si256(pb, 1),
+				_mm256_extracti128_si256(pg, 1),
+				_mm256_extracti128_si256(pr, 1),
+				&out[x * 3 + 48]);
+
+	}
+
+	yuyv_row_to_bgr_ssse3(row + x * 2, w - x, out + x * 3);
+
+}
+
+
+
+/**
+ * @brief copies 32 pixels' Y values out of 64 bytes of YUYV with AVX2
+ */
+__attribute__((target("avx2")))
+static void yuyv_row_to_gray_avx2(const uint8_t *row, uint16_t w, uint8_t *out)
+{
+
+	const __m256i mask = _mm256_set1_epi16(0xff);
+	uint16_t x = 0;
+
+	for (; x + 32 <= w; x += 32){
+
+		__m256i a, b;
+
+		a = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)&row[x * 2]), mask);
+		b = _mm256_and_si256(_mm256_loadu_si256((const __m256i*)&row[x * 2 + 32]), mask);
+
+		_mm256_storeu_si256((__m256i*)&out[x],
+				    _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b),
+							     _MM_SHUFFLE(3, 1, 2, 0)));
+
+	}
+
+	for (; x < w; x++)
+		out[x] = row[x * 2];
+
+}
+#endif	/* KOKI_HAVE_YUYV_KERNELS */
+
+
+
+/**
+ * @brief copies a row's Y values out of YUYV data
+ *
+ * @param row  the YUYV row
+ * @param w    the width of the row
+ * @param out  the row to write the Y values to
+ */
+static void yuyv_row_to_gray(const uint8_t *row, uint16_t w, uint8_t *out)
+{
+
+	uint16_t x = 0;
+
+#if defined(KOKI_HAVE_YUYV_KERNELS)
+	if (__builtin_cpu_supports("avx2")){
+		yuyv_row_to_gray_avx2(row, w, out);
+		return;
+	}
 #endif
 
-#ifndef MAX
-#define MAX(a, b) a > b ? a : b;
+#if defined(__SSE2__)
+	const __m128i mask = _mm_set1_epi16(0xff);
+
+	for (; x + 16 <= w; x += 16){
+
+		__m128i a, b;
+
+		a = _mm_and_si128(_mm_loadu_si128((const __m128i*)&row[x * 2]), mask);
+		b = _mm_and_si128(_mm_loadu_si128((const __m128i*)&row[x * 2 + 16]), mask);
+
+		_mm_storeu_si128((__m128i*)&out[x], _mm_packus_epi16(a, b));
+
+	}
+#endif
+
+	for (; x < w; x++)
+		out[x] = row[x * 2];
+
+}
+
+
+
+/**
+ * @brief converts a row of YUYV data to BGR, with the fastest kernel the
+ *        CPU has
+ *
+ * @param row  the YUYV row
+ * @param w    the width of the row
+ * @param out  the BGR row to write to
+ */
+static void yuyv_row_to_bgr(const uint8_t *row, uint16_t w, uint8_t *out)
+{
+
+#if defined(KOKI_HAVE_YUYV_KERNELS)
+	if (__builtin_cpu_supports("avx2")){
+		yuyv_row_to_bgr_avx2(row, w, out);
+		return;
+	}
+
+	if (__builtin_cpu_supports("ssse3")){
+		yuyv_row_to_bgr_ssse3(row, w, out);
+		return;
+	}
 #endif
 
-#define CLIP(x) MIN(255, MAX(0, (x)))
+	yuyv_row_to_bgr_scalar(row, 0, w, out);
+
+}
+
+
+
+/**
+ * @brief converts a YUYV image data array into an existing RGB \c IplImage
+ *
+ * Nothing is allocated, so this can be done for every frame that's
+ * captured.
+ *
+ * @param frame   the YUYV image data, as recovered by
+ *                \c koki_v4l_get_frame_array()
+ * @param w       the image width
+ * @param h       the image height
+ * @param output  the 3-channel, 8-bit image to write to, of the same size,
+ *                whose channels are in OpenCV's usual BGR order
+ */
+void koki_v4l_YUYV_frame_into_RGB_image(const uint8_t *frame,
+					uint16_t w, uint16_t h,
+					IplImage *output)
+{
+
+	assert(frame != NULL && output != NULL);
+	assert(output->width == w && output->height == h);
+	assert(output->nChannels == 3 && output->depth == IPL_DEPTH_8U);
+
+	for (uint16_t y=0; y<h; y++)
+		yuyv_row_to_bgr(&frame[(uint32_t)w * 2 * y], w,
+				&KOKI_IPLIMAGE_ELEM(output, 0, y, 0));
+
+}
+
 
 
 /**
- * @brief performs the conversion from Y, U and V to R, G and B
+ * @brief converts a YUYV image data array into an existing grayscale
+ *        \c IplImage
+ *
+ * The Y value is effectively the grayscale value, so that's used.  Nothing
+ * is allocated.
+ *
+ * @param frame   the YUYV image data, as recovered by
+ *                \c koki_v4l_get_frame_array()
+ * @param w       the image width
+ * @param h       the image height
+ * @param output  the 1-channel, 8-bit image to write to, of the same size
  */
-#define YUV_TO_RGB(Y, U, V, R, G, B) do {			\
-		int32_t c, d, e;				\
-		c = Y - 16;					\
-		d = U - 128;					\
-		e = V - 128;					\
-		R = CLIP((298*c + 409*e + 128) >> 8);		\
-		G = CLIP((298*c - 100*d - 208*e + 128) >> 8);	\
-		B = CLIP((298*c + 516*d + 128) >> 8);		\
-	} while (0);						\
+void koki_v4l_YUYV_frame_into_grayscale_image(const uint8_t *frame,
+					      uint16_t w, uint16_t h,
+					      IplImage *output)
+{
+
+	assert(frame != NULL && output != NULL);
+	assert(output->width == w && output->height == h);
+	assert(output->nChannels == 1 && output->depth == IPL_DEPTH_8U);
+
+	for (uint16_t y=0; y<h; y++)
+		yuyv_row_to_gray(&frame[(uint32_t)w * 2 * y], w,
+				 &KOKI_IPLIMAGE_GS_ELEM(output, 0, y));
+
+}
 
 
 
@@ -541,19 +1452,7 @@ IplImage *koki_v4l_YUYV_frame_to_RGB_image(uint8_t *frame,
 
 	assert(output != NULL);
 
-	for (uint16_t y=0; y<h; y++){
-		for (uint16_t x=0; x<w; x++){
-
-			uint8_t Y, U, V, r, g, b;
-			GET_YUV(frame, x, y, w, h, Y, U, V);
-			YUV_TO_RGB(Y, U, V, r, g, b);
-
-			KOKI_IPLIMAGE_ELEM(output, x, y, 2) = r;
-			KOKI_IPLIMAGE_ELEM(output, x, y, 1) = g;
-			KOKI_IPLIMAGE_ELEM(output, x, y, 0) = b;
-
-		}//for
-	}//for
+	koki_v4l_YUYV_frame_into_RGB_image(frame, w, h, output);
 
 	return output;
 
@@ -584,15 +1483,7 @@ IplImage *koki_v4l_YUYV_frame_to_grayscale_image(uint8_t *frame,
 
 	assert(output != NULL);
 
-	for (uint16_t y=0; y<h; y++){
-		for (uint16_t x=0; x<w; x++){
-
-			uint8_t Y;
-			GET_Y(frame, x, y, w, h, Y);
-			((uint8_t*)(output->imageData + output->widthStep*y))[x] = Y;
-
-		}//for
-	}//for
+	koki_v4l_YUYV_frame_into_grayscale_image(frame, w, h, output);
 
 	return output;
 
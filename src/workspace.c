@@ -0,0 +1,265 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/**
+ * @file  workspace.c
+ * @brief Implementation of the buffers that are kept between frames
+ */
+
+#include <stdlib.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "trace.h"
+
+#include "workspace.h"
+
+/**
+ * @brief the size of the blocks in a workspace's arena, which is enough for
+ *        the contours of a fairly cluttered frame
+ */
+#define KOKI_WORKSPACE_ARENA_BLOCK (256 * 1024)
+
+/**
+ * @brief create an empty workspace
+ *
+ * Nothing that depends on the frame size is allocated until the workspace
+ * is prepared for a frame.
+ *
+ * @return the new workspace
+ */
+koki_workspace_t* koki_workspace_new( void )
+{
+	koki_workspace_t *ws = g_malloc0( sizeof(koki_workspace_t) );
+
+	ws->arena = koki_arena_new( KOKI_WORKSPACE_ARENA_BLOCK );
+	ws->regions = g_array_new( FALSE, FALSE,
+				   sizeof(koki_traced_region_t) );
+	ws->trace_points = koki_contour_array_new( 1024, NULL );
+
+	return ws;
+}
+
+/**
+ * @brief free everything that depends on the frame size
+ *
+ * @param ws  the workspace
+ */
+static void workspace_release( koki_workspace_t *ws )
+{
+	if( ws->labelled_image != NULL )
+		koki_labelled_image_free( ws->labelled_image );
+
+	if( ws->iimg != NULL )
+		koki_integral_image_free( ws->iimg );
+
+	free( ws->thresh_row );
+	free( ws->runs[0] );
+	free( ws->runs[1] );
+
+	if( ws->luma_img != NULL )
+		cvReleaseImage( &ws->luma_img );
+	if( ws->thresh_img != NULL )
+		cvReleaseImage( &ws->thresh_img );
+	if( ws->contours != NULL )
+		cvReleaseImage( &ws->contours );
+	if( ws->disc_contours != NULL )
+		cvReleaseImage( &ws->disc_contours );
+
+	ws->labelled_image = NULL;
+	ws->iimg = NULL;
+	ws->thresh_row = NULL;
+	ws->runs[0] = ws->runs[1] = NULL;
+	ws->w = ws->h = 0;
+}
+
+/**
+ * @brief free a workspace and all its buffers
+ *
+ * @param ws  the workspace to free
+ */
+void koki_workspace_free( koki_workspace_t *ws )
+{
+	g_assert( ws != NULL );
+
+	workspace_release( ws );
+	koki_arena_free( ws->arena );
+	for( uint16_t k = 1; k < ws->n_workers; k++ )
+		koki_arena_free( ws->worker_arenas[k] );
+	g_free( ws->worker_arenas );
+	g_array_free( ws->regions, TRUE );
+	koki_contour_array_free( ws->trace_points );
+	g_free( ws );
+}
+
+/**
+ * @brief get a workspace ready for a new frame
+ *
+ * If the frame is a different size to the last one, the buffers are
+ * reallocated.  Otherwise the labelled image is just emptied, ready to be
+ * labelled again.
+ *
+ * @param ws  the workspace
+ * @param w   the width of the frame
+ * @param h   the height of the frame
+ */
+void koki_workspace_prepare( koki_workspace_t *ws, uint16_t w, uint16_t h )
+{
+	g_assert( ws != NULL );
+
+	g_array_set_size( ws->regions, 0 );
+
+	if( w != ws->w || h != ws->h || ws->labelled_image == NULL ) {
+		/* A row can't hold more runs than this */
+		uint16_t max_runs = w / 2 + 1;
+
+		workspace_release( ws );
+
+		ws->w = w;
+		ws->h = h;
+
+		ws->labelled_image = koki_labelled_image_new( w, h );
+
+		ws->thresh_row = malloc( w );
+		ws->runs[0] = malloc( sizeof(label_run_t) * max_runs );
+		ws->runs[1] = malloc( sizeof(label_run_t) * max_runs );
+		g_assert( ws->thresh_row != NULL
+			  && ws->runs[0] != NULL && ws->runs[1] != NULL );
+
+		return;
+	}
+
+	/* Every pixel gets relabelled, so only the arrays need emptying */
+	g_array_set_size( ws->labelled_image->aliases, 0 );
+	g_array_set_size( ws->labelled_image->clips, 0 );
+}
+
+/**
+ * @brief get an integral image of the frame, holding the given number of
+ *        rows, with nothing calculated yet
+ *
+ * The workspace's integral image is reused if it holds the same number of
+ * rows as last time.
+ *
+ * @param ws      the workspace, which must have been prepared for the frame
+ * @param frame   the frame
+ * @param n_rows  the number of rows to hold: the frame's height for a whole
+ *                integral image, or fewer for a rolling one
+ * @return        the integral image, which belongs to the workspace
+ */
+koki_integral_image_t* koki_workspace_integral_image( koki_workspace_t *ws,
+						      const IplImage *frame,
+						      uint16_t n_rows )
+{
+	g_assert( frame->width == ws->w && frame->height == ws->h );
+
+	if( n_rows > frame->height )
+		n_rows = frame->height;
+
+	if( ws->iimg != NULL && ws->iimg->n_rows == n_rows ) {
+		koki_integral_image_reset( ws->iimg, frame );
+		return ws->iimg;
+	}
+
+	if( ws->iimg != NULL )
+		koki_integral_image_free( ws->iimg );
+
+	if( n_rows == frame->height )
+		ws->iimg = koki_integral_image_new( frame, false );
+	else
+		ws->iimg = koki_integral_image_new_rolling( frame, n_rows );
+
+	return ws->iimg;
+}
+
+/**
+ * @brief get one of the workspace's images for logging, creating it if
+ *        need be
+ *
+ * The image's contents are whatever was last put in it.
+ *
+ * @param ws        the workspace, which must have been prepared for the frame
+ * @param img       the workspace's pointer to the image
+ * @param channels  the number of channels the image has
+ * @return          the image, which belongs to the workspace
+ */
+IplImage* koki_workspace_log_image( koki_workspace_t *ws, IplImage **img,
+				    int channels )
+{
+	if( *img == NULL ) {
+		*img = cvCreateImage( cvSize( ws->w, ws->h ),
+				      IPL_DEPTH_8U, channels );
+		g_assert( *img != NULL );
+	}
+
+	return *img;
+}
+
+/**
+ * @brief get the arena for one of the context's marker-finding workers
+ *
+ * @param ws      the workspace
+ * @param worker  the worker, which must have been prepared for with
+ *                \c koki_workspace_prepare_workers() unless it's \c 0
+ * @return        the worker's arena, which is \c ws->arena for worker \c 0
+ */
+koki_arena_t* koki_workspace_arena( koki_workspace_t *ws, uint16_t worker )
+{
+	if( worker == 0 )
+		return ws->arena;
+
+	g_assert( worker < ws->n_workers );
+
+	return ws->worker_arenas[worker];
+}
+
+/**
+ * @brief make sure there's an arena for each of a number of workers
+ *
+ * This must be called from the thread that owns the workspace, before the
+ * workers start.
+ *
+ * @param ws         the workspace
+ * @param n_workers  the number of workers
+ */
+void koki_workspace_prepare_workers( koki_workspace_t *ws, uint16_t n_workers )
+{
+	if( n_workers <= ws->n_workers )
+		return;
+
+	ws->worker_arenas = g_realloc( ws->worker_arenas,
+				       sizeof(koki_arena_t*) * n_workers );
+	ws->worker_arenas[0] = NULL;
+
+	for( uint16_t k = MAX( ws->n_workers, 1 ); k < n_workers; k++ )
+		ws->worker_arenas[k] = koki_arena_new( KOKI_WORKSPACE_ARENA_BLOCK );
+
+	ws->n_workers = n_workers;
+}
+
+/**
+ * @brief free everything allocated from the workspace's arenas this frame
+ *
+ * @param ws  the workspace
+ */
+void koki_workspace_reset_arenas( koki_workspace_t *ws )
+{
+	koki_arena_reset( ws->arena );
+
+	for( uint16_t k = 1; k < ws->n_workers; k++ )
+		koki_arena_reset( ws->worker_arenas[k] );
+}
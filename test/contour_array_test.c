@@ -0,0 +1,275 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Finds the contours and quads in some synthetic frames both through the
+   GSList functions and through the packed-array ones, checking that they
+   find the same points and vertices, before and after the vertices are
+   refined.  The contours traced while labelling (KOKI_LABEL_TRACE) are
+   checked against them too. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "koki.h"
+#include "pca.h"
+#include "trace.h"
+
+#define W 320
+#define H 240
+
+#define LIGHT 200
+#define DARK 30
+
+/**
+ * @brief a polygon to draw, with its corners relative to its centre
+ */
+typedef struct {
+	int n;
+	double x[12], y[12];
+} shape_t;
+
+/* a square, with a square hole in it, as markers have */
+static const shape_t ring_outer = { 4, { -30, 30, 30, -30 },
+				       { -30, -30, 30, 30 } };
+static const shape_t ring_inner = { 4, { -15, 15, 15, -15 },
+				       { -15, -15, 15, 15 } };
+
+/* a solid square */
+static const shape_t square = { 4, { -20, 20, 20, -20 },
+				   { -20, -20, 20, 20 } };
+
+/* a concave blob, shaped like an arrow head */
+static const shape_t arrow = { 7, { -25, 0, 25, 10, 10, -10, -10 },
+				  { 0, -25, 0, 0, 25, 25, 0 } };
+
+/**
+ * @brief whether a point is inside a polygon, rotated by \c angle and
+ *        centred on (\c cx, \c cy)
+ */
+static bool inside(const shape_t *s, double cx, double cy, double angle,
+		   double px, double py)
+{
+	double c = cos(angle), sn = sin(angle);
+	bool in = false;
+
+	for (int i=0, j=s->n-1; i<s->n; j=i++){
+		double xi = cx + s->x[i] * c - s->y[i] * sn;
+		double yi = cy + s->x[i] * sn + s->y[i] * c;
+		double xj = cx + s->x[j] * c - s->y[j] * sn;
+		double yj = cy + s->x[j] * sn + s->y[j] * c;
+
+		if ((yi > py) != (yj > py)
+		    && px < (xj - xi) * (py - yi) / (yj - yi) + xi)
+			in = !in;
+	}
+
+	return in;
+}
+
+/**
+ * @brief draws a frame of shapes, all rotated by \c angle
+ */
+static void draw_frame(IplImage *frame, double angle)
+{
+	for (int y=0; y<H; y++)
+		for (int x=0; x<W; x++){
+			double px = x + 0.5, py = y + 0.5;
+			bool dark = (inside(&ring_outer, 70, 70, angle, px, py)
+				     && !inside(&ring_inner, 70, 70, angle,
+						px, py))
+				|| inside(&square, 200, 70, angle, px, py)
+				|| inside(&arrow, 120, 170, angle, px, py);
+
+			KOKI_IPLIMAGE_GS_ELEM(frame, x, y) = dark ? DARK : LIGHT;
+		}
+}
+
+/**
+ * @brief checks that the same PCA comes out of a run of list points and
+ *        the same run of array points
+ */
+static void check_pca(GSList *start, GSList *end, const koki_contour_t *c,
+		      uint32_t first, uint32_t last)
+{
+	koki_point2Df_t vl[2], va[2], al, aa;
+	float el[2], ea[2];
+
+	assert(koki_pca(start, end, vl, el, &al) == 0);
+	assert(koki_pca_array(&c->x[first], &c->y[first], last - first + 1,
+			      va, ea, &aa) == 0);
+
+	assert(memcmp(vl, va, sizeof(vl)) == 0
+	       && memcmp(el, ea, sizeof(el)) == 0
+	       && al.x == aa.x && al.y == aa.y);
+}
+
+/**
+ * @brief finds a region's contour and quad both ways, and checks that they
+ *        agree
+ *
+ * @return  whether a quad was found
+ */
+static bool check_region(koki_labelled_image_t *lmg, label_t region)
+{
+	GSList *list, *l;
+	koki_contour_t *array;
+	koki_quad_t *ql, *qa;
+	uint32_t i;
+	bool found;
+
+	list = koki_contour_find(lmg, region);
+	array = koki_contour_find_array(lmg, region, NULL);
+
+	/* the same points, in the same order */
+	for (l = list, i = 0; l != NULL; l = l->next, i++){
+		koki_point2Di_t *p = l->data;
+
+		assert(i < array->len
+		       && p->x == array->x[i] && p->y == array->y[i]);
+	}
+	assert(i == array->len);
+
+	ql = koki_quad_find_vertices(list);
+	qa = koki_quad_find_vertices_array(array, NULL);
+	assert((ql == NULL) == (qa == NULL));
+	found = ql != NULL;
+
+	if (found){
+		/* the same vertices, at the same points */
+		for (int v=0; v<4; v++){
+			koki_point2Di_t *p = ql->links[v]->data;
+
+			assert(ql->indices[v] == qa->indices[v]);
+			assert(ql->vertices[v].x == qa->vertices[v].x
+			       && ql->vertices[v].y == qa->vertices[v].y);
+			assert(p->x == array->x[qa->indices[v]]
+			       && p->y == array->y[qa->indices[v]]);
+		}
+
+		/* the same fit along each side that doesn't wrap round */
+		for (int v=0; v<3; v++)
+			check_pca(ql->links[v], ql->links[v+1], array,
+				  qa->indices[v], qa->indices[v+1]);
+
+		koki_quad_refine_vertices(ql);
+		koki_quad_refine_vertices(qa);
+
+		for (int v=0; v<4; v++)
+			assert(ql->vertices[v].x == qa->vertices[v].x
+			       && ql->vertices[v].y == qa->vertices[v].y);
+	}
+
+	koki_quad_free(ql);
+	koki_quad_free(qa);
+	koki_contour_free(list);
+	koki_contour_array_free(array);
+
+	return found;
+}
+
+/**
+ * @brief checks that the traced regions' contours are those found in the
+ *        labelled image of the same frame
+ *
+ * @return  the number of contours checked
+ */
+static int check_traced(koki_labelled_image_t *lmg, GArray *regions)
+{
+	int checked = 0;
+
+	for (guint r=0; r<regions->len; r++){
+		koki_traced_region_t *t;
+		koki_contour_t *c = NULL;
+
+		t = &g_array_index(regions, koki_traced_region_t, r);
+		if (t->contour == NULL)
+			continue;
+
+		/* the region with the same clip region */
+		for (label_t i=0; i<lmg->clips->len && c == NULL; i++)
+			if (memcmp(&g_array_index(lmg->clips,
+						  koki_clip_region_t, i),
+				   &t->clip, sizeof(t->clip)) == 0)
+				c = koki_contour_find_array(lmg, i, NULL);
+
+		assert(c != NULL && c->len == t->contour->len
+		       && memcmp(c->x, t->contour->x,
+				 sizeof(int16_t) * c->len) == 0
+		       && memcmp(c->y, t->contour->y,
+				 sizeof(int16_t) * c->len) == 0);
+
+		koki_contour_array_free(c);
+		checked++;
+	}
+
+	return checked;
+}
+
+
+int main(void)
+{
+	koki_t *koki = koki_new();
+	koki_t *tracer = koki_new();
+	IplImage *frame = cvCreateImage(cvSize(W, H), IPL_DEPTH_8U, 1);
+	const double angles[] = { 0, 5, 17, 30, 45, 61, 80 };
+	int n_angles = sizeof(angles) / sizeof(angles[0]);
+
+	koki_set_label_method(tracer, KOKI_LABEL_TRACE);
+
+	for (int a=0; a<n_angles; a++){
+		koki_labelled_image_t *lmg;
+		int regions = 0, quads = 0, traced;
+
+		draw_frame(frame, angles[a] * M_PI / 180);
+
+		lmg = koki_label_adaptive(koki, frame, 11, 5);
+
+		for (label_t i=0; i<lmg->clips->len; i++){
+			if (!koki_label_useable(lmg, i))
+				continue;
+
+			regions++;
+			if (check_region(lmg, i))
+				quads++;
+		}
+
+		traced = check_traced(lmg,
+				      koki_label_trace_workspace(tracer, frame,
+								 11, 5));
+
+		printf("%2.0f degrees: %d regions, %d quads, %d traced\n",
+		       angles[a], regions, quads, traced);
+
+		/* the ring and the square are quads, but the arrow isn't */
+		assert(quads == 2 && traced == regions);
+
+		koki_labelled_image_free(lmg);
+	}
+
+	cvReleaseImage(&frame);
+	koki_destroy(tracer);
+	koki_destroy(koki);
+
+	printf("ok\n");
+
+	return 0;
+}
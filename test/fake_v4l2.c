@@ -0,0 +1,376 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h> /* for videodev2.h */
+#include <linux/videodev2.h>
+
+#include "fake_v4l2.h"
+
+/* The buffers are a page apart in the backing file */
+#define FAKE_PAGE 4096
+
+#define FAKE_MAX_BUFFERS 32
+
+enum {
+	FAKE_USER,	/* dequeued, or never queued */
+	FAKE_QUEUED,	/* waiting to be captured into */
+	FAKE_DONE	/* captured into, waiting to be dequeued */
+};
+
+/**
+ * @brief a buffer the pretend driver has given out
+ */
+typedef struct {
+	int state;		/**< FAKE_USER, FAKE_QUEUED or FAKE_DONE */
+	uint32_t order;		/**< when it was queued, or captured into */
+	uint32_t sequence;	/**< the frame captured into it */
+	uint32_t flags;		/**< the flags the frame was captured with */
+} fake_buffer_t;
+
+static struct {
+	FILE *file;		/**< the file backing the buffers */
+	int fd;			/**< the camera's file descriptor */
+	int max_buffers;	/**< how many buffers to give out at most */
+	uint32_t frame_size;	/**< the size of a buffer */
+	int n_buffers;		/**< how many buffers are given out */
+	bool streaming;		/**< whether STREAMON has been called */
+	fake_buffer_t buffers[FAKE_MAX_BUFFERS];
+	uint32_t order;		/**< the counter buffers are ordered by */
+	uint32_t sequence;	/**< the next frame's sequence number */
+	unsigned long fail_request; /**< a request to fail, or 0 */
+	int fail_after;		/**< how many of them succeed first */
+	int interval;		/**< how often frames arrive while polling,
+				     in milliseconds, or 0 if they don't */
+	uint32_t interval_flags; /**< the flags those frames are given */
+} fake;
+
+/**
+ * @brief opens the pretend camera
+ *
+ * @param n_buffers   the most buffers the driver gives out
+ * @param frame_size  the size of each buffer
+ * @return            the camera's file descriptor
+ */
+int fake_v4l2_open(int n_buffers, uint32_t frame_size)
+{
+	int ret;
+
+	assert(n_buffers > 0 && n_buffers <= FAKE_MAX_BUFFERS
+	       && frame_size >= sizeof(uint32_t) && frame_size <= FAKE_PAGE);
+
+	memset(&fake, 0, sizeof(fake));
+
+	fake.file = tmpfile();
+	assert(fake.file != NULL);
+
+	fake.fd = fileno(fake.file);
+	fake.max_buffers = n_buffers;
+	fake.frame_size = frame_size;
+
+	ret = ftruncate(fake.fd, (off_t)FAKE_PAGE * n_buffers);
+	assert(ret == 0);
+
+	return fake.fd;
+}
+
+/**
+ * @brief closes the pretend camera
+ */
+void fake_v4l2_close(void)
+{
+	fclose(fake.file);
+	fake.file = NULL;
+	fake.fd = -1;
+}
+
+/**
+ * @brief captures a frame into the buffer that's been queued longest
+ *
+ * The frame's sequence number is written to the start of the buffer.  If
+ * there's no buffer queued, the frame is lost, as it would be on a real
+ * camera.
+ *
+ * @param flags  the flags to give the frame, e.g. \c V4L2_BUF_FLAG_ERROR
+ * @return       whether the frame went into a buffer
+ */
+bool fake_v4l2_capture(uint32_t flags)
+{
+	fake_buffer_t *oldest = NULL;
+	uint32_t seq = fake.sequence++;
+	int index = 0;
+	ssize_t ret;
+
+	if (!fake.streaming)
+		return false;
+
+	for (int i=0; i<fake.n_buffers; i++)
+		if (fake.buffers[i].state == FAKE_QUEUED
+		    && (oldest == NULL || fake.buffers[i].order < oldest->order)){
+			oldest = &fake.buffers[i];
+			index = i;
+		}
+
+	if (oldest == NULL)
+		return false;
+
+	oldest->state = FAKE_DONE;
+	oldest->order = fake.order++;
+	oldest->sequence = seq;
+	oldest->flags = flags;
+
+	ret = pwrite(fake.fd, &seq, sizeof(seq), (off_t)FAKE_PAGE * index);
+	assert(ret == sizeof(seq));
+
+	return true;
+}
+
+/**
+ * @brief makes a request fail with \c EIO, once
+ *
+ * @param request  the request, e.g. \c VIDIOC_STREAMON
+ * @param after    how many of the request succeed before the one that fails
+ */
+void fake_v4l2_fail(unsigned long request, int after)
+{
+	fake.fail_request = request;
+	fake.fail_after = after;
+}
+
+/**
+ * @brief makes frames arrive by themselves while the camera's polled, as
+ *        they would from a real one
+ *
+ * @param interval  how often a frame arrives, in milliseconds, or 0 to
+ *                  only capture with \c fake_v4l2_capture()
+ * @param flags     the flags to give those frames
+ */
+void fake_v4l2_stream(int interval, uint32_t flags)
+{
+	fake.interval = interval;
+	fake.interval_flags = flags;
+}
+
+/**
+ * @brief the number of buffers the driver has given out, which goes back
+ *        to 0 when they're freed with \c VIDIOC_REQBUFS
+ */
+int fake_v4l2_n_buffers(void)
+{
+	return fake.n_buffers;
+}
+
+/**
+ * @brief whether the camera is streaming
+ */
+bool fake_v4l2_streaming(void)
+{
+	return fake.streaming;
+}
+
+/**
+ * @brief hands every buffer back to the program, as \c VIDIOC_STREAMOFF
+ *        does
+ */
+static void fake_stream_off(void)
+{
+	fake.streaming = false;
+
+	for (int i=0; i<fake.n_buffers; i++)
+		fake.buffers[i].state = FAKE_USER;
+}
+
+/**
+ * @brief finds a buffer from its index, as given to an ioctl
+ *
+ * @return  the buffer, or NULL if it's not one the driver gave out
+ */
+static fake_buffer_t* fake_buffer(const struct v4l2_buffer *b)
+{
+	if (b->type != V4L2_BUF_TYPE_VIDEO_CAPTURE
+	    || b->memory != V4L2_MEMORY_MMAP
+	    || b->index >= (uint32_t)fake.n_buffers)
+		return NULL;
+
+	return &fake.buffers[b->index];
+}
+
+/**
+ * @brief acts on an ioctl request to the pretend camera
+ *
+ * @return  0 on success, or an \c errno value
+ */
+static int fake_request(unsigned long request, void *arg)
+{
+	struct v4l2_requestbuffers *reqbuf = arg;
+	struct v4l2_buffer *b = arg;
+	fake_buffer_t *buffer, *done = NULL;
+
+	if (request == fake.fail_request && fake.fail_after-- == 0){
+		fake.fail_request = 0;
+		return EIO;
+	}
+
+	switch (request){
+
+	case VIDIOC_REQBUFS:
+		if (fake.streaming && reqbuf->count != 0)
+			return EBUSY;
+
+		fake_stream_off();
+
+		if (reqbuf->count > (uint32_t)fake.max_buffers)
+			reqbuf->count = fake.max_buffers;
+		fake.n_buffers = reqbuf->count;
+
+		return 0;
+
+	case VIDIOC_QUERYBUF:
+		if (fake_buffer(b) == NULL)
+			return EINVAL;
+
+		b->length = fake.frame_size;
+		b->m.offset = FAKE_PAGE * b->index;
+
+		return 0;
+
+	case VIDIOC_QBUF:
+		buffer = fake_buffer(b);
+		if (buffer == NULL || buffer->state != FAKE_USER)
+			return EINVAL;
+
+		buffer->state = FAKE_QUEUED;
+		buffer->order = fake.order++;
+
+		return 0;
+
+	case VIDIOC_DQBUF:
+		for (int i=0; i<fake.n_buffers; i++)
+			if (fake.buffers[i].state == FAKE_DONE
+			    && (done == NULL
+				|| fake.buffers[i].order < done->order))
+				done = &fake.buffers[i];
+
+		/* a real camera would block until there was one */
+		if (done == NULL)
+			return EAGAIN;
+
+		done->state = FAKE_USER;
+
+		b->index = done - fake.buffers;
+		b->bytesused = fake.frame_size;
+		b->flags = done->flags;
+		b->sequence = done->sequence;
+		b->timestamp.tv_sec = done->sequence;
+		b->timestamp.tv_usec = 0;
+
+		return 0;
+
+	case VIDIOC_STREAMON:
+		if (fake.n_buffers == 0)
+			return EINVAL;
+
+		fake.streaming = true;
+
+		return 0;
+
+	case VIDIOC_STREAMOFF:
+		fake_stream_off();
+
+		return 0;
+
+	default:
+		return ENOTTY;
+
+	}
+}
+
+/* Requests to the pretend camera are caught here; everything else goes to
+   the kernel as usual */
+int ioctl(int fd, unsigned long request, ...)
+{
+	va_list ap;
+	void *arg;
+	int err;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	if (fake.file == NULL || fd != fake.fd)
+		return syscall(SYS_ioctl, fd, request, arg);
+
+	err = fake_request(request, arg);
+	if (err != 0){
+		errno = err;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Only the pretend camera gets polled, so fds isn't looked at beyond
+   that.  Unless frames are set to arrive by themselves, it never waits:
+   either a frame's ready, or the time runs out straight away. */
+int poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+	bool queued = false;
+
+	assert(nfds == 1 && fake.file != NULL);
+
+	fds[0].revents = 0;
+
+	if (fake.interval > 0 && timeout != 0){
+		bool ready = false;
+
+		for (int i=0; i<fake.n_buffers; i++)
+			if (fake.buffers[i].state == FAKE_DONE)
+				ready = true;
+
+		/* the next frame arrives, if it's due in time */
+		if (!ready){
+			if (timeout > 0 && timeout < fake.interval){
+				usleep(timeout * 1000);
+				return 0;
+			}
+
+			usleep(fake.interval * 1000);
+			fake_v4l2_capture(fake.interval_flags);
+		}
+	}
+
+	for (int i=0; i<fake.n_buffers; i++){
+		if (fake.buffers[i].state == FAKE_DONE)
+			fds[0].revents = POLLIN;
+		if (fake.buffers[i].state == FAKE_QUEUED)
+			queued = true;
+	}
+
+	/* as V4L2 does when there's nothing to capture into */
+	if (fds[0].revents == 0 && !queued)
+		fds[0].revents = POLLERR;
+
+	return fds[0].revents != 0;
+}
@@ -0,0 +1,45 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* A pretend V4L2 camera, for testing the code that streams from one
+   without the hardware.  Linking fake_v4l2.c into a program replaces
+   ioctl() and poll() with versions that act as a capture driver for the
+   file descriptor fake_v4l2_open() returns.  The buffers are backed by a
+   temporary file, so mapping them needs nothing special.  Frames only
+   arrive when fake_v4l2_capture() is called. */
+
+#ifndef _FAKE_V4L2_H_
+#define _FAKE_V4L2_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+
+int fake_v4l2_open(int n_buffers, uint32_t frame_size);
+
+void fake_v4l2_close(void);
+
+bool fake_v4l2_capture(uint32_t flags);
+
+void fake_v4l2_fail(unsigned long request, int after);
+
+void fake_v4l2_stream(int interval, uint32_t flags);
+
+int fake_v4l2_n_buffers(void);
+
+bool fake_v4l2_streaming(void);
+
+#endif /* _FAKE_V4L2_H_ */
@@ -0,0 +1,185 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Compares the speed of advancing an integral image a column at a time
+   (as libkoki used to) with advancing it a row at a time (as it does now),
+   both all in one go and a row at a time as koki_label_adaptive() does. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+#include "integral-image.h"
+
+/* The old column-major advance, kept here for comparison */
+typedef struct {
+	uint32_t *data;
+	uint32_t *sum;
+	uint16_t w, h;
+	const IplImage *src;
+	uint16_t complete_x, complete_y;
+} old_ii_t;
+
+#define old_pix( ii, x, y ) ( (ii)->data[ ((ii)->w * (y)) + (x) ] )
+
+static void old_update_pixel(old_ii_t *ii, uint16_t x, uint16_t y)
+{
+	uint32_t v = 0;
+
+	ii->sum[x] += KOKI_IPLIMAGE_GS_ELEM(ii->src, x, y);
+
+	v = ii->sum[x];
+
+	if (x > 0)
+		v += old_pix(ii, x-1, y);
+
+	old_pix(ii, x, y) = v;
+}
+
+static void old_advance(old_ii_t *ii, uint16_t target_x, uint16_t target_y)
+{
+	uint16_t x, y;
+
+	for (x = ii->complete_x; x <= target_x; x++)
+		for (y=0; y < ii->complete_y; y++)
+			old_update_pixel(ii, x, y);
+	ii->complete_x = target_x + 1;
+
+	for (x=0; x < ii->complete_x; x++)
+		for (y = ii->complete_y; y <= target_y; y++)
+			old_update_pixel(ii, x, y);
+	ii->complete_y = target_y + 1;
+}
+
+static void old_reset(old_ii_t *ii)
+{
+	memset(ii->sum, 0, sizeof(uint32_t) * ii->w);
+	ii->complete_x = ii->complete_y = 0;
+}
+
+/* Time iters runs of the old advance, in ms per frame */
+static double time_old(IplImage *frame, int iters, bool by_row, uint32_t *result)
+{
+	old_ii_t ii;
+	gint64 start;
+
+	ii.w = frame->width;
+	ii.h = frame->height;
+	ii.src = frame;
+	ii.data = malloc(sizeof(uint32_t) * ii.w * ii.h);
+	ii.sum = malloc(sizeof(uint32_t) * ii.w);
+	assert(ii.data != NULL && ii.sum != NULL);
+
+	start = g_get_monotonic_time();
+
+	for (int i=0; i<iters; i++){
+		old_reset(&ii);
+
+		if (by_row)
+			for (uint16_t y=0; y<ii.h; y++)
+				old_advance(&ii, ii.w - 1, y);
+		else
+			old_advance(&ii, ii.w - 1, ii.h - 1);
+	}
+
+	double t = (g_get_monotonic_time() - start) / 1000.0 / iters;
+
+	memcpy(result, ii.data, sizeof(uint32_t) * ii.w * ii.h);
+	free(ii.data);
+	free(ii.sum);
+
+	return t;
+}
+
+/* Time iters runs of the current advance, in ms per frame */
+static double time_new(IplImage *frame, int iters, bool by_row, uint32_t *result)
+{
+	koki_integral_image_t *ii = NULL;
+	gint64 start = g_get_monotonic_time();
+
+	for (int i=0; i<iters; i++){
+		if (ii != NULL)
+			koki_integral_image_free(ii);
+		ii = koki_integral_image_new(frame, false);
+
+		if (by_row)
+			for (uint16_t y=0; y<ii->h; y++)
+				koki_integral_image_advance(ii, ii->w - 1, y);
+		else
+			koki_integral_image_advance(ii, ii->w - 1, ii->h - 1);
+	}
+
+	double t = (g_get_monotonic_time() - start) / 1000.0 / iters;
+
+	memcpy(result, ii->data, sizeof(uint32_t) * ii->w * ii->h);
+	koki_integral_image_free(ii);
+
+	return t;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	const int sizes[][2] = { {640, 480}, {1280, 720}, {1920, 1080} };
+	int iters = 50;
+
+	if (argc > 2){
+		printf("Usage: ./integral_speed_test [iterations]\n");
+		return 1;
+	}
+
+	if (argc == 2)
+		iters = atoi(argv[1]);
+
+	for (int s=0; s<3; s++){
+		int w = sizes[s][0], h = sizes[s][1];
+		IplImage *frame = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 1);
+		uint32_t *old_result = malloc(sizeof(uint32_t) * w * h);
+		uint32_t *new_result = malloc(sizeof(uint32_t) * w * h);
+		assert(frame != NULL && old_result != NULL && new_result != NULL);
+
+		/* Noise is as good as anything for this */
+		srand(s);
+		for (int y=0; y<h; y++)
+			for (int x=0; x<w; x++)
+				KOKI_IPLIMAGE_GS_ELEM(frame, x, y) = rand() & 0xff;
+
+		for (int by_row=0; by_row<2; by_row++){
+			double t_old = time_old(frame, iters, by_row, old_result);
+			double t_new = time_new(frame, iters, by_row, new_result);
+
+			/* Make sure they agree */
+			assert(memcmp(old_result, new_result,
+				      sizeof(uint32_t) * w * h) == 0);
+
+			printf("%4dx%-4d %-8s old %8.3f ms  new %8.3f ms  (%.2fx)\n",
+			       w, h, by_row ? "by row" : "in one", t_old, t_new,
+			       t_old / t_new);
+		}
+
+		free(old_result);
+		free(new_result);
+		cvReleaseImage(&frame);
+	}
+
+	return 0;
+}
@@ -0,0 +1,168 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Switches one context between labelling methods on frames of the same
+   size, checking that it finds the same as contexts that only ever use
+   one method.  The workspace keeps its label buffer between such frames,
+   so one method mustn't leave anything in it that trips up another. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <glib.h>
+#include <cv.h>
+#include <highgui.h>
+
+#include "koki.h"
+
+static const koki_label_method_t methods[] = {
+	KOKI_LABEL_TRACE, KOKI_LABEL_RUNS, KOKI_LABEL_TRACE, KOKI_LABEL_PIXEL,
+	KOKI_LABEL_RUNS, KOKI_LABEL_PIXEL, KOKI_LABEL_TRACE
+};
+
+#define N_METHODS (sizeof(methods) / sizeof(methods[0]))
+
+/**
+ * @brief the final label of a pixel, or 0 if it's light
+ */
+static label_t final_label(koki_labelled_image_t *l, uint16_t x, uint16_t y)
+{
+	label_t label = KOKI_LABELLED_IMAGE_LABEL(l, x, y);
+
+	if (label == 0)
+		return 0;
+
+	assert(label <= l->aliases->len);
+
+	return g_array_index(l->aliases, label_t, label-1);
+}
+
+/**
+ * @brief checks that two labelled images of the same frame are the same
+ *
+ * @return  whether they are
+ */
+static bool labels_match(koki_labelled_image_t *a, koki_labelled_image_t *b)
+{
+	if (a->w != b->w || a->h != b->h || a->aliases->len != b->aliases->len)
+		return false;
+
+	for (uint16_t y=0; y<a->h; y++)
+		for (uint16_t x=0; x<a->w; x++)
+			if (final_label(a, x, y) != final_label(b, x, y))
+				return false;
+
+	return true;
+}
+
+/**
+ * @brief checks that two sets of markers found in the same frame are the
+ *        same
+ *
+ * @return  whether they are
+ */
+static bool markers_match(GPtrArray *a, GPtrArray *b)
+{
+	if (a->len != b->len)
+		return false;
+
+	for (guint i=0; i<a->len; i++){
+		koki_marker_t *ma = g_ptr_array_index(a, i);
+		koki_marker_t *mb = g_ptr_array_index(b, i);
+
+		if (ma->code != mb->code
+		    || ma->centre.image.x != mb->centre.image.x
+		    || ma->centre.image.y != mb->centre.image.y)
+			return false;
+	}
+
+	return true;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	koki_t *koki = koki_new();
+	koki_t *single[KOKI_LABEL_TRACE + 1];
+	koki_camera_params_t params;
+	int failures = 0;
+
+	if (argc != 2){
+		printf("Usage: ./label_switch_test <filename>\n");
+		return 1;
+	}
+
+	IplImage *frame = cvLoadImage(argv[1], CV_LOAD_IMAGE_GRAYSCALE);
+	assert(frame != NULL);
+
+	params.size.x = frame->width;
+	params.size.y = frame->height;
+	params.principal_point.x = params.size.x / 2;
+	params.principal_point.y = params.size.y / 2;
+	params.focal_length.x = 571.0;
+	params.focal_length.y = 571.0;
+
+	for (int m=KOKI_LABEL_PIXEL; m<=KOKI_LABEL_TRACE; m++){
+		single[m] = koki_new();
+		koki_set_label_method(single[m], m);
+	}
+
+	for (unsigned i=0; i<N_METHODS; i++){
+		koki_label_method_t m = methods[i];
+
+		koki_set_label_method(koki, m);
+
+		/* The labelled image first, while the buffer still holds
+		   whatever the method before left in it */
+		if (m != KOKI_LABEL_TRACE){
+			koki_labelled_image_t *l =
+				koki_label_adaptive_workspace(koki, frame, 11, 5);
+			koki_labelled_image_t *ref =
+				koki_label_adaptive(single[m], frame, 11, 5);
+
+			if (!labels_match(l, ref)){
+				printf("frame %u: labels differ\n", i);
+				failures++;
+			}
+
+			koki_labelled_image_free(ref);
+		}
+
+		GPtrArray *found = koki_find_markers(koki, frame, 0.11, &params);
+		GPtrArray *expected = koki_find_markers(single[m], frame, 0.11,
+							&params);
+
+		if (!markers_match(found, expected)){
+			printf("frame %u: markers differ\n", i);
+			failures++;
+		}
+
+		koki_markers_free(found);
+		koki_markers_free(expected);
+	}
+
+	printf("%u frames, %d failures\n", (unsigned)N_METHODS, failures);
+
+	for (int m=KOKI_LABEL_PIXEL; m<=KOKI_LABEL_TRACE; m++)
+		koki_destroy(single[m]);
+
+	cvReleaseImage(&frame);
+	koki_destroy(koki);
+
+	return failures == 0 ? 0 : 1;
+}
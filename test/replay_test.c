@@ -0,0 +1,147 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Replays a recording, or a directory of images, through the detector as
+   fast as it'll go: first a frame at a time, then through a pipeline,
+   which drops the frames it can't keep up with. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <cv.h>
+
+#include "koki.h"
+
+static koki_source_t* open_source(const char *path)
+{
+	struct stat st;
+
+	if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+		return koki_source_dir_new(path);
+
+	return koki_source_recording_new(path, false);
+}
+
+static void print_stats(const koki_stats_counts_t *c)
+{
+	for (int i=0; i<KOKI_STAGE_COUNT; i++)
+		printf("  %-16s %8.3f ms/frame\n", koki_stats_stage_name(i),
+		       c->stage_time[i] / 1e6 / c->frames);
+
+	printf("  per frame: %.1f regions, %.1f usable, %.1f contours, "
+	       "%.1f quads, %.1f rejected, %.1f codes\n",
+	       (double)c->regions / c->frames,
+	       (double)c->usable_regions / c->frames,
+	       (double)c->contours / c->frames, (double)c->quads / c->frames,
+	       (double)c->quads_rejected / c->frames,
+	       (double)c->codes / c->frames);
+}
+
+static void count_result(const koki_pipeline_result_t *result, void *userdata)
+{
+	int *counts = userdata;
+
+	counts[0]++;
+	counts[1] += result->markers->len;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	koki_t *koki = koki_new();
+	koki_camera_params_t params;
+	koki_source_t *source;
+	koki_pipeline_t *p;
+	koki_v4l_frame_t f;
+	koki_stats_t stats;
+	int frames = 0, markers = 0, counts[2] = { 0, 0 };
+	gint64 start, t;
+
+	if (argc != 2 && argc != 3){
+		printf("Usage: ./replay_test <recording or directory> [marker_threads]\n");
+		return 1;
+	}
+
+	if (argc == 3)
+		koki_set_marker_threads(koki, atoi(argv[2]));
+
+	source = open_source(argv[1]);
+	if (source == NULL)
+		return 1;
+
+	params.size.x = source->fmt.fmt.pix.width;
+	params.size.y = source->fmt.fmt.pix.height;
+	params.principal_point.x = params.size.x / 2;
+	params.principal_point.y = params.size.y / 2;
+	params.focal_length.x = 571.0;
+	params.focal_length.y = 571.0;
+
+	/* A frame at a time, in place, timing each stage */
+	koki_set_stats(koki, TRUE);
+	start = g_get_monotonic_time();
+
+	while (koki_source_get_frame(source, &f, -1) > 0){
+		IplImage view;
+
+		koki_v4l_luma_view(&view, f.data, source->fmt);
+		GPtrArray *found = koki_find_markers(koki, &view, 0.11, &params);
+
+		frames++;
+		markers += found->len;
+
+		koki_markers_free(found);
+		koki_source_release_frame(source, &f);
+	}
+
+	t = g_get_monotonic_time() - start;
+	koki_source_free(source);
+
+	assert(frames > 0);
+	printf("%dx%d, %d frames\n", (int)params.size.x, (int)params.size.y,
+	       frames);
+	printf("in turn:  %8.3f ms/frame, %.2f markers/frame\n",
+	       t / 1000.0 / frames, (double)markers / frames);
+
+	koki_get_stats(koki, &stats);
+	koki_set_stats(koki, FALSE);
+	print_stats(&stats.total);
+
+	/* Then all the stages at once */
+	source = open_source(argv[1]);
+	assert(source != NULL);
+
+	start = g_get_monotonic_time();
+	p = koki_pipeline_start_source(koki, source, 0.11, &params,
+				       count_result, counts);
+
+	while (!koki_pipeline_finished(p))
+		g_usleep(1000);
+
+	koki_pipeline_stop(p);
+	t = g_get_monotonic_time() - start;
+	koki_source_free(source);
+
+	printf("pipeline: %8.3f ms/frame, %d of %d frames published\n",
+	       t / 1000.0 / frames, counts[0], frames);
+
+	koki_destroy(koki);
+
+	return 0;
+}
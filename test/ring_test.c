@@ -0,0 +1,259 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Runs a ring of buffers against a pretend camera (see fake_v4l2.h),
+   checking which frames it hands out, that it gives every buffer back,
+   and that it cleans up after the camera fails. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/time.h> /* for videodev2.h */
+#include <linux/videodev2.h>
+#include <cv.h>
+
+#include "koki.h"
+
+#include "fake_v4l2.h"
+
+#define N_BUFFERS 4
+#define FRAME_SIZE 64
+
+/**
+ * @brief the sequence number the pretend camera wrote into a frame
+ */
+static uint32_t frame_sequence(const koki_v4l_frame_t *frame)
+{
+	uint32_t seq;
+
+	memcpy(&seq, frame->data, sizeof(seq));
+
+	return seq;
+}
+
+/**
+ * @brief checks a frame is the one the camera captured with the given
+ *        sequence number
+ */
+static void check_frame(const koki_v4l_frame_t *frame, uint32_t seq)
+{
+	assert(frame->sequence == seq && frame_sequence(frame) == seq
+	       && frame->length == FRAME_SIZE);
+}
+
+static void test_newest(void)
+{
+	int fd = fake_v4l2_open(N_BUFFERS, FRAME_SIZE);
+	koki_v4l_ring_t *ring = koki_v4l_ring_start(fd, N_BUFFERS);
+	koki_v4l_frame_t f, g;
+
+	assert(ring != NULL && ring->count == N_BUFFERS
+	       && ring->n_queued == N_BUFFERS && fake_v4l2_streaming());
+
+	/* nothing captured yet */
+	assert(koki_v4l_ring_get_frame(ring, &f, 0) == 0);
+
+	fake_v4l2_capture(0);
+	assert(koki_v4l_ring_get_frame(ring, &f, 0) == 1);
+	check_frame(&f, 0);
+
+	/* three more while that's held: only the newest is got, and the
+	   others go straight back */
+	for (int i=0; i<3; i++)
+		fake_v4l2_capture(0);
+	assert(koki_v4l_ring_get_frame(ring, &g, -1) == 1);
+	check_frame(&g, 3);
+	assert(ring->n_queued == N_BUFFERS - 2);
+
+	koki_v4l_ring_release_frame(ring, &f);
+	koki_v4l_ring_release_frame(ring, &g);
+	assert(ring->n_queued == N_BUFFERS);
+
+	/* a corrupt frame isn't got, and its buffer goes back */
+	fake_v4l2_capture(V4L2_BUF_FLAG_ERROR);
+	assert(koki_v4l_ring_get_frame(ring, &f, 0) == 0);
+	assert(ring->n_queued == N_BUFFERS);
+
+	/* nor is one that's newer than a good one */
+	fake_v4l2_capture(0);
+	fake_v4l2_capture(V4L2_BUF_FLAG_ERROR);
+	assert(koki_v4l_ring_get_frame(ring, &f, 0) == 1);
+	check_frame(&f, 5);
+	koki_v4l_ring_release_frame(ring, &f);
+
+	/* a stale frame that can't be handed back is a failure, but the
+	   newest is still got */
+	fake_v4l2_capture(0);
+	fake_v4l2_capture(0);
+	fake_v4l2_fail(VIDIOC_QBUF, 0);
+	assert(koki_v4l_ring_get_frame(ring, &f, 0) < 0);
+	check_frame(&f, 8);
+	assert(ring->n_queued == N_BUFFERS - 2);
+	koki_v4l_ring_release_frame(ring, &f);
+	assert(ring->n_queued == N_BUFFERS - 1);
+
+	koki_v4l_ring_stop(ring);
+	assert(!fake_v4l2_streaming() && fake_v4l2_n_buffers() == 0);
+	fake_v4l2_close();
+}
+
+static void test_next(void)
+{
+	int fd = fake_v4l2_open(N_BUFFERS, FRAME_SIZE);
+	koki_v4l_ring_t *ring = koki_v4l_ring_start(fd, N_BUFFERS);
+	koki_v4l_frame_t frames[N_BUFFERS];
+
+	assert(ring != NULL);
+
+	/* every frame's got, in order, skipping the corrupt ones */
+	fake_v4l2_capture(0);
+	fake_v4l2_capture(V4L2_BUF_FLAG_ERROR);
+	fake_v4l2_capture(0);
+
+	assert(koki_v4l_ring_get_next_frame(ring, &frames[0], 0) == 1);
+	check_frame(&frames[0], 0);
+	assert(koki_v4l_ring_get_next_frame(ring, &frames[1], 0) == 1);
+	check_frame(&frames[1], 2);
+
+	/* the corrupt frame's buffer is captured into again */
+	fake_v4l2_capture(V4L2_BUF_FLAG_ERROR);
+	fake_v4l2_capture(0);
+	assert(koki_v4l_ring_get_next_frame(ring, &frames[2], 0) == 1);
+	check_frame(&frames[2], 4);
+	assert(koki_v4l_ring_get_next_frame(ring, &frames[3], 0) == 0);
+	assert(ring->n_queued == N_BUFFERS - 3);
+
+	/* with every buffer held, frames are lost */
+	fake_v4l2_capture(0);
+	assert(koki_v4l_ring_get_next_frame(ring, &frames[3], 0) == 1);
+	check_frame(&frames[3], 5);
+	assert(!fake_v4l2_capture(0));
+	assert(koki_v4l_ring_get_next_frame(ring, &frames[0], 0) < 0);
+
+	for (int i=0; i<N_BUFFERS; i++)
+		koki_v4l_ring_release_frame(ring, &frames[i]);
+	assert(ring->n_queued == N_BUFFERS);
+
+	fake_v4l2_capture(0);
+	assert(koki_v4l_ring_get_next_frame(ring, &frames[0], 0) == 1);
+	check_frame(&frames[0], 7);
+	koki_v4l_ring_release_frame(ring, &frames[0]);
+
+	koki_v4l_ring_stop(ring);
+	fake_v4l2_close();
+}
+
+static void test_steady(void)
+{
+	int fd = fake_v4l2_open(N_BUFFERS, FRAME_SIZE);
+	koki_v4l_ring_t *ring = koki_v4l_ring_start(fd, N_BUFFERS);
+	koki_v4l_frame_t f;
+	uint32_t seq = 0, last = 0;
+	int got = 0;
+
+	assert(ring != NULL);
+
+	/* a varying number of frames between each get */
+	for (int i=0; i<1000; i++){
+		for (int k=0; k<i%5; k++, seq++)
+			fake_v4l2_capture(i % 7 == 0 ? V4L2_BUF_FLAG_ERROR : 0);
+
+		if (koki_v4l_ring_get_frame(ring, &f, 0) == 1){
+			assert(f.sequence == seq - 1
+			       && frame_sequence(&f) == f.sequence);
+			assert(got == 0 || f.sequence > last);
+			last = f.sequence;
+			got++;
+			koki_v4l_ring_release_frame(ring, &f);
+		}
+
+		assert(ring->n_queued == N_BUFFERS);
+	}
+
+	printf("steady: %d frames got of %u\n", got, seq);
+
+	koki_v4l_ring_stop(ring);
+	fake_v4l2_close();
+}
+
+static void test_timeout(void)
+{
+	int fd = fake_v4l2_open(N_BUFFERS, FRAME_SIZE);
+	koki_v4l_ring_t *ring = koki_v4l_ring_start(fd, N_BUFFERS);
+	koki_v4l_frame_t f;
+	struct timeval start, end;
+	long ms;
+
+	assert(ring != NULL);
+
+	/* a run of corrupt frames mustn't make the wait any longer */
+	fake_v4l2_stream(20, V4L2_BUF_FLAG_ERROR);
+
+	gettimeofday(&start, NULL);
+	assert(koki_v4l_ring_get_frame(ring, &f, 100) == 0);
+	assert(koki_v4l_ring_get_next_frame(ring, &f, 100) == 0);
+	gettimeofday(&end, NULL);
+
+	ms = (end.tv_sec - start.tv_sec) * 1000
+		+ (end.tv_usec - start.tv_usec) / 1000;
+	printf("timeout: two 100ms waits took %ldms\n", ms);
+	assert(ms >= 180 && ms < 400);
+
+	/* but a good frame among them is still got */
+	fake_v4l2_stream(20, 0);
+	assert(koki_v4l_ring_get_next_frame(ring, &f, 100) == 1);
+	koki_v4l_ring_release_frame(ring, &f);
+
+	koki_v4l_ring_stop(ring);
+	fake_v4l2_close();
+}
+
+static void test_start_failure(unsigned long request, int after)
+{
+	int fd = fake_v4l2_open(N_BUFFERS, FRAME_SIZE);
+
+	fake_v4l2_fail(request, after);
+	assert(koki_v4l_ring_start(fd, N_BUFFERS) == NULL);
+
+	/* the driver's buffers were freed, so the camera can be set up
+	   again */
+	assert(fake_v4l2_n_buffers() == 0 && !fake_v4l2_streaming());
+
+	koki_v4l_ring_t *ring = koki_v4l_ring_start(fd, N_BUFFERS);
+	assert(ring != NULL);
+	koki_v4l_ring_stop(ring);
+
+	fake_v4l2_close();
+}
+
+
+int main(void)
+{
+	test_newest();
+	test_next();
+	test_steady();
+	test_timeout();
+
+	test_start_failure(VIDIOC_QBUF, 0);
+	test_start_failure(VIDIOC_QBUF, 2);
+	test_start_failure(VIDIOC_STREAMON, 0);
+
+	printf("ok\n");
+
+	return 0;
+}
@@ -16,6 +16,8 @@
    along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 #include <cv.h>
 #include <highgui.h>
@@ -24,18 +26,110 @@
 #include "koki.h"
 
 
+/**
+ * @brief times finding markers in a frame
+ *
+ * @return the mean time per frame, in milliseconds
+ */
+static double time_find_markers(koki_t *koki, IplImage *frame,
+				koki_camera_params_t *params, int iters)
+{
+	gint64 start = g_get_monotonic_time();
+
+	for (int iteration=0; iteration<iters; iteration++){
+
+		/* get markers */
+		GPtrArray *markers = koki_find_markers(koki, frame, 0.11, params);
+
+		koki_markers_free(markers);
+
+	}
+
+	return (g_get_monotonic_time() - start) / 1000.0 / iters;
+}
+
+
+/**
+ * @brief times labelling a frame on its own, region statistics included
+ *
+ * @param stats_pass  whether to gather the statistics in a separate pass,
+ *                    as libkoki used to, rather than while labelling
+ * @return            the mean time per frame, in milliseconds
+ */
+static double time_label(koki_t *koki, IplImage *frame, int iters,
+			 gboolean stats_pass)
+{
+	koki_set_label_stats_pass(koki, stats_pass);
+
+	gint64 start = g_get_monotonic_time();
+
+	for (int iteration=0; iteration<iters; iteration++){
+
+		koki_labelled_image_t *l = koki_label_adaptive(koki, frame, 11, 5);
+
+		koki_labelled_image_free(l);
+
+	}
+
+	double t = (g_get_monotonic_time() - start) / 1000.0 / iters;
+
+	koki_set_label_stats_pass(koki, FALSE);
+
+	return t;
+}
+
+/**
+ * @brief checks that gathering the region statistics while labelling gives
+ *        the same as the separate pass
+ */
+static bool stats_match(koki_t *koki, IplImage *frame)
+{
+	koki_labelled_image_t *a, *b;
+	bool match;
+
+	a = koki_label_adaptive(koki, frame, 11, 5);
+	koki_set_label_stats_pass(koki, TRUE);
+	b = koki_label_adaptive(koki, frame, 11, 5);
+	koki_set_label_stats_pass(koki, FALSE);
+
+	match = a->clips->len == b->clips->len
+		&& memcmp(a->clips->data, b->clips->data,
+			  sizeof(koki_clip_region_t) * a->clips->len) == 0;
+
+	koki_labelled_image_free(a);
+	koki_labelled_image_free(b);
+
+	return match;
+}
+
+
+/**
+ * @brief the next number of threads to time: double the last, but always
+ *        finishing on \c max
+ */
+static int next_thread_count(int n, int max)
+{
+	if (n >= max)
+		return max + 1;
+
+	return n * 2 < max ? n * 2 : max;
+}
+
+
 int main(int argc, const char *argv[])
 {
 	koki_t* koki = koki_new();
 
-	if (argc != 3){
-		printf("Usage: ./speed_test <iterations> <filename>\n");
+	if (argc != 3 && argc != 4){
+		printf("Usage: ./speed_test <iterations> <filename> [max_threads]\n");
 		return 1;
 	}
 
 	const char *iters_str = argv[1];
 	int iters = atoi(iters_str);
 	const char *filename = argv[2];
+	int max_threads = argc == 4 ? atoi(argv[3]) : g_get_num_processors();
+	assert(max_threads >= 1);
 
 	IplImage *frame = cvLoadImage(filename, CV_LOAD_IMAGE_GRAYSCALE);
 	assert(frame != NULL);
@@ -48,18 +142,54 @@ int main(int argc, const char *argv[])
 	params.focal_length.x = 571.0;
 	params.focal_length.y = 571.0;
 
+	printf("%dx%d, %d iterations\n", frame->width, frame->height, iters);
 
-	for (int iteration=0; iteration<iters; iteration++){
+	/* Labelling on its own, gathering the region statistics in a separate
+	   pass (as it used to) and while labelling (as it does now) */
+	assert(stats_match(koki, frame));
+	double t_pass = time_label(koki, frame, iters, TRUE);
+	double t_fused = time_label(koki, frame, iters, FALSE);
+	printf("labelling only:       stats pass %8.3f ms  while labelling "
+	       "%8.3f ms  (%.2fx)\n", t_pass, t_fused, t_pass / t_fused);
 
-		/* get markers */
-		GPtrArray *markers = koki_find_markers(koki, frame, 0.11, &params);
+	/* The default single-threaded labeller */
+	printf("pixel labelling:      %8.3f ms/frame\n",
+	       time_find_markers(koki, frame, &params, iters));
 
-		koki_markers_free(markers);
+	/* Threaded labelling always labels runs, so scale from that */
+	koki_set_label_method(koki, KOKI_LABEL_RUNS);
+	double base = 0;
+
+	for (int n = 1; n <= max_threads; n = next_thread_count(n, max_threads)){
+
+		koki_set_label_threads(koki, n);
+		double t = time_find_markers(koki, frame, &params, iters);
+
+		if (n == 1)
+			base = t;
+
+		printf("run labelling, %2d thread%s: %8.3f ms/frame (%.2fx)\n",
+		       n, n == 1 ? " " : "s", t, base / t);
+	}
+
+	/* Labelling while tracing the contours */
+	koki_set_label_threads(koki, 1);
+	koki_set_label_method(koki, KOKI_LABEL_TRACE);
+	printf("contour tracing:      %8.3f ms/frame\n",
+	       time_find_markers(koki, frame, &params, iters));
+
+	/* Then sharing the candidate regions out between threads */
+	for (int n = 2; n <= max_threads; n = next_thread_count(n, max_threads)){
+
+		koki_set_marker_threads(koki, n);
+		double t = time_find_markers(koki, frame, &params, iters);
 
+		printf("markers, %2d threads:  %8.3f ms/frame\n", n, t);
 	}
 
 
 	cvReleaseImage(&frame);
+	koki_destroy(koki);
 
 	return 0;
 
@@ -0,0 +1,148 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Compares the speed of converting YUYV frames to RGB and grayscale a
+   pixel at a time (as libkoki used to) with the row kernels it uses now,
+   and checks that they agree. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <stdint.h>
+#include <cv.h>
+#include <glib.h>
+
+#include "koki.h"
+
+/* The old per-pixel conversion, kept here for comparison */
+#define OLD_CLIP(x) ((x) < 0 ? 0 : ((x) > 255 ? 255 : (x)))
+
+static void old_to_rgb(const uint8_t *frame, uint16_t w, uint16_t h,
+		       IplImage *output)
+{
+	for (uint16_t y=0; y<h; y++){
+		for (uint16_t x=0; x<w; x++){
+
+			const uint8_t *tmp = &frame[(w * 2 * y) + ((x & ~1) * 2)];
+			int32_t c, d, e;
+
+			c = ((x & 1) ? tmp[2] : tmp[0]) - 16;
+			d = tmp[1] - 128;
+			e = tmp[3] - 128;
+
+			KOKI_IPLIMAGE_ELEM(output, x, y, 2) =
+				OLD_CLIP((298*c + 409*e + 128) >> 8);
+			KOKI_IPLIMAGE_ELEM(output, x, y, 1) =
+				OLD_CLIP((298*c - 100*d - 208*e + 128) >> 8);
+			KOKI_IPLIMAGE_ELEM(output, x, y, 0) =
+				OLD_CLIP((298*c + 516*d + 128) >> 8);
+
+		}
+	}
+}
+
+static void old_to_grayscale(const uint8_t *frame, uint16_t w, uint16_t h,
+			     IplImage *output)
+{
+	for (uint16_t y=0; y<h; y++)
+		for (uint16_t x=0; x<w; x++){
+			const uint8_t *tmp = &frame[(w * 2 * y) + ((x & ~1) * 2)];
+			KOKI_IPLIMAGE_GS_ELEM(output, x, y) =
+				(x & 1) ? tmp[2] : tmp[0];
+		}
+}
+
+/* Time iters conversions, in ms per frame */
+static double time_convert(void (*convert)(const uint8_t*, uint16_t,
+					   uint16_t, IplImage*),
+			   const uint8_t *frame, IplImage *output, int iters)
+{
+	gint64 start = g_get_monotonic_time();
+
+	for (int i=0; i<iters; i++)
+		convert(frame, output->width, output->height, output);
+
+	return (g_get_monotonic_time() - start) / 1000.0 / iters;
+}
+
+static bool images_equal(const IplImage *a, const IplImage *b)
+{
+	for (int y=0; y<a->height; y++)
+		if (memcmp(a->imageData + a->widthStep * y,
+			   b->imageData + b->widthStep * y,
+			   a->width * a->nChannels) != 0)
+			return false;
+
+	return true;
+}
+
+
+int main(int argc, const char *argv[])
+{
+	const int sizes[][2] = { {640, 480}, {1280, 720}, {1920, 1080} };
+	int iters = 50;
+
+	if (argc > 2){
+		printf("Usage: ./yuyv_speed_test [iterations]\n");
+		return 1;
+	}
+
+	if (argc == 2)
+		iters = atoi(argv[1]);
+
+	for (int s=0; s<3; s++){
+		int w = sizes[s][0], h = sizes[s][1];
+		uint8_t *frame = malloc(w * h * 2);
+		assert(frame != NULL);
+
+		/* Noise covers the clipping as well as anything */
+		srand(s);
+		for (int i=0; i<w*h*2; i++)
+			frame[i] = rand() & 0xff;
+
+		for (int channels=3; channels>=1; channels-=2){
+			IplImage *old_img = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, channels);
+			IplImage *new_img = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, channels);
+			double t_old, t_new;
+
+			if (channels == 3){
+				t_old = time_convert(old_to_rgb, frame, old_img, iters);
+				t_new = time_convert(koki_v4l_YUYV_frame_into_RGB_image,
+						     frame, new_img, iters);
+			} else {
+				t_old = time_convert(old_to_grayscale, frame, old_img, iters);
+				t_new = time_convert(koki_v4l_YUYV_frame_into_grayscale_image,
+						     frame, new_img, iters);
+			}
+
+			/* Make sure they agree */
+			assert(images_equal(old_img, new_img));
+
+			printf("%4dx%-4d %-5s old %8.3f ms  new %8.3f ms  (%.2fx)\n",
+			       w, h, channels == 3 ? "RGB" : "gray", t_old, t_new,
+			       t_old / t_new);
+
+			cvReleaseImage(&old_img);
+			cvReleaseImage(&new_img);
+		}
+
+		free(frame);
+	}
+
+	return 0;
+}
@@ -0,0 +1,384 @@
+/* Copyright 2026 agent
+
+   This file is part of libkoki
+
+   libkoki is free software: you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation, either version 3 of the License, or
+   (at your option) any later version.
+
+   libkoki is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with libkoki.  If not, see <http://www.gnu.org/licenses/>. */
+
+/* Records a camera's frames, exactly as they're captured, to a file that
+   koki_source_recording_new() can replay.  The file is allocated up front
+   and the frames are written on a thread of their own, straight from the
+   camera's buffers, so the camera only drops frames if the disk falls
+   behind by more than it has buffers for. */
+
+#define _GNU_SOURCE /* for O_DIRECT */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <glib.h>
+#include <cv.h>
+#include <linux/videodev2.h>
+
+#include "koki.h"
+
+#define WIDTH  640
+#define HEIGHT 480
+
+/* The camera's buffers are all the slack the writer has */
+#define NUM_BUFFERS 16
+
+/* How often the index is written out, in frames */
+#define FLUSH_INTERVAL 64
+
+#define ALIGN_UP(x) (((uint64_t)(x) + KOKI_RECORDING_ALIGN - 1) \
+		     & ~(uint64_t)(KOKI_RECORDING_ALIGN - 1))
+
+
+typedef struct {
+	int fd;
+	koki_recording_header_t *header; /* a whole aligned block */
+	koki_recording_index_t *index;
+	uint64_t frames_offset, stride;
+	uint32_t n_written, n_flushed;
+
+	/* frames some drivers give can't be written from directly, so they're
+	   copied here first */
+	bool bounce;
+	uint8_t *bounce_buf;
+
+	koki_queue_t *captured, *written;
+	int done, failed;
+} recorder_t;
+
+static volatile sig_atomic_t stop = 0;
+
+
+static void handle_sigint(int sig)
+{
+	stop = 1;
+}
+
+
+static void* aligned_alloc0(uint64_t size)
+{
+	void *p;
+
+	if (posix_memalign(&p, KOKI_RECORDING_ALIGN, size) != 0)
+		return NULL;
+
+	memset(p, 0, size);
+	return p;
+}
+
+
+/* Write the whole of a buffer, returning -1 with errno set on failure */
+static int write_all(int fd, const uint8_t *buf, uint64_t len, uint64_t offset)
+{
+	while (len > 0){
+		ssize_t n = pwrite(fd, buf, len, offset);
+
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return -1;
+
+		buf += n;
+		len -= n;
+		offset += n;
+	}
+
+	return 0;
+}
+
+
+static bool write_frame(recorder_t *rec, const koki_v4l_frame_t *frame)
+{
+	uint64_t offset = rec->frames_offset + rec->stride * rec->n_written;
+	uint32_t length = MIN(frame->length, rec->header->frame_size);
+	koki_recording_index_t *entry = &rec->index[rec->n_written];
+	int ret = -1;
+
+	/* The buffers are whole pages, so the rounding up stays inside them */
+	if (!rec->bounce){
+		ret = write_all(rec->fd, frame->data, ALIGN_UP(length), offset);
+
+		if (ret < 0 && errno != EFAULT && errno != EINVAL)
+			return false;
+
+		/* Not every driver's buffers can be written from directly */
+		if (ret < 0)
+			rec->bounce = true;
+	}
+
+	if (ret < 0){
+		memcpy(rec->bounce_buf, frame->data, length);
+		memset(rec->bounce_buf + length, 0, rec->stride - length);
+
+		if (write_all(rec->fd, rec->bounce_buf, ALIGN_UP(length), offset) < 0)
+			return false;
+	}
+
+	entry->offset = offset;
+	entry->timestamp = (int64_t)frame->timestamp.tv_sec * 1000000
+		+ frame->timestamp.tv_usec;
+	entry->sequence = frame->sequence;
+	entry->length = length;
+
+	rec->n_written++;
+
+	return true;
+}
+
+
+/* Write out the index entries added since last time, then the header that
+   counts them */
+static bool flush_index(recorder_t *rec)
+{
+	uint64_t first = rec->n_flushed * sizeof(koki_recording_index_t);
+	uint64_t end = ALIGN_UP(rec->n_written * sizeof(koki_recording_index_t));
+
+	first &= ~(uint64_t)(KOKI_RECORDING_ALIGN - 1);
+
+	if (end > first
+	    && write_all(rec->fd, (uint8_t*)rec->index + first, end - first,
+			 rec->header->index_offset + first) < 0)
+		return false;
+
+	rec->header->n_frames = rec->n_written;
+
+	if (write_all(rec->fd, (uint8_t*)rec->header, KOKI_RECORDING_ALIGN, 0) < 0)
+		return false;
+
+	rec->n_flushed = rec->n_written;
+
+	return true;
+}
+
+
+static gpointer writer_thread(gpointer data)
+{
+	recorder_t *rec = data;
+	koki_v4l_frame_t *frame;
+
+	while (1){
+		bool done = __atomic_load_n(&rec->done, __ATOMIC_ACQUIRE);
+
+		frame = koki_queue_pop_wait(rec->captured,
+					    done ? 0 : 100 * G_TIME_SPAN_MILLISECOND);
+
+		if (frame == NULL){
+			if (done)
+				break;
+			continue;
+		}
+
+		/* After a failure, the frames are just handed back */
+		if (!__atomic_load_n(&rec->failed, __ATOMIC_RELAXED)
+		    && (!write_frame(rec, frame)
+			|| (rec->n_written % FLUSH_INTERVAL == 0
+			    && !flush_index(rec)))){
+			perror("Couldn't write frame");
+			__atomic_store_n(&rec->failed, 1, __ATOMIC_RELEASE);
+		}
+
+		koki_queue_push(rec->written, frame);
+	}
+
+	return NULL;
+}
+
+
+int main(int argc, const char **argv)
+{
+
+	int cam, width = WIDTH, height = HEIGHT, ret;
+	uint32_t max_frames, frame_size, n_captured = 0, dropped = 0, last = 0;
+	uint64_t index_size, total;
+	struct v4l2_format fmt;
+	const char *dev, *filename;
+	koki_v4l_ring_t *ring;
+	koki_v4l_frame_t frame, *slots, *f;
+	recorder_t rec;
+	GThread *writer;
+
+	if (argc != 4 && argc != 6){
+		printf("Usage: %s VIDEO_DEVICE FILENAME MAX_FRAMES [WIDTH HEIGHT]\n",
+		       argv[0]);
+		return 1;
+	}
+
+	dev = argv[1];
+	filename = argv[2];
+	max_frames = atoi(argv[3]);
+
+	if (argc == 6){
+		width = atoi(argv[4]);
+		height = atoi(argv[5]);
+	}
+
+	if (max_frames == 0){
+		printf("MAX_FRAMES must be at least 1\n");
+		return 1;
+	}
+
+	cam = koki_v4l_open_cam(dev);
+
+	if (cam == -1){
+		printf("Couldn't open camera '%s'\n", dev);
+		return 1;
+	}
+
+	fmt = koki_v4l_create_YUYV_format(width, height);
+	if (koki_v4l_set_format(cam, fmt) < 0){
+		printf("Unable to set format:\n");
+		koki_v4l_print_format(fmt);
+		return 1;
+	}
+
+	/* The driver may have picked something a little different */
+	fmt = koki_v4l_get_format(cam);
+	frame_size = fmt.fmt.pix.sizeimage;
+	if (frame_size == 0)
+		frame_size = fmt.fmt.pix.bytesperline * fmt.fmt.pix.height;
+
+	/* The header's block, then the index, then the frames */
+	memset(&rec, 0, sizeof(rec));
+	index_size = ALIGN_UP((uint64_t)max_frames * sizeof(koki_recording_index_t));
+	rec.stride = ALIGN_UP(frame_size);
+	rec.frames_offset = KOKI_RECORDING_ALIGN + index_size;
+	total = rec.frames_offset + rec.stride * max_frames;
+
+	rec.header = aligned_alloc0(KOKI_RECORDING_ALIGN);
+	rec.index = aligned_alloc0(index_size);
+	rec.bounce_buf = aligned_alloc0(rec.stride);
+	if (rec.header == NULL || rec.index == NULL || rec.bounce_buf == NULL){
+		printf("Couldn't allocate the index for %u frames\n", max_frames);
+		return 1;
+	}
+
+	memcpy(rec.header->magic, KOKI_RECORDING_MAGIC, 8);
+	rec.header->width = fmt.fmt.pix.width;
+	rec.header->height = fmt.fmt.pix.height;
+	rec.header->pixelformat = fmt.fmt.pix.pixelformat;
+	rec.header->bytesperline = fmt.fmt.pix.bytesperline;
+	rec.header->frame_size = frame_size;
+	rec.header->max_frames = max_frames;
+	rec.header->index_offset = KOKI_RECORDING_ALIGN;
+
+	/* Bypass the page cache where the filesystem allows it */
+	rec.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+	if (rec.fd < 0 && errno == EINVAL)
+		rec.fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (rec.fd < 0){
+		printf("Couldn't open '%s'\n", filename);
+		return 1;
+	}
+
+	ret = posix_fallocate(rec.fd, 0, total);
+	if (ret != 0){
+		printf("Couldn't allocate %llu bytes for '%s': %s\n",
+		       (unsigned long long)total, filename, strerror(ret));
+		return 1;
+	}
+
+	/* Until the index is written, the file's a recording of nothing */
+	if (!flush_index(&rec)){
+		perror("Couldn't write header");
+		return 1;
+	}
+
+	ring = koki_v4l_ring_start(cam, NUM_BUFFERS);
+	if (ring == NULL){
+		printf("Unable to start stream\n");
+		return 1;
+	}
+
+	slots = calloc(ring->count, sizeof(koki_v4l_frame_t));
+	assert(slots != NULL);
+
+	rec.captured = koki_queue_new(ring->count);
+	rec.written = koki_queue_new(ring->count);
+
+	signal(SIGINT, handle_sigint);
+	writer = g_thread_new("koki-record", writer_thread, &rec);
+
+	printf("Recording %ux%u frames to '%s', Ctrl-C to stop\n",
+	       rec.header->width, rec.header->height, filename);
+
+	while (!stop && n_captured < max_frames
+	       && !__atomic_load_n(&rec.failed, __ATOMIC_ACQUIRE)){
+
+		/* Give the camera back the buffers that have been written */
+		while ((f = koki_queue_pop(rec.written)) != NULL)
+			koki_v4l_ring_release_frame(ring, f);
+
+		if (ring->n_queued == 0){
+			f = koki_queue_pop_wait(rec.written,
+						100 * G_TIME_SPAN_MILLISECOND);
+			if (f != NULL)
+				koki_v4l_ring_release_frame(ring, f);
+			continue;
+		}
+
+		ret = koki_v4l_ring_get_next_frame(ring, &frame, 100);
+		if (ret < 0)
+			break;
+		if (ret == 0)
+			continue;
+
+		if (n_captured > 0 && frame.sequence != last + 1)
+			dropped += frame.sequence - last - 1;
+
+		last = frame.sequence;
+		n_captured++;
+
+		slots[frame.index] = frame;
+		koki_queue_push(rec.captured, &slots[frame.index]);
+
+	}
+
+	__atomic_store_n(&rec.done, 1, __ATOMIC_RELEASE);
+	g_thread_join(writer);
+
+	/* The space for frames that weren't recorded is given back */
+	if (!flush_index(&rec)
+	    || ftruncate(rec.fd, rec.frames_offset + rec.stride * rec.n_written) < 0)
+		perror("Couldn't finish recording");
+
+	close(rec.fd);
+
+	koki_v4l_ring_stop(ring);
+	koki_v4l_close_cam(cam);
+
+	printf("%u frames recorded, %u dropped by the camera\n",
+	       rec.n_written, dropped);
+
+	koki_queue_free(rec.captured);
+	koki_queue_free(rec.written);
+	free(slots);
+	free(rec.header);
+	free(rec.index);
+	free(rec.bounce_buf);
+
+	return 0;
+
+}